@@ -189,6 +189,11 @@ SOONG_CONFIG_NAMESPACES += XIAOMI_TOUCH
 SOONG_CONFIG_XIAOMI_TOUCH := HIGH_TOUCH_POLLING_PATH
 SOONG_CONFIG_XIAOMI_TOUCH_HIGH_TOUCH_POLLING_PATH := /sys/devices/virtual/touch/touch_dev/bump_sample_rate
 
+# UFS
+SOONG_CONFIG_NAMESPACES += XIAOMI_KONA_UFS
+SOONG_CONFIG_XIAOMI_KONA_UFS := BSG
+SOONG_CONFIG_XIAOMI_KONA_UFS_BSG := $(TARGET_HAS_UFS_BSG)
+
 # Verified Boot
 BOARD_AVB_ENABLE := true
 BOARD_AVB_MAKE_VBMETA_IMAGE_ARGS += --flags 3
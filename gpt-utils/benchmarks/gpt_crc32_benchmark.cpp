@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <benchmark/benchmark.h>
+#include <vector>
+#include <zlib.h>
+
+#include "gpt-crc32.h"
+
+// GPT header, then partition entry arrays of 128 to 1024 entries
+#define CRC_SIZES ->Arg(92)->Arg(128 * 128)->Arg(256 * 128)->Arg(512 * 128)->Arg(1024 * 128)
+
+static std::vector<uint8_t> MakeBuffer(size_t len) {
+    std::vector<uint8_t> buf(len);
+    for (size_t i = 0; i < len; i++) buf[i] = (uint8_t)(i * 2654435761u >> 24);
+    return buf;
+}
+
+static void BM_zlib_crc32(benchmark::State& state) {
+    std::vector<uint8_t> buf = MakeBuffer(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(crc32(0, buf.data(), buf.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * buf.size());
+}
+BENCHMARK(BM_zlib_crc32) CRC_SIZES;
+
+static void BM_gpt_crc32(benchmark::State& state) {
+    std::vector<uint8_t> buf = MakeBuffer(state.range(0));
+    state.SetLabel(gpt_crc32_impl());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(gpt_crc32(0, buf.data(), buf.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * buf.size());
+}
+BENCHMARK(BM_gpt_crc32) CRC_SIZES;
+
+static void BM_gpt_crc32_portable(benchmark::State& state) {
+    std::vector<uint8_t> buf = MakeBuffer(state.range(0));
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(gpt_crc32_portable(0, buf.data(), buf.size()));
+    }
+    state.SetBytesProcessed(state.iterations() * buf.size());
+}
+BENCHMARK(BM_gpt_crc32_portable) CRC_SIZES;
+
+BENCHMARK_MAIN();
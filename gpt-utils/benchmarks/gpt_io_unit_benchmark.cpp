@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Sequential write throughput by request size and alignment, to compare I/O
+// sized and aligned to the write unit and chunk size gpt-utils derives from
+// the UFS geometry descriptor against block granular I/O. Writes go through
+// O_DIRECT | O_DSYNC so that the device sees every request as issued.
+//
+// GPT_BENCH_DEV names a scratch block device to write to. ITS CONTENTS ARE
+// DESTROYED. Without it a file under TMPDIR is used, which only measures the
+// page cache and file system overhead.
+
+#include <benchmark/benchmark.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+#include "gpt-utils.h"
+
+// Bytes written per iteration
+#define SPAN_SIZE (8 * 1024 * 1024)
+
+class Target {
+  public:
+    ~Target() {
+        if (fd_ >= 0) close(fd_);
+        if (!tmp_.empty()) unlink(tmp_.c_str());
+        free(buf_);
+    }
+
+    bool Open() {
+        if (fd_ >= 0) return true;
+        const char* dev = getenv("GPT_BENCH_DEV");
+        std::string path;
+        if (dev) {
+            path = dev;
+        } else {
+            const char* tmp = getenv("TMPDIR");
+            tmp_ = std::string(tmp ? tmp : "/data/local/tmp") + "/gptio.XXXXXX";
+            int fd = mkstemp(&tmp_[0]);
+            if (fd < 0 || ftruncate(fd, 2 * SPAN_SIZE)) {
+                if (fd >= 0) close(fd);
+                return false;
+            }
+            close(fd);
+            path = tmp_;
+        }
+        fd_ = open(path.c_str(), O_RDWR | O_DIRECT | O_DSYNC);
+        if (fd_ < 0 && errno == EINVAL) fd_ = open(path.c_str(), O_RDWR | O_DSYNC);
+        if (fd_ < 0) return false;
+        if (!dev) {
+            // No geometry to a file, assume 4 KiB pages and 1 MiB chunks
+            geo_.block_size = geo_.write_unit = 4096;
+            geo_.chunk_size = 1024 * 1024;
+        } else if (gpt_utils_get_io_geometry(dev, &geo_)) {
+            return false;
+        }
+        if (posix_memalign(&buf_, 4096, SPAN_SIZE)) return false;
+        memset(buf_, 0x5a, SPAN_SIZE);
+        return true;
+    }
+
+    // Write SPAN_SIZE bytes in size bytes requests, starting shift bytes
+    // into the target
+    bool Write(uint32_t size, uint32_t shift) {
+        off_t off = shift;
+        for (uint32_t done = 0; done < SPAN_SIZE; done += size, off += size)
+            if (pwrite(fd_, buf_, size, off) != (ssize_t)size) return false;
+        return true;
+    }
+
+    const struct gpt_io_geometry& geo() const { return geo_; }
+
+  private:
+    int fd_ = -1;
+    std::string tmp_;
+    void* buf_ = nullptr;
+    struct gpt_io_geometry geo_ = {};
+};
+
+static Target target;
+
+// Write in size bytes requests, one block off the write unit if misaligned
+static void Run(benchmark::State& state, uint32_t size, bool misaligned) {
+    uint32_t shift = misaligned ? target.geo().block_size : 0;
+    for (auto _ : state) {
+        if (!target.Write(size, shift)) {
+            state.SkipWithError("write failed");
+            return;
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * SPAN_SIZE);
+    state.counters["size"] = size;
+    state.counters["write_unit"] = target.geo().write_unit;
+    state.counters["chunk"] = target.geo().chunk_size;
+}
+
+// Fixed request sizes, aligned or not
+static void BM_write_size(benchmark::State& state) {
+    if (!target.Open()) {
+        state.SkipWithError("cannot open the benchmark target");
+        return;
+    }
+    Run(state, state.range(0), state.range(1));
+}
+BENCHMARK(BM_write_size)
+        ->ArgNames({"size", "misaligned"})
+        ->ArgsProduct({{4096, 16384, 65536, 262144, 1048576}, {0, 1}})
+        ->UseRealTime();
+
+// Requests of the disk's write unit, and of its chunk size
+static void BM_write_geometry(benchmark::State& state) {
+    if (!target.Open()) {
+        state.SkipWithError("cannot open the benchmark target");
+        return;
+    }
+    uint32_t size = state.range(0) ? target.geo().chunk_size : target.geo().write_unit;
+    Run(state, size > SPAN_SIZE ? SPAN_SIZE : size, false);
+}
+BENCHMARK(BM_write_geometry)->ArgName("chunk")->Arg(0)->Arg(1)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,382 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Runs the slot switch path of gpt-utils against synthetic UFS layouts built
+// with the disk image backend: 1 to 8 LUNs of GPT images with 512 B or 4 KiB
+// sectors and 128 to 1024 entries each, plus the xbl and xblbak boot LUNs.
+
+#include <benchmark/benchmark.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+
+#include "gpt-crc32.h"
+#include "gpt-disk.h"
+#include "gpt-utils.h"
+
+#define LAYOUT_ARGS                                                    \
+    ->ArgNames({"sector", "entries", "luns"})                          \
+    ->ArgsProduct({{512, 4096}, {128, 256, 512, 1024}, {1, 2, 4, 8}})
+
+// Partitions that get a *bak twin, see PTN_SWAP_LIST
+static const char* const kSwapPtns[] = {
+        "abl",       "aop", "cmnlib",  "cmnlib64", "devcfg",     "dsp",    "dtbo",
+        "featenabler", "hyp", "imagefv", "keymaster", "qupfw", "tz", "uefisecapp",
+        "vbmeta",    "vbmeta_system",
+};
+static const char* const kAbPtns[] = {
+        "bluetooth", "boot", "modem", "odm", "product", "system", "vendor", "vendor_boot",
+};
+
+static void PutLE(uint8_t* p, uint64_t v, int len) {
+    for (int i = 0; i < len; i++) p[i] = (uint8_t)(v >> (8 * i));
+}
+
+// Deterministic GUID derived from seed
+static void MakeGuid(uint8_t* guid, const std::string& seed) {
+    uint32_t h = gpt_crc32(0, (const uint8_t*)seed.data(), seed.size());
+    for (int i = 0; i < 16; i++) {
+        h = h * 1103515245 + 12345;
+        guid[i] = (uint8_t)(h >> 16);
+    }
+}
+
+// GPT header size, as gpt-utils computes header CRCs over
+#define GPT_HEADER_SIZE 92
+
+// GPT image with one block per partition and both tables
+static bool WriteGptImage(const std::string& path, uint32_t sector, uint32_t entries,
+                          const std::vector<std::string>& ptns) {
+    uint64_t arr_size = (uint64_t)entries * PTN_ENTRY_SIZE;
+    uint64_t arr_blocks = (arr_size + sector - 1) / sector;
+    uint64_t first_usable = 2 + arr_blocks;
+    uint64_t last = first_usable + ptns.size() + arr_blocks;
+    uint64_t backup_arr = last - arr_blocks;
+    std::vector<uint8_t> img((last + 1) * sector);
+    uint8_t* arr = &img[2 * sector];
+
+    for (size_t i = 0; i < ptns.size() && i < entries; i++) {
+        const std::string& name = ptns[i];
+        uint8_t* e = arr + i * PTN_ENTRY_SIZE;
+        std::string type = name;
+        if (type.size() > 3 && !type.compare(type.size() - 3, 3, "bak"))
+            type.resize(type.size() - 3);
+        MakeGuid(e + TYPE_GUID_OFFSET, "type:" + type);
+        MakeGuid(e + UNIQUE_GUID_OFFSET, path + ":" + name);
+        PutLE(e + FIRST_LBA_OFFSET, first_usable + i, 8);
+        PutLE(e + LAST_LBA_OFFSET, first_usable + i, 8);
+        if (name.size() > 2 && !name.compare(name.size() - 2, 2, AB_SLOT_A_SUFFIX))
+            e[AB_FLAG_OFFSET] = AB_SLOT_ACTIVE_VAL;
+        for (size_t c = 0; c < name.size() && c < MAX_GPT_NAME_SIZE / 2; c++)
+            e[PARTITION_NAME_OFFSET + 2 * c] = name[c];
+    }
+    memcpy(&img[backup_arr * sector], arr, arr_size);
+
+    for (int instance = PRIMARY_GPT; instance <= SECONDARY_GPT; instance++) {
+        uint64_t my_lba = instance == PRIMARY_GPT ? 1 : last;
+        uint8_t* hdr = &img[my_lba * sector];
+        memcpy(hdr, GPT_SIGNATURE, 8);
+        PutLE(hdr + 8, 0x10000, 4);
+        PutLE(hdr + HEADER_SIZE_OFFSET, GPT_HEADER_SIZE, 4);
+        PutLE(hdr + PRIMARY_HEADER_OFFSET, my_lba, 8);
+        PutLE(hdr + BACKUP_HEADER_OFFSET, instance == PRIMARY_GPT ? last : 1, 8);
+        PutLE(hdr + FIRST_USABLE_LBA_OFFSET, first_usable, 8);
+        PutLE(hdr + LAST_USABLE_LBA_OFFSET, backup_arr - 1, 8);
+        MakeGuid(hdr + 56, path);
+        PutLE(hdr + PENTRIES_OFFSET, instance == PRIMARY_GPT ? 2 : backup_arr, 8);
+        PutLE(hdr + PARTITION_COUNT_OFFSET, entries, 4);
+        PutLE(hdr + PENTRY_SIZE_OFFSET, PTN_ENTRY_SIZE, 4);
+        PutLE(hdr + PARTITION_CRC_OFFSET, gpt_crc32(0, arr, arr_size), 4);
+        PutLE(hdr + HEADER_CRC_OFFSET, gpt_crc32(0, hdr, GPT_HEADER_SIZE), 4);
+    }
+
+    FILE* f = fopen(path.c_str(), "w");
+    if (!f) return false;
+    bool ok = fwrite(img.data(), 1, img.size(), f) == img.size();
+    return fclose(f) == 0 && ok;
+}
+
+// Disk image tree for one combination of the benchmark arguments
+class Layout {
+  public:
+    ~Layout() { Remove(); }
+
+    bool Build(uint32_t sector, uint32_t entries, uint32_t luns) {
+        if (!root_.empty() && sector == sector_ && entries == entries_ && luns == luns_)
+            return true;
+        Remove();
+        const char* tmp = getenv("TMPDIR");
+        std::string tmpl = std::string(tmp ? tmp : "/data/local/tmp") + "/gptbench.XXXXXX";
+        if (!mkdtemp(&tmpl[0])) return false;
+        root_ = tmpl;
+        sector_ = sector;
+        entries_ = entries;
+        luns_ = luns;
+        if (mkdir((root_ + "/by-name").c_str(), 0755)) return false;
+
+        // Swap partitions and their backups spread over the LUNs, A/B
+        // partitions on the first one, the rest of each table filled up
+        std::vector<std::vector<std::string>> ptns(luns + 2);
+        for (size_t i = 0; i < sizeof(kSwapPtns) / sizeof(kSwapPtns[0]); i++) {
+            ptns[i % luns].push_back(kSwapPtns[i]);
+            ptns[i % luns].push_back(std::string(kSwapPtns[i]) + "bak");
+        }
+        for (const char* ptn : kAbPtns) {
+            ptns[0].push_back(std::string(ptn) + AB_SLOT_A_SUFFIX);
+            ptns[0].push_back(std::string(ptn) + AB_SLOT_B_SUFFIX);
+        }
+        for (uint32_t lun = 0; lun < luns; lun++)
+            while (ptns[lun].size() < entries)
+                ptns[lun].push_back("fill" + std::to_string(lun) + "_" +
+                                    std::to_string(ptns[lun].size()));
+        ptns[luns].push_back("xbl");
+        ptns[luns + 1].push_back("xblbak");
+
+        for (uint32_t lun = 0; lun < luns + 2; lun++) {
+            std::string name = std::string("sd") + (char)('a' + lun);
+            if (!WriteGptImage(root_ + "/" + name, sector, entries, ptns[lun])) return false;
+            for (size_t i = 0; i < ptns[lun].size(); i++) {
+                std::string link = root_ + "/by-name/" + ptns[lun][i];
+                if (symlink(("../" + name + std::to_string(i + 1)).c_str(), link.c_str()))
+                    return false;
+            }
+        }
+        return gpt_utils_set_image_backend(root_.c_str(), sector, 1) == 0;
+    }
+
+  private:
+    void Remove() {
+        if (root_.empty()) return;
+        gpt_utils_set_image_backend(NULL, 0, 0);
+        std::string cmd = "rm -rf '" + root_ + "'";
+        if (system(cmd.c_str())) fprintf(stderr, "Failed to remove %s\n", root_.c_str());
+        root_.clear();
+    }
+
+    std::string root_;
+    uint32_t sector_ = 0, entries_ = 0, luns_ = 0;
+};
+
+static Layout layout;
+
+static bool SetUp(benchmark::State& state) {
+    if (layout.Build(state.range(0), state.range(1), state.range(2))) return true;
+    state.SkipWithError("failed to build the disk images");
+    return false;
+}
+
+static void ReportIo(benchmark::State& state, const struct gpt_io_stats& io) {
+    const auto avg = benchmark::Counter::kAvgIterations;
+    state.counters["syscalls"] = benchmark::Counter(io.syscalls, avg);
+    state.counters["fsyncs"] = benchmark::Counter(io.fsyncs, avg);
+    state.counters["bytes_read"] = benchmark::Counter(io.bytes_read, avg);
+    state.counters["bytes_written"] = benchmark::Counter(io.bytes_written, avg);
+}
+
+static void AddIo(struct gpt_io_stats* dst, const struct gpt_io_stats& src) {
+    dst->syscalls += src.syscalls;
+    dst->reads += src.reads;
+    dst->writes += src.writes;
+    dst->fsyncs += src.fsyncs;
+    dst->bytes_read += src.bytes_read;
+    dst->bytes_written += src.bytes_written;
+}
+
+// All three stages, which leave the tables as they found them
+static void BM_prepare_boot_update(benchmark::State& state) {
+    struct gpt_io_stats io = {};
+    if (!SetUp(state)) return;
+    for (auto _ : state) {
+        for (int stage = UPDATE_MAIN; stage <= UPDATE_FINALIZE; stage++) {
+            if (prepare_boot_update_with_stats((enum boot_update_stage)stage, &io)) {
+                state.SkipWithError("prepare_boot_update failed");
+                return;
+            }
+        }
+    }
+    ReportIo(state, io);
+}
+BENCHMARK(BM_prepare_boot_update) LAYOUT_ARGS->UseRealTime();
+
+static void BM_gpt_disk_get_disk_info(benchmark::State& state) {
+    struct gpt_io_stats io = {};
+    if (!SetUp(state)) return;
+    for (auto _ : state) {
+        struct gpt_disk* disk = gpt_disk_alloc();
+        if (!disk || gpt_disk_get_disk_info("boot_a", disk)) {
+            gpt_disk_free(disk);
+            state.SkipWithError("gpt_disk_get_disk_info failed");
+            return;
+        }
+        AddIo(&io, disk->io_stats);
+        gpt_disk_free(disk);
+    }
+    ReportIo(state, io);
+}
+BENCHMARK(BM_gpt_disk_get_disk_info) LAYOUT_ARGS;
+
+// Same load, refreshing a single GptDisk whose arena is reused
+static void BM_gpt_disk_reload(benchmark::State& state) {
+    struct gpt_io_stats io = {};
+    GptDisk disk;
+    if (!SetUp(state)) return;
+    for (auto _ : state) {
+        if (disk.Load("boot_a")) {
+            state.SkipWithError("GptDisk::Load failed");
+            return;
+        }
+        AddIo(&io, disk.c_disk()->io_stats);
+    }
+    ReportIo(state, io);
+    state.counters["arena_allocs"] = disk.arena_allocs();
+}
+BENCHMARK(BM_gpt_disk_reload) LAYOUT_ARGS;
+
+// Read-only counterpart of gpt_disk_get_disk_info, plus a lookup
+static void BM_gpt_view_open(benchmark::State& state) {
+    if (!SetUp(state)) return;
+    for (auto _ : state) {
+        struct gpt_view view;
+        if (gpt_view_open(&view, "boot_a")) {
+            state.SkipWithError("gpt_view_open failed");
+            return;
+        }
+        benchmark::DoNotOptimize(gpt_view_get_pentry(&view, "boot_b", PRIMARY_GPT));
+        gpt_view_close(&view);
+    }
+}
+BENCHMARK(BM_gpt_view_open) LAYOUT_ARGS;
+
+// Boot HAL style getter, served from the slot attribute snapshot
+static void BM_gpt_utils_get_ab_attr(benchmark::State& state) {
+    uint8_t attr;
+    if (!SetUp(state)) return;
+    for (auto _ : state) {
+        if (gpt_utils_get_ab_attr("boot_b", &attr)) {
+            state.SkipWithError("gpt_utils_get_ab_attr failed");
+            return;
+        }
+        benchmark::DoNotOptimize(attr);
+    }
+}
+BENCHMARK(BM_gpt_utils_get_ab_attr) LAYOUT_ARGS;
+
+// Slot switch as the boot HAL does it: flip the attributes of a pair of
+// entries in both tables, then recompute the CRCs. range(3) selects whether
+// the modified entries are marked dirty.
+static void BM_gpt_disk_update_crc(benchmark::State& state) {
+    const char* const ptns[] = {"boot_a", "boot_b"};
+    bool mark = state.range(3);
+    if (!SetUp(state)) return;
+    struct gpt_disk* disk = gpt_disk_alloc();
+    if (!disk || gpt_disk_get_disk_info("boot_a", disk)) {
+        gpt_disk_free(disk);
+        state.SkipWithError("gpt_disk_get_disk_info failed");
+        return;
+    }
+    for (auto _ : state) {
+        for (const char* ptn : ptns) {
+            for (int instance = PRIMARY_GPT; instance <= SECONDARY_GPT; instance++) {
+                uint8_t* pentry = gpt_disk_get_pentry(disk, ptn, (enum gpt_instance)instance);
+                pentry[AB_FLAG_OFFSET] ^= AB_PARTITION_ATTR_SLOT_ACTIVE;
+                if (mark) gpt_disk_mark_pentry_dirty(disk, pentry);
+            }
+        }
+        gpt_disk_update_crc(disk);
+    }
+    gpt_disk_free(disk);
+}
+BENCHMARK(BM_gpt_disk_update_crc)
+        ->ArgNames({"sector", "entries", "luns", "mark"})
+        ->ArgsProduct({{512, 4096}, {128, 256, 512, 1024}, {1}, {0, 1}});
+
+static void BM_gpt_disk_commit(benchmark::State& state) {
+    struct gpt_io_stats io = {};
+    if (!SetUp(state)) return;
+    struct gpt_disk* disk = gpt_disk_alloc();
+    if (!disk || gpt_disk_get_disk_info("boot_a", disk)) {
+        gpt_disk_free(disk);
+        state.SkipWithError("gpt_disk_get_disk_info failed");
+        return;
+    }
+    for (auto _ : state) {
+        struct gpt_io_stats before = disk->io_stats;
+        if (gpt_disk_commit(disk)) {
+            state.SkipWithError("gpt_disk_commit failed");
+            break;
+        }
+        io.syscalls += disk->io_stats.syscalls - before.syscalls;
+        io.fsyncs += disk->io_stats.fsyncs - before.fsyncs;
+        io.bytes_read += disk->io_stats.bytes_read - before.bytes_read;
+        io.bytes_written += disk->io_stats.bytes_written - before.bytes_written;
+    }
+    gpt_disk_free(disk);
+    ReportIo(state, io);
+}
+BENCHMARK(BM_gpt_disk_commit) LAYOUT_ARGS->UseRealTime();
+
+// One partition on every LUN of the layout, boot LUNs included
+static std::vector<const char*> LunDevs(uint32_t luns) {
+    std::vector<const char*> devs;
+    for (uint32_t lun = 0; lun < luns; lun++) devs.push_back(kSwapPtns[lun]);
+    devs.push_back("xbl");
+    devs.push_back("xblbak");
+    return devs;
+}
+
+#define BATCH_ARGS                                                      \
+    ->ArgNames({"sector", "entries", "luns", "uring"})                  \
+    ->ArgsProduct({{512, 4096}, {128, 1024}, {1, 4, 8}, {0, 1}})
+
+// Tables of every LUN, as a slot switch loads them. range(3) selects the
+// io_uring batch over one Load() per LUN.
+static void BM_gpt_disk_load_all(benchmark::State& state) {
+    struct gpt_io_stats io = {};
+    if (!SetUp(state)) return;
+    std::vector<const char*> devs = LunDevs(state.range(2));
+    std::vector<GptDisk> disks(devs.size());
+    gpt_utils_set_io_uring(state.range(3));
+    for (auto _ : state) {
+        if (GptDisk::LoadAll(disks, devs)) {
+            state.SkipWithError("GptDisk::LoadAll failed");
+            break;
+        }
+        for (GptDisk& disk : disks) AddIo(&io, disk.c_disk()->io_stats);
+    }
+    gpt_utils_set_io_uring(0);
+    ReportIo(state, io);
+}
+BENCHMARK(BM_gpt_disk_load_all) BATCH_ARGS->UseRealTime();
+
+static void BM_gpt_disk_commit_all(benchmark::State& state) {
+    struct gpt_io_stats io = {};
+    if (!SetUp(state)) return;
+    std::vector<const char*> devs = LunDevs(state.range(2));
+    std::vector<GptDisk> disks(devs.size());
+    if (GptDisk::LoadAll(disks, devs)) {
+        state.SkipWithError("GptDisk::LoadAll failed");
+        return;
+    }
+    gpt_utils_set_io_uring(state.range(3));
+    for (auto _ : state) {
+        for (GptDisk& disk : disks) disk.c_disk()->io_stats = {};
+        if (GptDisk::CommitAll(disks)) {
+            state.SkipWithError("GptDisk::CommitAll failed");
+            break;
+        }
+        for (GptDisk& disk : disks) AddIo(&io, disk.c_disk()->io_stats);
+    }
+    gpt_utils_set_io_uring(0);
+    ReportIo(state, io);
+}
+BENCHMARK(BM_gpt_disk_commit_all) BATCH_ARGS->UseRealTime();
+
+BENCHMARK_MAIN();
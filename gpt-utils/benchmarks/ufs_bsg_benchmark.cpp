@@ -0,0 +1,172 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// UFS query paths of recovery-ufs-bsg against the in-memory device of
+// ufs-bsg-fake, so that they run on any host or device without touching the
+// real UFS. The latency argument is the time the fake device takes to answer
+// every query, in microseconds: 0 measures the query path itself.
+
+#include <benchmark/benchmark.h>
+#include <errno.h>
+
+#include "ufs-bsg-fake.h"
+
+// Scsi generic node the legacy set_boot_lun() queries
+#define FAKE_SG_DEV "/dev/sg0"
+
+class FakeDevice {
+  public:
+    explicit FakeDevice(unsigned latency_us) : dev_(ufs_fake_create()) {
+        ufs_fake_add_node(dev_, FAKE_SG_DEV);
+        ufs_fake_set_latency(dev_, latency_us);
+        ufs_fake_install(dev_);
+    }
+
+    ~FakeDevice() {
+        ufs_fake_uninstall();
+        ufs_fake_destroy(dev_);
+    }
+
+    struct ufs_fake* get() const { return dev_; }
+
+    // Queries the device received, over either path
+    unsigned long Queries() const {
+        struct ufs_fake_stats stats;
+        ufs_fake_get_stats(dev_, &stats);
+        return stats.bsg_queries + stats.legacy_queries;
+    }
+
+  private:
+    struct ufs_fake* dev_;
+};
+
+static void SetQueryCounters(benchmark::State& state, const FakeDevice& dev) {
+    state.counters["queries"] =
+            benchmark::Counter(dev.Queries(), benchmark::Counter::kAvgIterations);
+}
+
+// Flip the boot LUN between A and B, as a slot switch does
+static void BM_set_boot_lun(benchmark::State& state) {
+    FakeDevice dev(state.range(0));
+    uint8_t lun = 1;
+
+    for (auto _ : state) {
+        lun = lun == 1 ? 2 : 1;
+        if (set_boot_lun((char*)FAKE_SG_DEV, lun) ||
+            ufs_fake_get_attr(dev.get(), 0x00 /* bBootLunEn */, 0, 0) != lun) {
+            state.SkipWithError("set_boot_lun failed");
+            return;
+        }
+    }
+    SetQueryCounters(state, dev);
+}
+BENCHMARK(BM_set_boot_lun)->ArgName("latency_us")->Arg(0)->Arg(50)->UseRealTime();
+
+#ifdef _BSG_FRAMEWORK_KERNEL_HEADERS
+// Attributes read per iteration
+static const __u8 kAttrs[] = {
+        QUERY_ATTR_IDN_BOOT_LU_EN,   QUERY_ATTR_IDN_BKOPS_STATUS,
+        QUERY_ATTR_IDN_ACTIVE_ICC_LVL, QUERY_ATTR_IDN_WB_FLUSH_STATUS,
+        QUERY_ATTR_IDN_AVAIL_WB_BUFF_SIZE, QUERY_ATTR_IDN_WB_BUFF_LIFE_TIME_EST,
+        QUERY_ATTR_IDN_CURR_WB_BUFF_SIZE,
+};
+#define NUM_ATTRS (sizeof(kAttrs) / sizeof(kAttrs[0]))
+
+// Read the attributes one ufs_bsg_read_attr() at a time
+static void BM_read_attr_single(benchmark::State& state) {
+    FakeDevice dev(state.range(0));
+    struct ufs_bsg_session* session = ufs_bsg_session_get();
+    __u32 value;
+
+    if (!session) {
+        state.SkipWithError("no UFS BSG session");
+        return;
+    }
+    for (auto _ : state) {
+        for (size_t i = 0; i < NUM_ATTRS; i++) {
+            if (ufs_bsg_read_attr(session, kAttrs[i], 0, 0, &value)) {
+                state.SkipWithError("attribute read failed");
+                return;
+            }
+            benchmark::DoNotOptimize(value);
+        }
+    }
+    SetQueryCounters(state, dev);
+}
+BENCHMARK(BM_read_attr_single)->ArgName("latency_us")->Arg(0)->Arg(50)->UseRealTime();
+
+// Read the same attributes in one ufs_bsg_query_batch()
+static void BM_read_attr_batch(benchmark::State& state) {
+    FakeDevice dev(state.range(0));
+    struct ufs_bsg_session* session = ufs_bsg_session_get();
+    struct ufs_query queries[NUM_ATTRS];
+
+    if (!session) {
+        state.SkipWithError("no UFS BSG session");
+        return;
+    }
+    for (auto _ : state) {
+        memset(queries, 0, sizeof(queries));
+        for (size_t i = 0; i < NUM_ATTRS; i++) {
+            queries[i].opcode = QUERY_REQ_OP_READ_ATTR;
+            queries[i].idn = kAttrs[i];
+        }
+        if (ufs_bsg_query_batch(session, queries, NUM_ATTRS)) {
+            state.SkipWithError("attribute batch failed");
+            return;
+        }
+        benchmark::DoNotOptimize(queries);
+    }
+    SetQueryCounters(state, dev);
+}
+BENCHMARK(BM_read_attr_batch)->ArgName("latency_us")->Arg(0)->Arg(50)->UseRealTime();
+
+// A full WriteBooster status poll
+static void BM_wb_read_status(benchmark::State& state) {
+    FakeDevice dev(state.range(0));
+    struct ufs_bsg_session* session = ufs_bsg_session_get();
+    struct ufs_wb_status status;
+
+    if (!session) {
+        state.SkipWithError("no UFS BSG session");
+        return;
+    }
+    for (auto _ : state) {
+        if (ufs_wb_read_status(session, &status)) {
+            state.SkipWithError("WriteBooster status read failed");
+            return;
+        }
+        benchmark::DoNotOptimize(status);
+    }
+    SetQueryCounters(state, dev);
+}
+BENCHMARK(BM_wb_read_status)->ArgName("latency_us")->Arg(0)->Arg(50)->UseRealTime();
+
+// Attribute reads the device answers with a general failure, to cost the
+// error path
+static void BM_read_attr_failing(benchmark::State& state) {
+    FakeDevice dev(0);
+    struct ufs_bsg_session* session = ufs_bsg_session_get();
+    __u32 value;
+
+    if (!session) {
+        state.SkipWithError("no UFS BSG session");
+        return;
+    }
+    ufs_fake_inject(dev.get(), QUERY_REQ_OP_READ_ATTR, UFS_FAKE_ANY,
+                    UFS_FAKE_FAULT_RESPONSE, 0xFF, 0, 0);
+    for (auto _ : state) {
+        if (!ufs_bsg_read_attr(session, QUERY_ATTR_IDN_BOOT_LU_EN, 0, 0, &value)) {
+            state.SkipWithError("injected fault did not fail the query");
+            return;
+        }
+    }
+    SetQueryCounters(state, dev);
+}
+BENCHMARK(BM_read_attr_failing)->UseRealTime();
+#endif
+
+BENCHMARK_MAIN();
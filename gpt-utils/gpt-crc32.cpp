@@ -0,0 +1,306 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/******************************************************************************
+ * INCLUDE SECTION
+ ******************************************************************************/
+#include <string.h>
+#include "gpt-crc32.h"
+
+#if defined(__aarch64__)
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/******************************************************************************
+ * DEFINE SECTION
+ ******************************************************************************/
+//Reflected IEEE 802.3 polynomial
+#define CRC32_POLY 0xedb88320
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+typedef uint32_t (*crc32_fn)(uint32_t crc, const uint8_t *buf, size_t len);
+
+//crc32_table[0] is the classic byte-wise table, crc32_table[k][n] is the
+//CRC of byte n followed by k zero bytes
+struct crc32_tables {
+        uint32_t t[8][256];
+
+        constexpr crc32_tables() : t()
+        {
+                for (uint32_t n = 0; n < 256; n++) {
+                        uint32_t c = n;
+                        for (int k = 0; k < 8; k++)
+                                c = (c & 1) ? CRC32_POLY ^ (c >> 1) : c >> 1;
+                        t[0][n] = c;
+                }
+                for (uint32_t n = 0; n < 256; n++)
+                        for (int k = 1; k < 8; k++)
+                                t[k][n] = (t[k - 1][n] >> 8) ^
+                                                t[0][t[k - 1][n] & 0xff];
+        }
+};
+
+static constexpr crc32_tables crc32_table;
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+//Byte at a time, on the pre-inverted crc
+static inline uint32_t crc32_bytes(uint32_t crc, const uint8_t *buf, size_t len)
+{
+        while (len--)
+                crc = crc32_table.t[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+        return crc;
+}
+
+uint32_t gpt_crc32_portable(uint32_t crc, const uint8_t *buf, size_t len)
+{
+        uint32_t lo, hi;
+
+        if (!buf)
+                return 0;
+        crc = ~crc;
+        for (; len >= 8; buf += 8, len -= 8) {
+                lo = crc ^ ((uint32_t)buf[0] | (uint32_t)buf[1] << 8 |
+                                (uint32_t)buf[2] << 16 | (uint32_t)buf[3] << 24);
+                hi = (uint32_t)buf[4] | (uint32_t)buf[5] << 8 |
+                                (uint32_t)buf[6] << 16 | (uint32_t)buf[7] << 24;
+                crc = crc32_table.t[7][lo & 0xff] ^
+                                crc32_table.t[6][(lo >> 8) & 0xff] ^
+                                crc32_table.t[5][(lo >> 16) & 0xff] ^
+                                crc32_table.t[4][lo >> 24] ^
+                                crc32_table.t[3][hi & 0xff] ^
+                                crc32_table.t[2][(hi >> 8) & 0xff] ^
+                                crc32_table.t[1][(hi >> 16) & 0xff] ^
+                                crc32_table.t[0][hi >> 24];
+        }
+        return ~crc32_bytes(crc, buf, len);
+}
+
+#if defined(__aarch64__)
+//ARMv8 CRC32X/CRC32B compute exactly the reflected IEEE CRC
+__attribute__((target("crc")))
+static uint32_t crc32_armv8(uint32_t crc, const uint8_t *buf, size_t len)
+{
+        uint64_t v;
+
+        if (!buf)
+                return 0;
+        crc = ~crc;
+        while (len && ((uintptr_t)buf & 7)) {
+                crc = __builtin_arm_crc32b(crc, *buf++);
+                len--;
+        }
+        for (; len >= 8; buf += 8, len -= 8) {
+                memcpy(&v, buf, sizeof(v));
+                crc = __builtin_arm_crc32d(crc, v);
+        }
+        while (len--)
+                crc = __builtin_arm_crc32b(crc, *buf++);
+        return ~crc;
+}
+#elif defined(__x86_64__) || defined(__i386__)
+//Carry-less multiplication folding after Intel's "Fast CRC Computation for
+//Generic Polynomials Using PCLMULQDQ Instruction". Four 128-bit lanes are
+//folded 64 bytes at a time, then reduced to a single lane, to 64 bits and
+//finally Barrett reduced to the 32-bit remainder.
+__attribute__((target("sse4.1,pclmul")))
+static uint32_t crc32_pclmul_fold(uint32_t crc, const uint8_t *buf, size_t len)
+{
+        //x^(4*128+32) mod P, x^(4*128-32) mod P, bit reflected
+        const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+        //x^(128+32) mod P, x^(128-32) mod P
+        const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+        //x^64 mod P
+        const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+        //P and mu = x^64 / P
+        const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+        const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+        __m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+        //len is a multiple of 16 and at least 64
+        x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+        x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+        x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+        x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+        x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128(crc));
+        buf += 64;
+        len -= 64;
+
+        for (; len >= 64; buf += 64, len -= 64) {
+                x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+                x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+                x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+                x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+                x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+                x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+                x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+                x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+                x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                                _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+                x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+                                _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+                x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+                                _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+                x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+                                _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+        }
+
+        //Fold the four lanes into one
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+        for (; len >= 16; buf += 16, len -= 16) {
+                x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+                x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+                x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                                _mm_loadu_si128((const __m128i *)buf));
+        }
+
+        //128 -> 64 bits
+        x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+        x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+        x2 = _mm_srli_si128(x1, 4);
+        x1 = _mm_and_si128(x1, mask32);
+        x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+
+        //Barrett reduction to 32 bits
+        x2 = _mm_and_si128(x1, mask32);
+        x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+        x2 = _mm_and_si128(x2, mask32);
+        x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+        x1 = _mm_xor_si128(x1, x2);
+        x0 = _mm_srli_si128(x1, 4);
+        return (uint32_t)_mm_cvtsi128_si32(x0);
+}
+
+static uint32_t crc32_pclmul(uint32_t crc, const uint8_t *buf, size_t len)
+{
+        size_t chunk;
+
+        if (!buf)
+                return 0;
+        crc = ~crc;
+        if (len >= 64) {
+                chunk = len & ~(size_t)15;
+                crc = crc32_pclmul_fold(crc, buf, chunk);
+                buf += chunk;
+                len -= chunk;
+        }
+        return ~crc32_bytes(crc, buf, len);
+}
+#endif
+
+//a * b modulo the CRC polynomial, both reflected
+static uint32_t crc32_multmodp(uint32_t a, uint32_t b)
+{
+        uint32_t m = (uint32_t)1 << 31;
+        uint32_t p = 0;
+
+        for (;;) {
+                if (a & m) {
+                        p ^= b;
+                        if ((a & (m - 1)) == 0)
+                                break;
+                }
+                m >>= 1;
+                b = (b & 1) ? (b >> 1) ^ CRC32_POLY : b >> 1;
+        }
+        return p;
+}
+
+//x^(2^n) modulo the CRC polynomial, for n = 0..31
+struct crc32_x2n {
+        uint32_t t[32];
+
+        crc32_x2n() : t()
+        {
+                uint32_t p = (uint32_t)1 << 30;     /* x^1 */
+
+                t[0] = p;
+                for (int n = 1; n < 32; n++)
+                        t[n] = p = crc32_multmodp(p, p);
+        }
+};
+
+uint32_t gpt_crc32_combine_gen(uint64_t len2)
+{
+        static const crc32_x2n x2n;
+        uint32_t p = (uint32_t)1 << 31;         /* x^0 == 1 */
+        unsigned k = 3;                         /* len2 is in bytes */
+
+        for (; len2; len2 >>= 1, k++) {
+                if (len2 & 1)
+                        p = crc32_multmodp(x2n.t[k & 31], p);
+        }
+        return p;
+}
+
+uint32_t gpt_crc32_combine_op(uint32_t crc1, uint32_t crc2, uint32_t op)
+{
+        return crc32_multmodp(op, crc1) ^ crc2;
+}
+
+uint32_t gpt_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+        return gpt_crc32_combine_op(crc1, crc2, gpt_crc32_combine_gen(len2));
+}
+
+static crc32_fn crc32_select(const char **name)
+{
+#if defined(__aarch64__)
+        if (getauxval(AT_HWCAP) & HWCAP_CRC32) {
+                *name = "armv8";
+                return crc32_armv8;
+        }
+#elif defined(__x86_64__) || defined(__i386__)
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("pclmul") &&
+                        __builtin_cpu_supports("sse4.1")) {
+                *name = "pclmul";
+                return crc32_pclmul;
+        }
+#endif
+        *name = "slice8";
+        return gpt_crc32_portable;
+}
+
+//Implementation picked on first use
+struct crc32_impl {
+        const char *name;
+        crc32_fn fn;
+
+        crc32_impl() : name(NULL), fn(crc32_select(&name)) {}
+};
+
+static const crc32_impl &crc32_get_impl()
+{
+        static const crc32_impl impl;
+        return impl;
+}
+
+uint32_t gpt_crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+        return crc32_get_impl().fn(crc, buf, len);
+}
+
+const char *gpt_crc32_impl()
+{
+        return crc32_get_impl().name;
+}
@@ -0,0 +1,41 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef __GPT_CRC32_H__
+#define __GPT_CRC32_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+#include <stddef.h>
+
+//CRC32 (IEEE 802.3, as used by GPT) of len bytes at buf. Same contract as
+//zlib crc32(): start with crc 0 and pass the previous result to continue
+//over the next chunk. A NULL buf returns 0.
+//
+//The implementation is picked once at runtime: ARMv8 CRC32 instructions or
+//PCLMULQDQ folding when the CPU has them, slicing-by-8 tables otherwise.
+uint32_t gpt_crc32(uint32_t crc, const uint8_t *buf, size_t len);
+
+//Portable slicing-by-8 implementation, regardless of the CPU
+uint32_t gpt_crc32_portable(uint32_t crc, const uint8_t *buf, size_t len);
+
+//Name of the implementation gpt_crc32() dispatches to
+const char *gpt_crc32_impl();
+
+//CRC arithmetic, same as zlib crc32_combine_gen/op/crc32_combine:
+//gpt_crc32_combine(crc(A), crc(B), len(B)) is crc(A followed by B).
+//gpt_crc32_combine_gen() precomputes the operator for a given len2 so it
+//can be applied with gpt_crc32_combine_op() at the cost of one GF(2)
+//multiplication. gpt_crc32_combine_op(crc1, 0, op) appends len2 zero bytes
+//to a raw (unconditioned) CRC register value.
+uint32_t gpt_crc32_combine_gen(uint64_t len2);
+uint32_t gpt_crc32_combine_op(uint32_t crc1, uint32_t crc2, uint32_t op);
+uint32_t gpt_crc32_combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+#ifdef __cplusplus
+}
+#endif
+#endif /* __GPT_CRC32_H__ */
@@ -0,0 +1,104 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef __GPT_DISK_H__
+#define __GPT_DISK_H__
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <memory>
+#include <span>
+
+#include "gpt-utils.h"
+
+struct gpt_uring;
+
+// Owner of a struct gpt_disk and of everything it points to. Both headers
+// and both partition entries arrays live in a single block aligned arena,
+// laid out the way the backup table sits at the end of the disk:
+//
+//   | primary header | primary entries | backup entries | backup header |
+//
+// so the backup entries and header are read in one go. The arena is sized
+// from the primary header and kept across Load() calls; it only grows when
+// a disk needs more room than any loaded before.
+//
+// The gpt_disk_* functions work on c_disk(). gpt_disk_alloc() creates a
+// GptDisk and hands out its c_disk(), gpt_disk_free() destroys it.
+class GptDisk {
+  public:
+    GptDisk();
+    ~GptDisk();
+    GptDisk(GptDisk&& other) noexcept;
+    GptDisk& operator=(GptDisk&& other) noexcept;
+    GptDisk(const GptDisk&) = delete;
+    GptDisk& operator=(const GptDisk&) = delete;
+
+    // (Re)load the GPT of the disk holding the partition named dev, see
+    // gpt_disk_get_disk_info(). Spans handed out before are invalidated.
+    // On failure the disk is left unloaded.
+    int Load(const char* dev);
+    bool loaded() const { return disk_.is_initialized == GPT_DISK_INIT_MAGIC; }
+
+    // Header block and partition entries array of a table, empty spans
+    // when nothing is loaded
+    std::span<uint8_t> header(enum gpt_instance instance);
+    std::span<uint8_t> entries(enum gpt_instance instance);
+    // Entry i of a table, empty if there is no such entry
+    std::span<uint8_t> entry(uint32_t i, enum gpt_instance instance);
+    uint32_t num_entries() const;
+
+    // Load() and Commit() several disks, eg: all the LUNs a slot switch
+    // touches. With io_uring enabled (see gpt_utils_set_io_uring()) the
+    // tables of all disks are read in a single batch, and every disk is
+    // committed as one chain of linked requests: backup table, flush,
+    // primary table, flush, with the chains of different disks running
+    // side by side. A disk whose batched I/O fails, or whose tables are not
+    // where the batch expects them, is redone with Load() or Commit().
+    static int LoadAll(std::span<GptDisk> disks, std::span<const char* const> devs);
+    static int CommitAll(std::span<GptDisk> disks);
+
+    // Entry of partition partname, empty if it is not there
+    std::span<uint8_t> Find(const char* partname, enum gpt_instance instance);
+    // See gpt_disk_update_crc() and gpt_disk_commit()
+    int UpdateCrc() { return gpt_disk_update_crc(&disk_); }
+    int Commit() { return gpt_disk_commit(&disk_); }
+
+    // Bytes the arena holds, and the number of times it was allocated
+    size_t arena_size() const { return arena_size_; }
+    uint32_t arena_allocs() const { return arena_allocs_; }
+
+    struct gpt_disk* c_disk() { return &disk_; }
+    // The GptDisk disk belongs to, NULL if disk does not come from one
+    static GptDisk* FromC(struct gpt_disk* disk) { return disk ? disk->owner : NULL; }
+
+  private:
+    struct ArenaDeleter {
+        void operator()(uint8_t* arena) const { free(arena); }
+    };
+
+    int Open(const char* dev, struct gpt_session* session);
+    int LoadTables(struct gpt_session* session);
+    int QueueTables(struct gpt_uring* ring, struct gpt_session* session, uint64_t tag,
+                    int* len);
+    int TakeTables(struct gpt_session* session);
+    int Finish(struct gpt_session* session);
+    int QueueCommit(struct gpt_uring* ring, struct gpt_session* session, uint64_t tag,
+                    int* len);
+    uint8_t* Reserve(uint32_t block_size, size_t size, size_t keep);
+    void Unload();
+    void Release();
+    void Take(GptDisk& other);
+
+    struct gpt_disk disk_;
+    std::unique_ptr<uint8_t, ArenaDeleter> arena_;
+    size_t arena_size_ = 0;
+    uint32_t arena_align_ = 0;
+    uint32_t arena_allocs_ = 0;
+};
+
+#endif /* __GPT_DISK_H__ */
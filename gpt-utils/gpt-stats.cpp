@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/******************************************************************************
+ * INCLUDE SECTION
+ ******************************************************************************/
+#include <string.h>
+#include <atomic>
+#include <mutex>
+#include "gpt-stats.h"
+
+using namespace std;
+
+/******************************************************************************
+ * DEFINE SECTION
+ ******************************************************************************/
+//Counters of a thread: the scalar fields of struct gpt_utils_stats in
+//order, then the calls, the time and the cache hits of every public call
+enum {
+        STAT_SYSCALLS = 0,
+        STAT_READS,
+        STAT_WRITES,
+        STAT_FSYNCS,
+        STAT_BYTES_READ,
+        STAT_BYTES_WRITTEN,
+        STAT_IOCTLS,
+        STAT_API_CALLS,
+        STAT_API_TIME = STAT_API_CALLS + GPT_API_COUNT,
+        STAT_API_HITS = STAT_API_TIME + GPT_API_COUNT,
+        STAT_COUNT = STAT_API_HITS + GPT_API_COUNT
+                        };
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+struct gpt_thread_stats {
+        gpt_thread_stats();
+        ~gpt_thread_stats();
+
+        //Only the owning thread adds to them, other threads sum and reset
+        //them
+        atomic<uint64_t> counters[STAT_COUNT];
+        //Links of the stats_threads list
+        gpt_thread_stats *prev;
+        gpt_thread_stats *next;
+};
+
+/******************************************************************************
+ * GLOBALS
+ ******************************************************************************/
+static const char *const api_names[GPT_API_COUNT] = {
+        "prepare_boot_update",
+        "gpt_disk_get_disk_info",
+        "gpt_disk_commit",
+        "gpt_view_open",
+        "gpt_utils_get_ab_attr",
+        "gpt_utils_set_slot_attr",
+        "gpt_utils_set_xbl_boot_partition",
+        "gpt_utils_get_partition_map",
+        "gpt_utils_get_io_geometry",
+        "gpt_utils_scan_lun",
+        "gpt_utils_scan",
+        "gpt_verify_run",
+};
+
+//Threads that counted something and are still running, and the sum of
+//what the ones that exited counted
+static mutex stats_lock;
+static gpt_thread_stats *stats_threads;
+static uint64_t stats_exited[STAT_COUNT];
+
+static thread_local gpt_thread_stats thread_stats;
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+gpt_thread_stats::gpt_thread_stats() : prev(NULL)
+{
+        lock_guard<mutex> lock(stats_lock);
+
+        for (int i = 0; i < STAT_COUNT; i++)
+                counters[i].store(0, memory_order_relaxed);
+        next = stats_threads;
+        if (next)
+                next->prev = this;
+        stats_threads = this;
+}
+
+gpt_thread_stats::~gpt_thread_stats()
+{
+        lock_guard<mutex> lock(stats_lock);
+
+        for (int i = 0; i < STAT_COUNT; i++)
+                stats_exited[i] += counters[i].load(memory_order_relaxed);
+        if (prev)
+                prev->next = next;
+        else
+                stats_threads = next;
+        if (next)
+                next->prev = prev;
+}
+
+//An atomic add even though only the owning thread counts: a reset from
+//another thread must not be undone by a load and store around it
+static inline void stats_add(int counter, uint64_t n)
+{
+        thread_stats.counters[counter].fetch_add(n, memory_order_relaxed);
+}
+
+void gpt_stats_add_io(const struct gpt_io_stats *io)
+{
+        stats_add(STAT_SYSCALLS, io->syscalls);
+        stats_add(STAT_READS, io->reads);
+        stats_add(STAT_WRITES, io->writes);
+        stats_add(STAT_FSYNCS, io->fsyncs);
+        stats_add(STAT_BYTES_READ, io->bytes_read);
+        stats_add(STAT_BYTES_WRITTEN, io->bytes_written);
+}
+
+void gpt_stats_add_ioctl()
+{
+        stats_add(STAT_IOCTLS, 1);
+}
+
+void gpt_stats_add_api(enum gpt_api api, uint64_t time_ns)
+{
+        stats_add(STAT_API_CALLS + (int)api, 1);
+        stats_add(STAT_API_TIME + (int)api, time_ns);
+}
+
+void gpt_stats_add_api_hit(enum gpt_api api)
+{
+        stats_add(STAT_API_HITS + (int)api, 1);
+}
+
+int gpt_utils_get_stats(struct gpt_utils_stats *stats, int all_threads)
+{
+        uint64_t sum[STAT_COUNT];
+        int i;
+
+        if (!stats)
+                return -1;
+        if (!all_threads) {
+                for (i = 0; i < STAT_COUNT; i++)
+                        sum[i] = thread_stats.counters[i].load(
+                                        memory_order_relaxed);
+        } else {
+                lock_guard<mutex> lock(stats_lock);
+
+                memcpy(sum, stats_exited, sizeof(sum));
+                for (gpt_thread_stats *t = stats_threads; t; t = t->next)
+                        for (i = 0; i < STAT_COUNT; i++)
+                                sum[i] += t->counters[i].load(
+                                                memory_order_relaxed);
+        }
+        stats->syscalls = sum[STAT_SYSCALLS];
+        stats->reads = sum[STAT_READS];
+        stats->writes = sum[STAT_WRITES];
+        stats->fsyncs = sum[STAT_FSYNCS];
+        stats->bytes_read = sum[STAT_BYTES_READ];
+        stats->bytes_written = sum[STAT_BYTES_WRITTEN];
+        stats->ioctls = sum[STAT_IOCTLS];
+        for (i = 0; i < GPT_API_COUNT; i++) {
+                stats->api[i].calls = sum[STAT_API_CALLS + i];
+                stats->api[i].time_ns = sum[STAT_API_TIME + i];
+                stats->api[i].hits = sum[STAT_API_HITS + i];
+        }
+        return 0;
+}
+
+void gpt_utils_reset_stats(int all_threads)
+{
+        int i;
+
+        if (!all_threads) {
+                for (i = 0; i < STAT_COUNT; i++)
+                        thread_stats.counters[i].store(0, memory_order_relaxed);
+                return;
+        }
+        lock_guard<mutex> lock(stats_lock);
+        memset(stats_exited, 0, sizeof(stats_exited));
+        for (gpt_thread_stats *t = stats_threads; t; t = t->next)
+                for (i = 0; i < STAT_COUNT; i++)
+                        t->counters[i].store(0, memory_order_relaxed);
+}
+
+const char *gpt_utils_api_name(enum gpt_api api)
+{
+        if (api < 0 || api >= GPT_API_COUNT)
+                return "unknown";
+        return api_names[api];
+}
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef __GPT_STATS_H__
+#define __GPT_STATS_H__
+#include <stdint.h>
+#include <time.h>
+#include "gpt-utils.h"
+
+//Accounting behind gpt_utils_get_stats(), private to libgptutils. Every
+//thread counts into its own set of counters.
+
+//Add the I/O of a GPT session to the calling thread
+void gpt_stats_add_io(const struct gpt_io_stats *io);
+//Count an ioctl issued by the calling thread
+void gpt_stats_add_ioctl();
+//Count a public call that took time_ns
+void gpt_stats_add_api(enum gpt_api api, uint64_t time_ns);
+//Count a public call answered from an in-process cache
+void gpt_stats_add_api_hit(enum gpt_api api);
+
+static inline uint64_t gpt_stats_now_ns()
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+//Accounts the scope it is declared in to a public call
+class GptApiTimer {
+public:
+        explicit GptApiTimer(enum gpt_api api) :
+                        api_(api), start_(gpt_stats_now_ns()) {}
+        ~GptApiTimer()
+        {
+                gpt_stats_add_api(api_, gpt_stats_now_ns() - start_);
+        }
+        GptApiTimer(const GptApiTimer &) = delete;
+        GptApiTimer &operator=(const GptApiTimer &) = delete;
+
+private:
+        enum gpt_api api_;
+        uint64_t start_;
+};
+#endif /* __GPT_STATS_H__ */
@@ -0,0 +1,249 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/******************************************************************************
+ * INCLUDE SECTION
+ ******************************************************************************/
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "gpt-uring.h"
+
+#if defined(__NR_io_uring_setup) && defined(__NR_io_uring_enter) && \
+        __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define GPT_HAVE_URING 1
+#endif
+
+#ifdef GPT_HAVE_URING
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+struct gpt_uring {
+        int fd;
+        //Submission queue ring and the SQEs it indexes
+        void *sq_ring;
+        size_t sq_ring_size;
+        unsigned *sq_head;
+        unsigned *sq_tail;
+        unsigned *sq_array;
+        unsigned sq_mask;
+        unsigned sq_entries;
+        struct io_uring_sqe *sqes;
+        size_t sqes_size;
+        //Completion queue ring, mapped along with the submission queue ring
+        //when cq_ring_size is 0
+        void *cq_ring;
+        size_t cq_ring_size;
+        unsigned *cq_head;
+        unsigned *cq_tail;
+        unsigned cq_mask;
+        struct io_uring_cqe *cqes;
+        //Single iovec of the request in each SQE slot
+        struct iovec *iov;
+        //Requests queued since the last gpt_uring_run()
+        unsigned queued;
+        uint32_t syscalls;
+};
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+struct gpt_uring *gpt_uring_create(uint32_t entries)
+{
+        struct io_uring_params p;
+        struct gpt_uring *ring;
+        uint8_t *sq, *cq;
+
+        ring = (struct gpt_uring *)calloc(1, sizeof(*ring));
+        if (!ring)
+                return NULL;
+        memset(&p, 0, sizeof(p));
+        ring->sq_ring = ring->cq_ring = MAP_FAILED;
+        ring->sqes = (struct io_uring_sqe *)MAP_FAILED;
+        ring->syscalls++;
+        ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+        if (ring->fd < 0)
+                goto error;
+        ring->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        ring->cq_ring_size = p.cq_off.cqes +
+                        p.cq_entries * sizeof(struct io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+                if (ring->cq_ring_size > ring->sq_ring_size)
+                        ring->sq_ring_size = ring->cq_ring_size;
+                ring->cq_ring_size = 0;
+        }
+        ring->syscalls++;
+        ring->sq_ring = mmap(NULL, ring->sq_ring_size,
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQ_RING);
+        if (ring->sq_ring == MAP_FAILED)
+                goto error;
+        if (ring->cq_ring_size) {
+                ring->syscalls++;
+                ring->cq_ring = mmap(NULL, ring->cq_ring_size,
+                                PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                                ring->fd, IORING_OFF_CQ_RING);
+                if (ring->cq_ring == MAP_FAILED)
+                        goto error;
+        }
+        ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+        ring->syscalls++;
+        ring->sqes = (struct io_uring_sqe *)mmap(NULL, ring->sqes_size,
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                        ring->fd, IORING_OFF_SQES);
+        if (ring->sqes == MAP_FAILED)
+                goto error;
+        ring->iov = (struct iovec *)calloc(p.sq_entries, sizeof(struct iovec));
+        if (!ring->iov)
+                goto error;
+
+        sq = (uint8_t *)ring->sq_ring;
+        cq = ring->cq_ring_size ? (uint8_t *)ring->cq_ring : sq;
+        ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+        ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+        ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+        ring->sq_mask = *(unsigned *)(sq + p.sq_off.ring_mask);
+        ring->sq_entries = p.sq_entries;
+        ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+        ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+        ring->cq_mask = *(unsigned *)(cq + p.cq_off.ring_mask);
+        ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+        return ring;
+error:
+        gpt_uring_destroy(ring);
+        return NULL;
+}
+
+void gpt_uring_destroy(struct gpt_uring *ring)
+{
+        if (!ring)
+                return;
+        if (ring->sqes != MAP_FAILED)
+                munmap(ring->sqes, ring->sqes_size);
+        if (ring->cq_ring != MAP_FAILED)
+                munmap(ring->cq_ring, ring->cq_ring_size);
+        if (ring->sq_ring != MAP_FAILED)
+                munmap(ring->sq_ring, ring->sq_ring_size);
+        if (ring->fd >= 0)
+                close(ring->fd);
+        free(ring->iov);
+        free(ring);
+}
+
+int gpt_uring_queue(struct gpt_uring *ring, enum gpt_uring_op op, int fd,
+                void *buf, uint32_t len, int64_t offset, uint64_t tag, int link)
+{
+        struct io_uring_sqe *sqe;
+        unsigned idx;
+
+        //Requests are only queued while the ring is idle, see gpt_uring_run()
+        if (ring->queued == ring->sq_entries)
+                return -1;
+        idx = (*ring->sq_tail + ring->queued) & ring->sq_mask;
+        sqe = &ring->sqes[idx];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->fd = fd;
+        sqe->user_data = tag;
+        if (link)
+                sqe->flags = IOSQE_IO_LINK;
+        if (op == GPT_URING_FSYNC) {
+                sqe->opcode = IORING_OP_FSYNC;
+                sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+        } else {
+                ring->iov[idx].iov_base = buf;
+                ring->iov[idx].iov_len = len;
+                sqe->opcode = op == GPT_URING_READ ? IORING_OP_READV :
+                                IORING_OP_WRITEV;
+                sqe->addr = (uintptr_t)&ring->iov[idx];
+                sqe->len = 1;
+                sqe->off = offset;
+        }
+        ring->sq_array[idx] = idx;
+        ring->queued++;
+        return 0;
+}
+
+int gpt_uring_run(struct gpt_uring *ring,
+                void (*done)(void *arg, uint64_t tag, int res), void *arg)
+{
+        //Queued but not taken by the kernel yet, and taken but not completed
+        unsigned to_submit = ring->queued;
+        unsigned in_flight = 0;
+        unsigned head, tail;
+        int failed = 0;
+        int r;
+
+        __atomic_store_n(ring->sq_tail, *ring->sq_tail + ring->queued,
+                        __ATOMIC_RELEASE);
+        ring->queued = 0;
+        while (to_submit || in_flight) {
+                ring->syscalls++;
+                r = syscall(__NR_io_uring_enter, ring->fd, to_submit, 1,
+                                IORING_ENTER_GETEVENTS, NULL, 0);
+                if (r >= 0) {
+                        r = (unsigned)r < to_submit ? r : to_submit;
+                        to_submit -= r;
+                        in_flight += r;
+                } else if (to_submit && errno != EINTR && errno != EAGAIN &&
+                                errno != EBUSY) {
+                        //Drop what the kernel did not take. What it did take
+                        //keeps using the buffers, so it is waited for all the
+                        //same, failed waits are simply retried.
+                        to_submit = 0;
+                        failed = 1;
+                }
+                head = *ring->cq_head;
+                tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+                for (; head != tail && in_flight; head++, in_flight--) {
+                        struct io_uring_cqe *cqe =
+                                        &ring->cqes[head & ring->cq_mask];
+
+                        done(arg, cqe->user_data, cqe->res);
+                }
+                __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+        }
+        return failed ? -1 : 0;
+}
+
+uint32_t gpt_uring_syscalls(const struct gpt_uring *ring)
+{
+        //munmap() of the rings and SQEs, close()
+        return ring->syscalls + (ring->cq_ring_size ? 4 : 3);
+}
+#else
+//No io_uring in the kernel headers: callers always take their synchronous
+//path
+struct gpt_uring *gpt_uring_create(uint32_t entries)
+{
+        return NULL;
+}
+
+void gpt_uring_destroy(struct gpt_uring *ring)
+{
+}
+
+int gpt_uring_queue(struct gpt_uring *ring, enum gpt_uring_op op, int fd,
+                void *buf, uint32_t len, int64_t offset, uint64_t tag, int link)
+{
+        return -1;
+}
+
+int gpt_uring_run(struct gpt_uring *ring,
+                void (*done)(void *arg, uint64_t tag, int res), void *arg)
+{
+        return -1;
+}
+
+uint32_t gpt_uring_syscalls(const struct gpt_uring *ring)
+{
+        return 0;
+}
+#endif
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef __GPT_URING_H__
+#define __GPT_URING_H__
+#ifdef __cplusplus
+extern "C" {
+#endif
+#include <stdint.h>
+
+//Minimal io_uring ring used to batch GPT I/O across disks. It talks to the
+//kernel through the raw system calls, so no library is needed, and sticks
+//to operations kernels have had since io_uring was introduced (vectored
+//read/write, fsync) plus linked requests.
+struct gpt_uring;
+
+enum gpt_uring_op {
+	GPT_URING_READ = 0,
+	GPT_URING_WRITE,
+	//fdatasync(), buf, len and offset are ignored
+	GPT_URING_FSYNC
+};
+
+//Set up a ring with room for at least entries requests in flight. Returns
+//NULL when io_uring cannot be used: kernels without it, or seccomp or
+//SELinux denying it to the process.
+struct gpt_uring *gpt_uring_create(uint32_t entries);
+void gpt_uring_destroy(struct gpt_uring *ring);
+
+//Queue a request, tagged with tag. With link set, the next request queued
+//only starts once this one completed in full; if it fails, the requests
+//linked after it complete with -ECANCELED. buf must stay valid until
+//gpt_uring_run() returns. Returns -1 when the ring is full.
+int gpt_uring_queue(struct gpt_uring *ring, enum gpt_uring_op op, int fd,
+		void *buf, uint32_t len, int64_t offset, uint64_t tag, int link);
+
+//Submit everything queued and wait for all of it to complete. done is
+//called with the tag and result (bytes transferred or -errno) of every
+//request submitted. Returns -1 if some requests could not be submitted,
+//the ring is then of no further use. Either way nothing is in flight
+//anymore when it returns, so the buffers are free to reuse.
+int gpt_uring_run(struct gpt_uring *ring,
+		void (*done)(void *arg, uint64_t tag, int res), void *arg);
+
+//System calls the ring made so far, counting the ones gpt_uring_destroy()
+//will make
+uint32_t gpt_uring_syscalls(const struct gpt_uring *ring);
+#ifdef __cplusplus
+}
+#endif
+#endif /* __GPT_URING_H__ */
@@ -27,7 +27,7 @@
  * IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
-#define _LARGEFILE64_SOURCE /* enable lseek64() */
+#define _LARGEFILE64_SOURCE /* enable pread64()/preadv64() */
 
 /******************************************************************************
  * INCLUDE SECTION
@@ -37,6 +37,8 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <linux/fs.h>
 #include <limits.h>
@@ -45,6 +47,14 @@
 #include <map>
 #include <vector>
 #include <string>
+#include <unordered_map>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <numeric>
+#include <pthread.h>
+#include <time.h>
 #ifndef __STDC_FORMAT_MACROS
 #define __STDC_FORMAT_MACROS
 #endif
@@ -55,7 +65,11 @@
 #include <cutils/log.h>
 #include <cutils/properties.h>
 #include "gpt-utils.h"
-#include <zlib.h>
+#include "gpt-disk.h"
+#include "gpt-stats.h"
+#include "gpt-crc32.h"
+#include "gpt-uring.h"
+#include "recovery-ufs-bsg.h"
 #include <endian.h>
 
 
@@ -63,15 +77,23 @@
  * DEFINE SECTION
  ******************************************************************************/
 #define BLK_DEV_FILE    "/dev/block/mmcblk0"
+//Names used under the root of the disk image backend
+#define IMAGE_BLK_DEV_FILE  "mmcblk0"
+#define IMAGE_BOOT_DEV_DIR  "by-name"
+#define IMAGE_BOOT_LUN_FILE "boot_lun"
 /* list the names of the backed-up partitions to be swapped */
 /* extension used for the backup partitions - tzbak, abootbak, etc. */
 #define BAK_PTN_NAME_EXT    "bak"
-#define XBL_PRIMARY         "/dev/block/bootdevice/by-name/xbl"
-#define XBL_BACKUP          "/dev/block/bootdevice/by-name/xblbak"
-#define XBL_AB_PRIMARY      "/dev/block/bootdevice/by-name/xbl_a"
-#define XBL_AB_SECONDARY    "/dev/block/bootdevice/by-name/xbl_b"
+/* XBL partitions, looked up under BOOT_DEV_DIR */
+#define XBL_PRIMARY         "xbl"
+#define XBL_BACKUP          "xblbak"
+#define XBL_AB_PRIMARY      "xbl_a"
+#define XBL_AB_SECONDARY    "xbl_b"
 /* GPT defines */
 #define MAX_LUNS                    26
+//Entries a partition entries array is expected to hold, 128 as laid out by
+//most partitioning tools. Arenas of a GptDisk are first sized for that.
+#define GPT_DEFAULT_PENTRIES        128
 //This will allow us to get the root lun path from the path to the partition.
 //i.e: from /dev/block/sdaXXX get /dev/block/sda. The assumption here is that
 //the boot critical luns lie between sda to sdz which is acceptable because
@@ -83,6 +105,15 @@
 #define LUN_NAME_START_LOC (sizeof("/dev/block/") - 1)
 #define BOOT_LUN_A_ID 1
 #define BOOT_LUN_B_ID 2
+//Upper bound on the threads preparing or scanning LUNs concurrently
+#define MAX_UPDATE_WORKERS 4
+//Largest partition entries array the scanner reads, 1024 entries of 1K
+#define GPT_SCAN_MAX_PENTRIES_SIZE (1024 * 1024)
+//Large sequential transfers go in chunks of at least that many bytes,
+//rounded to the write and erase units of the disk unless those are larger
+//than GPT_IO_CHUNK_MAX together
+#define GPT_IO_CHUNK_MIN (1024 * 1024)
+#define GPT_IO_CHUNK_MAX (64 * 1024 * 1024)
 /******************************************************************************
  * MACROS
  ******************************************************************************/
@@ -111,6 +142,49 @@
  * TYPES
  ******************************************************************************/
 using namespace std;
+//Partition name -> offsets of matching entries in a partition entries array
+typedef unordered_map<string, vector<uint32_t>> gpt_name_index;
+//Lookup tables over both partition entries arrays of a gpt_disk, built
+//when the arrays are loaded. Entries are referenced by their offset into
+//the array.
+struct gpt_disk_index {
+     gpt_name_index by_name[2];
+     //Unique GUID -> offset of the entry
+     unordered_map<string, uint32_t> by_unique_guid[2];
+     //Type GUID -> offset of the first entry of that type
+     unordered_map<string, uint32_t> by_type_guid[2];
+};
+//CRC bookkeeping of one partition entries array. The array CRC is linear
+//in the entries, so changing entry k changes it by the change of the
+//entry's own CRC shifted past the entries that follow it.
+struct gpt_arr_crc {
+     //Raw CRC (zero seed, no final inversion) of each entry as last hashed
+     vector<uint32_t> entry;
+     //CRC of the whole array as last hashed
+     uint32_t arr;
+     //Offsets of the entries marked dirty since
+     vector<uint32_t> dirty;
+};
+struct gpt_disk_crc {
+     gpt_arr_crc arr[2];
+};
+//A LUN holding A/B partitions the slot snapshot was taken from
+struct gpt_slot_lun {
+     char devpath[PATH_MAX];
+     uint32_t block_size;
+     uint64_t dev_size;
+     //Start of both GPT headers (signature up to the header CRC) as
+     //snapshotted
+     uint8_t hdr_start[2][HEADER_CRC_OFFSET + 4];
+};
+//A/B attribute bytes of the AB_PTN_LIST partitions of all LUNs
+struct gpt_slot_snapshot {
+     //gpt_generation the snapshot was taken at
+     uint64_t generation;
+     vector<gpt_slot_lun> luns;
+     //Partition name with slot suffix -> A/B attribute byte
+     unordered_map<string, uint8_t> attr;
+};
 enum gpt_state {
     GPT_OK = 0,
     GPT_BAD_SIGNATURE,
@@ -122,100 +196,657 @@ struct update_data {
      char lun_list[MAX_LUNS][PATH_MAX];
      uint32_t num_valid_entries;
 };
+//The XBL boot LUN switch of an update stage. It has to happen before any
+//LUN is modified but only once per stage, so the first LUN about to be
+//modified performs it and the others wait for its result.
+struct xbl_switch {
+     once_flag once;
+     int result;
+};
+//Work shared by the threads preparing the LUNs of an update stage
+struct update_work {
+     enum boot_update_stage stage;
+     struct update_data *data;
+     struct xbl_switch xbl;
+     //Next LUN to hand out
+     atomic<uint32_t> next;
+     int rcode[MAX_LUNS];
+     uint64_t elapsed_us[MAX_LUNS];
+     struct gpt_io_stats stats[MAX_LUNS];
+};
+//One GPT table as read by the scanner
+struct gpt_scan_table {
+     uint8_t *hdr;
+     //Partition entries array, NULL if the header does not locate it
+     uint8_t *arr;
+     uint32_t arr_size;
+     uint32_t pentry_size;
+     //GPT_SCAN_* problems
+     uint32_t errors;
+};
+//Work shared by the threads scanning the LUNs
+struct scan_work {
+     const vector<string> *luns;
+     struct gpt_scan_lun *results;
+     //Next LUN to hand out
+     atomic<uint32_t> next;
+     int rcode[GPT_SCAN_MAX_LUNS];
+};
 
-int32_t set_boot_lun(char *sg_dev,uint8_t boot_lun_id);
 /******************************************************************************
  * FUNCTIONS
  ******************************************************************************/
+//Round len up to a whole number of blocks
+static inline size_t gpt_io_buf_size(uint32_t block_size, size_t len)
+{
+    return (len + block_size - 1) / block_size * block_size;
+}
+
 /**
  *  ==========================================================================
  *
- *  \brief  Read/Write len bytes from/to block dev
+ *  \brief  Allocate a zeroed buffer for GPT I/O
+ *
+ *  The buffer is aligned to and padded up to a whole number of blocks so
+ *  that it can be used for direct I/O. Release it with free().
+ *
+ *  \param [in] block_size  Block size of the disk
+ *  \param [in] len         Number of bytes needed
+ *
+ *  \return  Buffer or NULL
+ *
+ *  ==========================================================================
+ */
+static uint8_t *gpt_io_buf_alloc(uint32_t block_size, size_t len)
+{
+    size_t size = gpt_io_buf_size(block_size, len);
+    void *buf = NULL;
+
+    if (!size || posix_memalign(&buf, block_size, size))
+        return NULL;
+    memset(buf, 0, size);
+    return (uint8_t *)buf;
+}
+
+//Switch a session over to buffered I/O, for block devs or file systems
+//that turn out not to support O_DIRECT only when I/O is issued.
+//Writes stay synchronous through O_DSYNC.
+static int gpt_session_drop_direct_io(struct gpt_session *session)
+{
+    int flags;
+
+    if (!session->direct_io)
+        return 0;
+    session->stats.syscalls += 2;
+    flags = fcntl(session->fd, F_GETFL);
+    if (flags < 0 || fcntl(session->fd, F_SETFL, flags & ~O_DIRECT))
+        return 0;
+    fprintf(stderr, "%s: direct I/O not supported, using buffered I/O\n",
+            session->devpath);
+    session->direct_io = 0;
+    return 1;
+}
+
+//Bumped on every write to a GPT, see gpt_utils_get_generation()
+static atomic<uint64_t> gpt_generation(0);
+
+/**
+ *  ==========================================================================
+ *
+ *  \brief  Submit the writes queued on a session
  *
- *  \param [in] fd      block dev file descriptor (returned from open)
- *  \param [in] rw      RW flag: 0 - read, != 0 - write
- *  \param [in] offset  block dev offset [bytes] - RW start position
- *  \param [in] buf     Pointer to the buffer containing the data
- *  \param [in] len     RW size in bytes. Buf must be at least that big
+ *  Queued regions are sorted by offset and every run of back to back
+ *  regions goes out as a single pwritev(). No flush is issued here, see
+ *  gpt_session_barrier().
+ *
+ *  \param [in] session  GPT session of the block dev
  *
  *  \return  0 on success
  *
  *  ==========================================================================
  */
-static int blk_rw(int fd, int rw, int64_t offset, uint8_t *buf, unsigned len)
+static int gpt_session_submit(struct gpt_session *session)
 {
-    int r;
+    struct gpt_write_region *pending = session->pending;
+    struct iovec iov[GPT_MAX_PENDING_WRITES];
+    uint32_t i, j, n;
+    int64_t end;
+    ssize_t len;
+    int r = 0;
 
-    if (lseek64(fd, offset, SEEK_SET) < 0) {
-        fprintf(stderr, "block dev lseek64 %" PRIi64 " failed: %s\n", offset,
-                strerror(errno));
-        return -1;
+    /* insertion sort, there are only a handful of regions */
+    for (i = 1; i < session->num_pending; i++) {
+        struct gpt_write_region tmp = pending[i];
+        for (j = i; j > 0 && pending[j - 1].offset > tmp.offset; j--)
+            pending[j] = pending[j - 1];
+        pending[j] = tmp;
     }
 
-    if (rw)
-        r = write(fd, buf, len);
+    for (i = 0; i < session->num_pending; i += n) {
+        len = 0;
+        end = pending[i].offset;
+        for (n = 0; i + n < session->num_pending &&
+                    pending[i + n].offset == end; n++) {
+            iov[n].iov_base = pending[i + n].buf;
+            iov[n].iov_len = pending[i + n].len;
+            end += pending[i + n].len;
+            len += pending[i + n].len;
+        }
+        session->stats.syscalls++;
+        if (pwritev64(session->fd, iov, n, pending[i].offset) != len &&
+                (errno != EINVAL || !gpt_session_drop_direct_io(session) ||
+                 pwritev64(session->fd, iov, n, pending[i].offset) != len)) {
+            fprintf(stderr, "block dev write at %" PRIi64 " failed: %s\n",
+                    pending[i].offset, strerror(errno));
+            r = -1;
+            break;
+        }
+        session->stats.writes++;
+        session->stats.bytes_written += len;
+        session->needs_sync = 1;
+        gpt_generation++;
+    }
+    session->num_pending = 0;
+    return r;
+}
+
+/**
+ *  ==========================================================================
+ *
+ *  \brief  Queue a write on a session
+ *
+ *  The buffer is not copied and must stay valid until the next
+ *  gpt_session_submit() or gpt_session_barrier() on the session.
+ *
+ *  \param [in] session  GPT session of the block dev
+ *  \param [in] offset   block dev offset [bytes] - write start position
+ *  \param [in] buf      Pointer to the buffer containing the data
+ *  \param [in] len      Write size in bytes
+ *
+ *  \return  0 on success
+ *
+ *  ==========================================================================
+ */
+static int gpt_session_queue_write(struct gpt_session *session, int64_t offset,
+                                   uint8_t *buf, unsigned len)
+{
+    uint32_t i;
+
+    for (i = 0; i < session->num_pending; i++) {
+        const struct gpt_write_region *w = &session->pending[i];
+        /* overlapping writes must reach the disk in the order issued */
+        if (offset < w->offset + w->len && w->offset < offset + len)
+            break;
+    }
+    if (i < session->num_pending ||
+            session->num_pending == GPT_MAX_PENDING_WRITES) {
+        if (gpt_session_submit(session))
+            return -1;
+    }
+    session->pending[session->num_pending].offset = offset;
+    session->pending[session->num_pending].buf = buf;
+    session->pending[session->num_pending].len = len;
+    session->num_pending++;
+    return 0;
+}
+
+/**
+ *  ==========================================================================
+ *
+ *  \brief  Ordering barrier for writes queued on a session
+ *
+ *  Submits everything queued so far and makes it durable with a single
+ *  fdatasync(). Nothing queued after the barrier can reach the disk
+ *  before what was queued ahead of it.
+ *
+ *  \param [in] session  GPT session of the block dev
+ *
+ *  \return  0 on success
+ *
+ *  ==========================================================================
+ */
+int gpt_session_barrier(struct gpt_session *session)
+{
+    int r;
+
+    r = gpt_session_submit(session);
+    //O_DSYNC writes are already durable by the time they return
+    if (r || !session->needs_sync || session->direct_io)
+        return r;
+    session->stats.syscalls++;
+    session->stats.fsyncs++;
+    r = fdatasync(session->fd);
+    if (r < 0)
+        fprintf(stderr, "fdatasync failed: %s\n", strerror(errno));
     else
-        r = read(fd, buf, len);
+        session->needs_sync = 0;
+    return r;
+}
 
-    if (r < 0) {
-        fprintf(stderr, "block dev %s failed: %s\n", rw ? "write" : "read",
-                strerror(errno));
-    } else {
-        if (rw) {
-            r = fsync(fd);
-            if (r < 0)
-                fprintf(stderr, "fsync failed: %s\n", strerror(errno));
-        } else {
-            r = 0;
+//CRC of the size bytes long GPT header at hdr, computed without copying
+//it: the header CRC is calculated with its own CRC field set to 0
+static uint32_t gpt_hdr_calc_crc(const uint8_t *hdr, uint32_t size)
+{
+        static const uint8_t crc_field[4] = {0};
+        uint32_t crc;
+
+        crc = gpt_crc32(0, hdr, HEADER_CRC_OFFSET);
+        crc = gpt_crc32(crc, crc_field, sizeof(crc_field));
+        return gpt_crc32(crc, hdr + HEADER_CRC_OFFSET + sizeof(crc_field),
+                        size - HEADER_CRC_OFFSET - sizeof(crc_field));
+}
+
+//Byte offset of the primary or secondary GPT header on the session's disk
+static int64_t gpt_session_hdr_offset(const struct gpt_session *session,
+                enum gpt_instance instance)
+{
+        if (instance == PRIMARY_GPT)
+                return session->block_size;
+        return (int64_t)session->dev_size - session->block_size;
+}
+
+/**
+ *  ==========================================================================
+ *
+ *  \brief  Read/Write len bytes from/to block dev
+ *
+ *  Reads are synchronous. Writes are queued on the session and reach the
+ *  disk at the next gpt_session_barrier(). With direct I/O, len is rounded
+ *  up to whole blocks, buf comes from gpt_io_buf_alloc() and offset must be
+ *  block aligned.
+ *
+ *  \param [in] session  GPT session of the block dev
+ *  \param [in] rw       RW flag: 0 - read, != 0 - write
+ *  \param [in] offset   block dev offset [bytes] - RW start position
+ *  \param [in] buf      Pointer to the buffer containing the data
+ *  \param [in] len      RW size in bytes. Buf must be at least that big
+ *
+ *  \return  0 on success
+ *
+ *  ==========================================================================
+ */
+static int blk_rw(struct gpt_session *session, int rw, int64_t offset,
+                  uint8_t *buf, unsigned len)
+{
+    ssize_t r;
+
+    if (session->direct_io) {
+        if (((uintptr_t)buf | (uint64_t)offset) % session->block_size) {
+            fprintf(stderr, "unaligned direct I/O at %" PRIi64 "\n", offset);
+            return -1;
         }
+        len = gpt_io_buf_size(session->block_size, len);
     }
+    if (rw)
+        return gpt_session_queue_write(session, offset, buf, len);
 
-    return r;
+    session->stats.syscalls++;
+    r = pread64(session->fd, buf, len, offset);
+    if (r < 0 && errno == EINVAL && gpt_session_drop_direct_io(session)) {
+        session->stats.syscalls++;
+        r = pread64(session->fd, buf, len, offset);
+    }
+    if (r < 0) {
+        fprintf(stderr, "block dev read failed: %s\n", strerror(errno));
+        return -1;
+    }
+    session->stats.reads++;
+    session->stats.bytes_read += r;
+    return 0;
+}
+
+//Add the counters in src to dst
+static void gpt_io_stats_add(struct gpt_io_stats *dst,
+                const struct gpt_io_stats *src)
+{
+        dst->syscalls += src->syscalls;
+        dst->reads += src->reads;
+        dst->writes += src->writes;
+        dst->fsyncs += src->fsyncs;
+        dst->bytes_read += src->bytes_read;
+        dst->bytes_written += src->bytes_written;
+}
+
+
+//Get the block size of the disk represented by decsriptor fd
+static uint32_t gpt_get_block_size(int fd)
+{
+        uint32_t block_size = 0;
+        if (fd < 0) {
+                ALOGE("%s: invalid descriptor",
+                                __func__);
+                goto error;
+        }
+        gpt_stats_add_ioctl();
+        if (ioctl(fd, BLKSSZGET, &block_size) != 0) {
+                ALOGE("%s: Failed to get GPT dev block size : %s",
+                                __func__,
+                                strerror(errno));
+                goto error;
+        }
+        return block_size;
+error:
+        return 0;
+}
+
+//Sector size of disk images, 0 unless gpt_utils_set_image_backend() set
+//up the image backend
+static atomic<uint32_t> image_sector_size(0);
+
+//Whether sessions are opened for direct I/O
+static atomic<int> direct_io_enabled(0);
+
+void gpt_utils_set_direct_io(int enable)
+{
+        direct_io_enabled = !!enable;
+}
+
+//Whether disks loaded or committed together go through io_uring
+static atomic<int> io_uring_enabled(0);
+
+void gpt_utils_set_io_uring(int enable)
+{
+        io_uring_enabled = !!enable;
 }
 
+//Check whether the session is on a regular file, and take its size if so
+static int gpt_session_is_image(struct gpt_session *session)
+{
+        struct stat st;
 
+        session->stats.syscalls++;
+        if (fstat(session->fd, &st) || !S_ISREG(st.st_mode))
+                return 0;
+        session->dev_size = st.st_size;
+        return 1;
+}
 
 /**
  *  ==========================================================================
  *
- *  \brief  Search within GPT for partition entry with the given name
- *  or it's backup twin (name-bak).
+ *  \brief  Open a GPT session on a block dev
+ *
+ *  The block dev is opened once and its block size and total size are
+ *  cached, so the GPT helpers below neither repeat BLKSSZGET nor seek to
+ *  the end of the device to locate the secondary GPT.
  *
- *  \param [in] ptn_name        Partition name to seek
- *  \param [in] pentries_start  Partition entries array start pointer
- *  \param [in] pentries_end    Partition entries array end pointer
- *  \param [in] pentry_size     Single partition entry size [bytes]
+ *  \param [out] session  Session to initialize
+ *  \param [in]  devpath  Path to the block dev holding the GPT
  *
- *  \return  First partition entry pointer that matches the name or NULL
+ *  \return  0 on success
  *
  *  ==========================================================================
  */
-static uint8_t *gpt_pentry_seek(const char *ptn_name,
-                                const uint8_t *pentries_start,
-                                const uint8_t *pentries_end,
-                                uint32_t pentry_size)
+int gpt_session_open(struct gpt_session *session, const char *devpath)
+{
+        if (!session || !devpath) {
+                ALOGE("%s: Invalid argument", __func__);
+                return -1;
+        }
+        memset(session, 0, sizeof(struct gpt_session));
+        session->fd = -1;
+        strlcpy(session->devpath, devpath, sizeof(session->devpath));
+        if (direct_io_enabled) {
+                session->fd = open(devpath, O_RDWR | O_DIRECT | O_DSYNC);
+                session->stats.syscalls++;
+                if (session->fd >= 0)
+                        session->direct_io = 1;
+                else if (errno == EINVAL)
+                        fprintf(stderr, "%s: %s does not support direct I/O\n",
+                                        __func__,
+                                        devpath);
+        }
+        if (session->fd < 0) {
+                session->fd = open(devpath, O_RDWR);
+                session->stats.syscalls++;
+        }
+        if (session->fd < 0) {
+                ALOGE("%s: Failed to open %s : %s",
+                                __func__,
+                                devpath,
+                                strerror(errno));
+                goto error;
+        }
+        if (image_sector_size && gpt_session_is_image(session)) {
+                //Disk image: fixed sector size, fstat in place of an ioctl
+                session->block_size = image_sector_size;
+        } else {
+                //BLKSSZGET and BLKGETSIZE64
+                session->stats.syscalls += 2;
+                session->block_size = gpt_get_block_size(session->fd);
+                if (session->block_size == 0) {
+                        ALOGE("%s: Failed to get block size for %s",
+                                        __func__,
+                                        devpath);
+                        goto error;
+                }
+                gpt_stats_add_ioctl();
+                if (ioctl(session->fd, BLKGETSIZE64,
+                                        &session->dev_size) != 0) {
+                        ALOGE("%s: Failed to get size of %s : %s",
+                                        __func__,
+                                        devpath,
+                                        strerror(errno));
+                        goto error;
+                }
+        }
+        if (session->dev_size < 3ULL * session->block_size) {
+                ALOGE("%s: %s is too small to hold a GPT",
+                                __func__,
+                                devpath);
+                goto error;
+        }
+        return 0;
+error:
+        gpt_session_close(session);
+        return -1;
+}
+
+//Close a session previously opened with gpt_session_open. Writes still
+//queued are dropped, callers that want them on disk issue a barrier first.
+void gpt_session_close(struct gpt_session *session)
+{
+        if (!session)
+                return;
+        if (session->fd >= 0) {
+                session->num_pending = 0;
+                close(session->fd);
+                session->stats.syscalls++;
+                gpt_stats_add_io(&session->stats);
+        }
+        session->fd = -1;
+}
+
+//Room the entries arrays of a GptDisk arena get before any header was
+//read, in bytes
+static inline size_t gpt_default_arr_io_size(uint32_t block_size)
+{
+        return gpt_io_buf_size(block_size,
+                        GPT_DEFAULT_PENTRIES * PTN_ENTRY_SIZE);
+}
+
+//Locate the partition entries array the primary header hdr points at.
+//Fails if the array is empty or does not lie between the primary header
+//and the backup header.
+static int gpt_session_pentries(const struct gpt_session *session,
+                const uint8_t *hdr, uint64_t *start, uint32_t *pentry_size,
+                uint32_t *arr_size)
+{
+        *start = GET_8_BYTES(hdr + PENTRIES_OFFSET) * session->block_size;
+        *pentry_size = GET_4_BYTES(hdr + PENTRY_SIZE_OFFSET);
+        *arr_size = GET_4_BYTES(hdr + PARTITION_COUNT_OFFSET) * *pentry_size;
+        if (!*arr_size || *start < 2ULL * session->block_size ||
+                        *start + *arr_size > (uint64_t)
+                        gpt_session_hdr_offset(session, SECONDARY_GPT))
+                return -1;
+        return 0;
+}
+
+//Make the arena at least size bytes long and aligned to block_size,
+//keeping its first keep bytes. The arena is only reallocated when it is too
+//small or not aligned enough, buffers of the old one are invalidated then.
+uint8_t *GptDisk::Reserve(uint32_t block_size, size_t size, size_t keep)
+{
+        uint8_t *arena;
+
+        if (arena_ && arena_size_ >= size && arena_align_ % block_size == 0)
+                return arena_.get();
+        arena = gpt_io_buf_alloc(block_size, size);
+        if (!arena) {
+                ALOGE("%s: Failed to allocate %zu bytes", __func__, size);
+                return NULL;
+        }
+        if (arena_ && keep)
+                memcpy(arena, arena_.get(), keep);
+        arena_.reset(arena);
+        arena_size_ = gpt_io_buf_size(block_size, size);
+        arena_align_ = block_size;
+        arena_allocs_++;
+        return arena;
+}
+
+//Read both GPT headers and both partition entry arrays of the session's disk
+//into the arena, sized from the primary header. The backup entry array
+//normally sits right in front of the backup header, and does in the arena,
+//so both are fetched with a single pread().
+int GptDisk::LoadTables(struct gpt_session *session)
+{
+        struct gpt_disk *disk = &disk_;
+        uint32_t block_size = session->block_size;
+        int64_t hdr_bak_offset = gpt_session_hdr_offset(session, SECONDARY_GPT);
+        uint64_t pentries_start = 0;
+        uint64_t pentries_bak_start = 0;
+        //Entries arrays are read and written as whole blocks
+        uint32_t arr_io_size = 0;
+        uint8_t *arena = NULL;
+        ssize_t expected = 0;
+
+        arena = Reserve(block_size, 2 * block_size +
+                        2 * gpt_default_arr_io_size(block_size), 0);
+        if (!arena)
+                goto error;
+        if (blk_rw(session, 0, gpt_session_hdr_offset(session, PRIMARY_GPT),
+                                arena, block_size)) {
+                ALOGE("%s: Failed to read primary GPT header", __func__);
+                goto error;
+        }
+        if (gpt_session_pentries(session, arena, &pentries_start,
+                                &disk->pentry_size, &disk->pentry_arr_size)) {
+                ALOGE("%s: Invalid partition entry array in primary header",
+                                __func__);
+                goto error;
+        }
+        arr_io_size = gpt_io_buf_size(block_size, disk->pentry_arr_size);
+        arena = Reserve(block_size, 2 * block_size + 2 * arr_io_size,
+                        block_size);
+        if (!arena)
+                goto error;
+        disk->hdr = arena;
+        disk->pentry_arr = arena + block_size;
+        disk->pentry_arr_bak = disk->pentry_arr + arr_io_size;
+        disk->hdr_bak = disk->pentry_arr_bak + arr_io_size;
+        //Padding written back along with the arrays is not left over from
+        //an earlier load
+        memset(disk->pentry_arr + disk->pentry_arr_size, 0,
+                        arr_io_size - disk->pentry_arr_size);
+        memset(disk->pentry_arr_bak + disk->pentry_arr_size, 0,
+                        arr_io_size - disk->pentry_arr_size);
+        if (blk_rw(session, 0, pentries_start, disk->pentry_arr,
+                                disk->pentry_arr_size)) {
+                ALOGE("%s: Failed to read partition entry array", __func__);
+                goto error;
+        }
+        //Backup entries followed by the backup header, block aligned
+        expected = arr_io_size + block_size;
+        pentries_bak_start = hdr_bak_offset - arr_io_size;
+        session->stats.syscalls++;
+        if (pread64(session->fd, disk->pentry_arr_bak, expected,
+                                pentries_bak_start) != expected &&
+                        (errno != EINVAL ||
+                         !gpt_session_drop_direct_io(session) ||
+                         pread64(session->fd, disk->pentry_arr_bak, expected,
+                                 pentries_bak_start) != expected)) {
+                ALOGE("%s: Failed to read backup GPT: %s",
+                                __func__,
+                                strerror(errno));
+                goto error;
+        }
+        session->stats.reads++;
+        session->stats.bytes_read += expected;
+        //Entries not where we guessed them, go by what the backup header says
+        if (GET_8_BYTES(disk->hdr_bak + PENTRIES_OFFSET) * block_size !=
+                        pentries_bak_start) {
+                pentries_bak_start =
+                        GET_8_BYTES(disk->hdr_bak + PENTRIES_OFFSET) * block_size;
+                if (blk_rw(session, 0, pentries_bak_start,
+                                        disk->pentry_arr_bak,
+                                        disk->pentry_arr_size)) {
+                        ALOGE("%s: Failed to read backup partition entry array",
+                                        __func__);
+                        goto error;
+                }
+        }
+        return 0;
+error:
+        return -1;
+}
+
+//Copy the name of the partition entry pentry into name8, which must be
+//MAX_GPT_NAME_SIZE bytes long
+static void gpt_pentry_get_name(const uint8_t *pentry, char *name8)
 {
-    char     *pentry_name;
-    unsigned  len = strlen(ptn_name);
-    unsigned  i;
-    char      name8[MAX_GPT_NAME_SIZE] = {0}; // initialize with null
+    const uint8_t *pentry_name = pentry + PARTITION_NAME_OFFSET;
+    unsigned i;
 
-    for (pentry_name = (char *) (pentries_start + PARTITION_NAME_OFFSET);
-         pentry_name < (char *) pentries_end;
-         pentry_name += pentry_size) {
+    /* Partition names in GPT are UTF-16 - ignoring UTF-16 2nd byte */
+    for (i = 0; i < MAX_GPT_NAME_SIZE / 2; i++)
+        name8[i] = pentry_name[i * 2];
+    name8[i] = '\0';
+}
 
-        /* Partition names in GPT are UTF-16 - ignoring UTF-16 2nd byte */
-        for (i = 0; i < sizeof(name8) / 2; i++)
-            name8[i] = pentry_name[i * 2];
-        name8[i] = '\0';
+/**
+ *  ==========================================================================
+ *
+ *  \brief  Index the partition entries of a GPT by name
+ *
+ *  Every entry is filed under its own name and, for backup twins, also
+ *  under the name without the BAK_PTN_NAME_EXT suffix. A lookup of "tz"
+ *  therefore yields the offsets of both "tz" and "tzbak" in table order,
+ *  which is what a linear search for the name or its backup twin returns.
+ *
+ *  \param [in]  pentries     Partition entries array start pointer
+ *  \param [in]  arr_size     Partition entries array size [bytes]
+ *  \param [in]  pentry_size  Single partition entry size [bytes]
+ *  \param [out] index        Name index to fill, cleared first
+ *
+ *  ==========================================================================
+ */
+static void gpt_index_names(const uint8_t *pentries, uint32_t arr_size,
+                            uint32_t pentry_size, gpt_name_index &index)
+{
+    char name8[MAX_GPT_NAME_SIZE];
+    size_t len;
+    uint32_t off;
 
-        if (!strncmp(ptn_name, name8, len)) {
-            if (name8[len] == 0 || !strcmp(&name8[len], BAK_PTN_NAME_EXT))
-                return (uint8_t *) (pentry_name - PARTITION_NAME_OFFSET);
+    index.clear();
+    if (!pentry_size)
+        return;
+    index.reserve(arr_size / pentry_size);
+    for (off = 0; off + pentry_size <= arr_size; off += pentry_size) {
+        gpt_pentry_get_name(pentries + off, name8);
+        len = strlen(name8);
+        if (!len)
+            continue;
+        index[name8].push_back(off);
+        if (len > strlen(BAK_PTN_NAME_EXT) &&
+                !strcmp(&name8[len - strlen(BAK_PTN_NAME_EXT)], BAK_PTN_NAME_EXT)) {
+            name8[len - strlen(BAK_PTN_NAME_EXT)] = '\0';
+            index[name8].push_back(off);
         }
     }
-
-    return NULL;
+    /* entries are visited in table order, keep the twins that way */
+    for (auto &it : index)
+        sort(it.second.begin(), it.second.end());
 }
 
 
@@ -233,38 +864,42 @@ static uint8_t *gpt_pentry_seek(const char *ptn_name,
  *
  *  ==========================================================================
  */
-static int gpt_boot_chain_swap(const uint8_t *pentries_start,
-                                const uint8_t *pentries_end,
+static int gpt_boot_chain_swap(uint8_t *pentries_start,
+                                uint8_t *pentries_end,
                                 uint32_t pentry_size)
 {
     const char ptn_swap_list[][MAX_GPT_NAME_SIZE] = { PTN_SWAP_LIST };
 
     int backup_not_found = 1;
+    int is_ufs = gpt_utils_is_ufs_device();
+    gpt_name_index index;
     unsigned i;
 
+    gpt_index_names(pentries_start, pentries_end - pentries_start,
+                    pentry_size, index);
     for (i = 0; i < ARRAY_SIZE(ptn_swap_list); i++) {
         uint8_t *ptn_entry;
         uint8_t *ptn_bak_entry;
         uint8_t ptn_swap[PTN_ENTRY_SIZE];
+        gpt_name_index::const_iterator it;
         //Skip the xbl, multiimgoem, multiimgqti partitions on UFS devices. That is handled
         //seperately.
-        if ((gpt_utils_is_ufs_device() && !strncmp(ptn_swap_list[i],PTN_XBL,strlen(PTN_XBL)))
+        if ((is_ufs && !strncmp(ptn_swap_list[i],PTN_XBL,strlen(PTN_XBL)))
             || !strncmp(ptn_swap_list[i],PTN_MULTIIMGOEM,strlen(PTN_MULTIIMGOEM))
             || !strncmp(ptn_swap_list[i],PTN_MULTIIMGQTI,strlen(PTN_MULTIIMGQTI)))
             continue;
 
-        ptn_entry = gpt_pentry_seek(ptn_swap_list[i], pentries_start,
-                        pentries_end, pentry_size);
-        if (ptn_entry == NULL)
+        it = index.find(ptn_swap_list[i]);
+        if (it == index.end())
             continue;
+        ptn_entry = pentries_start + it->second[0];
 
-        ptn_bak_entry = gpt_pentry_seek(ptn_swap_list[i],
-                        ptn_entry + pentry_size, pentries_end, pentry_size);
-        if (ptn_bak_entry == NULL) {
+        if (it->second.size() < 2) {
             fprintf(stderr, "'%s' partition not backup - skip safe update\n",
                     ptn_swap_list[i]);
             continue;
         }
+        ptn_bak_entry = pentries_start + it->second[1];
 
         /* swap primary <-> backup partition entries */
         memcpy(ptn_swap, ptn_entry, PTN_ENTRY_SIZE);
@@ -283,14 +918,14 @@ static int gpt_boot_chain_swap(const uint8_t *pentries_start,
  *
  *  \brief  Sets secondary GPT boot chain
  *
- *  \param [in] fd    block dev file descriptor
- *  \param [in] boot  Boot chain to switch to
+ *  \param [in] session  GPT session of the block dev
+ *  \param [in] boot     Boot chain to switch to
  *
  *  \return  0 on success
  *
  *  ==========================================================================
  */
-static int gpt2_set_boot_chain(int fd, enum boot_chain boot)
+static int gpt2_set_boot_chain(struct gpt_session *session, enum boot_chain boot)
 {
     int64_t  gpt2_header_offset;
     uint64_t pentries_start_offset;
@@ -302,33 +937,21 @@ static int gpt2_set_boot_chain(int fd, enum boot_chain boot)
     uint8_t  *pentries = NULL;
     uint32_t crc;
     uint32_t crc_zero;
-    uint32_t blk_size = 0;
+    uint32_t blk_size = session->block_size;
     int r;
 
 
-    crc_zero = crc32(0L, Z_NULL, 0);
-    if (ioctl(fd, BLKSSZGET, &blk_size) != 0) {
-            fprintf(stderr, "Failed to get GPT device block size: %s\n",
-                            strerror(errno));
-            r = -1;
-            goto EXIT;
-    }
-    gpt_header = (uint8_t*)malloc(blk_size);
+    crc_zero = gpt_crc32(0L, NULL, 0);
+    gpt_header = gpt_io_buf_alloc(blk_size, blk_size);
     if (!gpt_header) {
             fprintf(stderr, "Failed to allocate memory to hold GPT block\n");
             r = -1;
             goto EXIT;
     }
-    gpt2_header_offset = lseek64(fd, 0, SEEK_END) - blk_size;
-    if (gpt2_header_offset < 0) {
-        fprintf(stderr, "Getting secondary GPT header offset failed: %s\n",
-                strerror(errno));
-        r = -1;
-        goto EXIT;
-    }
+    gpt2_header_offset = gpt_session_hdr_offset(session, SECONDARY_GPT);
 
     /* Read primary GPT header from block dev */
-    r = blk_rw(fd, 0, blk_size, gpt_header, blk_size);
+    r = blk_rw(session, 0, blk_size, gpt_header, blk_size);
 
     if (r) {
             fprintf(stderr, "Failed to read primary GPT header from blk dev\n");
@@ -340,7 +963,7 @@ static int gpt2_set_boot_chain(int fd, enum boot_chain boot)
     pentries_array_size =
         GET_4_BYTES(gpt_header + PARTITION_COUNT_OFFSET) * pentry_size;
 
-    pentries = (uint8_t *) calloc(1, pentries_array_size);
+    pentries = gpt_io_buf_alloc(blk_size, pentries_array_size);
     if (pentries == NULL) {
         fprintf(stderr,
                     "Failed to alloc memory for GPT partition entries array\n");
@@ -348,11 +971,11 @@ static int gpt2_set_boot_chain(int fd, enum boot_chain boot)
         goto EXIT;
     }
     /* Read primary GPT partititon entries array from block dev */
-    r = blk_rw(fd, 0, pentries_start_offset, pentries, pentries_array_size);
+    r = blk_rw(session, 0, pentries_start_offset, pentries, pentries_array_size);
     if (r)
         goto EXIT;
 
-    crc = crc32(crc_zero, pentries, pentries_array_size);
+    crc = gpt_crc32(crc_zero, pentries, pentries_array_size);
     if (GET_4_BYTES(gpt_header + PARTITION_CRC_OFFSET) != crc) {
         fprintf(stderr, "Primary GPT partition entries array CRC invalid\n");
         r = -1;
@@ -360,7 +983,7 @@ static int gpt2_set_boot_chain(int fd, enum boot_chain boot)
     }
 
     /* Read secondary GPT header from block dev */
-    r = blk_rw(fd, 0, gpt2_header_offset, gpt_header, blk_size);
+    r = blk_rw(session, 0, gpt2_header_offset, gpt_header, blk_size);
     if (r)
         goto EXIT;
 
@@ -375,20 +998,23 @@ static int gpt2_set_boot_chain(int fd, enum boot_chain boot)
             goto EXIT;
     }
 
-    crc = crc32(crc_zero, pentries, pentries_array_size);
+    crc = gpt_crc32(crc_zero, pentries, pentries_array_size);
     PUT_4_BYTES(gpt_header + PARTITION_CRC_OFFSET, crc);
 
     /* header CRC is calculated with this field cleared */
     PUT_4_BYTES(gpt_header + HEADER_CRC_OFFSET, 0);
-    crc = crc32(crc_zero, gpt_header, gpt_header_size);
+    crc = gpt_crc32(crc_zero, gpt_header, gpt_header_size);
     PUT_4_BYTES(gpt_header + HEADER_CRC_OFFSET, crc);
 
-    /* Write the modified GPT header back to block dev */
-    r = blk_rw(fd, 1, gpt2_header_offset, gpt_header, blk_size);
+    /* Write the modified GPT partititon entries array back to block dev */
+    r = blk_rw(session, 1, pentries_start_offset, pentries,
+                pentries_array_size);
+    if (!r)
+        /* Write the modified GPT header back to block dev */
+        r = blk_rw(session, 1, gpt2_header_offset, gpt_header, blk_size);
+    /* Both normally go out as one write ahead of a single flush */
     if (!r)
-        /* Write the modified GPT partititon entries array back to block dev */
-        r = blk_rw(fd, 1, pentries_start_offset, pentries,
-                    pentries_array_size);
+        r = gpt_session_barrier(session);
 
 EXIT:
     if(gpt_header)
@@ -403,47 +1029,35 @@ EXIT:
  *
  *  \brief  Checks GPT state (header signature and CRC)
  *
- *  \param [in] fd      block dev file descriptor
- *  \param [in] gpt     GPT header to be checked
- *  \param [out] state  GPT header state
+ *  \param [in] session  GPT session of the block dev
+ *  \param [in] gpt      GPT header to be checked
+ *  \param [out] state   GPT header state
  *
  *  \return  0 on success
  *
  *  ==========================================================================
  */
-static int gpt_get_state(int fd, enum gpt_instance gpt, enum gpt_state *state)
+static int gpt_get_state(struct gpt_session *session, enum gpt_instance gpt,
+                enum gpt_state *state)
 {
     int64_t gpt_header_offset;
     uint32_t gpt_header_size;
     uint8_t  *gpt_header = NULL;
     uint32_t crc;
     uint32_t crc_zero;
-    uint32_t blk_size = 0;
+    uint32_t blk_size = session->block_size;
 
     *state = GPT_OK;
 
-    crc_zero = crc32(0L, Z_NULL, 0);
-    if (ioctl(fd, BLKSSZGET, &blk_size) != 0) {
-            fprintf(stderr, "Failed to get GPT device block size: %s\n",
-                            strerror(errno));
-            goto error;
-    }
-    gpt_header = (uint8_t*)malloc(blk_size);
+    crc_zero = gpt_crc32(0L, NULL, 0);
+    gpt_header = gpt_io_buf_alloc(blk_size, blk_size);
     if (!gpt_header) {
             fprintf(stderr, "gpt_get_state:Failed to alloc memory for header\n");
             goto error;
     }
-    if (gpt == PRIMARY_GPT)
-        gpt_header_offset = blk_size;
-    else {
-        gpt_header_offset = lseek64(fd, 0, SEEK_END) - blk_size;
-        if (gpt_header_offset < 0) {
-            fprintf(stderr, "gpt_get_state:Seek to end of GPT part fail\n");
-            goto error;
-        }
-    }
+    gpt_header_offset = gpt_session_hdr_offset(session, gpt);
 
-    if (blk_rw(fd, 0, gpt_header_offset, gpt_header, blk_size)) {
+    if (blk_rw(session, 0, gpt_header_offset, gpt_header, blk_size)) {
         fprintf(stderr, "gpt_get_state: blk_rw failed\n");
         goto error;
     }
@@ -454,7 +1068,7 @@ static int gpt_get_state(int fd, enum gpt_instance gpt, enum gpt_state *state)
     crc = GET_4_BYTES(gpt_header + HEADER_CRC_OFFSET);
     /* header CRC is calculated with this field cleared */
     PUT_4_BYTES(gpt_header + HEADER_CRC_OFFSET, 0);
-    if (crc32(crc_zero, gpt_header, gpt_header_size) != crc)
+    if (gpt_crc32(crc_zero, gpt_header, gpt_header_size) != crc)
         *state = GPT_BAD_CRC;
     free(gpt_header);
     return 0;
@@ -471,44 +1085,32 @@ error:
  *
  *  \brief  Sets GPT header state (used to corrupt and fix GPT signature)
  *
- *  \param [in] fd     block dev file descriptor
- *  \param [in] gpt    GPT header to be checked
- *  \param [in] state  GPT header state to set (GPT_OK or GPT_BAD_SIGNATURE)
+ *  \param [in] session  GPT session of the block dev
+ *  \param [in] gpt      GPT header to be checked
+ *  \param [in] state    GPT header state to set (GPT_OK or GPT_BAD_SIGNATURE)
  *
  *  \return  0 on success
  *
  *  ==========================================================================
  */
-static int gpt_set_state(int fd, enum gpt_instance gpt, enum gpt_state state)
+static int gpt_set_state(struct gpt_session *session, enum gpt_instance gpt,
+                enum gpt_state state)
 {
     int64_t gpt_header_offset;
     uint32_t gpt_header_size;
     uint8_t  *gpt_header = NULL;
     uint32_t crc;
     uint32_t crc_zero;
-    uint32_t blk_size = 0;
+    uint32_t blk_size = session->block_size;
 
-    crc_zero = crc32(0L, Z_NULL, 0);
-    if (ioctl(fd, BLKSSZGET, &blk_size) != 0) {
-            fprintf(stderr, "Failed to get GPT device block size: %s\n",
-                            strerror(errno));
-            goto error;
-    }
-    gpt_header = (uint8_t*)malloc(blk_size);
+    crc_zero = gpt_crc32(0L, NULL, 0);
+    gpt_header = gpt_io_buf_alloc(blk_size, blk_size);
     if (!gpt_header) {
             fprintf(stderr, "Failed to alloc memory for gpt header\n");
             goto error;
     }
-    if (gpt == PRIMARY_GPT)
-        gpt_header_offset = blk_size;
-    else {
-        gpt_header_offset = lseek64(fd, 0, SEEK_END) - blk_size;
-        if (gpt_header_offset < 0) {
-            fprintf(stderr, "Failed to seek to end of GPT device\n");
-            goto error;
-        }
-    }
-    if (blk_rw(fd, 0, gpt_header_offset, gpt_header, blk_size)) {
+    gpt_header_offset = gpt_session_hdr_offset(session, gpt);
+    if (blk_rw(session, 0, gpt_header_offset, gpt_header, blk_size)) {
         fprintf(stderr, "Failed to r/w gpt header\n");
         goto error;
     }
@@ -525,13 +1127,15 @@ static int gpt_set_state(int fd, enum gpt_instance gpt, enum gpt_state state)
 
     /* header CRC is calculated with this field cleared */
     PUT_4_BYTES(gpt_header + HEADER_CRC_OFFSET, 0);
-    crc = crc32(crc_zero, gpt_header, gpt_header_size);
+    crc = gpt_crc32(crc_zero, gpt_header, gpt_header_size);
     PUT_4_BYTES(gpt_header + HEADER_CRC_OFFSET, crc);
 
-    if (blk_rw(fd, 1, gpt_header_offset, gpt_header, blk_size)) {
+    if (blk_rw(session, 1, gpt_header_offset, gpt_header, blk_size) ||
+            gpt_session_barrier(session)) {
         fprintf(stderr, "gpt_set_state: blk write failed\n");
         goto error;
     }
+    free(gpt_header);
     return 0;
 error:
     if(gpt_header)
@@ -616,9 +1220,350 @@ error:
 
 
 
-//Swtich betwieen using either the primary or the backup
-//boot LUN for boot. This is required since UFS boot partitions
-//cannot have a backup GPT which is what we use for failsafe
+//Snapshot of the boot device layout. It is built in one scan of
+//BOOT_DEV_DIR the first time it is needed and never modified afterwards,
+//gpt_utils_invalidate_topology() drops it so that the next user rescans.
+//A snapshot taken before the by-name links exist (eg: a HAL starting ahead
+//of ueventd) is not kept, every user rescans until the links show up.
+struct gpt_topology {
+        int is_ufs;
+        //Whether the scan found the partitions, ie: the snapshot may be kept
+        int complete;
+        //Disk image backend root, empty for the real boot device
+        string image_root;
+        //eMMC device holding the GPT
+        string blk_dev;
+        //Partition name -> LUN holding it (eg: /dev/block/sda). UFS only.
+        unordered_map<string, string> ptn_lun;
+        //LUN -> scsi generic node (eg: /dev/sg0)
+        unordered_map<string, string> lun_sg;
+        //LUN -> bsg node (eg: /dev/bsg/0:0:0:0)
+        unordered_map<string, string> lun_bsg;
+};
+
+static mutex topology_lock;
+static shared_ptr<const gpt_topology> topology;
+//Disk image backend, see gpt_utils_set_image_backend()
+static string image_root;
+static int image_is_ufs;
+//Preferred I/O sizes per disk, see gpt_utils_get_io_geometry()
+static mutex io_geometry_lock;
+static unordered_map<string, gpt_io_geometry> io_geometry;
+
+//Return the name of the first entry of the directory dir_path whose name
+//starts with prefix, or an empty string
+static string gpt_find_dir_entry(const char *dir_path, const char *prefix)
+{
+        DIR *dir = opendir(dir_path);
+        struct dirent *de;
+        string name;
+
+        if (!dir)
+                return name;
+        while ((de = readdir(dir))) {
+                if (de->d_name[0] == '.')
+                        continue;
+                if (!strncmp(de->d_name, prefix, strlen(prefix))) {
+                        name = de->d_name;
+                        break;
+                }
+        }
+        closedir(dir);
+        return name;
+}
+
+//Snapshot of a disk image tree. by-name/ links point at the LUN images,
+//or at "partitions" named after them (sdb -> sdb, sdb12 -> sdb), which are
+//looked up under the image root wherever the link points.
+static shared_ptr<const gpt_topology> gpt_build_image_topology()
+{
+        shared_ptr<gpt_topology> topo = make_shared<gpt_topology>();
+        string by_name = image_root + "/" IMAGE_BOOT_DEV_DIR;
+        char real_path[PATH_MAX];
+        struct dirent *de;
+        const char *lun;
+        DIR *dir;
+        ssize_t len;
+
+        topo->is_ufs = image_is_ufs;
+        topo->image_root = image_root;
+        topo->blk_dev = image_root + "/" IMAGE_BLK_DEV_FILE;
+        topo->complete = !topo->is_ufs;
+        if (!topo->is_ufs)
+                return topo;
+        dir = opendir(by_name.c_str());
+        if (!dir) {
+                fprintf(stderr, "%s: Failed to open %s(%s)\n",
+                                __func__,
+                                by_name.c_str(),
+                                strerror(errno));
+                return topo;
+        }
+        while ((de = readdir(dir))) {
+                if (de->d_name[0] == '.')
+                        continue;
+                len = readlinkat(dirfd(dir), de->d_name, real_path,
+                                sizeof(real_path) - 1);
+                if (len < 0)
+                        continue;
+                real_path[len] = '\0';
+                while (len > 0 && real_path[len - 1] >= '0' &&
+                                real_path[len - 1] <= '9')
+                        real_path[--len] = '\0';
+                lun = strrchr(real_path, '/');
+                lun = lun ? lun + 1 : real_path;
+                if (!*lun) {
+                        fprintf(stderr, "%s: Unknown path %s for %s\n",
+                                        __func__,
+                                        real_path,
+                                        de->d_name);
+                        continue;
+                }
+                topo->ptn_lun[de->d_name] = image_root + "/" + lun;
+        }
+        closedir(dir);
+        topo->complete = !topo->ptn_lun.empty();
+        return topo;
+}
+
+static shared_ptr<const gpt_topology> gpt_build_topology()
+{
+        shared_ptr<gpt_topology> topo = make_shared<gpt_topology>();
+        char bootdevice[PROPERTY_VALUE_MAX] = {0};
+        char real_path[PATH_MAX];
+        char sys_path[PATH_MAX];
+        struct dirent *de;
+        string node;
+        DIR *dir;
+        ssize_t len;
+
+        if (!image_root.empty())
+                return gpt_build_image_topology();
+        topo->blk_dev = BLK_DEV_FILE;
+        property_get("ro.boot.bootdevice", bootdevice, "N/A");
+        if (strlen(bootdevice) >= strlen(".ufshc") + 1)
+                topo->is_ufs = !strncmp(
+                                &bootdevice[strlen(bootdevice) - strlen(".ufshc")],
+                                ".ufshc",
+                                sizeof(".ufshc"));
+        topo->complete = !topo->is_ufs;
+        if (!topo->is_ufs)
+                return topo;
+
+        dir = opendir(BOOT_DEV_DIR);
+        if (!dir) {
+                fprintf(stderr, "%s: Failed to open %s(%s)\n",
+                                __func__,
+                                BOOT_DEV_DIR,
+                                strerror(errno));
+                return topo;
+        }
+        while ((de = readdir(dir))) {
+                if (de->d_name[0] == '.')
+                        continue;
+                len = readlinkat(dirfd(dir), de->d_name, real_path,
+                                sizeof(real_path) - 1);
+                if (len < 0)
+                        continue;
+                real_path[len] = '\0';
+                if (strlen(real_path) < PATH_TRUNCATE_LOC + 1) {
+                        fprintf(stderr, "%s: Unknown path %s for %s\n",
+                                        __func__,
+                                        real_path,
+                                        de->d_name);
+                        continue;
+                }
+                real_path[PATH_TRUNCATE_LOC] = '\0';
+                topo->ptn_lun[de->d_name] = real_path;
+                topo->lun_sg[real_path];
+        }
+        closedir(dir);
+        topo->complete = !topo->ptn_lun.empty();
+
+        //A handful of LUNs, each looked up once
+        for (auto &it : topo->lun_sg) {
+                const char *lun = &it.first[LUN_NAME_START_LOC];
+                snprintf(sys_path, sizeof(sys_path),
+                                "/sys/block/%s/device/scsi_generic", lun);
+                node = gpt_find_dir_entry(sys_path, "sg");
+                if (!node.empty())
+                        it.second = "/dev/" + node;
+                snprintf(sys_path, sizeof(sys_path),
+                                "/sys/block/%s/device/bsg", lun);
+                node = gpt_find_dir_entry(sys_path, "");
+                if (!node.empty())
+                        topo->lun_bsg[it.first] = "/dev/bsg/" + node;
+        }
+        return topo;
+}
+
+//Get the current boot device snapshot, building it if needed or if the
+//last scan came back empty
+static shared_ptr<const gpt_topology> gpt_get_topology()
+{
+        lock_guard<mutex> lock(topology_lock);
+        if (!topology || !topology->complete)
+                topology = gpt_build_topology();
+        return topology;
+}
+
+void gpt_utils_invalidate_topology()
+{
+        {
+                lock_guard<mutex> lock(io_geometry_lock);
+                io_geometry.clear();
+        }
+        lock_guard<mutex> lock(topology_lock);
+        topology.reset();
+}
+
+int gpt_utils_set_image_backend(const char *root, uint32_t sector_size,
+                int is_ufs)
+{
+        if (root && (sector_size < 512 ||
+                                (sector_size & (sector_size - 1)))) {
+                ALOGE("%s: Invalid sector size %u", __func__, sector_size);
+                return -1;
+        }
+        lock_guard<mutex> lock(topology_lock);
+        image_root = root ? root : "";
+        image_is_ufs = root ? is_ufs : 0;
+        image_sector_size = root ? sector_size : 0;
+        topology.reset();
+        return 0;
+}
+
+//Look up the preferred I/O sizes of the disk at devpath, a LUN or one of its
+//partitions. The UFS descriptors are only queried once per LUN: disks that
+//do not report them are cached with sizes derived from block_size.
+static void gpt_io_geometry_lookup(const char *devpath, uint32_t block_size,
+                struct gpt_io_geometry *geo)
+{
+        shared_ptr<const gpt_topology> topo;
+        unordered_map<string, string>::const_iterator bsg;
+        uint32_t write_unit = 0;
+        uint32_t erase_unit = 0;
+        char real_path[PATH_MAX];
+        string lun = devpath;
+        const char *addr;
+        uint64_t unit;
+
+        {
+                lock_guard<mutex> lock(io_geometry_lock);
+                auto it = io_geometry.find(lun);
+                if (it != io_geometry.end() &&
+                                it->second.block_size == block_size) {
+                        *geo = it->second;
+                        return;
+                }
+        }
+        topo = gpt_get_topology();
+        if (topo->is_ufs && topo->image_root.empty()) {
+                bsg = topo->lun_bsg.find(lun);
+                //A partition: go by the LUN holding it
+                if (bsg == topo->lun_bsg.end() &&
+                                realpath(devpath, real_path) &&
+                                strlen(real_path) > PATH_TRUNCATE_LOC) {
+                        real_path[PATH_TRUNCATE_LOC] = '\0';
+                        bsg = topo->lun_bsg.find(real_path);
+                }
+                //bsg nodes are named after the SCSI address, H:C:T:LUN
+                if (bsg != topo->lun_bsg.end() &&
+                                (addr = strrchr(bsg->second.c_str(), ':')) &&
+                                strtoul(addr + 1, NULL, 10) <= UINT8_MAX &&
+                                get_ufs_io_unit(strtoul(addr + 1, NULL, 10),
+                                        &write_unit, &erase_unit)) {
+                        fprintf(stderr, "%s: No UFS geometry for %s\n",
+                                        __func__,
+                                        devpath);
+                        write_unit = erase_unit = 0;
+                }
+        }
+        geo->block_size = block_size;
+        geo->write_unit = max<uint32_t>(block_size,
+                        gpt_io_buf_size(block_size, write_unit));
+        geo->erase_unit = gpt_io_buf_size(block_size, erase_unit);
+        unit = geo->write_unit;
+        if (geo->erase_unit)
+                unit = std::lcm<uint64_t>(unit, geo->erase_unit);
+        if (unit > GPT_IO_CHUNK_MAX)
+                unit = geo->write_unit;
+        geo->chunk_size = gpt_io_buf_size(unit, GPT_IO_CHUNK_MIN);
+
+        lock_guard<mutex> lock(io_geometry_lock);
+        io_geometry[lun] = *geo;
+}
+
+int gpt_utils_get_io_geometry(const char *devpath,
+                struct gpt_io_geometry *geo)
+{
+        GptApiTimer timer(GPT_API_GET_IO_GEOMETRY);
+        uint32_t block_size = 0;
+        struct stat st;
+        int fd;
+
+        if (!devpath || !geo) {
+                ALOGE("%s: Invalid argument", __func__);
+                return -1;
+        }
+        fd = open(devpath, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                ALOGE("%s: Failed to open %s : %s",
+                                __func__,
+                                devpath,
+                                strerror(errno));
+                return -1;
+        }
+        if (image_sector_size && !fstat(fd, &st) && S_ISREG(st.st_mode))
+                block_size = image_sector_size;
+        else
+                block_size = gpt_get_block_size(fd);
+        close(fd);
+        if (!block_size)
+                return -1;
+        gpt_io_geometry_lookup(devpath, block_size, geo);
+        return 0;
+}
+
+//Stand-in for the bBootLunEn attribute of a disk image tree
+static int gpt_image_set_boot_lun(const gpt_topology &topo, uint8_t lun_id)
+{
+        string path = topo.image_root + "/" IMAGE_BOOT_LUN_FILE;
+        char buf[8];
+        int fd, len, rc = 0;
+
+        fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+                fprintf(stderr, "%s: Failed to open %s(%s)\n",
+                                __func__,
+                                path.c_str(),
+                                strerror(errno));
+                return -1;
+        }
+        len = snprintf(buf, sizeof(buf), "%u\n", lun_id);
+        if (write(fd, buf, len) != len || fsync(fd)) {
+                fprintf(stderr, "%s: Failed to write %s(%s)\n",
+                                __func__,
+                                path.c_str(),
+                                strerror(errno));
+                rc = -1;
+        }
+        close(fd);
+        return rc;
+}
+
+//Return the LUN holding partname, or NULL if there is no such partition
+static const char *gpt_topology_lun(const gpt_topology &topo,
+                const char *partname)
+{
+        unordered_map<string, string>::const_iterator it =
+                topo.ptn_lun.find(partname);
+        return it == topo.ptn_lun.end() ? NULL : it->second.c_str();
+}
+
+//Swtich betwieen using either the primary or the backup
+//boot LUN for boot. This is required since UFS boot partitions
+//cannot have a backup GPT which is what we use for failsafe
 //updates of the other 'critical' partitions. This function will
 //not be invoked for emmc targets and on UFS targets is only required
 //to be invoked for XBL.
@@ -633,19 +1578,24 @@ error:
 //
 //- Once we locate sgY we call the query ioctl on /dev/sgy to switch
 //the boot lun to either LUNA or LUNB
+//
+//Both lookups are answered from the boot device snapshot.
 int gpt_utils_set_xbl_boot_partition(enum boot_chain chain)
 {
-        struct stat st;
+        GptApiTimer timer(GPT_API_SET_XBL_BOOT_PARTITION);
+        shared_ptr<const gpt_topology> topo = gpt_get_topology();
         ///sys/block/sdX/device/scsi_generic/
         char sg_dev_node[PATH_MAX] = {0};
         uint8_t boot_lun_id = 0;
         const char *boot_dev = NULL;
+        const char *lun = NULL;
+        unordered_map<string, string>::const_iterator sg;
 
         if (chain == BACKUP_BOOT) {
                 boot_lun_id = BOOT_LUN_B_ID;
-                if (!stat(XBL_BACKUP, &st))
+                if (gpt_topology_lun(*topo, XBL_BACKUP))
                         boot_dev = XBL_BACKUP;
-                else if (!stat(XBL_AB_SECONDARY, &st))
+                else if (gpt_topology_lun(*topo, XBL_AB_SECONDARY))
                         boot_dev = XBL_AB_SECONDARY;
                 else {
                         fprintf(stderr, "%s: Failed to locate secondary xbl\n",
@@ -654,9 +1604,9 @@ int gpt_utils_set_xbl_boot_partition(enum boot_chain chain)
                 }
         } else if (chain == NORMAL_BOOT) {
                 boot_lun_id = BOOT_LUN_A_ID;
-                if (!stat(XBL_PRIMARY, &st))
+                if (gpt_topology_lun(*topo, XBL_PRIMARY))
                         boot_dev = XBL_PRIMARY;
-                else if (!stat(XBL_AB_PRIMARY, &st))
+                else if (gpt_topology_lun(*topo, XBL_AB_PRIMARY))
                         boot_dev = XBL_AB_PRIMARY;
                 else {
                         fprintf(stderr, "%s: Failed to locate primary xbl\n",
@@ -669,25 +1619,27 @@ int gpt_utils_set_xbl_boot_partition(enum boot_chain chain)
         }
         //We need either both xbl and xblbak or both xbl_a and xbl_b to exist at
         //the same time. If not the current configuration is invalid.
-        if((stat(XBL_PRIMARY, &st) ||
-                                stat(XBL_BACKUP, &st)) &&
-                        (stat(XBL_AB_PRIMARY, &st) ||
-                         stat(XBL_AB_SECONDARY, &st))) {
-                fprintf(stderr, "%s:primary/secondary XBL prt not found(%s)\n",
-                                __func__,
-                                strerror(errno));
+        if((!gpt_topology_lun(*topo, XBL_PRIMARY) ||
+                                !gpt_topology_lun(*topo, XBL_BACKUP)) &&
+                        (!gpt_topology_lun(*topo, XBL_AB_PRIMARY) ||
+                         !gpt_topology_lun(*topo, XBL_AB_SECONDARY))) {
+                fprintf(stderr, "%s:primary/secondary XBL prt not found\n",
+                                __func__);
                 goto error;
         }
         fprintf(stderr, "%s: setting %s lun as boot lun\n",
                         __func__,
                         boot_dev);
-        if (get_scsi_node_from_bootdevice(boot_dev,
-                                sg_dev_node,
-                                sizeof(sg_dev_node))) {
+        if (!topo->image_root.empty())
+                return gpt_image_set_boot_lun(*topo, boot_lun_id);
+        lun = gpt_topology_lun(*topo, boot_dev);
+        sg = topo->lun_sg.find(lun);
+        if (sg == topo->lun_sg.end() || sg->second.empty()) {
                 fprintf(stderr, "%s: Failed to get scsi node path for xblbak\n",
                                 __func__);
                 goto error;
         }
+        strlcpy(sg_dev_node, sg->second.c_str(), sizeof(sg_dev_node));
         /* set boot lun using /dev/sg or /dev/ufs-bsg* */
         if (set_boot_lun(sg_dev_node, boot_lun_id)) {
                 fprintf(stderr, "%s: Failed to set xblbak as boot partition\n",
@@ -701,14 +1653,37 @@ error:
 
 int gpt_utils_is_ufs_device()
 {
-    char bootdevice[PROPERTY_VALUE_MAX] = {0};
-    property_get("ro.boot.bootdevice", bootdevice, "N/A");
-    if (strlen(bootdevice) < strlen(".ufshc") + 1)
-        return 0;
-    return (!strncmp(&bootdevice[strlen(bootdevice) - strlen(".ufshc")],
-                            ".ufshc",
-                            sizeof(".ufshc")));
+        return gpt_get_topology()->is_ufs;
+}
+
+//Whether both xbl and xblbak are present on the boot device
+static int gpt_has_xbl_backup()
+{
+        shared_ptr<const gpt_topology> topo = gpt_get_topology();
+        return gpt_topology_lun(*topo, XBL_PRIMARY) &&
+                gpt_topology_lun(*topo, XBL_BACKUP);
+}
+
+//Switch the boot LUN to chain, through xbl when the switch is shared by
+//the LUNs of a stage
+static int gpt_switch_xbl(struct xbl_switch *xbl, enum boot_chain chain)
+{
+        if (!xbl)
+                return gpt_utils_set_xbl_boot_partition(chain);
+        call_once(xbl->once, [xbl, chain] {
+                xbl->result = gpt_utils_set_xbl_boot_partition(chain);
+        });
+        return xbl->result;
+}
+
+//Monotonic time in microseconds
+static uint64_t gpt_time_us()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
+
 //dev_path is the path to the block device that contains the GPT image that
 //needs to be updated. This would be the device which holds one or more critical
 //boot partitions and their backups. In the case of EMMC this function would
@@ -716,32 +1691,36 @@ int gpt_utils_is_ufs_device()
 //containing all the partitions For UFS devices it could potentially be
 //invoked multiple times, once for each LUN containing critical image(s) and
 //their backups
-int prepare_partitions(enum boot_update_stage stage, const char *dev_path)
+//
+//The I/O cost of the stage is added to stats when it is not NULL. When xbl
+//is not NULL the XBL boot LUN switch is shared with the other LUNs of the
+//stage.
+static int prepare_lun(enum boot_update_stage stage, const char *dev_path,
+                struct gpt_io_stats *stats, struct xbl_switch *xbl)
 {
     int r = 0;
-    int fd = -1;
+    struct gpt_session session;
     int is_ufs = gpt_utils_is_ufs_device();
     enum gpt_state gpt_prim, gpt_second;
     enum boot_update_stage internal_stage;
-    struct stat xbl_partition_stat;
 
+    session.fd = -1;
     if (!dev_path) {
         fprintf(stderr, "%s: Invalid dev_path\n",
                         __func__);
         r = -1;
         goto EXIT;
     }
-    fd = open(dev_path, O_RDWR);
-    if (fd < 0) {
+    if (gpt_session_open(&session, dev_path)) {
         fprintf(stderr, "%s: Opening '%s' failed: %s\n",
                         __func__,
-                       BLK_DEV_FILE,
+                       dev_path,
                        strerror(errno));
         r = -1;
         goto EXIT;
     }
-    r = gpt_get_state(fd, PRIMARY_GPT, &gpt_prim) ||
-        gpt_get_state(fd, SECONDARY_GPT, &gpt_second);
+    r = gpt_get_state(&session, PRIMARY_GPT, &gpt_prim) ||
+        gpt_get_state(&session, SECONDARY_GPT, &gpt_second);
     if (r) {
         fprintf(stderr, "%s: Getting GPT headers state failed\n",
                         __func__);
@@ -788,17 +1767,15 @@ int prepare_partitions(enum boot_update_stage stage, const char *dev_path)
     switch (stage) {
     case UPDATE_MAIN:
             if (is_ufs) {
-                if(stat(XBL_PRIMARY, &xbl_partition_stat)||
-                                stat(XBL_BACKUP, &xbl_partition_stat)){
+                if(!gpt_has_xbl_backup()){
                         //Non fatal error. Just means this target does not
                         //use XBL but relies on sbl whose update is handled
                         //by the normal methods.
-                        fprintf(stderr, "%s: xbl part not found(%s).Assuming sbl in use\n",
-                                        __func__,
-                                        strerror(errno));
+                        fprintf(stderr, "%s: xbl part not found.Assuming sbl in use\n",
+                                        __func__);
                 } else {
                         //Switch the boot lun so that backup boot LUN is used
-                        r = gpt_utils_set_xbl_boot_partition(BACKUP_BOOT);
+                        r = gpt_switch_xbl(xbl, BACKUP_BOOT);
                         if(r){
                                 fprintf(stderr, "%s: Failed to set xbl backup partition as boot\n",
                                                 __func__);
@@ -810,7 +1787,7 @@ int prepare_partitions(enum boot_update_stage stage, const char *dev_path)
         //the backup copy of the boot critical images
         fprintf(stderr, "%s: Preparing for primary partition update\n",
                         __func__);
-        r = gpt2_set_boot_chain(fd, BACKUP_BOOT);
+        r = gpt2_set_boot_chain(&session, BACKUP_BOOT);
         if (r) {
             if (r < 0)
                 fprintf(stderr,
@@ -823,7 +1800,7 @@ int prepare_partitions(enum boot_update_stage stage, const char *dev_path)
         }
         //corrupt the primary GPT so that the backup(which now points to
         //the backup boot partitions is used)
-        r = gpt_set_state(fd, PRIMARY_GPT, GPT_BAD_SIGNATURE);
+        r = gpt_set_state(&session, PRIMARY_GPT, GPT_BAD_SIGNATURE);
         if (r) {
             fprintf(stderr, "%s: Corrupting primary GPT header failed\n",
                             __func__);
@@ -832,17 +1809,15 @@ int prepare_partitions(enum boot_update_stage stage, const char *dev_path)
         break;
     case UPDATE_BACKUP:
         if (is_ufs) {
-                if(stat(XBL_PRIMARY, &xbl_partition_stat)||
-                                stat(XBL_BACKUP, &xbl_partition_stat)){
+                if(!gpt_has_xbl_backup()){
                         //Non fatal error. Just means this target does not
                         //use XBL but relies on sbl whose update is handled
                         //by the normal methods.
-                        fprintf(stderr, "%s: xbl part not found(%s).Assuming sbl in use\n",
-                                        __func__,
-                                        strerror(errno));
+                        fprintf(stderr, "%s: xbl part not found.Assuming sbl in use\n",
+                                        __func__);
                 } else {
                         //Switch the boot lun so that backup boot LUN is used
-                        r = gpt_utils_set_xbl_boot_partition(NORMAL_BOOT);
+                        r = gpt_switch_xbl(xbl, NORMAL_BOOT);
                         if(r) {
                                 fprintf(stderr, "%s: Failed to set xbl backup partition as boot\n",
                                                 __func__);
@@ -853,14 +1828,14 @@ int prepare_partitions(enum boot_update_stage stage, const char *dev_path)
         //Fix the primary GPT header so that is used
         fprintf(stderr, "%s: Preparing for backup partition update\n",
                         __func__);
-        r = gpt_set_state(fd, PRIMARY_GPT, GPT_OK);
+        r = gpt_set_state(&session, PRIMARY_GPT, GPT_OK);
         if (r) {
             fprintf(stderr, "%s: Fixing primary GPT header failed\n",
                              __func__);
             goto EXIT;
         }
         //Corrupt the scondary GPT header
-        r = gpt_set_state(fd, SECONDARY_GPT, GPT_BAD_SIGNATURE);
+        r = gpt_set_state(&session, SECONDARY_GPT, GPT_BAD_SIGNATURE);
         if (r) {
             fprintf(stderr, "%s: Corrupting secondary GPT header failed\n",
                             __func__);
@@ -873,14 +1848,14 @@ int prepare_partitions(enum boot_update_stage stage, const char *dev_path)
         //partitions
         fprintf(stderr, "%s: Finalizing partitions\n",
                         __func__);
-        r = gpt2_set_boot_chain(fd, NORMAL_BOOT);
+        r = gpt2_set_boot_chain(&session, NORMAL_BOOT);
         if (r < 0) {
             fprintf(stderr, "%s: Setting secondary GPT to normal boot failed\n",
                             __func__);
             goto EXIT;
         }
 
-        r = gpt_set_state(fd, SECONDARY_GPT, GPT_OK);
+        r = gpt_set_state(&session, SECONDARY_GPT, GPT_OK);
         if (r) {
             fprintf(stderr, "%s: Fixing secondary GPT header failed\n",
                             __func__);
@@ -891,13 +1866,47 @@ int prepare_partitions(enum boot_update_stage stage, const char *dev_path)
     }
 
 EXIT:
-    if (fd >= 0) {
-       fsync(fd);
-       close(fd);
+    if (session.fd >= 0) {
+       gpt_session_close(&session);
+       fprintf(stderr, "%s: %s stage %d took %u syscalls, %u fsyncs\n",
+                       __func__,
+                       dev_path,
+                       stage,
+                       session.stats.syscalls,
+                       session.stats.fsyncs);
+       if (stats)
+               gpt_io_stats_add(stats, &session.stats);
     }
     return r;
 }
 
+int prepare_partitions(enum boot_update_stage stage, const char *dev_path)
+{
+    return prepare_lun(stage, dev_path, NULL, NULL);
+}
+
+//Worker thread preparing LUNs of the update stage until none is left
+static void *prepare_lun_worker(void *arg)
+{
+        struct update_work *work = (struct update_work *)arg;
+        uint64_t start;
+        uint32_t i;
+
+        while ((i = work->next++) < work->data->num_valid_entries) {
+                fprintf(stderr, "%s: Preparing %s for update stage %d\n",
+                                __func__,
+                                work->data->lun_list[i],
+                                work->stage);
+                start = gpt_time_us();
+                work->rcode[i] = prepare_lun(work->stage,
+                                work->data->lun_list[i],
+                                &work->stats[i],
+                                &work->xbl);
+                work->elapsed_us[i] = gpt_time_us() - start;
+        }
+        return NULL;
+}
+
 int add_lun_to_update_list(char *lun_path, struct update_data *dat)
 {
         uint32_t i = 0;
@@ -944,23 +1953,94 @@ int add_lun_to_update_list(char *lun_path, struct update_data *dat)
         return 0;
 }
 
+//Prepare the LUNs in data for the update stage on a few worker threads.
+//The LUNs are independent block devices so their GPTs are read, fixed up
+//and flushed concurrently. Failures are reported per LUN and do not stop
+//the other LUNs, as before.
+static int prepare_luns(enum boot_update_stage stage, struct update_data *data,
+                struct gpt_io_stats *io_stats)
+{
+        struct update_work *work = new (std::nothrow) update_work();
+        pthread_t workers[MAX_UPDATE_WORKERS];
+        uint32_t num_workers = 0;
+        uint32_t i = 0;
+        uint64_t start = gpt_time_us();
+        int is_error = 0;
+
+        if (!work) {
+                fprintf(stderr, "%s: Failed to allocate memory\n", __func__);
+                return -1;
+        }
+        work->stage = stage;
+        work->data = data;
+        work->next = 0;
+        //This thread is a worker too
+        for (i = 0; i + 1 < data->num_valid_entries &&
+                        i + 1 < MAX_UPDATE_WORKERS; i++) {
+                if (pthread_create(&workers[num_workers], NULL,
+                                        prepare_lun_worker, work)) {
+                        fprintf(stderr, "%s: Failed to start worker: %s\n",
+                                        __func__,
+                                        strerror(errno));
+                        break;
+                }
+                num_workers++;
+        }
+        prepare_lun_worker(work);
+        for (i = 0; i < num_workers; i++)
+                pthread_join(workers[i], NULL);
+
+        for (i = 0; i < data->num_valid_entries; i++) {
+                fprintf(stderr, "%s: %s took %" PRIu64 " us\n",
+                                __func__,
+                                data->lun_list[i],
+                                work->elapsed_us[i]);
+                gpt_io_stats_add(io_stats, &work->stats[i]);
+                if (work->rcode[i] != 0) {
+                        fprintf(stderr, "%s: Failed to prepare %s.Continuing..\n",
+                                        __func__,
+                                        data->lun_list[i]);
+                        is_error = 1;
+                }
+        }
+        fprintf(stderr, "%s: stage %d on %u LUNs took %" PRIu64 " us with %u threads\n",
+                        __func__,
+                        stage,
+                        data->num_valid_entries,
+                        gpt_time_us() - start,
+                        num_workers + 1);
+        delete work;
+        return is_error ? -1 : 0;
+}
+
 int prepare_boot_update(enum boot_update_stage stage)
 {
-        int is_ufs = gpt_utils_is_ufs_device();
-        struct stat ufs_dir_stat;
+        return prepare_boot_update_with_stats(stage, NULL);
+}
+
+int prepare_boot_update_with_stats(enum boot_update_stage stage,
+                struct gpt_io_stats *stats)
+{
+        GptApiTimer timer(GPT_API_PREPARE_BOOT_UPDATE);
+        shared_ptr<const gpt_topology> topo = gpt_get_topology();
+        int is_ufs = topo->is_ufs;
+        const char *lun = NULL;
         struct update_data data;
-        int rcode = 0;
         uint32_t i = 0;
         int is_error = 0;
         const char ptn_swap_list[][MAX_GPT_NAME_SIZE] = { PTN_SWAP_LIST };
-        //Holds /dev/block/bootdevice/by-name/*bak entry
+        //Holds the name of the *bak partition
         char buf[PATH_MAX] = {0};
-        //Holds the resolved path of the symlink stored in buf
+        //Holds the path of the LUN the *bak partition sits on
         char real_path[PATH_MAX] = {0};
+        //I/O cost of the stage summed up over all the LUNs
+        struct gpt_io_stats io_stats;
 
+        memset(&io_stats, 0, sizeof(io_stats));
         if (!is_ufs) {
                 //emmc device. Just pass in path to mmcblk0
-                return prepare_partitions(stage, BLK_DEV_FILE);
+                if (prepare_lun(stage, topo->blk_dev.c_str(), &io_stats, NULL))
+                        is_error = 1;
         } else {
                 //Now we need to find the list of LUNs over
                 //which the boot critical images are spread
@@ -968,7 +2048,8 @@ int prepare_boot_update(enum boot_update_stage stage)
                 //this we find out where the symlinks for the
                 //each of the paths under
                 ///dev/block/bootdevice/by-name/PTN_SWAP_LIST
-                //actually point to.
+                //actually point to, as recorded in the boot
+                //device snapshot.
                 fprintf(stderr, "%s: Running on a UFS device\n",
                                 __func__);
                 memset(&data, '\0', sizeof(struct update_data));
@@ -982,44 +2063,28 @@ int prepare_boot_update(enum boot_update_stage stage)
                             || !strncmp(ptn_swap_list[i],PTN_MULTIIMGQTI,strlen(PTN_MULTIIMGQTI)))
                                 continue;
                         snprintf(buf, sizeof(buf),
-                                        "%s/%sbak",
-                                        BOOT_DEV_DIR,
-                                        ptn_swap_list[i]);
-                        if (stat(buf, &ufs_dir_stat)) {
-                                continue;
-                        }
-                        if (readlink(buf, real_path, sizeof(real_path) - 1) < 0)
-                        {
-                                fprintf(stderr, "%s: readlink error. Skipping %s",
-                                                __func__,
-                                                strerror(errno));
-                        } else {
-                              if(strlen(real_path) < PATH_TRUNCATE_LOC + 1){
-                                    fprintf(stderr, "Unknown path.Skipping :%s:\n",
-                                                real_path);
-                                } else {
-                                    real_path[PATH_TRUNCATE_LOC] = '\0';
-                                    add_lun_to_update_list(real_path, &data);
-                                }
-                        }
-                        memset(buf, '\0', sizeof(buf));
-                        memset(real_path, '\0', sizeof(real_path));
-                }
-                for (i=0; i < data.num_valid_entries; i++) {
-                        fprintf(stderr, "%s: Preparing %s for update stage %d\n",
-                                        __func__,
-                                        data.lun_list[i],
-                                        stage);
-                        rcode = prepare_partitions(stage, data.lun_list[i]);
-                        if (rcode != 0)
-                        {
-                                fprintf(stderr, "%s: Failed to prepare %s.Continuing..\n",
-                                                __func__,
-                                                data.lun_list[i]);
-                                is_error = 1;
+                                        "%s%s",
+                                        ptn_swap_list[i],
+                                        BAK_PTN_NAME_EXT);
+                        lun = gpt_topology_lun(*topo, buf);
+                        if (lun) {
+                                strlcpy(real_path, lun, sizeof(real_path));
+                                add_lun_to_update_list(real_path, &data);
                         }
                 }
+                if (prepare_luns(stage, &data, &io_stats))
+                        is_error = 1;
         }
+        fprintf(stderr, "%s: stage %d took %u syscalls, %u fsyncs, "
+                        "%" PRIu64 " bytes read, %" PRIu64 " bytes written\n",
+                        __func__,
+                        stage,
+                        io_stats.syscalls,
+                        io_stats.fsyncs,
+                        io_stats.bytes_read,
+                        io_stats.bytes_written);
+        if (stats)
+                gpt_io_stats_add(stats, &io_stats);
         if (is_error)
                 return -1;
         return 0;
@@ -1028,35 +2093,27 @@ int prepare_boot_update(enum boot_update_stage stage)
 //Given a parttion name(eg: rpm) get the path to the block device that
 //represents the GPT disk the partition resides on. In the case of emmc it
 //would be the default emmc dev(/dev/block/mmcblk0). In the case of UFS we look
-//through the /dev/block/bootdevice/by-name/ tree for partname, and resolve
-//the path to the LUN from there.
+//up partname in the snapshot of the /dev/block/bootdevice/by-name/ tree,
+//which records the LUN each partition resolves to.
 static int get_dev_path_from_partition_name(const char *partname,
                 char *buf,
                 size_t buflen)
 {
-        struct stat st;
-        char path[PATH_MAX] = {0};
+        shared_ptr<const gpt_topology> topo;
+        const char *lun = NULL;
         if (!partname || !buf || buflen < ((PATH_TRUNCATE_LOC) + 1)) {
                 ALOGE("%s: Invalid argument", __func__);
                 goto error;
         }
-        if (gpt_utils_is_ufs_device()) {
+        topo = gpt_get_topology();
+        if (topo->is_ufs) {
                 //Need to find the lun that holds partition partname
-                snprintf(path, sizeof(path),
-                                "%s/%s",
-                                BOOT_DEV_DIR,
-                                partname);
-                if (stat(path, &st)) {
+                lun = gpt_topology_lun(*topo, partname);
+                if (!lun)
                         goto error;
-                }
-                if (readlink(path, buf, buflen) < 0)
-                {
-                        goto error;
-                } else {
-                        buf[PATH_TRUNCATE_LOC] = '\0';
-                }
+                strlcpy(buf, lun, buflen);
         } else {
-                snprintf(buf, buflen, BLK_DEV_FILE);
+                strlcpy(buf, topo->blk_dev.c_str(), buflen);
         }
         return 0;
 
@@ -1066,6 +2123,7 @@ error:
 
 int gpt_utils_get_partition_map(vector<string>& ptn_list,
                 map<string, vector<string>>& partition_map) {
+        GptApiTimer timer(GPT_API_GET_PARTITION_MAP);
         char devpath[PATH_MAX] = {'\0'};
         map<string, vector<string>>::iterator it;
         if (ptn_list.size() < 1) {
@@ -1101,52 +2159,24 @@ error:
         return -1;
 }
 
-//Get the block size of the disk represented by decsriptor fd
-static uint32_t gpt_get_block_size(int fd)
-{
-        uint32_t block_size = 0;
-        if (fd < 0) {
-                ALOGE("%s: invalid descriptor",
-                                __func__);
-                goto error;
-        }
-        if (ioctl(fd, BLKSSZGET, &block_size) != 0) {
-                ALOGE("%s: Failed to get GPT dev block size : %s",
-                                __func__,
-                                strerror(errno));
-                goto error;
-        }
-        return block_size;
-error:
-        return 0;
-}
-
 //Write the GPT header present in the passed in buffer back to the
-//disk represented by fd
-static int gpt_set_header(uint8_t *gpt_header, int fd,
+//disk represented by session
+static int gpt_set_header(uint8_t *gpt_header, struct gpt_session *session,
                 enum gpt_instance instance)
 {
-        uint32_t block_size = 0;
         off64_t gpt_header_offset = 0;
-        if (!gpt_header || fd < 0) {
+        if (!gpt_header || !session || session->fd < 0) {
                 ALOGE("%s: Invalid arguments",
                                 __func__);
                 goto error;
         }
-        block_size = gpt_get_block_size(fd);
-        if (block_size == 0) {
-                ALOGE("%s: Failed to get block size", __func__);
-                goto error;
-        }
-        if (instance == PRIMARY_GPT)
-                gpt_header_offset = block_size;
-        else
-                gpt_header_offset = lseek64(fd, 0, SEEK_END) - block_size;
+        gpt_header_offset = gpt_session_hdr_offset(session, instance);
         if (gpt_header_offset <= 0) {
                 ALOGE("%s: Failed to get gpt header offset",__func__);
                 goto error;
         }
-        if (blk_rw(fd, 1, gpt_header_offset, gpt_header, block_size)) {
+        if (blk_rw(session, 1, gpt_header_offset, gpt_header,
+                                session->block_size)) {
                 ALOGE("%s: Failed to write back GPT header", __func__);
                 goto error;
         }
@@ -1155,222 +2185,311 @@ error:
         return -1;
 }
 
-//Read out the GPT header for the disk that contains the partition partname
-static uint8_t* gpt_get_header(const char *partname, enum gpt_instance instance)
-{
-        uint8_t* hdr = NULL;
-        char devpath[PATH_MAX] = {0};
-        int64_t hdr_offset = 0;
-        uint32_t block_size = 0;
-        int fd = -1;
-        if (!partname) {
-                ALOGE("%s: Invalid partition name", __func__);
-                goto error;
-        }
-        if (get_dev_path_from_partition_name(partname, devpath, sizeof(devpath))
-                        != 0) {
-                ALOGE("%s: Failed to resolve path for %s",
-                                __func__,
-                                partname);
-                goto error;
-        }
-        fd = open(devpath, O_RDWR);
-        if (fd < 0) {
-                ALOGE("%s: Failed to open %s : %s",
-                                __func__,
-                                devpath,
-                                strerror(errno));
-                goto error;
-        }
-        block_size = gpt_get_block_size(fd);
-        if (block_size == 0)
-        {
-                ALOGE("%s: Failed to get gpt block size for %s",
-                                __func__,
-                                partname);
-                goto error;
-        }
-
-        hdr = (uint8_t*)malloc(block_size);
-        if (!hdr) {
-                ALOGE("%s: Failed to allocate memory for gpt header",
-                                __func__);
-        }
-        if (instance == PRIMARY_GPT)
-                hdr_offset = block_size;
-        else {
-                hdr_offset = lseek64(fd, 0, SEEK_END) - block_size;
-        }
-        if (hdr_offset < 0) {
-                ALOGE("%s: Failed to get gpt header offset",
-                                __func__);
-                goto error;
-        }
-        if (blk_rw(fd, 0, hdr_offset, hdr, block_size)) {
-                ALOGE("%s: Failed to read GPT header from device",
-                                __func__);
-                goto error;
-        }
-        close(fd);
-        return hdr;
-error:
-        if (fd >= 0)
-                close(fd);
-        if (hdr)
-                free(hdr);
-        return NULL;
-}
-
-//Returns the partition entry array based on the
-//passed in buffer which contains the gpt header.
-//The fd here is the descriptor for the 'disk' which
-//holds the partition
-static uint8_t* gpt_get_pentry_arr(uint8_t *hdr, int fd)
+static int gpt_set_pentry_arr(uint8_t *hdr, struct gpt_session *session,
+                uint8_t* arr)
 {
         uint64_t pentries_start = 0;
         uint32_t pentry_size = 0;
-        uint32_t block_size = 0;
         uint32_t pentries_arr_size = 0;
-        uint8_t *pentry_arr = NULL;
         int rc = 0;
-        if (!hdr) {
-                ALOGE("%s: Invalid header", __func__);
-                goto error;
-        }
-        if (fd < 0) {
-                ALOGE("%s: Invalid fd", __func__);
-                goto error;
-        }
-        block_size = gpt_get_block_size(fd);
-        if (!block_size) {
-                ALOGE("%s: Failed to get gpt block size for",
-                                __func__);
+        if (!hdr || !session || session->fd < 0 || !arr) {
+                ALOGE("%s: Invalid argument", __func__);
                 goto error;
         }
-        pentries_start = GET_8_BYTES(hdr + PENTRIES_OFFSET) * block_size;
+        pentries_start = GET_8_BYTES(hdr + PENTRIES_OFFSET) *
+                session->block_size;
         pentry_size = GET_4_BYTES(hdr + PENTRY_SIZE_OFFSET);
         pentries_arr_size =
                 GET_4_BYTES(hdr + PARTITION_COUNT_OFFSET) * pentry_size;
-        pentry_arr = (uint8_t*)calloc(1, pentries_arr_size);
-        if (!pentry_arr) {
-                ALOGE("%s: Failed to allocate memory for partition array",
-                                __func__);
-                goto error;
-        }
-        rc = blk_rw(fd, 0,
+        rc = blk_rw(session, 1,
                         pentries_start,
-                        pentry_arr,
+                        arr,
                         pentries_arr_size);
         if (rc) {
                 ALOGE("%s: Failed to read partition entry array",
                                 __func__);
                 goto error;
         }
-        return pentry_arr;
+        return 0;
 error:
-        if (pentry_arr)
-                free(pentry_arr);
-        return NULL;
+        return -1;
 }
 
-static int gpt_set_pentry_arr(uint8_t *hdr, int fd, uint8_t* arr)
+
+
+GptDisk::GptDisk() : disk_()
 {
-        uint32_t block_size = 0;
-        uint64_t pentries_start = 0;
-        uint32_t pentry_size = 0;
-        uint32_t pentries_arr_size = 0;
-        int rc = 0;
-        if (!hdr || fd < 0 || !arr) {
-                ALOGE("%s: Invalid argument", __func__);
-                goto error;
-        }
-        block_size = gpt_get_block_size(fd);
-        if (!block_size) {
-                ALOGE("%s: Failed to get gpt block size for",
-                                __func__);
-                goto error;
-        }
-        pentries_start = GET_8_BYTES(hdr + PENTRIES_OFFSET) * block_size;
-        pentry_size = GET_4_BYTES(hdr + PENTRY_SIZE_OFFSET);
-        pentries_arr_size =
-                GET_4_BYTES(hdr + PARTITION_COUNT_OFFSET) * pentry_size;
-        rc = blk_rw(fd, 1,
-                        pentries_start,
-                        arr,
-                        pentries_arr_size);
-        if (rc) {
-                ALOGE("%s: Failed to read partition entry array",
-                                __func__);
-                goto error;
+        disk_.owner = this;
+}
+
+GptDisk::~GptDisk()
+{
+        Release();
+}
+
+GptDisk::GptDisk(GptDisk &&other) noexcept : disk_()
+{
+        Take(other);
+}
+
+GptDisk &GptDisk::operator=(GptDisk &&other) noexcept
+{
+        if (this != &other) {
+                Release();
+                Take(other);
         }
-        return 0;
-error:
-        return -1;
+        return *this;
+}
+
+//Free everything the disk owns
+void GptDisk::Release()
+{
+        delete disk_.index;
+        delete disk_.crc;
+        disk_.index = NULL;
+        disk_.crc = NULL;
+        arena_.reset();
+        arena_size_ = 0;
+        arena_align_ = 0;
+}
+
+//Move the tables and the arena of other over, leaving it empty
+void GptDisk::Take(GptDisk &other)
+{
+        disk_ = other.disk_;
+        disk_.owner = this;
+        arena_ = std::move(other.arena_);
+        arena_size_ = other.arena_size_;
+        arena_align_ = other.arena_align_;
+        arena_allocs_ = other.arena_allocs_;
+        memset(&other.disk_, 0, sizeof(other.disk_));
+        other.disk_.owner = &other;
+        other.arena_size_ = 0;
+        other.arena_align_ = 0;
+        other.arena_allocs_ = 0;
+}
+
+//Forget the tables, keeping the arena and the lookup tables for reuse
+void GptDisk::Unload()
+{
+        disk_.is_initialized = 0;
+        disk_.hdr = NULL;
+        disk_.hdr_bak = NULL;
+        disk_.pentry_arr = NULL;
+        disk_.pentry_arr_bak = NULL;
+        disk_.pentry_arr_size = 0;
+        disk_.pentry_size = 0;
+}
+
+std::span<uint8_t> GptDisk::header(enum gpt_instance instance)
+{
+        if (!loaded())
+                return {};
+        return {instance == PRIMARY_GPT ? disk_.hdr : disk_.hdr_bak,
+                disk_.block_size};
+}
+
+std::span<uint8_t> GptDisk::entries(enum gpt_instance instance)
+{
+        if (!loaded())
+                return {};
+        return {instance == PRIMARY_GPT ? disk_.pentry_arr :
+                disk_.pentry_arr_bak, disk_.pentry_arr_size};
 }
 
+std::span<uint8_t> GptDisk::entry(uint32_t i, enum gpt_instance instance)
+{
+        if (i >= num_entries())
+                return {};
+        return entries(instance).subspan((size_t)i * disk_.pentry_size,
+                        disk_.pentry_size);
+}
 
+uint32_t GptDisk::num_entries() const
+{
+        if (!loaded() || !disk_.pentry_size)
+                return 0;
+        return disk_.pentry_arr_size / disk_.pentry_size;
+}
+
+std::span<uint8_t> GptDisk::Find(const char *partname,
+                enum gpt_instance instance)
+{
+        uint8_t *pentry = gpt_disk_get_pentry(&disk_, partname, instance);
+
+        if (!pentry)
+                return {};
+        return {pentry, disk_.pentry_size};
+}
 
 //Allocate a handle used by calls to the "gpt_disk" api's
 struct gpt_disk * gpt_disk_alloc()
 {
-        struct gpt_disk *disk;
-        disk = (struct gpt_disk *)malloc(sizeof(struct gpt_disk));
-        if (!disk) {
+        GptDisk *owner = new (std::nothrow) GptDisk();
+        if (!owner) {
                 ALOGE("%s: Failed to allocate memory", __func__);
-                goto end;
+                return NULL;
         }
-        memset(disk, 0, sizeof(struct gpt_disk));
-end:
-        return disk;
+        return owner->c_disk();
 }
 
 //Free previously allocated/initialized handle
 void gpt_disk_free(struct gpt_disk *disk)
 {
-        if (!disk)
+        if (disk && !GptDisk::FromC(disk)) {
+                ALOGE("%s: disk did not come from gpt_disk_alloc", __func__);
                 return;
-        if (disk->hdr)
-                free(disk->hdr);
-        if (disk->hdr_bak)
-                free(disk->hdr_bak);
-        if (disk->pentry_arr)
-                free(disk->pentry_arr);
-        if (disk->pentry_arr_bak)
-                free(disk->pentry_arr_bak);
-        free(disk);
-        return;
+        }
+        delete GptDisk::FromC(disk);
 }
 
-//fills up the passed in gpt_disk struct with information about the
-//disk represented by path dev. Returns 0 on success and -1 on error.
-int gpt_disk_get_disk_info(const char *dev, struct gpt_disk *dsk)
+//Check that pentry is named partname or is its backup twin
+static int gpt_pentry_name_matches(const uint8_t *pentry, const char *partname)
 {
+        char name8[MAX_GPT_NAME_SIZE];
+        size_t len = strlen(partname);
 
-	struct gpt_disk *disk = NULL;
-	int fd = -1;
-	uint32_t gpt_header_size = 0;
-	uint32_t crc_zero;
+        gpt_pentry_get_name(pentry, name8);
+        if (strncmp(partname, name8, len))
+                return 0;
+        return name8[len] == 0 || !strcmp(&name8[len], BAK_PTN_NAME_EXT);
+}
 
-	crc_zero = crc32(0L, Z_NULL, 0);
-        if (!dsk || !dev) {
-                ALOGE("%s: Invalid arguments", __func__);
-                goto error;
+//Build the name and GUID lookup tables of a gpt_disk from its partition
+//entries arrays. Unused entries (null type GUID) are not indexed.
+int gpt_disk_reindex(struct gpt_disk *disk)
+{
+        static const uint8_t null_guid[TYPE_GUID_SIZE] = {0};
+        uint32_t off;
+        int i;
+
+        if (!disk || !disk->pentry_arr || !disk->pentry_arr_bak ||
+                        !disk->pentry_size) {
+                ALOGE("%s: Invalid argument", __func__);
+                return -1;
         }
-        disk = dsk;
-        disk->hdr = gpt_get_header(dev, PRIMARY_GPT);
-        if (!disk->hdr) {
-                ALOGE("%s: Failed to get primary header", __func__);
-                goto error;
+        if (!disk->index) {
+                disk->index = new (std::nothrow) gpt_disk_index;
+                if (!disk->index) {
+                        ALOGE("%s: Failed to allocate memory", __func__);
+                        return -1;
+                }
         }
-        gpt_header_size = GET_4_BYTES(disk->hdr + HEADER_SIZE_OFFSET);
-        disk->hdr_crc = crc32(crc_zero, disk->hdr, gpt_header_size);
-        disk->hdr_bak = gpt_get_header(dev, SECONDARY_GPT);
-        if (!disk->hdr_bak) {
-                ALOGE("%s: Failed to get backup header", __func__);
-                goto error;
+        for (i = PRIMARY_GPT; i <= SECONDARY_GPT; i++) {
+                const uint8_t *arr = (i == PRIMARY_GPT) ?
+                        disk->pentry_arr : disk->pentry_arr_bak;
+                gpt_index_names(arr, disk->pentry_arr_size, disk->pentry_size,
+                                disk->index->by_name[i]);
+                disk->index->by_unique_guid[i].clear();
+                disk->index->by_type_guid[i].clear();
+                for (off = 0; off + disk->pentry_size <= disk->pentry_arr_size;
+                                off += disk->pentry_size) {
+                        const char *pentry = (const char *)arr + off;
+                        if (!memcmp(pentry + TYPE_GUID_OFFSET, null_guid,
+                                                TYPE_GUID_SIZE))
+                                continue;
+                        //emplace() keeps the first entry in table order
+                        disk->index->by_unique_guid[i].emplace(
+                                        string(pentry + UNIQUE_GUID_OFFSET,
+                                                TYPE_GUID_SIZE), off);
+                        disk->index->by_type_guid[i].emplace(
+                                        string(pentry + TYPE_GUID_OFFSET,
+                                                TYPE_GUID_SIZE), off);
+                }
+        }
+        return 0;
+}
+
+//Look up partname in the index of disk without checking for staleness
+static uint8_t* gpt_disk_index_find(struct gpt_disk *disk,
+                const char *partname,
+                enum gpt_instance instance)
+{
+        uint8_t *ptn_arr = (instance == PRIMARY_GPT) ?
+                disk->pentry_arr : disk->pentry_arr_bak;
+        const gpt_name_index &names = disk->index->by_name[instance];
+        gpt_name_index::const_iterator it = names.find(partname);
+
+        if (it == names.end())
+                return NULL;
+        return ptn_arr + it->second[0];
+}
+
+//Raw CRC of a single partition entry, the unit gpt_arr_crc works with
+static inline uint32_t gpt_pentry_raw_crc(const uint8_t *pentry, uint32_t size)
+{
+        return ~gpt_crc32(0xffffffff, pentry, size);
+}
+
+//Hash a whole partition entries array, entry by entry
+static void gpt_arr_crc_init(gpt_arr_crc &st, const uint8_t *arr,
+                uint32_t arr_size, uint32_t pentry_size)
+{
+        uint32_t k;
+
+        st.entry.resize(arr_size / pentry_size);
+        for (k = 0; k < st.entry.size(); k++)
+                st.entry[k] = gpt_pentry_raw_crc(arr + k * pentry_size,
+                                pentry_size);
+        st.arr = gpt_crc32(0, arr, arr_size);
+        st.dirty.clear();
+}
+
+//Fold the entries marked dirty into the array CRC
+static void gpt_arr_crc_update(gpt_arr_crc &st, const uint8_t *arr,
+                uint32_t arr_size, uint32_t pentry_size)
+{
+        uint32_t crc, delta;
+
+        sort(st.dirty.begin(), st.dirty.end());
+        st.dirty.erase(unique(st.dirty.begin(), st.dirty.end()),
+                        st.dirty.end());
+        for (uint32_t off : st.dirty) {
+                crc = gpt_pentry_raw_crc(arr + off, pentry_size);
+                delta = crc ^ st.entry[off / pentry_size];
+                if (!delta)
+                        continue;
+                st.arr ^= gpt_crc32_combine_op(delta, 0,
+                                gpt_crc32_combine_gen(arr_size - off -
+                                        pentry_size));
+                st.entry[off / pentry_size] = crc;
         }
-        disk->hdr_bak_crc = crc32(crc_zero, disk->hdr_bak, gpt_header_size);
+        st.dirty.clear();
+}
+
+//(Re)hash both partition entries arrays of disk. The backup array is
+//usually a copy of the primary one and is then not hashed again.
+static int gpt_disk_crc_init(struct gpt_disk *disk)
+{
+        if (!disk->crc) {
+                disk->crc = new (std::nothrow) gpt_disk_crc;
+                if (!disk->crc) {
+                        ALOGE("%s: Failed to allocate memory", __func__);
+                        return -1;
+                }
+        }
+        gpt_arr_crc_init(disk->crc->arr[PRIMARY_GPT], disk->pentry_arr,
+                        disk->pentry_arr_size, disk->pentry_size);
+        if (!memcmp(disk->pentry_arr, disk->pentry_arr_bak,
+                                disk->pentry_arr_size))
+                disk->crc->arr[SECONDARY_GPT] = disk->crc->arr[PRIMARY_GPT];
+        else
+                gpt_arr_crc_init(disk->crc->arr[SECONDARY_GPT],
+                                disk->pentry_arr_bak,
+                                disk->pentry_arr_size, disk->pentry_size);
+        return 0;
+}
+
+//Resolve the disk holding partition dev and open a session on it
+int GptDisk::Open(const char *dev, struct gpt_session *session)
+{
+        struct gpt_disk *disk = &disk_;
 
+        session->fd = -1;
+        if (!dev) {
+                ALOGE("%s: Invalid arguments", __func__);
+                return -1;
+        }
         //Descriptor for the block device. We will use this for further
         //modifications to the partition table
         if (get_dev_path_from_partition_name(dev,
@@ -1379,64 +2498,178 @@ int gpt_disk_get_disk_info(const char *dev, struct gpt_disk *dsk)
                 ALOGE("%s: Failed to resolve path for %s",
                                 __func__,
                                 dev);
-                goto error;
+                return -1;
         }
-        fd = open(disk->devpath, O_RDWR);
-        if (fd < 0) {
-                ALOGE("%s: Failed to open %s: %s",
+        if (gpt_session_open(session, disk->devpath)) {
+                ALOGE("%s: Failed to open %s",
                                 __func__,
-                                disk->devpath,
-                                strerror(errno));
-                goto error;
-        }
-        disk->pentry_arr = gpt_get_pentry_arr(disk->hdr, fd);
-        if (!disk->pentry_arr) {
-                ALOGE("%s: Failed to obtain partition entry array",
-                                __func__);
-                goto error;
-        }
-        disk->pentry_arr_bak = gpt_get_pentry_arr(disk->hdr_bak, fd);
-        if (!disk->pentry_arr_bak) {
-                ALOGE("%s: Failed to obtain backup partition entry array",
-                                __func__);
-                goto error;
+                                disk->devpath);
+                return -1;
         }
-        disk->pentry_size = GET_4_BYTES(disk->hdr + PENTRY_SIZE_OFFSET);
-        disk->pentry_arr_size =
-                GET_4_BYTES(disk->hdr + PARTITION_COUNT_OFFSET) *
-                disk->pentry_size;
+        return 0;
+}
+
+//Finish loading the tables read through session, which is closed
+int GptDisk::Finish(struct gpt_session *session)
+{
+	struct gpt_disk *disk = &disk_;
+	uint32_t gpt_header_size = 0;
+	uint32_t crc_zero;
+
+	crc_zero = gpt_crc32(0L, NULL, 0);
+        gpt_header_size = GET_4_BYTES(disk->hdr + HEADER_SIZE_OFFSET);
+        disk->hdr_crc = gpt_crc32(crc_zero, disk->hdr, gpt_header_size);
+        disk->hdr_bak_crc = gpt_crc32(crc_zero, disk->hdr_bak, gpt_header_size);
         disk->pentry_arr_crc = GET_4_BYTES(disk->hdr + PARTITION_CRC_OFFSET);
         disk->pentry_arr_bak_crc = GET_4_BYTES(disk->hdr_bak +
                         PARTITION_CRC_OFFSET);
-        disk->block_size = gpt_get_block_size(fd);
-        close(fd);
+        disk->block_size = session->block_size;
+        gpt_session_close(session);
+        //One pass over the entries now saves one per lookup later
+        if (gpt_disk_reindex(disk)) {
+                ALOGE("%s: Failed to index partition entries", __func__);
+                return -1;
+        }
+        if (gpt_disk_crc_init(disk))
+                return -1;
+        disk->io_stats = session->stats;
         disk->is_initialized = GPT_DISK_INIT_MAGIC;
         return 0;
+}
+
+//fills up the gpt_disk struct with information about the disk
+//represented by path dev. Returns 0 on success and -1 on error.
+int GptDisk::Load(const char *dev)
+{
+        struct gpt_session session;
+
+        Unload();
+        if (Open(dev, &session))
+                goto error;
+        if (LoadTables(&session)) {
+                ALOGE("%s: Failed to read GPT from %s",
+                                __func__,
+                                disk_.devpath);
+                goto error;
+        }
+        if (Finish(&session))
+                goto error;
+        return 0;
 error:
-        if (fd >= 0)
-                close(fd);
+        gpt_session_close(&session);
+        Unload();
         return -1;
 }
 
+//fills up the passed in gpt_disk struct with information about the
+//disk represented by path dev. Returns 0 on success and -1 on error.
+int gpt_disk_get_disk_info(const char *dev, struct gpt_disk *disk)
+{
+        GptApiTimer timer(GPT_API_DISK_GET_DISK_INFO);
+        GptDisk *owner = GptDisk::FromC(disk);
+
+        if (!owner) {
+                ALOGE("%s: Invalid arguments, disk must come from gpt_disk_alloc",
+                                __func__);
+                return -1;
+        }
+        return owner->Load(dev);
+}
+
 //Get pointer to partition entry from a allocated gpt_disk structure
 uint8_t* gpt_disk_get_pentry(struct gpt_disk *disk,
                 const char *partname,
                 enum gpt_instance instance)
 {
-        uint8_t *ptn_arr = NULL;
+        uint8_t *pentry = NULL;
         if (!disk || !partname || disk->is_initialized != GPT_DISK_INIT_MAGIC) {
                 ALOGE("%s: Invalid argument",__func__);
                 goto error;
         }
+        if (!disk->index && gpt_disk_reindex(disk))
+                goto error;
+        pentry = gpt_disk_index_find(disk, partname, instance);
+        if (pentry && !gpt_pentry_name_matches(pentry, partname)) {
+                //Entries were moved around since the index was built
+                if (gpt_disk_reindex(disk))
+                        goto error;
+                pentry = gpt_disk_index_find(disk, partname, instance);
+        }
+        return pentry;
+error:
+        return NULL;
+}
+
+//Get pointer to the first partition entry whose unique or type GUID,
+//selected by guid_offset, matches guid
+uint8_t* gpt_disk_get_pentry_by_guid(struct gpt_disk *disk,
+                const uint8_t *guid,
+                uint32_t guid_offset,
+                enum gpt_instance instance)
+{
+        uint8_t *ptn_arr = NULL;
+        unordered_map<string, uint32_t> *guids = NULL;
+        unordered_map<string, uint32_t>::const_iterator it;
+        if (!disk || !guid || disk->is_initialized != GPT_DISK_INIT_MAGIC ||
+                        (guid_offset != TYPE_GUID_OFFSET &&
+                         guid_offset != UNIQUE_GUID_OFFSET)) {
+                ALOGE("%s: Invalid argument",__func__);
+                goto error;
+        }
+        if (!disk->index && gpt_disk_reindex(disk))
+                goto error;
         ptn_arr = (instance == PRIMARY_GPT) ?
                 disk->pentry_arr : disk->pentry_arr_bak;
-        return (gpt_pentry_seek(partname, ptn_arr,
-                        ptn_arr + disk->pentry_arr_size ,
-                        disk->pentry_size));
+        guids = (guid_offset == TYPE_GUID_OFFSET) ?
+                &disk->index->by_type_guid[instance] :
+                &disk->index->by_unique_guid[instance];
+        it = guids->find(string((const char *)guid, TYPE_GUID_SIZE));
+        if (it != guids->end() &&
+                        memcmp(ptn_arr + it->second + guid_offset, guid,
+                                TYPE_GUID_SIZE)) {
+                //Entries were moved around since the index was built
+                if (gpt_disk_reindex(disk))
+                        goto error;
+                it = guids->find(string((const char *)guid, TYPE_GUID_SIZE));
+        }
+        if (it == guids->end())
+                goto error;
+        return ptn_arr + it->second;
 error:
         return NULL;
 }
 
+//Mark the partition entry holding pentry as modified
+int gpt_disk_mark_pentry_dirty(struct gpt_disk *disk, const uint8_t *pentry)
+{
+        const uint8_t *arr;
+        int i;
+
+        if (!disk || !pentry || disk->is_initialized != GPT_DISK_INIT_MAGIC) {
+                ALOGE("%s: Invalid argument", __func__);
+                return -1;
+        }
+        //Without per-entry CRCs gpt_disk_update_crc hashes everything
+        if (!disk->crc)
+                return 0;
+        for (i = PRIMARY_GPT; i <= SECONDARY_GPT; i++) {
+                arr = (i == PRIMARY_GPT) ? disk->pentry_arr :
+                        disk->pentry_arr_bak;
+                if (pentry < arr || pentry >= arr +
+                                disk->crc->arr[i].entry.size() *
+                                disk->pentry_size)
+                        continue;
+                disk->crc->arr[i].dirty.push_back((uint32_t)(pentry - arr) /
+                                disk->pentry_size * disk->pentry_size);
+                return 0;
+        }
+        ALOGE("%s: %p is not a partition entry of %s",
+                        __func__,
+                        pentry,
+                        disk->devpath);
+        return -1;
+}
+
 //Update CRC values for the various components of the gpt_disk
 //structure. This function should be called after any of the fields
 //have been updated before the structure contents are written back to
@@ -1445,19 +2678,29 @@ int gpt_disk_update_crc(struct gpt_disk *disk)
 {
         uint32_t gpt_header_size = 0;
         uint32_t crc_zero;
-        crc_zero = crc32(0L, Z_NULL, 0);
+        crc_zero = gpt_crc32(0L, NULL, 0);
         if (!disk || (disk->is_initialized != GPT_DISK_INIT_MAGIC)) {
                 ALOGE("%s: invalid argument", __func__);
                 goto error;
         }
-        //Recalculate the CRC of the primary partiton array
-        disk->pentry_arr_crc = crc32(crc_zero,
-                        disk->pentry_arr,
-                        disk->pentry_arr_size);
-        //Recalculate the CRC of the backup partition array
-        disk->pentry_arr_bak_crc = crc32(crc_zero,
-                        disk->pentry_arr_bak,
-                        disk->pentry_arr_size);
+        if (disk->crc && (!disk->crc->arr[PRIMARY_GPT].dirty.empty() ||
+                                !disk->crc->arr[SECONDARY_GPT].dirty.empty())) {
+                //Only rehash the entries the caller marked as modified
+                gpt_arr_crc_update(disk->crc->arr[PRIMARY_GPT],
+                                disk->pentry_arr,
+                                disk->pentry_arr_size,
+                                disk->pentry_size);
+                gpt_arr_crc_update(disk->crc->arr[SECONDARY_GPT],
+                                disk->pentry_arr_bak,
+                                disk->pentry_arr_size,
+                                disk->pentry_size);
+        } else if (gpt_disk_crc_init(disk)) {
+                //Nothing marked: any entry may have changed
+                goto error;
+        }
+        //CRC of the primary and backup partition arrays
+        disk->pentry_arr_crc = disk->crc->arr[PRIMARY_GPT].arr;
+        disk->pentry_arr_bak_crc = disk->crc->arr[SECONDARY_GPT].arr;
         //Update the partition CRC value in the primary GPT header
         PUT_4_BYTES(disk->hdr + PARTITION_CRC_OFFSET, disk->pentry_arr_crc);
         //Update the partition CRC value in the backup GPT header
@@ -1468,8 +2711,8 @@ int gpt_disk_update_crc(struct gpt_disk *disk)
         //Header CRC is calculated with its own CRC field set to 0
         PUT_4_BYTES(disk->hdr + HEADER_CRC_OFFSET, 0);
         PUT_4_BYTES(disk->hdr_bak + HEADER_CRC_OFFSET, 0);
-        disk->hdr_crc = crc32(crc_zero, disk->hdr, gpt_header_size);
-        disk->hdr_bak_crc = crc32(crc_zero, disk->hdr_bak, gpt_header_size);
+        disk->hdr_crc = gpt_crc32(crc_zero, disk->hdr, gpt_header_size);
+        disk->hdr_bak_crc = gpt_crc32(crc_zero, disk->hdr_bak, gpt_header_size);
         PUT_4_BYTES(disk->hdr + HEADER_CRC_OFFSET, disk->hdr_crc);
         PUT_4_BYTES(disk->hdr_bak + HEADER_CRC_OFFSET, disk->hdr_bak_crc);
         return 0;
@@ -1480,47 +2723,1174 @@ error:
 //Write the contents of struct gpt_disk back to the actual disk
 int gpt_disk_commit(struct gpt_disk *disk)
 {
-        int fd = -1;
+        GptApiTimer timer(GPT_API_DISK_COMMIT);
+        struct gpt_session session;
+        session.fd = -1;
         if (!disk || (disk->is_initialized != GPT_DISK_INIT_MAGIC)){
                 ALOGE("%s: Invalid args", __func__);
                 goto error;
         }
-        fd = open(disk->devpath, O_RDWR);
-        if (fd < 0) {
-                ALOGE("%s: Failed to open %s: %s",
+        if (gpt_session_open(&session, disk->devpath)) {
+                ALOGE("%s: Failed to open %s",
                                 __func__,
-                                disk->devpath,
-                                strerror(errno));
+                                disk->devpath);
                 goto error;
         }
-        //Write the primary header
-        if(gpt_set_header(disk->hdr, fd, PRIMARY_GPT) != 0) {
-                ALOGE("%s: Failed to update primary GPT header",
+        //The backup table goes out and is flushed first so that a power
+        //loss while the primary is being written still leaves one valid
+        //GPT on the disk. Entries and header of each table are contiguous
+        //and are written together.
+        //Write back the secondary partition array
+        if (gpt_set_pentry_arr(disk->hdr_bak, &session, disk->pentry_arr_bak)) {
+                ALOGE("%s: Failed to write secondary GPT partition arr",
+                                __func__);
+                goto error;
+        }
+        //Write back the secondary header
+        if(gpt_set_header(disk->hdr_bak, &session, SECONDARY_GPT) != 0 ||
+                        gpt_session_barrier(&session)) {
+                ALOGE("%s: Failed to update secondary GPT header",
                                 __func__);
                 goto error;
         }
         //Write back the primary partition array
-        if (gpt_set_pentry_arr(disk->hdr, fd, disk->pentry_arr)) {
+        if (gpt_set_pentry_arr(disk->hdr, &session, disk->pentry_arr)) {
                 ALOGE("%s: Failed to write primary GPT partition arr",
                                 __func__);
                 goto error;
         }
-        //Write back the secondary header
-        if(gpt_set_header(disk->hdr_bak, fd, SECONDARY_GPT) != 0) {
-                ALOGE("%s: Failed to update secondary GPT header",
+        //Write the primary header
+        if(gpt_set_header(disk->hdr, &session, PRIMARY_GPT) != 0 ||
+                        gpt_session_barrier(&session)) {
+                ALOGE("%s: Failed to update primary GPT header",
                                 __func__);
                 goto error;
         }
-        //Write back the secondary partition array
-        if (gpt_set_pentry_arr(disk->hdr_bak, fd, disk->pentry_arr_bak)) {
-                ALOGE("%s: Failed to write secondary GPT partition arr",
-                                __func__);
+        gpt_session_close(&session);
+        gpt_io_stats_add(&disk->io_stats, &session.stats);
+        return 0;
+error:
+        gpt_session_close(&session);
+        return -1;
+}
+
+//Requests a single disk queues on a batch at most, see
+//GptDisk::QueueCommit()
+#define GPT_URING_DISK_TAGS 6
+
+//Record the result of a batched request in the vector<int> arg, by tag
+static void gpt_uring_done(void *arg, uint64_t tag, int res)
+{
+        vector<int> *results = (vector<int> *)arg;
+
+        if (tag < results->size())
+                (*results)[tag] = res;
+}
+
+//Whether the requests a disk queued from tag on (len holds their lengths,
+//-1 past the last one) were all queued and completed in full
+static int gpt_uring_disk_ok(const vector<int> &res, const vector<int> &len,
+                uint64_t tag)
+{
+        uint32_t k;
+
+        if (len[tag] < 0)
+                return 0;
+        for (k = 0; k < GPT_URING_DISK_TAGS && len[tag + k] >= 0; k++)
+                if (res[tag + k] != len[tag + k])
+                        return 0;
+        return 1;
+}
+
+//Queue reads of both tables of the session's disk, betting on the usual
+//layout: no more than GPT_DEFAULT_PENTRIES entries, right behind the
+//primary header and right in front of the backup header. Each table is
+//then a single read into the arena. See TakeTables().
+int GptDisk::QueueTables(struct gpt_uring *ring, struct gpt_session *session,
+                uint64_t tag, int *len)
+{
+        uint32_t block_size = session->block_size;
+        size_t window = gpt_default_arr_io_size(block_size);
+        uint8_t *arena;
+
+        if (session->dev_size < 3 * block_size + 2 * window)
+                return -1;
+        arena = Reserve(block_size, 2 * block_size + 2 * window, 0);
+        if (!arena)
+                return -1;
+        len[0] = len[1] = block_size + window;
+        if (gpt_uring_queue(ring, GPT_URING_READ, session->fd, arena, len[0],
+                                block_size, tag, 0) ||
+                        gpt_uring_queue(ring, GPT_URING_READ, session->fd,
+                                arena + block_size + window, len[1],
+                                session->dev_size - block_size - window,
+                                tag + 1, 0)) {
+                len[0] = -1;
+                return -1;
+        }
+        return 0;
+}
+
+//Adopt the tables read as queued by QueueTables(). Fails if the headers do
+//not put the entries where it bet they are.
+int GptDisk::TakeTables(struct gpt_session *session)
+{
+        struct gpt_disk *disk = &disk_;
+        uint32_t block_size = session->block_size;
+        size_t window = gpt_default_arr_io_size(block_size);
+        uint8_t *arena = arena_.get();
+        uint8_t *hdr_bak = arena + block_size + 2 * window;
+        uint64_t pentries_start = 0;
+        uint32_t arr_io_size = 0;
+
+        session->stats.reads += 2;
+        session->stats.bytes_read += 2 * (block_size + window);
+        if (gpt_session_pentries(session, arena, &pentries_start,
+                                &disk->pentry_size, &disk->pentry_arr_size))
+                return -1;
+        arr_io_size = gpt_io_buf_size(block_size, disk->pentry_arr_size);
+        if (pentries_start != 2ULL * block_size || arr_io_size > window ||
+                        GET_8_BYTES(hdr_bak + PENTRIES_OFFSET) * block_size !=
+                        session->dev_size - block_size - arr_io_size)
+                return -1;
+        disk->hdr = arena;
+        disk->pentry_arr = arena + block_size;
+        disk->pentry_arr_bak = hdr_bak - arr_io_size;
+        disk->hdr_bak = hdr_bak;
+        return 0;
+}
+
+int GptDisk::LoadAll(std::span<GptDisk> disks,
+                std::span<const char *const> devs)
+{
+        uint32_t n = disks.size();
+        struct gpt_uring *ring = NULL;
+        vector<struct gpt_session> sessions;
+        vector<int> res, len;
+        uint64_t tag;
+        uint32_t i;
+        int rc = -1;
+
+        if (devs.size() != n) {
+                ALOGE("%s: Invalid arguments", __func__);
+                return -1;
+        }
+        if (n > 1 && io_uring_enabled)
+                ring = gpt_uring_create(2 * n);
+        if (!ring) {
+                for (i = 0; i < n; i++)
+                        if (disks[i].Load(devs[i]))
+                                return -1;
+                return 0;
+        }
+        sessions.resize(n);
+        for (i = 0; i < n; i++)
+                sessions[i].fd = -1;
+        res.assign(n * GPT_URING_DISK_TAGS, -ECANCELED);
+        len.assign(n * GPT_URING_DISK_TAGS, -1);
+        for (i = 0; i < n; i++) {
+                disks[i].Unload();
+                if (disks[i].Open(devs[i], &sessions[i]))
+                        goto out;
+                //Disks that cannot be batched are read synchronously below
+                disks[i].QueueTables(ring, &sessions[i],
+                                i * GPT_URING_DISK_TAGS,
+                                &len[i * GPT_URING_DISK_TAGS]);
+        }
+        //Nothing is in flight once it returns, so the disks the batch
+        //failed for can fall back to synchronous I/O on the same buffers
+        if (gpt_uring_run(ring, gpt_uring_done, &res))
+                ALOGE("%s: io_uring submission failed: %s",
+                                __func__,
+                                strerror(errno));
+        sessions[0].stats.syscalls += gpt_uring_syscalls(ring);
+        for (i = 0; i < n; i++) {
+                tag = i * GPT_URING_DISK_TAGS;
+                if ((!gpt_uring_disk_ok(res, len, tag) ||
+                                        disks[i].TakeTables(&sessions[i])) &&
+                                disks[i].LoadTables(&sessions[i])) {
+                        ALOGE("%s: Failed to read GPT from %s",
+                                        __func__,
+                                        disks[i].disk_.devpath);
+                        goto out;
+                }
+                if (disks[i].Finish(&sessions[i]))
+                        goto out;
+        }
+        rc = 0;
+out:
+        gpt_uring_destroy(ring);
+        for (i = 0; i < n; i++) {
+                gpt_session_close(&sessions[i]);
+                if (rc)
+                        disks[i].Unload();
+        }
+        return rc;
+}
+
+//Queue the writes of both tables of the session's disk as one chain of
+//linked requests, in the order gpt_disk_commit() issues them: backup
+//entries and header, flush, primary entries and header, flush. Entries and
+//header that are back to back in the arena as well as on the disk go out
+//as a single write.
+int GptDisk::QueueCommit(struct gpt_uring *ring, struct gpt_session *session,
+                uint64_t tag, int *len)
+{
+        static const enum gpt_instance order[] = { SECONDARY_GPT, PRIMARY_GPT };
+        struct gpt_write_region ops[GPT_URING_DISK_TAGS];
+        uint32_t block_size = session->block_size;
+        uint32_t num_ops = 0, arr_len, k;
+        int64_t hdr_off, arr_off;
+        uint8_t *hdr, *arr;
+
+        for (enum gpt_instance instance : order) {
+                hdr = instance == PRIMARY_GPT ? disk_.hdr : disk_.hdr_bak;
+                arr = instance == PRIMARY_GPT ? disk_.pentry_arr :
+                        disk_.pentry_arr_bak;
+                hdr_off = gpt_session_hdr_offset(session, instance);
+                arr_off = GET_8_BYTES(hdr + PENTRIES_OFFSET) * block_size;
+                arr_len = GET_4_BYTES(hdr + PARTITION_COUNT_OFFSET) *
+                        GET_4_BYTES(hdr + PENTRY_SIZE_OFFSET);
+                if (session->direct_io)
+                        arr_len = gpt_io_buf_size(block_size, arr_len);
+                if (arr_len % block_size == 0 && instance == SECONDARY_GPT &&
+                                arr + arr_len == hdr &&
+                                arr_off + arr_len == hdr_off) {
+                        ops[num_ops++] = { arr_off, arr, arr_len + block_size };
+                } else if (arr_len % block_size == 0 &&
+                                instance == PRIMARY_GPT &&
+                                hdr + block_size == arr &&
+                                hdr_off + block_size == arr_off) {
+                        ops[num_ops++] = { hdr_off, hdr, block_size + arr_len };
+                } else {
+                        ops[num_ops++] = { arr_off, arr, arr_len };
+                        ops[num_ops++] = { hdr_off, hdr, block_size };
+                }
+                //O_DSYNC writes are already durable once they complete
+                if (!session->direct_io)
+                        ops[num_ops++] = { 0, NULL, 0 };
+        }
+        for (k = 0; k < num_ops; k++) {
+                if (gpt_uring_queue(ring, ops[k].buf ? GPT_URING_WRITE :
+                                        GPT_URING_FSYNC, session->fd,
+                                        ops[k].buf, ops[k].len,
+                                        ops[k].offset, tag + k,
+                                        k + 1 < num_ops))
+                        return -1;
+                len[k] = ops[k].len;
+        }
+        return 0;
+}
+
+int GptDisk::CommitAll(std::span<GptDisk> disks)
+{
+        uint32_t n = disks.size();
+        struct gpt_uring *ring = NULL;
+        vector<struct gpt_session> sessions;
+        vector<int> res, len;
+        uint64_t tag;
+        uint32_t i, k;
+        int rc = -1;
+
+        for (i = 0; i < n; i++) {
+                if (!disks[i].loaded()) {
+                        ALOGE("%s: Invalid args", __func__);
+                        return -1;
+                }
+        }
+        if (n > 1 && io_uring_enabled)
+                ring = gpt_uring_create(n * GPT_URING_DISK_TAGS);
+        if (!ring) {
+                for (i = 0; i < n; i++)
+                        if (disks[i].Commit())
+                                return -1;
+                return 0;
+        }
+        sessions.resize(n);
+        for (i = 0; i < n; i++)
+                sessions[i].fd = -1;
+        res.assign(n * GPT_URING_DISK_TAGS, -ECANCELED);
+        len.assign(n * GPT_URING_DISK_TAGS, -1);
+        //Every disk is opened before anything is written
+        for (i = 0; i < n; i++) {
+                if (gpt_session_open(&sessions[i], disks[i].disk_.devpath)) {
+                        ALOGE("%s: Failed to open %s",
+                                        __func__,
+                                        disks[i].disk_.devpath);
+                        goto out;
+                }
+        }
+        for (i = 0; i < n; i++)
+                disks[i].QueueCommit(ring, &sessions[i],
+                                i * GPT_URING_DISK_TAGS,
+                                &len[i * GPT_URING_DISK_TAGS]);
+        //Nothing is in flight once it returns, so the disks the batch
+        //failed for can fall back to synchronous I/O on the same buffers
+        if (gpt_uring_run(ring, gpt_uring_done, &res))
+                ALOGE("%s: io_uring submission failed: %s",
+                                __func__,
+                                strerror(errno));
+        sessions[0].stats.syscalls += gpt_uring_syscalls(ring);
+        for (i = 0; i < n; i++) {
+                tag = i * GPT_URING_DISK_TAGS;
+                for (k = 0; k < GPT_URING_DISK_TAGS && len[tag + k] >= 0; k++) {
+                        if (res[tag + k] != len[tag + k])
+                                continue;
+                        if (!len[tag + k]) {
+                                sessions[i].stats.fsyncs++;
+                        } else {
+                                sessions[i].stats.writes++;
+                                sessions[i].stats.bytes_written += res[tag + k];
+                                gpt_generation++;
+                        }
+                }
+                gpt_session_close(&sessions[i]);
+                gpt_io_stats_add(&disks[i].disk_.io_stats, &sessions[i].stats);
+                if (gpt_uring_disk_ok(res, len, tag))
+                        continue;
+                //Writing the same tables again is harmless, whatever part
+                //of the chain made it to the disk
+                ALOGE("%s: Batched write of %s failed, retrying",
+                                __func__,
+                                disks[i].disk_.devpath);
+                if (disks[i].Commit())
+                        goto out;
+        }
+        rc = 0;
+out:
+        gpt_uring_destroy(ring);
+        for (i = 0; i < n; i++)
+                gpt_session_close(&sessions[i]);
+        return rc;
+}
+
+//Map len bytes of the disk at offset through the mapping slot idx of view,
+//replacing what the slot mapped before. Returns a pointer to offset.
+static const uint8_t* gpt_view_map(struct gpt_view *view, int fd, int idx,
+                uint64_t offset, uint64_t len)
+{
+        uint64_t page = sysconf(_SC_PAGESIZE);
+        uint64_t start = offset / page * page;
+        void *p;
+
+        if (view->map[idx])
+                munmap(view->map[idx], view->map_len[idx]);
+        view->map[idx] = NULL;
+        view->map_len[idx] = 0;
+        p = mmap(NULL, offset + len - start, PROT_READ, MAP_SHARED, fd, start);
+        if (p == MAP_FAILED) {
+                ALOGE("%s: Failed to map %s at %" PRIu64 ": %s",
+                                __func__,
+                                view->devpath,
+                                start,
+                                strerror(errno));
+                return NULL;
+        }
+        view->map[idx] = p;
+        view->map_len[idx] = offset + len - start;
+        return (const uint8_t *)p + (offset - start);
+}
+
+//Check signature and CRC of a GPT header without copying it
+static int gpt_view_hdr_valid(const uint8_t *hdr, uint32_t block_size)
+{
+        uint32_t size = GET_4_BYTES(hdr + HEADER_SIZE_OFFSET);
+
+        if (memcmp(hdr, GPT_SIGNATURE, strlen(GPT_SIGNATURE)) ||
+                        size < HEADER_CRC_OFFSET + 4 ||
+                        size > block_size)
+                return 0;
+        return gpt_hdr_calc_crc(hdr, size) ==
+                GET_4_BYTES(hdr + HEADER_CRC_OFFSET);
+}
+
+//Map one GPT table of the session's disk into view and validate it. The
+//header is mapped together with the entries normally next to it: behind
+//the primary header, in front of the backup one. Entries found elsewhere
+//get the mapping extended to them.
+static int gpt_view_load_table(struct gpt_view *view,
+                const struct gpt_session *session,
+                enum gpt_instance instance)
+{
+        uint32_t block_size = session->block_size;
+        int64_t hdr_offset = gpt_session_hdr_offset(session, instance);
+        int64_t hdr_bak_offset = gpt_session_hdr_offset(session, SECONDARY_GPT);
+        uint64_t map_offset, map_len, map_end;
+        uint64_t pentries_start;
+        uint32_t pentry_size, arr_size;
+        const uint8_t *base, *hdr, *arr;
+
+        if (instance == PRIMARY_GPT) {
+                map_offset = 0;
+                map_len = 2ULL * block_size;
+        } else {
+                map_len = ((uint64_t)view->pentry_arr_size[PRIMARY_GPT] +
+                                block_size - 1) / block_size * block_size;
+                map_offset = hdr_offset - map_len;
+                map_len += block_size;
+        }
+        base = gpt_view_map(view, session->fd, instance, map_offset, map_len);
+        if (!base)
+                return -1;
+        hdr = base + (hdr_offset - map_offset);
+        view->map_hdr_offset[instance] = hdr - (const uint8_t *)view->map[instance];
+        if (!gpt_view_hdr_valid(hdr, block_size)) {
+                ALOGE("%s: %s GPT header of %s is invalid",
+                                __func__,
+                                instance == PRIMARY_GPT ? "Primary" : "Backup",
+                                view->devpath);
+                return -1;
+        }
+        pentries_start = GET_8_BYTES(hdr + PENTRIES_OFFSET) * block_size;
+        pentry_size = GET_4_BYTES(hdr + PENTRY_SIZE_OFFSET);
+        arr_size = GET_4_BYTES(hdr + PARTITION_COUNT_OFFSET) * pentry_size;
+        if (pentry_size < PTN_ENTRY_SIZE || !arr_size ||
+                        pentries_start < 2ULL * block_size ||
+                        pentries_start + arr_size > (uint64_t)hdr_bak_offset) {
+                ALOGE("%s: Invalid partition entry array in %s",
+                                __func__,
+                                view->devpath);
+                return -1;
+        }
+        if (pentries_start < map_offset ||
+                        pentries_start + arr_size > map_offset + map_len) {
+                map_end = max<uint64_t>(pentries_start + arr_size,
+                                hdr_offset + block_size);
+                map_offset = min<uint64_t>(pentries_start, hdr_offset);
+                map_len = map_end - map_offset;
+                base = gpt_view_map(view, session->fd, instance, map_offset,
+                                map_len);
+                if (!base)
+                        return -1;
+                hdr = base + (hdr_offset - map_offset);
+                view->map_hdr_offset[instance] =
+                        hdr - (const uint8_t *)view->map[instance];
+        }
+        arr = base + (pentries_start - map_offset);
+        if (gpt_crc32(0, arr, arr_size) !=
+                        GET_4_BYTES(hdr + PARTITION_CRC_OFFSET)) {
+                ALOGE("%s: %s partition entry array CRC of %s is invalid",
+                                __func__,
+                                instance == PRIMARY_GPT ? "Primary" : "Backup",
+                                view->devpath);
+                return -1;
+        }
+        view->hdr[instance] = hdr;
+        view->pentry_arr[instance] = arr;
+        view->pentry_arr_size[instance] = arr_size;
+        view->pentry_size[instance] = pentry_size;
+        return 0;
+}
+
+//Map the GPT of the disk holding partition dev. Both tables are validated
+//here, once, so lookups afterwards are plain memory reads.
+int gpt_view_open(struct gpt_view *view, const char *dev)
+{
+        GptApiTimer timer(GPT_API_VIEW_OPEN);
+        struct gpt_session session;
+        int rc_primary, rc_backup;
+
+        session.fd = -1;
+        if (!view || !dev) {
+                ALOGE("%s: Invalid arguments", __func__);
+                return -1;
+        }
+        memset(view, 0, sizeof(struct gpt_view));
+        if (get_dev_path_from_partition_name(dev,
+                                view->devpath,
+                                sizeof(view->devpath)) != 0) {
+                ALOGE("%s: Failed to resolve path for %s",
+                                __func__,
+                                dev);
+                goto error;
+        }
+        if (gpt_session_open(&session, view->devpath)) {
+                ALOGE("%s: Failed to open %s",
+                                __func__,
+                                view->devpath);
+                goto error;
+        }
+        view->block_size = session.block_size;
+        rc_primary = gpt_view_load_table(view, &session, PRIMARY_GPT);
+        rc_backup = gpt_view_load_table(view, &session, SECONDARY_GPT);
+        //The mappings outlive the descriptor
+        gpt_session_close(&session);
+        if (rc_primary && rc_backup) {
+                ALOGE("%s: No valid GPT on %s",
+                                __func__,
+                                view->devpath);
                 goto error;
         }
-        close(fd);
         return 0;
 error:
-        if (fd >= 0)
-                close(fd);
+        gpt_session_close(&session);
+        gpt_view_close(view);
         return -1;
 }
+
+//Get pointer to partition entry partname, or its backup twin, from a view
+const uint8_t* gpt_view_get_pentry(const struct gpt_view *view,
+                const char *partname,
+                enum gpt_instance instance)
+{
+        const uint8_t *arr;
+        uint32_t off;
+
+        if (!view || !partname ||
+                        (instance != PRIMARY_GPT && instance != SECONDARY_GPT)) {
+                ALOGE("%s: Invalid argument", __func__);
+                return NULL;
+        }
+        arr = view->pentry_arr[instance];
+        if (!arr)
+                return NULL;
+        for (off = 0; off + view->pentry_size[instance] <=
+                        view->pentry_arr_size[instance];
+                        off += view->pentry_size[instance]) {
+                if (gpt_pentry_name_matches(arr + off, partname))
+                        return arr + off;
+        }
+        return NULL;
+}
+
+//Release the mappings of a view
+void gpt_view_close(struct gpt_view *view)
+{
+        int i;
+
+        if (!view)
+                return;
+        for (i = PRIMARY_GPT; i <= SECONDARY_GPT; i++) {
+                if (view->map[i])
+                        munmap(view->map[i], view->map_len[i]);
+                view->map[i] = NULL;
+                view->map_len[i] = 0;
+                view->map_hdr_offset[i] = 0;
+                view->hdr[i] = NULL;
+                view->pentry_arr[i] = NULL;
+        }
+}
+
+uint64_t gpt_utils_get_generation()
+{
+        return gpt_generation;
+}
+
+static mutex slot_snapshot_lock;
+static unique_ptr<gpt_slot_snapshot> slot_snapshot;
+
+//Read the start of both GPT headers of a LUN the snapshot depends on
+static int gpt_slot_lun_read_hdrs(const gpt_slot_lun &lun,
+                uint8_t hdr[2][HEADER_CRC_OFFSET + 4])
+{
+        struct gpt_io_stats stats;
+        ssize_t size = sizeof(lun.hdr_start[0]);
+        int64_t offset;
+        int fd, i;
+        int rc = -1;
+
+        memset(&stats, 0, sizeof(stats));
+        stats.syscalls++;
+        fd = open(lun.devpath, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                ALOGE("%s: Failed to open %s: %s",
+                                __func__,
+                                lun.devpath,
+                                strerror(errno));
+                goto out;
+        }
+        for (i = PRIMARY_GPT; i <= SECONDARY_GPT; i++) {
+                offset = i == PRIMARY_GPT ? lun.block_size :
+                        lun.dev_size - lun.block_size;
+                stats.syscalls++;
+                stats.reads++;
+                if (pread(fd, hdr[i], size, offset) != size)
+                        goto out;
+                stats.bytes_read += size;
+        }
+        rc = 0;
+out:
+        if (fd >= 0) {
+                close(fd);
+                stats.syscalls++;
+        }
+        gpt_stats_add_io(&stats);
+        return rc;
+}
+
+//Remember where the GPT headers of a LUN the snapshot depends on are and
+//how they started, as a view of the LUN mapped them
+static int gpt_slot_lun_init(gpt_slot_lun &lun, const struct gpt_view *view)
+{
+        struct gpt_io_stats stats;
+        off_t size;
+        int fd, i;
+
+        strlcpy(lun.devpath, view->devpath, sizeof(lun.devpath));
+        lun.block_size = view->block_size;
+        memset(&stats, 0, sizeof(stats));
+        stats.syscalls++;
+        fd = open(lun.devpath, O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+                gpt_stats_add_io(&stats);
+                return -1;
+        }
+        size = lseek(fd, 0, SEEK_END);
+        close(fd);
+        stats.syscalls += 2;
+        gpt_stats_add_io(&stats);
+        if (size < 0)
+                return -1;
+        lun.dev_size = size;
+        for (i = PRIMARY_GPT; i <= SECONDARY_GPT; i++)
+                memcpy(lun.hdr_start[i], (const uint8_t *)view->map[i] +
+                                view->map_hdr_offset[i],
+                                sizeof(lun.hdr_start[i]));
+        return 0;
+}
+
+//Whether neither gpt-utils nor anybody else wrote a GPT the snapshot
+//depends on since it was taken. Any change to the entries changes the
+//header CRC, the failsafe update also flips the header signature. Only
+//the headers are read, nothing stays open or mapped between calls.
+static int gpt_slot_snapshot_fresh(const gpt_slot_snapshot &snap)
+{
+        uint8_t hdr[2][HEADER_CRC_OFFSET + 4];
+
+        if (snap.generation != gpt_generation)
+                return 0;
+        for (const gpt_slot_lun &lun : snap.luns) {
+                if (gpt_slot_lun_read_hdrs(lun, hdr) ||
+                                memcmp(hdr, lun.hdr_start, sizeof(hdr)))
+                        return 0;
+        }
+        return 1;
+}
+
+static unique_ptr<gpt_slot_snapshot> gpt_build_slot_snapshot()
+{
+        unique_ptr<gpt_slot_snapshot> snap(new (std::nothrow) gpt_slot_snapshot);
+        const char ptn_list[][MAX_GPT_NAME_SIZE] = { AB_PTN_LIST };
+        const char *suffix[] = { AB_SLOT_A_SUFFIX, AB_SLOT_B_SUFFIX };
+        map<string, vector<string>> ptn_map;
+        struct gpt_view view;
+        vector<string> ptns;
+        const uint8_t *pentry;
+        uint32_t i;
+
+        if (!snap)
+                return NULL;
+        //Writes racing with the scan leave it stale right away
+        snap->generation = gpt_generation;
+        for (i = 0; i < ARRAY_SIZE(ptn_list); i++) {
+                ptns.push_back(string(ptn_list[i]) + suffix[0]);
+                ptns.push_back(string(ptn_list[i]) + suffix[1]);
+        }
+        if (gpt_utils_get_partition_map(ptns, ptn_map))
+                return NULL;
+        //The GPTs are only mapped while the snapshot is taken
+        for (auto &it : ptn_map) {
+                snap->luns.emplace_back();
+                if (gpt_view_open(&view, it.second[0].c_str()) ||
+                                !view.map[PRIMARY_GPT] ||
+                                !view.map[SECONDARY_GPT] ||
+                                gpt_slot_lun_init(snap->luns.back(), &view)) {
+                        gpt_view_close(&view);
+                        ALOGE("%s: Failed to map GPT of %s",
+                                        __func__,
+                                        it.first.c_str());
+                        return NULL;
+                }
+                for (const string &ptn : it.second) {
+                        //Slot attributes live in the primary table, the
+                        //backup is only looked at while it is invalid
+                        pentry = gpt_view_get_pentry(&view, ptn.c_str(),
+                                        PRIMARY_GPT);
+                        if (!pentry && !view.pentry_arr[PRIMARY_GPT])
+                                pentry = gpt_view_get_pentry(&view,
+                                                ptn.c_str(), SECONDARY_GPT);
+                        if (pentry)
+                                snap->attr[ptn] = pentry[AB_FLAG_OFFSET];
+                }
+                gpt_view_close(&view);
+        }
+        return snap;
+}
+
+int gpt_utils_get_ab_attr(const char *partname, uint8_t *attr)
+{
+        unordered_map<string, uint8_t>::const_iterator it;
+
+        if (!partname || !attr) {
+                ALOGE("%s: Invalid argument", __func__);
+                return -1;
+        }
+        GptApiTimer timer(GPT_API_GET_AB_ATTR);
+        lock_guard<mutex> lock(slot_snapshot_lock);
+        if (slot_snapshot && gpt_slot_snapshot_fresh(*slot_snapshot)) {
+                gpt_stats_add_api_hit(GPT_API_GET_AB_ATTR);
+        } else {
+                slot_snapshot.reset();
+                slot_snapshot = gpt_build_slot_snapshot();
+                if (!slot_snapshot) {
+                        ALOGE("%s: Failed to snapshot slot attributes",
+                                        __func__);
+                        return -1;
+                }
+        }
+        it = slot_snapshot->attr.find(partname);
+        if (it == slot_snapshot->attr.end())
+                return -1;
+        *attr = it->second;
+        return 0;
+}
+
+//Apply op to the A/B attribute byte attr of a partition entry, slot_entry
+//telling whether the entry belongs to the slot op is about
+static void gpt_slot_op_apply(uint8_t *attr, enum gpt_slot_op op,
+                int slot_entry)
+{
+        switch (op) {
+        case GPT_SLOT_SET_ACTIVE:
+                *attr = slot_entry ? AB_SLOT_ACTIVE_VAL : AB_SLOT_INACTIVE_VAL;
+                break;
+        case GPT_SLOT_MARK_SUCCESSFUL:
+                *attr |= AB_PARTITION_ATTR_BOOT_SUCCESSFUL;
+                break;
+        case GPT_SLOT_MARK_UNBOOTABLE:
+                *attr |= AB_PARTITION_ATTR_UNBOOTABLE;
+                break;
+        }
+}
+
+//Apply op to the partitions ptns, all on the loaded disk
+static int gpt_slot_update_disk(GptDisk &disk, const vector<string> &ptns,
+                const char *slot, enum gpt_slot_op op)
+{
+        std::span<uint8_t> pentry;
+        size_t slot_len = strlen(slot);
+        int slot_entry, i;
+
+        for (const string &ptn : ptns) {
+                slot_entry = ptn.size() > slot_len &&
+                        !ptn.compare(ptn.size() - slot_len, slot_len, slot);
+                for (i = PRIMARY_GPT; i <= SECONDARY_GPT; i++) {
+                        pentry = disk.Find(ptn.c_str(), (enum gpt_instance)i);
+                        if (pentry.empty()) {
+                                ALOGE("%s: Failed to get %s entry of %s",
+                                                __func__,
+                                                i == PRIMARY_GPT ?
+                                                "primary" : "backup",
+                                                ptn.c_str());
+                                return -1;
+                        }
+                        gpt_slot_op_apply(pentry.data() + AB_FLAG_OFFSET, op,
+                                        slot_entry);
+                        gpt_disk_mark_pentry_dirty(disk.c_disk(),
+                                        pentry.data());
+                }
+        }
+        if (disk.UpdateCrc()) {
+                ALOGE("%s: Failed to update CRCs of %s",
+                                __func__,
+                                disk.c_disk()->devpath);
+                return -1;
+        }
+        return 0;
+}
+
+int gpt_utils_set_slot_attr(const char *slot, enum gpt_slot_op op)
+{
+        GptApiTimer timer(GPT_API_SET_SLOT_ATTR);
+        const char ptn_list[][MAX_GPT_NAME_SIZE] = { AB_PTN_LIST };
+        const char *other = NULL;
+        map<string, vector<string>> ptn_map;
+        vector<string> ptns;
+        vector<const char *> devs;
+        string xbl;
+        uint32_t i;
+
+        if (!slot || (op != GPT_SLOT_SET_ACTIVE &&
+                                op != GPT_SLOT_MARK_SUCCESSFUL &&
+                                op != GPT_SLOT_MARK_UNBOOTABLE)) {
+                ALOGE("%s: Invalid argument", __func__);
+                return -1;
+        }
+        if (!strcmp(slot, AB_SLOT_A_SUFFIX))
+                other = AB_SLOT_B_SUFFIX;
+        else if (!strcmp(slot, AB_SLOT_B_SUFFIX))
+                other = AB_SLOT_A_SUFFIX;
+        else {
+                ALOGE("%s: Invalid slot %s", __func__, slot);
+                return -1;
+        }
+        for (i = 0; i < ARRAY_SIZE(ptn_list); i++) {
+                ptns.push_back(string(ptn_list[i]) + slot);
+                //Activating a slot deactivates the other one
+                if (op == GPT_SLOT_SET_ACTIVE)
+                        ptns.push_back(string(ptn_list[i]) + other);
+        }
+        if (gpt_utils_get_partition_map(ptns, ptn_map))
+                return -1;
+        //All disks are updated in memory before any of them is written
+        for (auto &it : ptn_map)
+                devs.push_back(it.second[0].c_str());
+        vector<GptDisk> disks(devs.size());
+        if (GptDisk::LoadAll(disks, devs)) {
+                ALOGE("%s: Failed to get disk info", __func__);
+                return -1;
+        }
+        i = 0;
+        for (auto &it : ptn_map) {
+                if (gpt_slot_update_disk(disks[i++], it.second, slot, op)) {
+                        ALOGE("%s: Failed to update slot %s on %s",
+                                        __func__,
+                                        slot,
+                                        it.first.c_str());
+                        return -1;
+                }
+        }
+        if (GptDisk::CommitAll(disks)) {
+                ALOGE("%s: Failed to write back slot %s", __func__, slot);
+                return -1;
+        }
+        if (op == GPT_SLOT_SET_ACTIVE && gpt_utils_is_ufs_device()) {
+                xbl = string(PTN_XBL) + slot;
+                if (gpt_topology_lun(*gpt_get_topology(), xbl.c_str()) &&
+                                gpt_utils_set_xbl_boot_partition(
+                                        !strcmp(slot, AB_SLOT_A_SUFFIX) ?
+                                        NORMAL_BOOT : BACKUP_BOOT)) {
+                        ALOGE("%s: Failed to switch boot LUN to %s",
+                                        __func__,
+                                        xbl.c_str());
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+//Read the header of one GPT table of the session's disk and check it, then
+//the partition entries array it points at if that lies on the disk
+static void gpt_scan_read_table(struct gpt_session *session,
+                enum gpt_instance instance, struct gpt_scan_table *table)
+{
+        uint32_t block_size = session->block_size;
+        int64_t hdr_offset = gpt_session_hdr_offset(session, instance);
+        int64_t hdr_bak_offset = gpt_session_hdr_offset(session, SECONDARY_GPT);
+        uint64_t alt_lba = gpt_session_hdr_offset(session,
+                        instance == PRIMARY_GPT ? SECONDARY_GPT : PRIMARY_GPT) /
+                block_size;
+        uint64_t first_usable, last_usable, pentries_start, arr_size;
+        uint32_t hdr_size;
+        uint8_t *hdr;
+
+        hdr = table->hdr = gpt_io_buf_alloc(block_size, block_size);
+        if (!hdr || blk_rw(session, 0, hdr_offset, hdr, block_size)) {
+                table->errors |= GPT_SCAN_IO_ERROR;
+                return;
+        }
+        if (memcmp(hdr, GPT_SIGNATURE, strlen(GPT_SIGNATURE)))
+                table->errors |= GPT_SCAN_BAD_SIGNATURE;
+        hdr_size = GET_4_BYTES(hdr + HEADER_SIZE_OFFSET);
+        if (hdr_size < GPT_HEADER_MIN_SIZE || hdr_size > block_size) {
+                table->errors |= GPT_SCAN_BAD_HDR_FIELDS | GPT_SCAN_BAD_HDR_CRC;
+                return;
+        }
+        if (gpt_hdr_calc_crc(hdr, hdr_size) !=
+                        GET_4_BYTES(hdr + HEADER_CRC_OFFSET))
+                table->errors |= GPT_SCAN_BAD_HDR_CRC;
+
+        first_usable = GET_8_BYTES(hdr + FIRST_USABLE_LBA_OFFSET);
+        last_usable = GET_8_BYTES(hdr + LAST_USABLE_LBA_OFFSET);
+        pentries_start = GET_8_BYTES(hdr + PENTRIES_OFFSET);
+        table->pentry_size = GET_4_BYTES(hdr + PENTRY_SIZE_OFFSET);
+        arr_size = (uint64_t)GET_4_BYTES(hdr + PARTITION_COUNT_OFFSET) *
+                table->pentry_size;
+        //Headers point at themselves and at each other, and the usable
+        //range lies between the two tables
+        if (GET_8_BYTES(hdr + PRIMARY_HEADER_OFFSET) !=
+                        (uint64_t)hdr_offset / block_size ||
+                        GET_8_BYTES(hdr + BACKUP_HEADER_OFFSET) != alt_lba ||
+                        first_usable < 2 || first_usable > last_usable ||
+                        last_usable >= (uint64_t)hdr_bak_offset / block_size)
+                table->errors |= GPT_SCAN_BAD_HDR_FIELDS;
+        if (table->pentry_size < PTN_ENTRY_SIZE ||
+                        table->pentry_size % PTN_ENTRY_SIZE || !arr_size ||
+                        arr_size > GPT_SCAN_MAX_PENTRIES_SIZE ||
+                        pentries_start < 2 ||
+                        pentries_start * block_size + arr_size >
+                        (uint64_t)hdr_bak_offset) {
+                table->errors |= GPT_SCAN_BAD_HDR_FIELDS;
+                return;
+        }
+        //Entries sit outside of the usable range, on their own side of it
+        if (instance == PRIMARY_GPT ?
+                        pentries_start * block_size + arr_size >
+                        first_usable * block_size :
+                        pentries_start <= last_usable)
+                table->errors |= GPT_SCAN_BAD_HDR_FIELDS;
+
+        table->arr_size = arr_size;
+        table->arr = gpt_io_buf_alloc(block_size, arr_size);
+        if (!table->arr || blk_rw(session, 0, pentries_start * block_size,
+                                table->arr, arr_size)) {
+                table->errors |= GPT_SCAN_IO_ERROR;
+                free(table->arr);
+                table->arr = NULL;
+                return;
+        }
+        if (gpt_crc32(0, table->arr, arr_size) !=
+                        GET_4_BYTES(hdr + PARTITION_CRC_OFFSET))
+                table->errors |= GPT_SCAN_BAD_PENTRIES_CRC;
+}
+
+//Nonzero if the len bytes at a and b differ. Words are XORed and ORed
+//together without an early exit, which the compiler turns into a vector
+//loop.
+static inline uint64_t gpt_scan_differ(const uint8_t *a, const uint8_t *b,
+                uint32_t len)
+{
+        uint64_t x, y, acc = 0;
+        uint32_t i;
+
+        for (i = 0; i + sizeof(x) <= len; i += sizeof(x)) {
+                memcpy(&x, a + i, sizeof(x));
+                memcpy(&y, b + i, sizeof(y));
+                acc |= x ^ y;
+        }
+        for (; i < len; i++)
+                acc |= a[i] ^ b[i];
+        return acc;
+}
+
+//GPT_SCAN_DIFF_* bits of the fields in which two entries differ
+static uint32_t gpt_scan_diff_fields(const uint8_t *a, const uint8_t *b,
+                uint32_t pentry_size)
+{
+        uint32_t fields = 0;
+
+        if (gpt_scan_differ(a + TYPE_GUID_OFFSET, b + TYPE_GUID_OFFSET,
+                                TYPE_GUID_SIZE))
+                fields |= GPT_SCAN_DIFF_TYPE_GUID;
+        if (gpt_scan_differ(a + UNIQUE_GUID_OFFSET, b + UNIQUE_GUID_OFFSET,
+                                FIRST_LBA_OFFSET - UNIQUE_GUID_OFFSET))
+                fields |= GPT_SCAN_DIFF_UNIQUE_GUID;
+        if (gpt_scan_differ(a + FIRST_LBA_OFFSET, b + FIRST_LBA_OFFSET,
+                                ATTRIBUTE_FLAG_OFFSET - FIRST_LBA_OFFSET))
+                fields |= GPT_SCAN_DIFF_LBA;
+        if (gpt_scan_differ(a + ATTRIBUTE_FLAG_OFFSET, b + ATTRIBUTE_FLAG_OFFSET,
+                                PARTITION_NAME_OFFSET - ATTRIBUTE_FLAG_OFFSET))
+                fields |= GPT_SCAN_DIFF_ATTR;
+        if (gpt_scan_differ(a + PARTITION_NAME_OFFSET, b + PARTITION_NAME_OFFSET,
+                                MAX_GPT_NAME_SIZE))
+                fields |= GPT_SCAN_DIFF_NAME;
+        if (gpt_scan_differ(a + PTN_ENTRY_SIZE, b + PTN_ENTRY_SIZE,
+                                pentry_size - PTN_ENTRY_SIZE))
+                fields |= GPT_SCAN_DIFF_RESERVED;
+        return fields;
+}
+
+//Whether entry index differs between the tables only because a failsafe
+//update swapped it with its backup twin: the backup table holds the twin's
+//primary entry there and the other way around
+static int gpt_scan_is_swap(const uint8_t *arr, const uint8_t *arr_bak,
+                uint32_t arr_size, uint32_t pentry_size, uint32_t index,
+                gpt_name_index &names)
+{
+        const uint8_t *pentry = arr + index * pentry_size;
+        const uint8_t *pentry_bak = arr_bak + index * pentry_size;
+        char name[MAX_GPT_NAME_SIZE];
+        char name_bak[MAX_GPT_NAME_SIZE];
+        size_t len, len_bak, ext = strlen(BAK_PTN_NAME_EXT);
+        gpt_name_index::const_iterator it;
+
+        gpt_pentry_get_name(pentry, name);
+        gpt_pentry_get_name(pentry_bak, name_bak);
+        len = strlen(name);
+        len_bak = strlen(name_bak);
+        //One name is the other with BAK_PTN_NAME_EXT appended
+        if (!(len == len_bak + ext && !strncmp(name, name_bak, len_bak) &&
+                                !strcmp(name + len_bak, BAK_PTN_NAME_EXT)) &&
+                        !(len_bak == len + ext && !strncmp(name, name_bak, len) &&
+                                !strcmp(name_bak + len, BAK_PTN_NAME_EXT)))
+                return 0;
+        if (names.empty())
+                gpt_index_names(arr, arr_size, pentry_size, names);
+        it = names.find(name_bak);
+        if (it == names.end())
+                return 0;
+        for (uint32_t off : it->second) {
+                if (off == index * pentry_size)
+                        continue;
+                if (!gpt_scan_differ(arr + off, pentry_bak, pentry_size) &&
+                                !gpt_scan_differ(arr_bak + off, pentry,
+                                        pentry_size))
+                        return 1;
+        }
+        return 0;
+}
+
+//Diff the primary entries against the backup ones into result
+static void gpt_scan_diff_tables(const struct gpt_scan_table *table,
+                struct gpt_scan_lun *result)
+{
+        const uint8_t *arr = table[PRIMARY_GPT].arr;
+        const uint8_t *arr_bak = table[SECONDARY_GPT].arr;
+        uint32_t pentry_size = table[PRIMARY_GPT].pentry_size;
+        uint32_t arr_size = min(table[PRIMARY_GPT].arr_size,
+                        table[SECONDARY_GPT].arr_size);
+        struct gpt_scan_mismatch *m;
+        gpt_name_index names;
+        uint32_t off, fields, expected;
+
+        //Both tables normally are identical, settle that in one memcmp
+        if (!memcmp(arr, arr_bak, arr_size))
+                return;
+        for (off = 0; off + pentry_size <= arr_size; off += pentry_size) {
+                if (!gpt_scan_differ(arr + off, arr_bak + off, pentry_size))
+                        continue;
+                fields = gpt_scan_diff_fields(arr + off, arr_bak + off,
+                                pentry_size);
+                expected = gpt_scan_is_swap(arr, arr_bak, arr_size,
+                                pentry_size, off / pentry_size, names);
+                if (result->num_mismatches < GPT_SCAN_MAX_MISMATCHES) {
+                        m = &result->mismatches[result->num_mismatches];
+                        m->index = off / pentry_size;
+                        m->fields = fields;
+                        m->expected = expected;
+                        gpt_pentry_get_name(arr + off, m->name);
+                        gpt_pentry_get_name(arr_bak + off, m->name_bak);
+                }
+                result->num_mismatches++;
+                result->num_expected += expected;
+        }
+}
+
+int gpt_utils_scan_lun(const char *devpath, struct gpt_scan_lun *result)
+{
+        GptApiTimer timer(GPT_API_SCAN_LUN);
+        struct gpt_session session;
+        struct gpt_scan_table table[2];
+        uint64_t start = gpt_time_us();
+        const uint8_t *hdr, *hdr_bak;
+        int i, rc = -1;
+
+        session.fd = -1;
+        memset(table, 0, sizeof(table));
+        if (!devpath || !result) {
+                ALOGE("%s: Invalid arguments", __func__);
+                return -1;
+        }
+        memset(result, 0, sizeof(struct gpt_scan_lun));
+        snprintf(result->devpath, sizeof(result->devpath), "%s", devpath);
+        if (gpt_session_open(&session, devpath)) {
+                ALOGE("%s: Failed to open %s", __func__, devpath);
+                result->table_errors[PRIMARY_GPT] = GPT_SCAN_IO_ERROR;
+                result->table_errors[SECONDARY_GPT] = GPT_SCAN_IO_ERROR;
+                goto error;
+        }
+        result->block_size = session.block_size;
+        for (i = PRIMARY_GPT; i <= SECONDARY_GPT; i++) {
+                gpt_scan_read_table(&session, (enum gpt_instance)i, &table[i]);
+                result->table_errors[i] = table[i].errors;
+        }
+        hdr = table[PRIMARY_GPT].hdr;
+        hdr_bak = table[SECONDARY_GPT].hdr;
+        if (!(table[PRIMARY_GPT].errors & GPT_SCAN_IO_ERROR) &&
+                        !(table[SECONDARY_GPT].errors & GPT_SCAN_IO_ERROR) &&
+                        (memcmp(hdr + DISK_GUID_OFFSET,
+                                hdr_bak + DISK_GUID_OFFSET, TYPE_GUID_SIZE) ||
+                         memcmp(hdr + FIRST_USABLE_LBA_OFFSET,
+                                 hdr_bak + FIRST_USABLE_LBA_OFFSET,
+                                 LAST_USABLE_LBA_OFFSET + 8 -
+                                 FIRST_USABLE_LBA_OFFSET) ||
+                         memcmp(hdr + PARTITION_COUNT_OFFSET,
+                                 hdr_bak + PARTITION_COUNT_OFFSET, 8)))
+                result->hdr_mismatch = 1;
+        if (table[PRIMARY_GPT].arr && table[SECONDARY_GPT].arr)
+                gpt_scan_diff_tables(table, result);
+        rc = result->table_errors[PRIMARY_GPT] ||
+                result->table_errors[SECONDARY_GPT] ||
+                result->hdr_mismatch ||
+                result->num_mismatches != result->num_expected;
+        if (rc)
+                ALOGE("%s: %s: errors %#x/%#x, header mismatch %u, %u of %u entry mismatches unexpected",
+                                __func__,
+                                devpath,
+                                result->table_errors[PRIMARY_GPT],
+                                result->table_errors[SECONDARY_GPT],
+                                result->hdr_mismatch,
+                                result->num_mismatches - result->num_expected,
+                                result->num_mismatches);
+error:
+        for (i = PRIMARY_GPT; i <= SECONDARY_GPT; i++) {
+                free(table[i].hdr);
+                free(table[i].arr);
+        }
+        gpt_session_close(&session);
+        result->elapsed_us = gpt_time_us() - start;
+        return rc;
+}
+
+static void *scan_lun_worker(void *arg)
+{
+        struct scan_work *work = (struct scan_work *)arg;
+        uint32_t i;
+
+        while ((i = work->next++) < work->luns->size())
+                work->rcode[i] = gpt_utils_scan_lun((*work->luns)[i].c_str(),
+                                &work->results[i]);
+        return NULL;
+}
+
+int gpt_utils_scan(struct gpt_scan_lun *luns, uint32_t max_luns,
+                uint32_t *num_luns)
+{
+        GptApiTimer timer(GPT_API_SCAN);
+        shared_ptr<const gpt_topology> topo = gpt_get_topology();
+        pthread_t workers[MAX_UPDATE_WORKERS - 1];
+        uint32_t i, num_workers = 0;
+        struct scan_work work;
+        vector<string> lun_list;
+        int problems = 0;
+
+        if (!luns || !num_luns) {
+                ALOGE("%s: Invalid arguments", __func__);
+                return -1;
+        }
+        if (topo->is_ufs) {
+                for (auto &it : topo->ptn_lun)
+                        lun_list.push_back(it.second);
+                sort(lun_list.begin(), lun_list.end());
+                lun_list.erase(unique(lun_list.begin(), lun_list.end()),
+                                lun_list.end());
+        } else {
+                lun_list.push_back(topo->blk_dev);
+        }
+        if (lun_list.size() > min<uint32_t>(max_luns, GPT_SCAN_MAX_LUNS))
+                lun_list.resize(min<uint32_t>(max_luns, GPT_SCAN_MAX_LUNS));
+        work.luns = &lun_list;
+        work.results = luns;
+        work.next = 0;
+        //Each LUN is a handful of small reads, one thread per LUN at most
+        for (i = 0; i + 1 < min<size_t>(lun_list.size(), MAX_UPDATE_WORKERS);
+                        i++) {
+                if (pthread_create(&workers[num_workers], NULL,
+                                        scan_lun_worker, &work)) {
+                        ALOGE("%s: Failed to start worker: %s",
+                                        __func__,
+                                        strerror(errno));
+                        break;
+                }
+                num_workers++;
+        }
+        scan_lun_worker(&work);
+        for (i = 0; i < num_workers; i++)
+                pthread_join(workers[i], NULL);
+
+        for (i = 0; i < lun_list.size(); i++)
+                if (work.rcode[i])
+                        problems++;
+        *num_luns = lun_list.size();
+        return problems;
+}
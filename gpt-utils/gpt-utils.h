@@ -47,10 +47,12 @@ extern "C" {
 #define BACKUP_HEADER_OFFSET        32
 #define FIRST_USABLE_LBA_OFFSET     40
 #define LAST_USABLE_LBA_OFFSET      48
+#define DISK_GUID_OFFSET            56
 #define PENTRIES_OFFSET             72
 #define PARTITION_COUNT_OFFSET      80
 #define PENTRY_SIZE_OFFSET          84
 #define PARTITION_CRC_OFFSET        88
+#define GPT_HEADER_MIN_SIZE         92
 
 #define TYPE_GUID_OFFSET            0
 #define TYPE_GUID_SIZE              16
@@ -104,11 +106,93 @@ enum gpt_instance {
 	SECONDARY_GPT
 };
 
+//Slot operations applied by gpt_utils_set_slot_attr
+enum gpt_slot_op {
+	//Make the slot active and the other one inactive
+	GPT_SLOT_SET_ACTIVE = 0,
+	//Set AB_PARTITION_ATTR_BOOT_SUCCESSFUL on the slot
+	GPT_SLOT_MARK_SUCCESSFUL,
+	//Set AB_PARTITION_ATTR_UNBOOTABLE on the slot
+	GPT_SLOT_MARK_UNBOOTABLE
+};
+
 enum boot_chain {
 	NORMAL_BOOT = 0,
 	BACKUP_BOOT
 };
 
+//Name and GUID lookup tables of a gpt_disk
+struct gpt_disk_index;
+//Per-entry CRC state of a gpt_disk
+struct gpt_disk_crc;
+//Owner of a gpt_disk and of its buffers, see gpt-disk.h
+class GptDisk;
+
+//I/O cost of a sequence of GPT operations
+struct gpt_io_stats {
+	//System calls issued, including open/ioctl/close
+	uint32_t syscalls;
+	//Read and write calls (a vectored call counts once)
+	uint32_t reads;
+	uint32_t writes;
+	//Durability barriers (fdatasync)
+	uint32_t fsyncs;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+};
+
+//Public calls whose time gpt_utils_get_stats accounts for, indexes of
+//gpt_utils_stats.api
+enum gpt_api {
+	GPT_API_PREPARE_BOOT_UPDATE = 0,
+	GPT_API_DISK_GET_DISK_INFO,
+	GPT_API_DISK_COMMIT,
+	GPT_API_VIEW_OPEN,
+	GPT_API_GET_AB_ATTR,
+	GPT_API_SET_SLOT_ATTR,
+	GPT_API_SET_XBL_BOOT_PARTITION,
+	GPT_API_GET_PARTITION_MAP,
+	GPT_API_GET_IO_GEOMETRY,
+	GPT_API_SCAN_LUN,
+	GPT_API_SCAN,
+	GPT_API_VERIFY,
+	GPT_API_COUNT
+};
+
+struct gpt_api_stats {
+	uint64_t calls;
+	//Wall clock time spent in the call, including nested public calls
+	//(eg: gpt_utils_set_xbl_boot_partition under
+	//gpt_utils_set_slot_attr), which are accounted for on their own too.
+	uint64_t time_ns;
+	//Calls answered from an in-process cache, also counted in calls and
+	//time_ns: gpt_utils_get_ab_attr calls that found its snapshot fresh
+	uint64_t hits;
+};
+
+//Cost counters of gpt-utils, see gpt_utils_get_stats
+struct gpt_utils_stats {
+	//System calls issued on GPT block devs, including open/ioctl/close
+	uint64_t syscalls;
+	//Read and write calls (a vectored call counts once)
+	uint64_t reads;
+	uint64_t writes;
+	//Durability barriers (fdatasync)
+	uint64_t fsyncs;
+	uint64_t bytes_read;
+	uint64_t bytes_written;
+	//ioctls: block dev geometry, UFS queries and boot LUN switches
+	uint64_t ioctls;
+	struct gpt_api_stats api[GPT_API_COUNT];
+};
+
+//A disk and the GPT read from it. Only gpt_disk_alloc() hands these out:
+//the struct is embedded in a GptDisk, which owns the buffers hdr, hdr_bak
+//and both pentry arrays point into. A gpt_disk declared or allocated by the
+//caller is rejected by gpt_disk_get_disk_info() and gpt_disk_free(), and
+//its buffers must never be passed to free(). The layout differs from the
+//one with separately malloc()ed buffers from io_stats on, code built
+//against that older header must be rebuilt.
 struct gpt_disk {
 	//GPT primary header
 	uint8_t *hdr;
@@ -135,25 +219,273 @@ struct gpt_disk {
 	//Block size of disk
 	uint32_t block_size;
 	uint32_t is_initialized;
+	//I/O done on the disk by gpt_disk_get_disk_info and gpt_disk_commit
+	struct gpt_io_stats io_stats;
+	//Partition lookup tables, built when the entries arrays are loaded
+	struct gpt_disk_index *index;
+	//Entry CRCs and entries marked dirty, see gpt_disk_mark_pentry_dirty
+	struct gpt_disk_crc *crc;
+	//Object holding this struct; hdr, hdr_bak and both pentry arrays
+	//point into its arena
+	GptDisk *owner;
+};
+
+//A write queued on a gpt_session
+struct gpt_write_region {
+	int64_t offset;
+	uint8_t *buf;
+	uint32_t len;
+};
+#define GPT_MAX_PENDING_WRITES 8
+
+//An open handle on the block dev holding a GPT. The device is opened once
+//and its geometry cached so that every header and entry array access
+//afterwards is a single positioned read or write. Writes are batched and
+//only flushed at gpt_session_barrier().
+struct gpt_session {
+	//Descriptor for the block dev
+	int fd;
+	//Block size of disk
+	uint32_t block_size;
+	//Size of the disk in bytes
+	uint64_t dev_size;
+	//Path to block dev representing the disk
+	char devpath[PATH_MAX];
+	//Writes queued since the last submission
+	struct gpt_write_region pending[GPT_MAX_PENDING_WRITES];
+	uint32_t num_pending;
+	//Set when data was written since the last barrier
+	uint32_t needs_sync;
+	//Opened with O_DIRECT | O_DSYNC, see gpt_utils_set_direct_io
+	uint32_t direct_io;
+	//I/O issued through the session
+	struct gpt_io_stats stats;
+};
+
+//Preferred I/O sizes of a disk
+struct gpt_io_geometry {
+	//Block size of disk
+	uint32_t block_size;
+	//Smallest write the disk takes without an internal read-modify-write,
+	//a multiple of block_size
+	uint32_t write_unit;
+	//Erase block size, 0 if the disk does not report one
+	uint32_t erase_unit;
+	//Size to split large sequential transfers (eg: partition copies) in,
+	//a multiple of write_unit and erase_unit
+	uint32_t chunk_size;
+};
+
+//Read-only view of the GPT of a disk. Headers and partition entries arrays
+//point straight into mappings of the disk instead of being copied, per
+//table indexed by enum gpt_instance. A table whose signature, header CRC
+//or entries CRC does not check out has NULL pointers.
+struct gpt_view {
+	//Path to block dev representing the disk
+	char devpath[PATH_MAX];
+	//Block size of disk
+	uint32_t block_size;
+	//GPT headers
+	const uint8_t *hdr[2];
+	//Partition entries arrays
+	const uint8_t *pentry_arr[2];
+	//Size of the pentry arrays
+	uint32_t pentry_arr_size[2];
+	//Size of each element in the pentry arrays
+	uint32_t pentry_size[2];
+	//Mappings of the start and of the end of the disk
+	void *map[2];
+	size_t map_len[2];
+	//Offset of the GPT header within each mapping, also set when the
+	//table it heads is invalid
+	size_t map_hdr_offset[2];
+};
+
+//Problems gpt_utils_scan finds on a GPT table, bits of
+//gpt_scan_lun.table_errors
+#define GPT_SCAN_IO_ERROR           (1 << 0)
+#define GPT_SCAN_BAD_SIGNATURE      (1 << 1)
+#define GPT_SCAN_BAD_HDR_CRC        (1 << 2)
+//Header LBAs, usable range or entries location inconsistent
+#define GPT_SCAN_BAD_HDR_FIELDS     (1 << 3)
+#define GPT_SCAN_BAD_PENTRIES_CRC   (1 << 4)
+
+//Fields in which a primary and a backup partition entry differ, bits of
+//gpt_scan_mismatch.fields
+#define GPT_SCAN_DIFF_TYPE_GUID     (1 << 0)
+#define GPT_SCAN_DIFF_UNIQUE_GUID   (1 << 1)
+#define GPT_SCAN_DIFF_LBA           (1 << 2)
+#define GPT_SCAN_DIFF_ATTR          (1 << 3)
+#define GPT_SCAN_DIFF_NAME          (1 << 4)
+#define GPT_SCAN_DIFF_RESERVED      (1 << 5)
+
+#define GPT_SCAN_MAX_MISMATCHES     32
+//Most LUNs gpt_utils_scan reports on
+#define GPT_SCAN_MAX_LUNS           26
+
+//A partition entry that differs between the primary and the backup table
+struct gpt_scan_mismatch {
+	//Index of the entry in the arrays
+	uint32_t index;
+	//GPT_SCAN_DIFF_* bits
+	uint32_t fields;
+	//Set when the difference is a primary <-> backup swap done by a
+	//failsafe update (eg: xbl in one table where xblbak is in the other)
+	uint32_t expected;
+	//Partition names in the primary and in the backup table
+	char name[MAX_GPT_NAME_SIZE / 2 + 1];
+	char name_bak[MAX_GPT_NAME_SIZE / 2 + 1];
+};
+
+//Integrity report of the GPT of one disk
+struct gpt_scan_lun {
+	//Path to block dev representing the disk
+	char devpath[PATH_MAX];
+	//Block size of disk
+	uint32_t block_size;
+	//GPT_SCAN_* problems of each table, indexed by enum gpt_instance
+	uint32_t table_errors[2];
+	//Set when the headers disagree on the disk GUID, the usable range or
+	//the entries layout
+	uint32_t hdr_mismatch;
+	//Entries that differ between the tables, including expected ones
+	uint32_t num_mismatches;
+	uint32_t num_expected;
+	//The first GPT_SCAN_MAX_MISMATCHES of them
+	struct gpt_scan_mismatch mismatches[GPT_SCAN_MAX_MISMATCHES];
+	//Time the scan of the disk took
+	uint64_t elapsed_us;
 };
 
 /******************************************************************************
  * FUNCTION PROTOTYPES
  ******************************************************************************/
 int prepare_boot_update(enum boot_update_stage stage);
+//Same as prepare_boot_update, adding the I/O done by the stage to stats
+int prepare_boot_update_with_stats(enum boot_update_stage stage,
+		struct gpt_io_stats *stats);
 //GPT disk methods
 struct gpt_disk* gpt_disk_alloc();
-//Free previously allocated gpt_disk struct
+//Free a gpt_disk struct and its buffers, disk must come from gpt_disk_alloc
 void gpt_disk_free(struct gpt_disk *disk);
 //Get the details of the disk holding the partition whose name
-//is passed in via dev
+//is passed in via dev. disk must come from gpt_disk_alloc. It can be
+//refreshed by calling this again, which reuses its buffers.
 int gpt_disk_get_disk_info(const char *dev, struct gpt_disk *disk);
 
+//Open the block dev at devpath and cache its block size and size
+int gpt_session_open(struct gpt_session *session, const char *devpath);
+
+//Get the preferred I/O sizes of the disk at devpath. On UFS they come from
+//the geometry and unit descriptors of its LUN, everywhere else they are
+//derived from the block size alone. Results are cached per disk.
+int gpt_utils_get_io_geometry(const char *devpath,
+		struct gpt_io_geometry *geo);
+
+//Have sessions opened from now on bypass the page cache. GPT reads then
+//always come from the disk and each write is made durable on its own
+//instead of by an fdatasync() of the whole block dev. Devices that do not
+//support O_DIRECT fall back to buffered I/O.
+void gpt_utils_set_direct_io(int enable);
+
+//Have GPTs that are loaded or committed several disks at once go through
+//io_uring instead of one blocking system call after another, see
+//GptDisk::LoadAll. Kernels or processes without io_uring keep using the
+//synchronous path.
+void gpt_utils_set_io_uring(int enable);
+
+//Write out everything queued on the session and flush it to the disk.
+//Writes queued afterwards are never reordered ahead of the barrier.
+int gpt_session_barrier(struct gpt_session *session);
+
+//Close a session previously opened with gpt_session_open. Writes queued
+//since the last barrier are dropped.
+void gpt_session_close(struct gpt_session *session);
+
 //Get pointer to partition entry from a allocated gpt_disk structure
 uint8_t* gpt_disk_get_pentry(struct gpt_disk *disk,
 		const char *partname,
 		enum gpt_instance instance);
 
+//Get pointer to the first partition entry whose GUID matches guid.
+//guid_offset selects the GUID compared: TYPE_GUID_OFFSET or
+//UNIQUE_GUID_OFFSET.
+uint8_t* gpt_disk_get_pentry_by_guid(struct gpt_disk *disk,
+		const uint8_t *guid,
+		uint32_t guid_offset,
+		enum gpt_instance instance);
+
+//Map the GPT of the disk holding the partition whose name is passed in via
+//dev and check both tables. Fails if neither table is valid. Needs no heap
+//memory; the view must be released with gpt_view_close.
+int gpt_view_open(struct gpt_view *view, const char *dev);
+
+//Get pointer to partition entry from a view, NULL if the partition or a
+//valid table is not there
+const uint8_t* gpt_view_get_pentry(const struct gpt_view *view,
+		const char *partname,
+		enum gpt_instance instance);
+
+//Unmap a view opened with gpt_view_open
+void gpt_view_close(struct gpt_view *view);
+
+//Get the A/B attribute byte (AB_PARTITION_ATTR_* bits at AB_FLAG_OFFSET)
+//of partname, one of the AB_PTN_LIST partitions with its slot suffix (eg:
+//boot_a). Answers come from an in-process snapshot of all such partitions
+//across the LUNs, rebuilt when gpt-utils wrote to a disk since (see
+//gpt_utils_get_generation) or when a GPT header changed underneath it.
+//Every call reads the start of both GPT headers of those LUNs to tell,
+//nothing is kept open or mapped in between.
+int gpt_utils_get_ab_attr(const char *partname, uint8_t *attr);
+
+//Apply op to the slot with suffix slot (AB_SLOT_A_SUFFIX or
+//AB_SLOT_B_SUFFIX) of every AB_PTN_LIST partition present, in both GPT
+//tables. Partitions are grouped by the disk they sit on, and each disk is
+//loaded, has its CRCs updated and is committed once. Activating a slot on
+//UFS also switches the boot LUN to the matching xbl.
+int gpt_utils_set_slot_attr(const char *slot, enum gpt_slot_op op);
+
+//Check both GPT headers, both partition entries array CRCs and the header
+//fields of the disk at devpath, and diff the primary entries against the
+//backup ones. Returns 1 if a problem other than an expected failsafe swap
+//was found, 0 if the GPT is clean and -1 if the disk could not be opened.
+int gpt_utils_scan_lun(const char *devpath, struct gpt_scan_lun *result);
+
+//gpt_utils_scan_lun on every LUN of the boot device (the eMMC device on
+//non UFS targets), in parallel. At most max_luns results are filled in and
+//their number is returned via num_luns. Returns the number of LUNs with
+//problems, or -1 on failure.
+int gpt_utils_scan(struct gpt_scan_lun *luns, uint32_t max_luns,
+		uint32_t *num_luns);
+
+//Counter bumped every time gpt-utils writes GPT data to a disk
+uint64_t gpt_utils_get_generation();
+
+//Get the cost counters of the calling thread or, when all_threads is set,
+//their sum over every thread that used gpt-utils, including the ones that
+//exited since. Counting is always on and costs a couple of relaxed
+//atomic adds per system call; block dev I/O is accounted for when its
+//GPT session is closed.
+int gpt_utils_get_stats(struct gpt_utils_stats *stats, int all_threads);
+
+//Zero the counters of the calling thread or of every thread. Counts other
+//threads add while all_threads counters are being reset are either zeroed
+//along with the rest or kept, a reset is never undone.
+void gpt_utils_reset_stats(int all_threads);
+
+//Name of the public call api is about, eg: "gpt_utils_set_slot_attr"
+const char* gpt_utils_api_name(enum gpt_api api);
+
+//Rebuild the partition lookup tables of the disk. Lookups already notice
+//entries that moved; call this after renaming entries or changing GUIDs.
+int gpt_disk_reindex(struct gpt_disk *disk);
+
+//Note that the partition entry at pentry (primary or backup array) was
+//modified. When entries were marked, gpt_disk_update_crc only rehashes
+//the marked ones instead of both whole arrays, so a caller that marks
+//entries must mark every entry it modified.
+int gpt_disk_mark_pentry_dirty(struct gpt_disk *disk, const uint8_t *pentry);
+
 //Update the crc fields of the modified disk structure
 int gpt_disk_update_crc(struct gpt_disk *disk);
 
@@ -163,6 +495,20 @@ int gpt_disk_commit(struct gpt_disk *disk);
 //Return if the current device is UFS based or not
 int gpt_utils_is_ufs_device();
 
+//The boot device type and the partition -> LUN -> scsi generic node
+//mapping are read once and served from memory afterwards. Drop that
+//snapshot so that the next call rescans, eg: after partitions were added.
+void gpt_utils_invalidate_topology();
+
+//Run gpt-utils against disk image files instead of the boot device.
+//root holds one GPT image per LUN (eg: root/sda, root/sdb; root/mmcblk0
+//when is_ufs is 0) and, for UFS, a by-name/ directory of symlinks from
+//partition names to the LUN images they sit on. The UFS boot LUN switch
+//writes the LUN id to root/boot_lun. Images are addressed in sector_size
+//blocks. A NULL root switches back to the real boot device.
+int gpt_utils_set_image_backend(const char *root, uint32_t sector_size,
+		int is_ufs);
+
 //Swtich betwieen using either the primary or the backup
 //boot LUN for boot. This is required since UFS boot partitions
 //cannot have a backup GPT which is what we use for failsafe
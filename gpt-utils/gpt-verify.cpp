@@ -0,0 +1,475 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define _LARGEFILE64_SOURCE /* enable pread64() */
+
+/******************************************************************************
+ * INCLUDE SECTION
+ ******************************************************************************/
+#include <ctype.h>
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+#include <openssl/sha.h>
+
+#define LOG_TAG "gpt-utils"
+#include <cutils/log.h>
+#include "gpt-verify.h"
+#include "gpt-crc32.h"
+#include "gpt-stats.h"
+
+using namespace std;
+
+/******************************************************************************
+ * DEFINE SECTION
+ ******************************************************************************/
+//Upper bound on the disks hashed concurrently, one worker each
+#define GPT_VERIFY_MAX_WORKERS 8
+//Reads are whole multiples of the chunk size of the disk (see
+//gpt_utils_get_io_geometry) of at least this many bytes
+#define GPT_VERIFY_READ_SIZE (4 * 1024 * 1024)
+//Alignment of the read buffers, good for O_DIRECT on any block size
+#define GPT_VERIFY_BUF_ALIGN 4096
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+//Partitions of entries sitting on one disk
+struct verify_disk {
+        string devpath;
+        vector<struct gpt_verify_entry *> entries;
+};
+
+struct verify_work {
+        vector<verify_disk> disks;
+        //Next disk to hand out
+        atomic<uint32_t> next;
+};
+
+//Running digest of one of the gpt_hash_algo
+struct verify_hash {
+        enum gpt_hash_algo algo;
+        SHA256_CTX sha256;
+        uint32_t crc;
+};
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+uint32_t gpt_hash_size(enum gpt_hash_algo algo)
+{
+        switch (algo) {
+        case GPT_HASH_SHA256:
+                return SHA256_DIGEST_LENGTH;
+        case GPT_HASH_CRC32:
+                return sizeof(uint32_t);
+        }
+        return 0;
+}
+
+const char *gpt_hash_name(enum gpt_hash_algo algo)
+{
+        switch (algo) {
+        case GPT_HASH_SHA256:
+                return "sha256";
+        case GPT_HASH_CRC32:
+                return "crc32";
+        }
+        return "unknown";
+}
+
+static void verify_hash_init(struct verify_hash *h, enum gpt_hash_algo algo)
+{
+        h->algo = algo;
+        if (algo == GPT_HASH_SHA256)
+                SHA256_Init(&h->sha256);
+        else
+                h->crc = 0;
+}
+
+static void verify_hash_update(struct verify_hash *h, const uint8_t *buf,
+                size_t len)
+{
+        if (h->algo == GPT_HASH_SHA256)
+                SHA256_Update(&h->sha256, buf, len);
+        else
+                h->crc = gpt_crc32(h->crc, buf, len);
+}
+
+//Big endian CRC, the way it is written out in hex
+static void verify_hash_final(struct verify_hash *h, uint8_t *digest)
+{
+        if (h->algo == GPT_HASH_SHA256) {
+                SHA256_Final(digest, &h->sha256);
+                return;
+        }
+        digest[0] = h->crc >> 24;
+        digest[1] = h->crc >> 16;
+        digest[2] = h->crc >> 8;
+        digest[3] = h->crc;
+}
+
+static int verify_parse_hex(const char *hex, uint8_t *out, uint32_t len)
+{
+        uint32_t i;
+
+        if (strlen(hex) != 2 * len)
+                return -1;
+        for (i = 0; i < 2 * len; i++) {
+                int c = tolower((unsigned char)hex[i]);
+                int v;
+
+                if (c >= '0' && c <= '9')
+                        v = c - '0';
+                else if (c >= 'a' && c <= 'f')
+                        v = c - 'a' + 10;
+                else
+                        return -1;
+                if (i & 1)
+                        out[i / 2] |= v;
+                else
+                        out[i / 2] = v << 4;
+        }
+        return 0;
+}
+
+//Whether name already carries a slot suffix
+static int verify_has_slot(const char *name)
+{
+        size_t len = strlen(name);
+        size_t suffix_len = strlen(AB_SLOT_A_SUFFIX);
+
+        return len > suffix_len &&
+                        (!strcmp(name + len - suffix_len, AB_SLOT_A_SUFFIX) ||
+                        !strcmp(name + len - suffix_len, AB_SLOT_B_SUFFIX));
+}
+
+int gpt_verify_load_manifest(const char *path, const char *slot,
+                struct gpt_verify_entry **entries, uint32_t *num_entries)
+{
+        vector<struct gpt_verify_entry> list;
+        char line[512], name[MAX_GPT_NAME_SIZE], algo[16], hex[80];
+        unsigned long long length;
+        struct gpt_verify_entry e;
+        uint32_t line_no = 0;
+        FILE *f;
+        int n;
+
+        if (!path || !entries || !num_entries) {
+                ALOGE("%s: Invalid arguments", __func__);
+                return -1;
+        }
+        f = fopen(path, "re");
+        if (!f) {
+                ALOGE("%s: Failed to open %s: %s", __func__, path,
+                                strerror(errno));
+                return -1;
+        }
+        while (fgets(line, sizeof(line), f)) {
+                line_no++;
+                n = sscanf(line, " %35s %15s %79s %llu", name, algo, hex,
+                                &length);
+                if (n <= 0 || name[0] == '#')
+                        continue;
+                memset(&e, 0, sizeof(e));
+                //algo and hex are only set if sscanf got that far
+                if (n < 3)
+                        n = 0;
+                else if (!strcmp(algo, gpt_hash_name(GPT_HASH_SHA256)))
+                        e.algo = GPT_HASH_SHA256;
+                else if (!strcmp(algo, gpt_hash_name(GPT_HASH_CRC32)))
+                        e.algo = GPT_HASH_CRC32;
+                else
+                        n = 0;
+                if (!n || verify_parse_hex(hex, e.expected,
+                                gpt_hash_size(e.algo)) ||
+                                snprintf(e.name, sizeof(e.name), "%s%s", name,
+                                slot && !verify_has_slot(name) ? slot : "") >=
+                                (int)sizeof(e.name)) {
+                        ALOGE("%s: %s:%u: expected <partition> "
+                                        "<sha256|crc32> <digest> [<bytes>]",
+                                        __func__, path, line_no);
+                        fclose(f);
+                        return -1;
+                }
+                e.has_expected = 1;
+                e.length = n > 3 ? length : 0;
+                list.push_back(e);
+        }
+        fclose(f);
+        *num_entries = list.size();
+        *entries = (struct gpt_verify_entry *)calloc(list.size() + 1,
+                        sizeof(e));
+        if (!*entries)
+                return -1;
+        if (!list.empty())
+                memcpy(*entries, list.data(), list.size() * sizeof(e));
+        return 0;
+}
+
+int gpt_verify_slot_entries(const char *slot, enum gpt_hash_algo algo,
+                struct gpt_verify_entry **entries, uint32_t *num_entries)
+{
+        const char ptn_list[][MAX_GPT_NAME_SIZE] = { AB_PTN_LIST };
+        map<string, vector<string>> ptn_map;
+        vector<string> ptns;
+        uint32_t i = 0;
+
+        if (!slot || !entries || !num_entries || !gpt_hash_size(algo)) {
+                ALOGE("%s: Invalid arguments", __func__);
+                return -1;
+        }
+        for (const char *ptn : ptn_list)
+                ptns.push_back(string(ptn) + slot);
+        if (gpt_utils_get_partition_map(ptns, ptn_map))
+                return -1;
+        //Only the partitions the device has, in AB_PTN_LIST order
+        *num_entries = 0;
+        for (auto &it : ptn_map)
+                *num_entries += it.second.size();
+        *entries = (struct gpt_verify_entry *)calloc(*num_entries + 1,
+                        sizeof(struct gpt_verify_entry));
+        if (!*entries)
+                return -1;
+        for (const string &ptn : ptns) {
+                for (auto &it : ptn_map) {
+                        if (find(it.second.begin(), it.second.end(), ptn) ==
+                                        it.second.end())
+                                continue;
+                        strlcpy((*entries)[i].name, ptn.c_str(),
+                                        sizeof((*entries)[i].name));
+                        (*entries)[i].algo = algo;
+                        i++;
+                }
+        }
+        return 0;
+}
+
+//Read len bytes at offset, falling back to buffered I/O when the disk
+//turns out not to support direct I/O of that buffer
+static ssize_t verify_read(int *fd, const char *devpath, uint8_t *buf,
+                size_t len, off64_t offset, struct gpt_io_stats *io)
+{
+        ssize_t r;
+
+        io->syscalls++;
+        r = pread64(*fd, buf, len, offset);
+        if (r < 0 && errno == EINVAL &&
+                        (fcntl(*fd, F_GETFL) & O_DIRECT)) {
+                close(*fd);
+                io->syscalls += 4;
+                *fd = open(devpath, O_RDONLY | O_CLOEXEC);
+                if (*fd < 0)
+                        return -1;
+                r = pread64(*fd, buf, len, offset);
+        }
+        if (r > 0) {
+                io->reads++;
+                io->bytes_read += r;
+        }
+        return r;
+}
+
+//Hash e, which spans [start, start + size) of the disk open on *fd
+static void verify_entry(int *fd, const char *devpath, uint8_t *buf,
+                size_t buf_size, uint32_t block_size, uint64_t start,
+                uint64_t size, struct gpt_verify_entry *e,
+                struct gpt_io_stats *io)
+{
+        uint64_t begin = gpt_stats_now_ns();
+        uint64_t len = e->length ? e->length : size;
+        uint64_t done = 0;
+        struct verify_hash h;
+        size_t want;
+        ssize_t r;
+
+        if (len > size) {
+                ALOGE("%s: %s is %" PRIu64 " bytes, shorter than the %" PRIu64
+                                " to hash", __func__, e->name, size, len);
+                e->status = GPT_VERIFY_MISMATCH;
+                return;
+        }
+        verify_hash_init(&h, e->algo);
+        while (done < len) {
+                //Whole blocks, the tail of the last one is not hashed
+                want = min<uint64_t>(buf_size,
+                                (len - done + block_size - 1) / block_size * block_size);
+                r = verify_read(fd, devpath, buf, want, start + done, io);
+                if (r <= 0) {
+                        ALOGE("%s: Failed to read %s at %" PRIu64 ": %s",
+                                        __func__, e->name, done,
+                                        r < 0 ? strerror(errno) : "end of disk");
+                        e->status = GPT_VERIFY_IO_ERROR;
+                        return;
+                }
+                r = min<uint64_t>(r, len - done);
+                verify_hash_update(&h, buf, r);
+                done += r;
+        }
+        verify_hash_final(&h, e->digest);
+        e->bytes = done;
+        e->elapsed_us = (gpt_stats_now_ns() - begin) / 1000;
+        e->status = e->has_expected &&
+                        memcmp(e->digest, e->expected, gpt_hash_size(e->algo)) ?
+                        GPT_VERIFY_MISMATCH : GPT_VERIFY_OK;
+}
+
+static void verify_disk_entries(verify_disk &disk)
+{
+        struct gpt_io_stats io = {};
+        struct gpt_io_geometry geo;
+        struct gpt_view view;
+        const uint8_t *pentry;
+        uint8_t *buf = NULL;
+        size_t buf_size;
+        int fd = -1;
+
+        for (struct gpt_verify_entry *e : disk.entries) {
+                e->status = GPT_VERIFY_IO_ERROR;
+                strlcpy(e->devpath, disk.devpath.c_str(), sizeof(e->devpath));
+        }
+        if (gpt_view_open(&view, disk.entries[0]->name)) {
+                ALOGE("%s: Failed to read the GPT of %s", __func__,
+                                disk.devpath.c_str());
+                return;
+        }
+        if (gpt_utils_get_io_geometry(disk.devpath.c_str(), &geo))
+                goto out;
+        buf_size = (GPT_VERIFY_READ_SIZE + geo.chunk_size - 1) /
+                        geo.chunk_size * geo.chunk_size;
+        if (posix_memalign((void **)&buf, GPT_VERIFY_BUF_ALIGN, buf_size)) {
+                buf = NULL;
+                goto out;
+        }
+        io.syscalls++;
+        fd = open(disk.devpath.c_str(), O_RDONLY | O_DIRECT | O_CLOEXEC);
+        if (fd < 0) {
+                io.syscalls++;
+                fd = open(disk.devpath.c_str(), O_RDONLY | O_CLOEXEC);
+        }
+        if (fd < 0) {
+                ALOGE("%s: Failed to open %s: %s", __func__,
+                                disk.devpath.c_str(), strerror(errno));
+                goto out;
+        }
+        for (struct gpt_verify_entry *e : disk.entries) {
+                uint64_t first, last;
+
+                pentry = gpt_view_get_pentry(&view, e->name, PRIMARY_GPT);
+                if (!pentry)
+                        pentry = gpt_view_get_pentry(&view, e->name,
+                                        SECONDARY_GPT);
+                if (!pentry) {
+                        e->status = GPT_VERIFY_NOT_FOUND;
+                        continue;
+                }
+                first = le64toh(*(const uint64_t *)(pentry + FIRST_LBA_OFFSET));
+                last = le64toh(*(const uint64_t *)(pentry + LAST_LBA_OFFSET));
+                if (last < first) {
+                        e->status = GPT_VERIFY_NOT_FOUND;
+                        continue;
+                }
+                verify_entry(&fd, disk.devpath.c_str(), buf, buf_size,
+                                view.block_size, first * view.block_size,
+                                (last - first + 1) * view.block_size, e, &io);
+                if (fd < 0)
+                        break;
+        }
+out:
+        if (fd >= 0) {
+                close(fd);
+                io.syscalls++;
+        }
+        gpt_stats_add_io(&io);
+        free(buf);
+        gpt_view_close(&view);
+}
+
+static void *verify_worker(void *arg)
+{
+        struct verify_work *work = (struct verify_work *)arg;
+        uint32_t i;
+
+        while ((i = work->next++) < work->disks.size())
+                verify_disk_entries(work->disks[i]);
+        return NULL;
+}
+
+int gpt_verify_run(struct gpt_verify_entry *entries, uint32_t num_entries)
+{
+        GptApiTimer timer(GPT_API_VERIFY);
+        map<string, vector<string>> ptn_map;
+        pthread_t workers[GPT_VERIFY_MAX_WORKERS - 1];
+        map<string, uint32_t> disk_index;
+        uint32_t i, num_workers = 0;
+        struct verify_work work;
+        vector<string> ptns;
+        int problems = 0;
+
+        if (!entries && num_entries) {
+                ALOGE("%s: Invalid arguments", __func__);
+                return -1;
+        }
+        for (i = 0; i < num_entries; i++) {
+                entries[i].status = GPT_VERIFY_NOT_FOUND;
+                entries[i].bytes = entries[i].elapsed_us = 0;
+                entries[i].devpath[0] = '\0';
+                if (!gpt_hash_size(entries[i].algo)) {
+                        ALOGE("%s: Unknown digest for %s", __func__,
+                                        entries[i].name);
+                        return -1;
+                }
+                ptns.push_back(entries[i].name);
+        }
+        if (num_entries && gpt_utils_get_partition_map(ptns, ptn_map))
+                return -1;
+        //Group the entries by disk, keeping their order within each disk
+        for (auto &it : ptn_map) {
+                disk_index[it.first] = work.disks.size();
+                work.disks.push_back({it.first, {}});
+        }
+        for (i = 0; i < num_entries; i++) {
+                for (auto &it : ptn_map) {
+                        if (find(it.second.begin(), it.second.end(), ptns[i]) !=
+                                        it.second.end()) {
+                                work.disks[disk_index[it.first]].entries.push_back(
+                                                &entries[i]);
+                                break;
+                        }
+                }
+        }
+        work.next = 0;
+        //Hashing a disk is a long sequential read, a thread for each
+        for (i = 0; i + 1 < min<size_t>(work.disks.size(),
+                        GPT_VERIFY_MAX_WORKERS); i++) {
+                if (pthread_create(&workers[num_workers], NULL, verify_worker,
+                                &work)) {
+                        ALOGE("%s: Failed to start worker: %s", __func__,
+                                        strerror(errno));
+                        break;
+                }
+                num_workers++;
+        }
+        verify_worker(&work);
+        for (i = 0; i < num_workers; i++)
+                pthread_join(workers[i], NULL);
+
+        for (i = 0; i < num_entries; i++)
+                if (entries[i].status != GPT_VERIFY_OK)
+                        problems++;
+        return problems;
+}
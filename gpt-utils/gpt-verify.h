@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef __GPT_VERIFY_H__
+#define __GPT_VERIFY_H__
+#include <limits.h>
+#include <stdint.h>
+#include "gpt-utils.h"
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+//Digests gpt_verify_run can compute
+enum gpt_hash_algo {
+	//SHA-256, on the CPU's SHA-2 instructions when it has them
+	GPT_HASH_SHA256 = 0,
+	//gpt_crc32(), several times faster; catches corruption, not tampering
+	GPT_HASH_CRC32
+};
+#define GPT_HASH_MAX_SIZE           32
+
+//Outcome of verifying a partition, gpt_verify_entry.status
+#define GPT_VERIFY_OK               0
+#define GPT_VERIFY_MISMATCH         1
+#define GPT_VERIFY_NOT_FOUND        2
+#define GPT_VERIFY_IO_ERROR         3
+
+//A partition to hash and the digest it should have
+struct gpt_verify_entry {
+	//Partition name, with its slot suffix if it has one
+	char name[MAX_GPT_NAME_SIZE / 2 + 1];
+	enum gpt_hash_algo algo;
+	//Bytes to hash from the start of the partition, 0 for all of it
+	uint64_t length;
+	//Expected digest, only compared when has_expected is set
+	uint8_t expected[GPT_HASH_MAX_SIZE];
+	uint32_t has_expected;
+	//GPT_VERIFY_* outcome, filled in by gpt_verify_run
+	int status;
+	uint8_t digest[GPT_HASH_MAX_SIZE];
+	//Bytes hashed and the time reading and hashing them took
+	uint64_t bytes;
+	uint64_t elapsed_us;
+	//Block dev of the disk holding the partition
+	char devpath[PATH_MAX];
+};
+
+//Size of the digests of algo, 0 for an unknown one
+uint32_t gpt_hash_size(enum gpt_hash_algo algo);
+//Name of algo in manifests, eg: "sha256"
+const char* gpt_hash_name(enum gpt_hash_algo algo);
+
+//Read the manifest at path, one partition per line:
+//  <partition> <sha256|crc32> <hex digest> [<bytes>]
+//Empty lines and lines starting with '#' are skipped. When slot is not
+//NULL, it is appended to names that have no slot suffix (eg: boot becomes
+//boot_b). The entries are allocated in *entries and must be released with
+//free().
+int gpt_verify_load_manifest(const char *path, const char *slot,
+		struct gpt_verify_entry **entries, uint32_t *num_entries);
+
+//Entries for every AB_PTN_LIST partition of slot present on the device,
+//without expected digests, eg: to write a manifest. Release with free().
+int gpt_verify_slot_entries(const char *slot, enum gpt_hash_algo algo,
+		struct gpt_verify_entry **entries, uint32_t *num_entries);
+
+//Hash the partitions of entries and compare them against the expected
+//digests. Partitions are located through the GPT of the disk they sit on
+//and read straight from that disk in large aligned chunks, bypassing the
+//page cache where it supports it, with one worker per disk. Returns the
+//number of entries whose status is not GPT_VERIFY_OK, or -1 on failure.
+int gpt_verify_run(struct gpt_verify_entry *entries, uint32_t num_entries);
+#ifdef __cplusplus
+}
+#endif
+#endif /* __GPT_VERIFY_H__ */
@@ -31,6 +31,7 @@
 #define LOG_TAG "recovery_ufs"
 
 #include "recovery-ufs-bsg.h"
+#include "gpt-stats.h"
 
 #ifndef _BSG_FRAMEWORK_KERNEL_HEADERS
 #ifndef _GENERIC_KERNEL_HEADERS
@@ -42,57 +43,115 @@
 //Size of the buffer that needs to be passed to the UFS ioctl
 #define UFS_ATTR_DATA_SIZE          32
 
+/* System calls of the current transport, see ufs_set_transport() */
+static struct ufs_transport ufs_transport_ops;
+
+static int ufs_open(const char *path, int flags)
+{
+    if (ufs_transport_ops.open)
+        return ufs_transport_ops.open(ufs_transport_ops.ctx, path, flags);
+    return open(path, flags);
+}
+
+static int ufs_close(int fd)
+{
+    if (ufs_transport_ops.close)
+        return ufs_transport_ops.close(ufs_transport_ops.ctx, fd);
+    return close(fd);
+}
+
+static int ufs_ioctl(int fd, unsigned long request, void *arg)
+{
+    gpt_stats_add_ioctl();
+    if (ufs_transport_ops.ioctl)
+        return ufs_transport_ops.ioctl(ufs_transport_ops.ctx, fd, request,
+                arg);
+    return ioctl(fd, request, arg);
+}
+
 #ifdef _BSG_FRAMEWORK_KERNEL_HEADERS
-static int get_ufs_bsg_dev(void)
-{
-    DIR *dir;
-    struct dirent *ent;
-    int ret = -ENODEV;
-
-    if ((dir = opendir ("/dev")) != NULL) {
-        /* read all the files and directories within directory */
-        while ((ent = readdir(dir)) != NULL) {
-            if (!strcmp(ent->d_name, "ufs-bsg") ||
-                    !strcmp(ent->d_name, "ufs-bsg0")) {
-                snprintf(ufs_bsg_dev, FNAME_SZ, "/dev/%s", ent->d_name);
-                ret = 0;
-                break;
-            }
-        }
-        if (ret)
-            ALOGE("could not find the ufs-bsg dev\n");
-        closedir (dir);
-    } else {
-        /* could not open directory */
-        ALOGE("could not open /dev (error no: %d)\n", errno);
-        ret = -EINVAL;
-    }
+static bool ufs_is_chr(const char *path)
+{
+    struct stat st;
 
-    return ret;
+    if (ufs_transport_ops.is_chr)
+        return ufs_transport_ops.is_chr(ufs_transport_ops.ctx, path);
+    return !stat(path, &st) && S_ISCHR(st.st_mode);
+}
+
+static pthread_mutex_t ufs_bsg_dev_lock = PTHREAD_MUTEX_INITIALIZER;
+static const char *ufs_bsg_dev;
+
+/*
+ * The node has one of two known names, stat them rather than scanning
+ * /dev. Only a successful lookup is cached: the node may show up later.
+ */
+const char *ufs_bsg_dev_path(void)
+{
+    static const char *const nodes[] = { UFS_BSG_DEV, UFS_BSG_DEV0 };
+    const char *dev;
+    unsigned i;
+
+    pthread_mutex_lock(&ufs_bsg_dev_lock);
+    for (i = 0; !ufs_bsg_dev && i < sizeof(nodes) / sizeof(nodes[0]); i++) {
+        if (ufs_is_chr(nodes[i]))
+            ufs_bsg_dev = nodes[i];
+    }
+    dev = ufs_bsg_dev;
+    pthread_mutex_unlock(&ufs_bsg_dev_lock);
+    if (!dev)
+        ALOGE("could not find the ufs-bsg dev\n");
+    return dev;
 }
 
-int ufs_bsg_dev_open(void)
+int ufs_bsg_session_open(struct ufs_bsg_session *session)
 {
+    const char *dev = ufs_bsg_dev_path();
     int ret;
-    if (!fd_ufs_bsg) {
-        fd_ufs_bsg = open(ufs_bsg_dev, O_RDWR);
-        ret = errno;
-        if (fd_ufs_bsg < 0) {
-            ALOGE("Unable to open %s (error no: %d)",
-                    ufs_bsg_dev, errno);
-            fd_ufs_bsg = 0;
-            return ret;
-        }
+
+    session->fd = -1;
+    if (!dev)
+        return -ENODEV;
+    session->fd = ufs_open(dev, O_RDWR | O_CLOEXEC);
+    if (session->fd < 0) {
+        ret = -errno;
+        ALOGE("Unable to open %s (error no: %d)", dev, -ret);
+        return ret;
     }
+    pthread_mutex_init(&session->lock, NULL);
+    ALOGV("Opened ufs bsg dev: %s\n", dev);
     return 0;
 }
 
-void ufs_bsg_dev_close(void)
+void ufs_bsg_session_close(struct ufs_bsg_session *session)
 {
-    if (fd_ufs_bsg) {
-        close(fd_ufs_bsg);
-        fd_ufs_bsg = 0;
+    if (session->fd >= 0) {
+        ufs_close(session->fd);
+        pthread_mutex_destroy(&session->lock);
     }
+    session->fd = -1;
+}
+
+static pthread_mutex_t ufs_bsg_shared_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ufs_bsg_session ufs_bsg_shared = { -1, PTHREAD_MUTEX_INITIALIZER };
+
+/* Opened on first use and kept open until ufs_bsg_session_release() */
+struct ufs_bsg_session *ufs_bsg_session_get(void)
+{
+    struct ufs_bsg_session *session = NULL;
+
+    pthread_mutex_lock(&ufs_bsg_shared_lock);
+    if (ufs_bsg_shared.fd >= 0 || !ufs_bsg_session_open(&ufs_bsg_shared))
+        session = &ufs_bsg_shared;
+    pthread_mutex_unlock(&ufs_bsg_shared_lock);
+    return session;
+}
+
+void ufs_bsg_session_release(void)
+{
+    pthread_mutex_lock(&ufs_bsg_shared_lock);
+    ufs_bsg_session_close(&ufs_bsg_shared);
+    pthread_mutex_unlock(&ufs_bsg_shared_lock);
 }
 
 static int ufs_bsg_ioctl(int fd, struct ufs_bsg_request *req,
@@ -117,7 +176,7 @@ static int ufs_bsg_ioctl(int fd, struct ufs_bsg_request *req,
         sg_io.dout_xferp = (__u64)(buf);
     }
 
-    ret = ioctl(fd, SG_IO, &sg_io);
+    ret = ufs_ioctl(fd, SG_IO, &sg_io);
     if (ret)
         ALOGE("%s: Error from sg_io ioctl (return value: %d, error no: %d, reply result from LLD: %d\n)",
                 __func__, ret, errno, rsp->result);
@@ -151,54 +210,487 @@ static void compose_ufs_bsg_query_req(struct ufs_bsg_request *req, __u8 func,
 }
 
 
-static int ufs_query_attr(int fd, __u32 value,
-        __u8 func, __u8 opcode, __u8 idn,
-        __u8 index, __u8 sel)
+/* Query response code, byte 6 of the reply UPIU header */
+#define UPIU_QUERY_RESPONSE(rsp) \
+    ((be32toh((rsp)->upiu_rsp.header.dword_1) >> 8) & 0xff)
+
+/* Issue one query on fd and parse the reply into query */
+static int ufs_bsg_query_fd(int fd, struct ufs_query *query)
 {
     struct ufs_bsg_request req = {0};
     struct ufs_bsg_reply rsp = {0};
     enum bsg_ioctl_dir dir = BSG_IOCTL_DIR_FROM_DEV;
-    int ret = 0;
+    __u8 func = QUERY_REQ_FUNC_STD_WRITE;
+    __u16 len = 0;
+    __u32 rcv_len;
 
-    if (opcode == QUERY_REQ_OP_WRITE_DESC || opcode == QUERY_REQ_OP_WRITE_ATTR)
+    switch (query->opcode) {
+    case QUERY_REQ_OP_READ_DESC:
+        func = QUERY_REQ_FUNC_STD_READ;
+        len = query->len;
+        break;
+    case QUERY_REQ_OP_WRITE_DESC:
+        dir = BSG_IOCTL_DIR_TO_DEV;
+        len = query->len;
+        break;
+    case QUERY_REQ_OP_READ_ATTR:
+    case QUERY_REQ_OP_READ_FLAG:
+        func = QUERY_REQ_FUNC_STD_READ;
+        break;
+    case QUERY_REQ_OP_WRITE_ATTR:
         dir = BSG_IOCTL_DIR_TO_DEV;
+        req.upiu_req.qr.value = htobe32(query->value);
+        break;
+    case QUERY_REQ_OP_SET_FLAG:
+    case QUERY_REQ_OP_CLEAR_FLAG:
+    case QUERY_REQ_OP_TOGGLE_FLAG:
+        break;
+    default:
+        ALOGE("%s: Unknown query opcode %d\n", __func__, query->opcode);
+        return query->result = -EINVAL;
+    }
+    if (len && !query->buf)
+        return query->result = -EINVAL;
+
+    compose_ufs_bsg_query_req(&req, func, query->opcode, query->idn,
+            query->index, query->selector, len);
+
+    query->result = ufs_bsg_ioctl(fd, &req, &rsp, len ? query->buf : NULL,
+            len, dir);
+    if (query->result) {
+        ALOGE("%s: Error from ufs_bsg_ioctl (opcode: %d, idn: %d, return value: %d, error no: %d\n)",
+                __func__, query->opcode, query->idn, query->result, errno);
+        return query->result;
+    }
+    if (UPIU_QUERY_RESPONSE(&rsp)) {
+        ALOGE("%s: Query failed (opcode: %d, idn: %d, response: 0x%x)\n",
+                __func__, query->opcode, query->idn, UPIU_QUERY_RESPONSE(&rsp));
+        return query->result = -EIO;
+    }
+
+    switch (query->opcode) {
+    case QUERY_REQ_OP_READ_DESC:
+        rcv_len = rsp.reply_payload_rcv_len;
+        if (!rcv_len)
+            rcv_len = be16toh(rsp.upiu_rsp.qr.length);
+        if (rcv_len < query->len)
+            query->len = rcv_len;
+        break;
+    case QUERY_REQ_OP_READ_ATTR:
+        query->value = be32toh(rsp.upiu_rsp.qr.value);
+        break;
+    case QUERY_REQ_OP_READ_FLAG:
+    case QUERY_REQ_OP_SET_FLAG:
+    case QUERY_REQ_OP_CLEAR_FLAG:
+    case QUERY_REQ_OP_TOGGLE_FLAG:
+        query->value = be32toh(rsp.upiu_rsp.qr.value) & 0x1;
+        break;
+    }
+    return 0;
+}
 
-    req.upiu_req.qr.value = htobe32(value);
+int ufs_bsg_query(struct ufs_bsg_session *session, struct ufs_query *query)
+{
+    return ufs_bsg_query_batch(session, query, 1) ? query->result : 0;
+}
+
+int ufs_bsg_query_batch(struct ufs_bsg_session *session,
+        struct ufs_query *queries, unsigned count)
+{
+    int failed = 0;
+    unsigned i;
+
+    pthread_mutex_lock(&session->lock);
+    for (i = 0; i < count; i++) {
+        if (ufs_bsg_query_fd(session->fd, &queries[i]))
+            failed++;
+    }
+    pthread_mutex_unlock(&session->lock);
+    return failed;
+}
+
+int ufs_bsg_read_attr(struct ufs_bsg_session *session, __u8 idn,
+        __u8 index, __u8 sel, __u32 *value)
+{
+    struct ufs_query query = {0};
+    int ret;
+
+    query.opcode = QUERY_REQ_OP_READ_ATTR;
+    query.idn = idn;
+    query.index = index;
+    query.selector = sel;
+    ret = ufs_bsg_query(session, &query);
+    if (!ret)
+        *value = query.value;
+    return ret;
+}
+
+int ufs_bsg_write_attr(struct ufs_bsg_session *session, __u8 idn,
+        __u8 index, __u8 sel, __u32 value)
+{
+    struct ufs_query query = {0};
+
+    query.opcode = QUERY_REQ_OP_WRITE_ATTR;
+    query.idn = idn;
+    query.index = index;
+    query.selector = sel;
+    query.value = value;
+    return ufs_bsg_query(session, &query);
+}
+
+static int ufs_bsg_flag_op(struct ufs_bsg_session *session, __u8 opcode,
+        __u8 idn, __u8 index, bool *value)
+{
+    struct ufs_query query = {0};
+    int ret;
+
+    query.opcode = opcode;
+    query.idn = idn;
+    query.index = index;
+    ret = ufs_bsg_query(session, &query);
+    if (!ret && value)
+        *value = query.value;
+    return ret;
+}
 
-    compose_ufs_bsg_query_req(&req, func, opcode, idn, index, sel, 0);
+int ufs_bsg_read_flag(struct ufs_bsg_session *session, __u8 idn,
+        __u8 index, bool *value)
+{
+    return ufs_bsg_flag_op(session, QUERY_REQ_OP_READ_FLAG, idn, index, value);
+}
+
+int ufs_bsg_set_flag(struct ufs_bsg_session *session, __u8 idn, __u8 index)
+{
+    return ufs_bsg_flag_op(session, QUERY_REQ_OP_SET_FLAG, idn, index, NULL);
+}
+
+int ufs_bsg_clear_flag(struct ufs_bsg_session *session, __u8 idn,
+        __u8 index)
+{
+    return ufs_bsg_flag_op(session, QUERY_REQ_OP_CLEAR_FLAG, idn, index, NULL);
+}
+
+int ufs_bsg_read_desc(struct ufs_bsg_session *session, __u8 idn,
+        __u8 index, __u8 sel, __u8 *buf, __u16 *len)
+{
+    struct ufs_query query = {0};
+    int ret;
 
-    ret = ufs_bsg_ioctl(fd, &req, &rsp, 0, 0, dir);
+    query.opcode = QUERY_REQ_OP_READ_DESC;
+    query.idn = idn;
+    query.index = index;
+    query.selector = sel;
+    query.buf = buf;
+    query.len = *len;
+    ret = ufs_bsg_query(session, &query);
+    if (!ret)
+        *len = query.len;
+    return ret;
+}
+
+int ufs_bsg_write_desc(struct ufs_bsg_session *session, __u8 idn,
+        __u8 index, __u8 sel, __u8 *buf, __u16 len)
+{
+    struct ufs_query query = {0};
+
+    query.opcode = QUERY_REQ_OP_WRITE_DESC;
+    query.idn = idn;
+    query.index = index;
+    query.selector = sel;
+    query.buf = buf;
+    query.len = len;
+    return ufs_bsg_query(session, &query);
+}
+
+int ufs_wb_read_status(struct ufs_bsg_session *session,
+        struct ufs_wb_status *status)
+{
+    struct ufs_query queries[] = {
+        { QUERY_REQ_OP_READ_FLAG, QUERY_FLAG_IDN_WB_EN, 0, 0, 0, NULL, 0, 0 },
+        { QUERY_REQ_OP_READ_FLAG, QUERY_FLAG_IDN_WB_BUFF_FLUSH_EN,
+            0, 0, 0, NULL, 0, 0 },
+        { QUERY_REQ_OP_READ_FLAG, QUERY_FLAG_IDN_WB_BUFF_FLUSH_DURING_HIBERN8,
+            0, 0, 0, NULL, 0, 0 },
+        { QUERY_REQ_OP_READ_ATTR, QUERY_ATTR_IDN_WB_FLUSH_STATUS,
+            0, 0, 0, NULL, 0, 0 },
+        { QUERY_REQ_OP_READ_ATTR, QUERY_ATTR_IDN_AVAIL_WB_BUFF_SIZE,
+            0, 0, 0, NULL, 0, 0 },
+        { QUERY_REQ_OP_READ_ATTR, QUERY_ATTR_IDN_WB_BUFF_LIFE_TIME_EST,
+            0, 0, 0, NULL, 0, 0 },
+        { QUERY_REQ_OP_READ_ATTR, QUERY_ATTR_IDN_CURR_WB_BUFF_SIZE,
+            0, 0, 0, NULL, 0, 0 },
+    };
+    unsigned i;
+
+    if (ufs_bsg_query_batch(session, queries,
+                sizeof(queries) / sizeof(queries[0]))) {
+        for (i = 0; i < sizeof(queries) / sizeof(queries[0]); i++) {
+            if (queries[i].result)
+                return queries[i].result;
+        }
+    }
+    status->enabled = queries[0].value;
+    status->flush = queries[1].value;
+    status->flush_during_hibern8 = queries[2].value;
+    status->flush_status = queries[3].value;
+    status->avail_buf = queries[4].value;
+    status->lifetime = queries[5].value;
+    status->cur_buf_size = queries[6].value;
+    return 0;
+}
+
+static int ufs_bsg_write_flag(struct ufs_bsg_session *session, __u8 idn,
+        bool value)
+{
+    if (value)
+        return ufs_bsg_set_flag(session, idn, 0);
+    return ufs_bsg_clear_flag(session, idn, 0);
+}
+
+int ufs_wb_set_enable(struct ufs_bsg_session *session, bool enable)
+{
+    return ufs_bsg_write_flag(session, QUERY_FLAG_IDN_WB_EN, enable);
+}
+
+int ufs_wb_set_flush_during_hibern8(struct ufs_bsg_session *session,
+        bool enable)
+{
+    return ufs_bsg_write_flag(session,
+            QUERY_FLAG_IDN_WB_BUFF_FLUSH_DURING_HIBERN8, enable);
+}
+
+int ufs_wb_set_flush(struct ufs_bsg_session *session, bool enable)
+{
+    return ufs_bsg_write_flag(session, QUERY_FLAG_IDN_WB_BUFF_FLUSH_EN,
+            enable);
+}
+
+int ufs_bkops_read_status(struct ufs_bsg_session *session, bool *enabled,
+        __u32 *status)
+{
+    struct ufs_query queries[] = {
+        { QUERY_REQ_OP_READ_FLAG, QUERY_FLAG_IDN_BKOPS_EN, 0, 0, 0, NULL, 0, 0 },
+        { QUERY_REQ_OP_READ_ATTR, QUERY_ATTR_IDN_BKOPS_STATUS,
+            0, 0, 0, NULL, 0, 0 },
+    };
+
+    if (ufs_bsg_query_batch(session, queries, 2))
+        return queries[0].result ? queries[0].result : queries[1].result;
+    *enabled = queries[0].value;
+    *status = queries[1].value;
+    return 0;
+}
+
+int ufs_bkops_set_enable(struct ufs_bsg_session *session, bool enable)
+{
+    return ufs_bsg_write_flag(session, QUERY_FLAG_IDN_BKOPS_EN, enable);
+}
+
+int ufs_icc_read_level(struct ufs_bsg_session *session, __u32 *level)
+{
+    return ufs_bsg_read_attr(session, QUERY_ATTR_IDN_ACTIVE_ICC_LVL, 0, 0,
+            level);
+}
+
+int ufs_icc_set_level(struct ufs_bsg_session *session, __u32 level)
+{
+    if (level > UFS_ICC_LEVEL_MAX)
+        return -EINVAL;
+    return ufs_bsg_write_attr(session, QUERY_ATTR_IDN_ACTIVE_ICC_LVL, 0, 0,
+            level);
+}
+
+/* Geometry descriptor fields */
+#define GEOMETRY_DESC_RAW_CAPACITY      0x04
+#define GEOMETRY_DESC_MAX_NUMBER_LU     0x0C
+#define GEOMETRY_DESC_SEGMENT_SIZE      0x0D
+#define GEOMETRY_DESC_ALLOC_UNIT_SIZE   0x11
+#define GEOMETRY_DESC_MIN_ADDR_BLK      0x12
+#define GEOMETRY_DESC_OPT_READ_BLK      0x13
+#define GEOMETRY_DESC_OPT_WRITE_BLK     0x14
+#define GEOMETRY_DESC_MAX_IN_BUF        0x15
+#define GEOMETRY_DESC_MAX_OUT_BUF       0x16
+#define GEOMETRY_DESC_MIN_LEN           0x17
+
+/* Unit descriptor fields */
+#define UNIT_DESC_LU_ENABLE             0x03
+#define UNIT_DESC_LOGICAL_BLK_SIZE      0x0A
+#define UNIT_DESC_LOGICAL_BLK_COUNT     0x0B
+#define UNIT_DESC_ERASE_BLK_SIZE        0x13
+#define UNIT_DESC_PROVISIONING_TYPE     0x17
+#define UNIT_DESC_MIN_LEN               0x18
+
+/* Geometry descriptor sizes are given in units of 512 bytes */
+#define UFS_DESC_SECTOR_SIZE            512
+
+static pthread_mutex_t ufs_desc_lock = PTHREAD_MUTEX_INITIALIZER;
+static bool ufs_geometry_cached;
+static struct ufs_geometry ufs_geometry_cache;
+/* Bit n set once the unit descriptor of LUN n is cached */
+static __u32 ufs_units_cached;
+static struct ufs_unit ufs_unit_cache[UFS_MAX_LUNS];
+
+/* Big endian descriptor field of len bytes */
+static __u64 ufs_desc_field(const __u8 *desc, unsigned offset, unsigned len)
+{
+    __u64 value = 0;
+    unsigned i;
+
+    for (i = 0; i < len; i++)
+        value = (value << 8) | desc[offset + i];
+    return value;
+}
+
+/*
+ * Read descriptor idn and check that it is what was asked for and long
+ * enough to hold min_len bytes of fields
+ */
+static int ufs_read_desc_checked(struct ufs_bsg_session *session, __u8 idn,
+        __u8 index, __u8 *buf, __u16 size, __u16 min_len)
+{
+    __u16 len = size;
+    int ret;
+
+    ret = ufs_bsg_read_desc(session, idn, index, 0, buf, &len);
     if (ret)
-        ALOGE("%s: Error from ufs_bsg_ioctl (return value: %d, error no: %d\n)",
-                __func__, ret, errno);
+        return ret;
+    if (len < min_len || buf[0] < min_len || buf[1] != idn) {
+        ALOGE("%s: Bad descriptor (idn: %d, index: %d, length: %d)\n",
+                __func__, idn, index, len);
+        return -EIO;
+    }
+    return 0;
+}
 
+int ufs_read_geometry(struct ufs_bsg_session *session,
+        struct ufs_geometry *geo)
+{
+    __u8 desc[QUERY_DESC_SIZE_GEOMETRY] = {0};
+    struct ufs_geometry *g = &ufs_geometry_cache;
+    int ret = 0;
+
+    pthread_mutex_lock(&ufs_desc_lock);
+    if (ufs_geometry_cached)
+        goto out;
+    ret = ufs_read_desc_checked(session, QUERY_DESC_IDN_GEOMETRY, 0, desc,
+            sizeof(desc), GEOMETRY_DESC_MIN_LEN);
+    if (ret)
+        goto out;
+    g->raw_capacity = ufs_desc_field(desc, GEOMETRY_DESC_RAW_CAPACITY, 8) *
+            UFS_DESC_SECTOR_SIZE;
+    g->max_lu = desc[GEOMETRY_DESC_MAX_NUMBER_LU] ? 32 : 8;
+    g->segment_size = ufs_desc_field(desc, GEOMETRY_DESC_SEGMENT_SIZE, 4) *
+            UFS_DESC_SECTOR_SIZE;
+    g->alloc_unit_size = desc[GEOMETRY_DESC_ALLOC_UNIT_SIZE] *
+            g->segment_size;
+    g->min_addr_block = desc[GEOMETRY_DESC_MIN_ADDR_BLK] *
+            UFS_DESC_SECTOR_SIZE;
+    g->opt_read_block = desc[GEOMETRY_DESC_OPT_READ_BLK] *
+            UFS_DESC_SECTOR_SIZE;
+    g->opt_write_block = desc[GEOMETRY_DESC_OPT_WRITE_BLK] *
+            UFS_DESC_SECTOR_SIZE;
+    g->max_in_buf = desc[GEOMETRY_DESC_MAX_IN_BUF] * UFS_DESC_SECTOR_SIZE;
+    g->max_out_buf = desc[GEOMETRY_DESC_MAX_OUT_BUF] * UFS_DESC_SECTOR_SIZE;
+    ufs_geometry_cached = true;
+out:
+    if (!ret)
+        *geo = *g;
+    pthread_mutex_unlock(&ufs_desc_lock);
     return ret;
 }
 
-int32_t set_boot_lun(char *sg_dev,uint8_t lun_id)
+int ufs_read_unit(struct ufs_bsg_session *session, __u8 lun,
+        struct ufs_unit *unit)
 {
+    __u8 desc[QUERY_DESC_SIZE_UNIT] = {0};
+    struct ufs_unit *u;
+    __u8 shift;
+    int ret = 0;
+
+    if (lun >= UFS_MAX_LUNS)
+        return -EINVAL;
+    u = &ufs_unit_cache[lun];
+    pthread_mutex_lock(&ufs_desc_lock);
+    if (ufs_units_cached & (1U << lun))
+        goto out;
+    ret = ufs_read_desc_checked(session, QUERY_DESC_IDN_UNIT, lun, desc,
+            sizeof(desc), UNIT_DESC_MIN_LEN);
+    if (ret)
+        goto out;
+    shift = desc[UNIT_DESC_LOGICAL_BLK_SIZE];
+    if (shift < 9 || shift > 20) {
+        ALOGE("%s: Bad logical block size 2^%d for LUN %d\n", __func__,
+                shift, lun);
+        ret = -EIO;
+        goto out;
+    }
+    u->enabled = desc[UNIT_DESC_LU_ENABLE];
+    u->block_size = 1U << shift;
+    u->block_count = ufs_desc_field(desc, UNIT_DESC_LOGICAL_BLK_COUNT, 8);
+    u->erase_block = ufs_desc_field(desc, UNIT_DESC_ERASE_BLK_SIZE, 4) *
+            u->block_size;
+    u->provisioning = desc[UNIT_DESC_PROVISIONING_TYPE];
+    ufs_units_cached |= 1U << lun;
+out:
+    if (!ret)
+        *unit = *u;
+    pthread_mutex_unlock(&ufs_desc_lock);
+    return ret;
+}
+
+/* Node opened for the call only, the descriptors read stay cached */
+int32_t get_ufs_io_unit(uint8_t lun, uint32_t *write_unit,
+        uint32_t *erase_unit)
+{
+    struct ufs_bsg_session session;
+    struct ufs_geometry geo;
+    struct ufs_unit unit;
     int32_t ret;
-    __u32 boot_lun_id  = lun_id;
 
-    ret = get_ufs_bsg_dev();
+    ret = ufs_bsg_session_open(&session);
     if (ret)
         return ret;
-    ALOGV("Found the ufs bsg dev: %s\n", ufs_bsg_dev);
+    ret = ufs_read_geometry(&session, &geo);
+    if (!ret)
+        ret = ufs_read_unit(&session, lun, &unit);
+    ufs_bsg_session_close(&session);
+    if (ret)
+        return ret;
+    *write_unit = geo.opt_write_block ? geo.opt_write_block :
+            geo.min_addr_block;
+    *erase_unit = unit.erase_block;
+    return 0;
+}
+
+/* Forget the node, the shared session and the descriptors read so far */
+static void ufs_bsg_reset(void)
+{
+    pthread_mutex_lock(&ufs_bsg_dev_lock);
+    ufs_bsg_dev = NULL;
+    pthread_mutex_unlock(&ufs_bsg_dev_lock);
+    ufs_bsg_session_release();
+    pthread_mutex_lock(&ufs_desc_lock);
+    ufs_geometry_cached = false;
+    ufs_units_cached = 0;
+    pthread_mutex_unlock(&ufs_desc_lock);
+}
 
-    ret = ufs_bsg_dev_open();
+int32_t set_boot_lun(char *sg_dev,uint8_t lun_id)
+{
+    struct ufs_bsg_session session;
+    int32_t ret;
+    __u32 boot_lun_id  = lun_id;
+
+    ret = ufs_bsg_session_open(&session);
     if (ret)
         return ret;
-    ALOGV("Opened ufs bsg dev: %s\n", ufs_bsg_dev);
 
-    ret = ufs_query_attr(fd_ufs_bsg, boot_lun_id, QUERY_REQ_FUNC_STD_WRITE,
-            QUERY_REQ_OP_WRITE_ATTR, QUERY_ATTR_IDN_BOOT_LU_EN, 0, 0);
-    if (ret) {
+    ret = ufs_bsg_write_attr(&session, QUERY_ATTR_IDN_BOOT_LU_EN, 0, 0,
+            boot_lun_id);
+    if (ret)
         ALOGE("Error requesting ufs attr idn %d via query ioctl (return value: %d, error no: %d)",
                 QUERY_ATTR_IDN_BOOT_LU_EN, ret, errno);
-        goto out;
-    }
-out:
-    ufs_bsg_dev_close();
+    ufs_bsg_session_close(&session);
     return ret;
 }
 #endif
@@ -223,7 +715,7 @@ int32_t set_boot_lun(char *sg_dev, uint8_t boot_lun_id)
         data->idn = QUERY_ATTR_IDN_BOOT_LU_EN;
         data->buf_size = UFS_ATTR_DATA_SIZE;
         data->buffer[0] = boot_lun_id;
-        fd = open(sg_dev, O_RDWR);
+        fd = ufs_open(sg_dev, O_RDWR);
         if (fd < 0) {
                 fprintf(stderr, "%s: Failed to open %s(%s)\n",
                                 __func__,
@@ -231,19 +723,19 @@ int32_t set_boot_lun(char *sg_dev, uint8_t boot_lun_id)
                                 strerror(errno));
                 goto error;
         }
-        rc = ioctl(fd, UFS_IOCTL_QUERY, data);
+        rc = ufs_ioctl(fd, UFS_IOCTL_QUERY, data);
         if (rc) {
                 fprintf(stderr, "%s: UFS query ioctl failed(%s)\n",
                                 __func__,
                                 strerror(errno));
                 goto error;
         }
-        close(fd);
+        ufs_close(fd);
         free(data);
         return 0;
 error:
         if (fd >= 0)
-                close(fd);
+                ufs_close(fd);
         if (data)
                 free(data);
         return -1;
@@ -251,4 +743,23 @@ error:
         return 0;
 #endif
 }
+
+//Descriptors are only read through the BSG framework, callers fall back
+//to the block size of the disk
+int32_t get_ufs_io_unit(uint8_t lun, uint32_t *write_unit,
+                uint32_t *erase_unit)
+{
+        return -1;
+}
 #endif
+
+void ufs_set_transport(const struct ufs_transport *transport)
+{
+#ifdef _BSG_FRAMEWORK_KERNEL_HEADERS
+    ufs_bsg_reset();
+#endif
+    if (transport)
+        ufs_transport_ops = *transport;
+    else
+        memset(&ufs_transport_ops, 0, sizeof(ufs_transport_ops));
+}
@@ -45,6 +45,8 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
 
 #ifdef ANDROID
 #include "cutils/log.h"
@@ -69,12 +71,46 @@
 #define DWORD(b3, b2, b1, b0) htobe32((b3 << 24) | (b2 << 16) |\
         (b1 << 8) | b0)
 
-/* UFS BSG device nodes */
-char ufs_bsg_dev[FNAME_SZ] = "/dev/ufs-bsg";
-
-int fd_ufs_bsg;
+/* UFS BSG device nodes, looked up in that order */
+#define UFS_BSG_DEV         "/dev/ufs-bsg"
+#define UFS_BSG_DEV0        "/dev/ufs-bsg0"
 
 int32_t set_ufs_lun(uint8_t lun_id);
+/*
+ * Make LUN boot_lun_id (1 or 2) the one the device boots from, through the
+ * BSG node or, without BSG support, the query ioctl on scsi generic node
+ * sg_dev
+ */
+int32_t set_boot_lun(char *sg_dev, uint8_t boot_lun_id);
+
+/*
+ * System calls UFS queries go through, on the BSG node as well as on the
+ * scsi generic node of the legacy query ioctl. They follow the system call
+ * conventions: -1 and errno on failure. NULL members fall back to the real
+ * system calls.
+ */
+struct ufs_transport {
+    int (*open)(void *ctx, const char *path, int flags);
+    int (*close)(void *ctx, int fd);
+    int (*ioctl)(void *ctx, int fd, unsigned long request, void *arg);
+    /* Whether path names a character device */
+    bool (*is_chr)(void *ctx, const char *path);
+    void *ctx;
+};
+
+/*
+ * Route the UFS queries of the whole process through transport, or back to
+ * the kernel if NULL. The node lookup, the shared session and the cached
+ * descriptors are dropped. Not to be called while queries are in flight.
+ */
+void ufs_set_transport(const struct ufs_transport *transport);
+/*
+ * Optimal write size and erase block size of LUN lun in bytes, from the
+ * geometry and unit descriptors. The write size falls back to the minimum
+ * addressable block, the erase block size is 0 when not reported.
+ */
+int32_t get_ufs_io_unit(uint8_t lun, uint32_t *write_unit,
+        uint32_t *erase_unit);
 
 #ifdef _BSG_FRAMEWORK_KERNEL_HEADERS
 /* UPIU Transaction Codes */
@@ -125,7 +161,223 @@ enum query_attr_idn {
     QUERY_ATTR_IDN_RESERVED          = 0x01,
     QUERY_ATTR_IDN_POWER_MODE        = 0x02,
     QUERY_ATTR_IDN_ACTIVE_ICC_LVL    = 0x03,
+    QUERY_ATTR_IDN_BKOPS_STATUS      = 0x05,
+    QUERY_ATTR_IDN_WB_FLUSH_STATUS   = 0x1C,
+    QUERY_ATTR_IDN_AVAIL_WB_BUFF_SIZE = 0x1D,
+    QUERY_ATTR_IDN_WB_BUFF_LIFE_TIME_EST = 0x1E,
+    QUERY_ATTR_IDN_CURR_WB_BUFF_SIZE = 0x1F,
+};
+
+enum query_flag_idn {
+    QUERY_FLAG_IDN_FDEVICEINIT       = 0x01,
+    QUERY_FLAG_IDN_PERMANENT_WPE     = 0x02,
+    QUERY_FLAG_IDN_PWR_ON_WPE        = 0x03,
+    QUERY_FLAG_IDN_BKOPS_EN          = 0x04,
+    QUERY_FLAG_IDN_WB_EN             = 0x0E,
+    QUERY_FLAG_IDN_WB_BUFF_FLUSH_EN  = 0x0F,
+    QUERY_FLAG_IDN_WB_BUFF_FLUSH_DURING_HIBERN8 = 0x10,
+};
+#endif  /*  _BSG_FRAMEWORK_KERNEL_HEADERS */
+
+#ifdef _BSG_FRAMEWORK_KERNEL_HEADERS
+/*
+ * An open handle on the UFS BSG node. The node is looked up once per
+ * process and a session keeps it open for any number of queries. Queries
+ * issued through one session from several threads are serialized by its
+ * lock, so they can all share a single open.
+ */
+struct ufs_bsg_session {
+    int fd;
+    pthread_mutex_t lock;
+};
+
+/* Path of the UFS BSG node, NULL if there is none */
+const char *ufs_bsg_dev_path(void);
+
+/* Open a session on the node, 0 or a negative errno */
+int ufs_bsg_session_open(struct ufs_bsg_session *session);
+void ufs_bsg_session_close(struct ufs_bsg_session *session);
+
+/*
+ * Session shared by the whole process, opened on first use and kept open
+ * until ufs_bsg_session_release(). NULL if the node cannot be opened.
+ * get_ufs_io_unit() and set_boot_lun() open the node for the call instead,
+ * so only long running users of the query API hold it.
+ */
+struct ufs_bsg_session *ufs_bsg_session_get(void);
+/*
+ * Close the shared session, the next ufs_bsg_session_get() opens it again.
+ * Not to be called while queries are in flight on it.
+ */
+void ufs_bsg_session_release(void);
+
+/*
+ * A query request and, once issued, its parsed reply. opcode is one of
+ * enum query_req_opcode.
+ */
+struct ufs_query {
+    __u8 opcode;
+    __u8 idn;
+    __u8 index;
+    __u8 selector;
+    /*
+     * Attribute value to write; the attribute value or flag state (0 or
+     * 1) read back, flag operations return the new state
+     */
+    __u32 value;
+    /* Descriptor buffer and its size, len is set to the length read */
+    __u8 *buf;
+    __u16 len;
+    /* 0, or the error of this query once issued */
+    int result;
 };
+
+int ufs_bsg_query(struct ufs_bsg_session *session, struct ufs_query *query);
+
+/*
+ * Issue count queries back to back, holding the session for all of them.
+ * Every query is issued even if an earlier one failed. Returns the number
+ * of failed queries, their result says why.
+ */
+int ufs_bsg_query_batch(struct ufs_bsg_session *session,
+        struct ufs_query *queries, unsigned count);
+
+int ufs_bsg_read_attr(struct ufs_bsg_session *session, __u8 idn,
+        __u8 index, __u8 sel, __u32 *value);
+int ufs_bsg_write_attr(struct ufs_bsg_session *session, __u8 idn,
+        __u8 index, __u8 sel, __u32 value);
+int ufs_bsg_read_flag(struct ufs_bsg_session *session, __u8 idn,
+        __u8 index, bool *value);
+int ufs_bsg_set_flag(struct ufs_bsg_session *session, __u8 idn, __u8 index);
+int ufs_bsg_clear_flag(struct ufs_bsg_session *session, __u8 idn,
+        __u8 index);
+/*
+ * Read descriptor idn into buf, *len bytes at most. *len is set to the
+ * length of the descriptor read.
+ */
+int ufs_bsg_read_desc(struct ufs_bsg_session *session, __u8 idn,
+        __u8 index, __u8 sel, __u8 *buf, __u16 *len);
+int ufs_bsg_write_desc(struct ufs_bsg_session *session, __u8 idn,
+        __u8 index, __u8 sel, __u8 *buf, __u16 len);
+
+/* bWriteBoosterBufferFlushStatus */
+enum ufs_wb_flush_status {
+    UFS_WB_FLUSH_IDLE         = 0x0,
+    UFS_WB_FLUSH_IN_PROGRESS  = 0x1,
+    UFS_WB_FLUSH_STOPPED      = 0x2,
+    UFS_WB_FLUSH_COMPLETED    = 0x3,
+    UFS_WB_FLUSH_FAILED       = 0x4,
+};
+
+/* bAvailableWriteBoosterBufferSize of an empty buffer, in 10% units */
+#define UFS_WB_AVAIL_BUF_FULL       0x0A
+/* bWriteBoosterBufferLifeTimeEst once the buffer is worn out */
+#define UFS_WB_LIFETIME_EXCEEDED    0x0B
+
+/*
+ * WriteBooster state of the device. The buffer is assumed to be shared by
+ * all LUNs, so every flag and attribute is accessed at index 0.
+ */
+struct ufs_wb_status {
+    /* fWriteBoosterEn */
+    bool enabled;
+    /* fWriteBoosterBufferFlushEn, an explicit flush was requested */
+    bool flush;
+    /* fWriteBoosterBufferFlushDuringHibernate */
+    bool flush_during_hibern8;
+    /* enum ufs_wb_flush_status */
+    __u32 flush_status;
+    /* Free buffer space, 0 to UFS_WB_AVAIL_BUF_FULL */
+    __u32 avail_buf;
+    /* Buffer wear, 0x01 (0-10% used) to UFS_WB_LIFETIME_EXCEEDED */
+    __u32 lifetime;
+    /* dCurrentWriteBoosterBufferSize, in allocation units */
+    __u32 cur_buf_size;
+};
+
+/* Read the whole WriteBooster state in a single batch */
+int ufs_wb_read_status(struct ufs_bsg_session *session,
+        struct ufs_wb_status *status);
+int ufs_wb_set_enable(struct ufs_bsg_session *session, bool enable);
+/* Let the device flush the buffer on its own while the link hibernates */
+int ufs_wb_set_flush_during_hibern8(struct ufs_bsg_session *session,
+        bool enable);
+/* Start or stop an explicit flush of the buffer to the main storage */
+int ufs_wb_set_flush(struct ufs_bsg_session *session, bool enable);
+
+/* bBackgroundOpStatus, how badly the device needs background operations */
+enum ufs_bkops_status {
+    UFS_BKOPS_STATUS_NO_OP          = 0x0,
+    UFS_BKOPS_STATUS_NON_CRITICAL   = 0x1,
+    UFS_BKOPS_STATUS_PERF_IMPACT    = 0x2,
+    UFS_BKOPS_STATUS_CRITICAL       = 0x3,
+};
+
+/* Highest bActiveICCLevel */
+#define UFS_ICC_LEVEL_MAX           0x0F
+
+/*
+ * Read fBackgroundOpsEn and bBackgroundOpStatus (enum ufs_bkops_status)
+ * in a single batch
+ */
+int ufs_bkops_read_status(struct ufs_bsg_session *session, bool *enabled,
+        __u32 *status);
+int ufs_bkops_set_enable(struct ufs_bsg_session *session, bool enable);
+
+/*
+ * bActiveICCLevel, 0 to UFS_ICC_LEVEL_MAX: the current the device may
+ * draw from its supplies while active, as listed in its power descriptor
+ */
+int ufs_icc_read_level(struct ufs_bsg_session *session, __u32 *level);
+int ufs_icc_set_level(struct ufs_bsg_session *session, __u32 level);
+
+/* Highest LUN that has a unit descriptor */
+#define UFS_MAX_LUNS                32
+
+/* Geometry descriptor of the device, sizes in bytes */
+struct ufs_geometry {
+    /* qTotalRawDeviceCapacity */
+    __u64 raw_capacity;
+    /* Number of LUNs the device supports, 8 or 32 */
+    __u32 max_lu;
+    /* dSegmentSize */
+    __u32 segment_size;
+    /* bAllocationUnitSize, in bytes rather than segments */
+    __u32 alloc_unit_size;
+    /* bMinAddrBlockSize */
+    __u32 min_addr_block;
+    /* bOptimalReadBlockSize and bOptimalWriteBlockSize, 0 if not reported */
+    __u32 opt_read_block;
+    /* bOptimalWriteBlockSize */
+    __u32 opt_write_block;
+    /* bMaxInBufferSize and bMaxOutBufferSize */
+    __u32 max_in_buf;
+    __u32 max_out_buf;
+};
+
+/* Unit descriptor of a LUN */
+struct ufs_unit {
+    /* bLUEnable */
+    bool enabled;
+    /* Logical block size, 2 ^ bLogicalBlockSize */
+    __u32 block_size;
+    /* qLogicalBlockCount */
+    __u64 block_count;
+    /* dEraseBlockSize in bytes, 0 if not reported */
+    __u32 erase_block;
+    /* bProvisioningType */
+    __u8 provisioning;
+};
+
+/*
+ * Both descriptors are read once per process and served from a cache
+ * afterwards: they only change when the device is provisioned again,
+ * which takes effect on the next power cycle.
+ */
+int ufs_read_geometry(struct ufs_bsg_session *session,
+        struct ufs_geometry *geo);
+int ufs_read_unit(struct ufs_bsg_session *session, __u8 lun,
+        struct ufs_unit *unit);
 #endif  /*  _BSG_FRAMEWORK_KERNEL_HEADERS */
 
 #endif /* __RECOVERY_UFS_BSG_H__ */
@@ -0,0 +1,631 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// gpt-utils against GPT disk images built under a temporary root and served
+// through the image backend (gpt_utils_set_image_backend): the failsafe
+// update stages, batched loads and commits, partition lookups, incremental
+// CRC updates, GptDisk, slot switches, the scanner and the slot attribute
+// snapshot. Results are checked on the images themselves, with a CRC of
+// the test's own.
+
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "gpt-disk.h"
+#include "gpt-utils.h"
+
+// Entries of every partition entries array, and blocks per partition
+#define TEST_ENTRIES 128
+#define TEST_PART_BLOCKS 8
+
+using Image = std::vector<uint8_t>;
+using Lun = std::pair<const char*, std::vector<std::string>>;
+
+// Failsafe layout: boot critical partitions next to their *bak twins, xbl
+// and xblbak on the two boot LUNs
+static const std::vector<Lun> kFailsafeLuns = {
+        {"sda", {"ssd", "persist"}},
+        {"sdb", {"abl", "tz", "ablbak", "tzbak", "boot_a", "boot_b"}},
+        {"sdc", {"hyp", "hypbak", "vbmeta", "vbmetabak", "vendor_a", "vendor_b"}},
+        {"sdd", {"xbl"}},
+        {"sde", {"xblbak"}},
+};
+
+// A/B layout, slot a active
+static const std::vector<Lun> kAbLuns = {
+        {"sda", {"boot_a", "boot_b", "vendor_a", "vendor_b", "userdata"}},
+        {"sdb", {"abl_a", "abl_b", "tz_a", "tz_b"}},
+        {"sdd", {"xbl_a"}},
+        {"sde", {"xbl_b"}},
+};
+
+static uint32_t Le32(const uint8_t* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t Le64(const uint8_t* p) {
+    return Le32(p) | (uint64_t)Le32(p + 4) << 32;
+}
+
+static void PutLe32(uint8_t* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) p[i] = v >> (8 * i);
+}
+
+static void PutLe64(uint8_t* p, uint64_t v) {
+    PutLe32(p, v);
+    PutLe32(p + 4, v >> 32);
+}
+
+// Bit at a time CRC32, independent of the engine gpt-crc32 picks
+static uint32_t Crc32(const uint8_t* buf, size_t len) {
+    uint32_t crc = ~0U;
+    while (len--) {
+        crc ^= *buf++;
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static uint32_t HeaderCrc(const uint8_t* hdr) {
+    uint8_t copy[GPT_HEADER_MIN_SIZE];
+    memcpy(copy, hdr, sizeof(copy));
+    PutLe32(copy + HEADER_CRC_OFFSET, 0);
+    return Crc32(copy, sizeof(copy));
+}
+
+// Made up GUID, the same for the same seed
+static void MakeGuid(const std::string& seed, uint8_t* guid) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (int i = 0; i < 16; i++) {
+        for (char c : seed) h = (h ^ (uint8_t)c) * 0x100000001b3ULL;
+        h = (h ^ i) * 0x100000001b3ULL;
+        guid[i] = h >> 56;
+    }
+}
+
+static std::string EntryName(const uint8_t* pentry) {
+    std::string name;
+    for (int i = 0; i < MAX_GPT_NAME_SIZE; i += 2) {
+        if (!pentry[PARTITION_NAME_OFFSET + i]) break;
+        name += (char)pentry[PARTITION_NAME_OFFSET + i];
+    }
+    return name;
+}
+
+class GptUtilsTest : public ::testing::TestWithParam<uint32_t> {
+  protected:
+    void SetUp() override {
+        bs_ = GetParam();
+        root_ = ::testing::TempDir() + "gpt_utils_test.XXXXXX";
+        ASSERT_NE(nullptr, mkdtemp(&root_[0]));
+        ASSERT_EQ(0, mkdir((root_ + "/by-name").c_str(), 0755));
+    }
+
+    void TearDown() override {
+        gpt_utils_set_image_backend(NULL, 0, 0);
+        gpt_utils_set_io_uring(0);
+        std::filesystem::remove_all(root_);
+    }
+
+    // Write the image of every LUN and link its partitions from by-name/,
+    // then have gpt-utils run on them
+    void UseLuns(const std::vector<Lun>& luns) {
+        for (const Lun& lun : luns) MakeLun(lun.first, lun.second);
+        ASSERT_EQ(0, gpt_utils_set_image_backend(root_.c_str(), bs_, 1));
+    }
+
+    void MakeLun(const char* lun, const std::vector<std::string>& names) {
+        uint64_t arr_blocks = (TEST_ENTRIES * PTN_ENTRY_SIZE + bs_ - 1) / bs_;
+        uint64_t first = 2 + arr_blocks;
+        uint64_t last = first + TEST_PART_BLOCKS * names.size() + arr_blocks + 4;
+        uint64_t arr_bak = last - arr_blocks;
+        Image img((last + 1) * bs_);
+        uint8_t* arr = &img[2 * bs_];
+
+        for (size_t i = 0; i < names.size(); i++) {
+            uint8_t* e = arr + i * PTN_ENTRY_SIZE;
+            std::string type = names[i].substr(0, names[i].find("bak"));
+            uint64_t start = first + i * TEST_PART_BLOCKS;
+            MakeGuid("type" + type, e + TYPE_GUID_OFFSET);
+            MakeGuid(root_ + lun + names[i], e + UNIQUE_GUID_OFFSET);
+            PutLe64(e + FIRST_LBA_OFFSET, start);
+            PutLe64(e + LAST_LBA_OFFSET, start + TEST_PART_BLOCKS - 1);
+            if (names[i].size() > 2 && !names[i].compare(names[i].size() - 2, 2, "_a"))
+                e[AB_FLAG_OFFSET] = AB_SLOT_ACTIVE_VAL;
+            for (size_t k = 0; k < names[i].size(); k++)
+                e[PARTITION_NAME_OFFSET + 2 * k] = names[i][k];
+            memset(&img[start * bs_], i + 1, TEST_PART_BLOCKS * bs_);
+
+            std::string link = root_ + "/by-name/" + names[i];
+            std::string target = std::string("../") + lun + std::to_string(i + 1);
+            ASSERT_EQ(0, symlink(target.c_str(), link.c_str()));
+        }
+        memcpy(&img[arr_bak * bs_], arr, TEST_ENTRIES * PTN_ENTRY_SIZE);
+        for (uint64_t my : {(uint64_t)1, last}) {
+            uint8_t* hdr = &img[my * bs_];
+            memcpy(hdr, GPT_SIGNATURE, strlen(GPT_SIGNATURE));
+            PutLe32(hdr + 8, 0x10000);
+            PutLe32(hdr + HEADER_SIZE_OFFSET, GPT_HEADER_MIN_SIZE);
+            PutLe64(hdr + PRIMARY_HEADER_OFFSET, my);
+            PutLe64(hdr + BACKUP_HEADER_OFFSET, my == 1 ? last : 1);
+            PutLe64(hdr + FIRST_USABLE_LBA_OFFSET, first);
+            PutLe64(hdr + LAST_USABLE_LBA_OFFSET, arr_bak - 1);
+            MakeGuid(root_ + lun, hdr + DISK_GUID_OFFSET);
+            PutLe64(hdr + PENTRIES_OFFSET, my == 1 ? 2 : arr_bak);
+            PutLe32(hdr + PARTITION_COUNT_OFFSET, TEST_ENTRIES);
+            PutLe32(hdr + PENTRY_SIZE_OFFSET, PTN_ENTRY_SIZE);
+            PutLe32(hdr + PARTITION_CRC_OFFSET, Crc32(arr, TEST_ENTRIES * PTN_ENTRY_SIZE));
+            PutLe32(hdr + HEADER_CRC_OFFSET, HeaderCrc(hdr));
+        }
+        WriteImage(lun, img);
+    }
+
+    std::string Path(const char* lun) const { return root_ + "/" + lun; }
+
+    Image ReadImage(const char* lun) const {
+        Image img;
+        int fd = open(Path(lun).c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if (fd >= 0 && !fstat(fd, &st)) {
+            img.resize(st.st_size);
+            if (pread(fd, img.data(), img.size(), 0) != (ssize_t)img.size()) img.clear();
+        }
+        if (fd >= 0) close(fd);
+        return img;
+    }
+
+    void WriteImage(const char* lun, const Image& img) {
+        int fd = open(Path(lun).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+        ASSERT_GE(fd, 0);
+        EXPECT_EQ((ssize_t)img.size(), pwrite(fd, img.data(), img.size(), 0));
+        close(fd);
+    }
+
+    const uint8_t* Header(const Image& img, enum gpt_instance instance) const {
+        return &img[instance == PRIMARY_GPT ? bs_ : img.size() - bs_];
+    }
+
+    const uint8_t* Entries(const Image& img, enum gpt_instance instance) const {
+        return &img[Le64(Header(img, instance) + PENTRIES_OFFSET) * bs_];
+    }
+
+    // Signature, header CRC, entries CRC and location of one table
+    ::testing::AssertionResult TableValid(const Image& img, enum gpt_instance instance) const {
+        const char* which = instance == PRIMARY_GPT ? "primary" : "backup";
+        const uint8_t* hdr = Header(img, instance);
+        uint64_t my = (instance == PRIMARY_GPT ? bs_ : img.size() - bs_) / bs_;
+
+        if (memcmp(hdr, GPT_SIGNATURE, strlen(GPT_SIGNATURE)))
+            return ::testing::AssertionFailure() << which << " signature";
+        if (Le32(hdr + HEADER_CRC_OFFSET) != HeaderCrc(hdr))
+            return ::testing::AssertionFailure() << which << " header CRC";
+        if (Le64(hdr + PRIMARY_HEADER_OFFSET) != my)
+            return ::testing::AssertionFailure() << which << " header LBA";
+        if (Le32(hdr + PARTITION_CRC_OFFSET) !=
+            Crc32(Entries(img, instance), TEST_ENTRIES * PTN_ENTRY_SIZE))
+            return ::testing::AssertionFailure() << which << " entries CRC";
+        return ::testing::AssertionSuccess();
+    }
+
+    // Both tables valid and holding the same entries
+    ::testing::AssertionResult LunClean(const char* lun) const {
+        Image img = ReadImage(lun);
+        if (img.empty()) return ::testing::AssertionFailure() << "no image " << lun;
+        ::testing::AssertionResult r = TableValid(img, PRIMARY_GPT);
+        if (r) r = TableValid(img, SECONDARY_GPT);
+        if (r && memcmp(Entries(img, PRIMARY_GPT), Entries(img, SECONDARY_GPT),
+                        TEST_ENTRIES * PTN_ENTRY_SIZE))
+            r = ::testing::AssertionFailure() << "tables differ";
+        return r << " (" << lun << ")";
+    }
+
+    // Index of the entry of partition name, -1 if there is none
+    int Index(const Image& img, enum gpt_instance instance, const std::string& name) const {
+        for (int i = 0; i < TEST_ENTRIES; i++)
+            if (EntryName(Entries(img, instance) + i * PTN_ENTRY_SIZE) == name) return i;
+        return -1;
+    }
+
+    // A/B attribute byte of partition name, -1 if there is no such entry
+    int Attr(const char* lun, const std::string& name, enum gpt_instance instance) const {
+        Image img = ReadImage(lun);
+        int i = Index(img, instance, name);
+        return i < 0 ? -1 : Entries(img, instance)[i * PTN_ENTRY_SIZE + AB_FLAG_OFFSET];
+    }
+
+    // Set the A/B attribute byte of partition name the way another tool
+    // would: straight in the image, with the CRCs of the table redone
+    void WriteAttr(const char* lun, const std::string& name, enum gpt_instance instance,
+                   uint8_t attr) {
+        Image img = ReadImage(lun);
+        int i = Index(img, instance, name);
+        ASSERT_GE(i, 0);
+        uint8_t* arr = const_cast<uint8_t*>(Entries(img, instance));
+        uint8_t* hdr = const_cast<uint8_t*>(Header(img, instance));
+        arr[i * PTN_ENTRY_SIZE + AB_FLAG_OFFSET] = attr;
+        PutLe32(hdr + PARTITION_CRC_OFFSET, Crc32(arr, TEST_ENTRIES * PTN_ENTRY_SIZE));
+        PutLe32(hdr + HEADER_CRC_OFFSET, HeaderCrc(hdr));
+        WriteImage(lun, img);
+    }
+
+    // LUN id in the boot_lun file of the image backend, -1 if not set
+    int BootLun() const {
+        char buf[8] = {};
+        int fd = open((root_ + "/boot_lun").c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return -1;
+        ssize_t len = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        return len > 0 ? atoi(buf) : -1;
+    }
+
+    uint32_t bs_;
+    std::string root_;
+};
+
+TEST_P(GptUtilsTest, PrepareBootUpdateStages) {
+    UseLuns(kFailsafeLuns);
+    std::map<std::string, Image> orig;
+    for (const Lun& lun : kFailsafeLuns) orig[lun.first] = ReadImage(lun.first);
+
+    // The backup tables boot the *bak partitions, the primary ones are
+    // invalidated and the backup boot LUN takes over
+    ASSERT_EQ(0, prepare_boot_update(UPDATE_MAIN));
+    for (const char* lun : {"sdb", "sdc"}) {
+        Image img = ReadImage(lun);
+        const Image& was = orig[lun];
+        EXPECT_NE(0, memcmp(Header(img, PRIMARY_GPT), GPT_SIGNATURE, strlen(GPT_SIGNATURE)));
+        EXPECT_TRUE(TableValid(img, SECONDARY_GPT)) << lun;
+        for (const std::string& name : kFailsafeLuns[lun[2] - 'a'].second) {
+            int i = Index(was, PRIMARY_GPT, name);
+            bool swapped = Index(was, PRIMARY_GPT, name + "bak") >= 0 ||
+                           name.find("bak") != std::string::npos;
+            std::string twin = name.find("bak") == std::string::npos
+                                       ? name + "bak"
+                                       : name.substr(0, name.find("bak"));
+            EXPECT_EQ(swapped ? twin : name,
+                      EntryName(Entries(img, SECONDARY_GPT) + i * PTN_ENTRY_SIZE))
+                    << lun << " " << name;
+        }
+    }
+    EXPECT_EQ(orig["sda"], ReadImage("sda"));
+    EXPECT_EQ(2, BootLun());
+    // Running a stage again is a no-op
+    ASSERT_EQ(0, prepare_boot_update(UPDATE_MAIN));
+    EXPECT_EQ(2, BootLun());
+
+    // The primary tables are back, the backup ones invalidated
+    ASSERT_EQ(0, prepare_boot_update(UPDATE_BACKUP));
+    for (const char* lun : {"sdb", "sdc"}) {
+        Image img = ReadImage(lun);
+        EXPECT_TRUE(TableValid(img, PRIMARY_GPT)) << lun;
+        EXPECT_NE(0, memcmp(Header(img, SECONDARY_GPT), GPT_SIGNATURE, strlen(GPT_SIGNATURE)));
+        EXPECT_EQ(0, memcmp(Entries(img, PRIMARY_GPT), Entries(orig[lun], PRIMARY_GPT),
+                            TEST_ENTRIES * PTN_ENTRY_SIZE));
+    }
+    EXPECT_EQ(1, BootLun());
+
+    // Everything as it was, and stages out of order are refused
+    ASSERT_EQ(0, prepare_boot_update(UPDATE_FINALIZE));
+    for (const Lun& lun : kFailsafeLuns) {
+        EXPECT_TRUE(LunClean(lun.first));
+        EXPECT_EQ(orig[lun.first], ReadImage(lun.first)) << lun.first;
+    }
+    EXPECT_NE(0, prepare_boot_update(UPDATE_BACKUP));
+    EXPECT_EQ(orig["sdb"], ReadImage("sdb"));
+}
+
+TEST_P(GptUtilsTest, LoadAllCommitAll) {
+    UseLuns(kFailsafeLuns);
+    const char* const devs[] = {"ssd", "boot_a", "vendor_a", "xbl", "xblbak"};
+    const char* const luns[] = {"sda", "sdb", "sdc", "sdd", "sde"};
+
+    // Once through the synchronous path and once batched through io_uring,
+    // or its fallback where the kernel has none
+    for (int uring = 0; uring <= 1; uring++) {
+        gpt_utils_set_io_uring(uring);
+        std::vector<GptDisk> disks(5);
+        ASSERT_EQ(0, GptDisk::LoadAll(disks, devs));
+        for (int i = 0; i < 5; i++) {
+            ASSERT_TRUE(disks[i].loaded());
+            EXPECT_EQ(Path(luns[i]), disks[i].c_disk()->devpath);
+            for (int t = PRIMARY_GPT; t <= SECONDARY_GPT; t++) {
+                std::span<uint8_t> e = disks[i].Find(devs[i], (enum gpt_instance)t);
+                ASSERT_FALSE(e.empty());
+                e[AB_FLAG_OFFSET] = 0x40 + uring;
+                gpt_disk_mark_pentry_dirty(disks[i].c_disk(), e.data());
+            }
+            ASSERT_EQ(0, disks[i].UpdateCrc());
+        }
+        ASSERT_EQ(0, GptDisk::CommitAll(disks));
+        for (int i = 0; i < 5; i++) {
+            EXPECT_TRUE(LunClean(luns[i]));
+            EXPECT_EQ(0x40 + uring, Attr(luns[i], devs[i], PRIMARY_GPT)) << devs[i];
+        }
+    }
+
+    // Partitions the disks do not have fail the whole load
+    const char* const bad[] = {"ssd", "nosuch"};
+    std::vector<GptDisk> disks(2);
+    EXPECT_NE(0, GptDisk::LoadAll(disks, bad));
+    EXPECT_FALSE(disks[0].loaded());
+}
+
+TEST_P(GptUtilsTest, PartitionIndex) {
+    UseLuns(kFailsafeLuns);
+    GptDisk disk;
+    ASSERT_EQ(0, disk.Load("tz"));
+    struct gpt_disk* c = disk.c_disk();
+    const std::vector<std::string>& names = kFailsafeLuns[1].second;
+
+    for (size_t i = 0; i < names.size(); i++) {
+        EXPECT_EQ(disk.entry(i, PRIMARY_GPT).data(),
+                  gpt_disk_get_pentry(c, names[i].c_str(), PRIMARY_GPT));
+        EXPECT_EQ(disk.entry(i, SECONDARY_GPT).data(),
+                  gpt_disk_get_pentry(c, names[i].c_str(), SECONDARY_GPT));
+    }
+    EXPECT_EQ(nullptr, gpt_disk_get_pentry(c, "nosuch", PRIMARY_GPT));
+    EXPECT_EQ(nullptr, gpt_disk_get_pentry(c, "ab", PRIMARY_GPT));
+
+    // By unique GUID, and by type GUID where the first match wins
+    uint8_t* boot_b = disk.entry(5, SECONDARY_GPT).data();
+    EXPECT_EQ(boot_b, gpt_disk_get_pentry_by_guid(c, boot_b + UNIQUE_GUID_OFFSET,
+                                                  UNIQUE_GUID_OFFSET, SECONDARY_GPT));
+    EXPECT_EQ(disk.entry(0, PRIMARY_GPT).data(),
+              gpt_disk_get_pentry_by_guid(c, disk.entry(2, PRIMARY_GPT).data(), TYPE_GUID_OFFSET,
+                                          PRIMARY_GPT));
+
+    // A renamed entry is found under its new name once reindexed
+    uint8_t* e = disk.entry(5, PRIMARY_GPT).data();
+    memset(e + PARTITION_NAME_OFFSET, 0, MAX_GPT_NAME_SIZE);
+    for (int k = 0; k < 8; k++) e[PARTITION_NAME_OFFSET + 2 * k] = "recovery"[k];
+    ASSERT_EQ(0, gpt_disk_reindex(c));
+    EXPECT_EQ(e, gpt_disk_get_pentry(c, "recovery", PRIMARY_GPT));
+    EXPECT_EQ(nullptr, gpt_disk_get_pentry(c, "boot_b", PRIMARY_GPT));
+    EXPECT_EQ(boot_b, gpt_disk_get_pentry(c, "boot_b", SECONDARY_GPT));
+
+    // Partitions grouped by the LUN holding them
+    std::vector<std::string> ptns = {"abl", "vendor_b", "xblbak", "tzbak"};
+    std::map<std::string, std::vector<std::string>> map;
+    ASSERT_EQ(0, gpt_utils_get_partition_map(ptns, map));
+    ASSERT_EQ(3U, map.size());
+    EXPECT_EQ((std::vector<std::string>{"abl", "tzbak"}), map[Path("sdb")]);
+    EXPECT_EQ((std::vector<std::string>{"vendor_b"}), map[Path("sdc")]);
+    EXPECT_EQ((std::vector<std::string>{"xblbak"}), map[Path("sde")]);
+}
+
+TEST_P(GptUtilsTest, IncrementalCrc) {
+    UseLuns(kFailsafeLuns);
+    GptDisk marked, full;
+    ASSERT_EQ(0, marked.Load("hyp"));
+    ASSERT_EQ(0, full.Load("hyp"));
+
+    // Only the marked entries are rehashed, with the same result as
+    // rehashing everything
+    for (GptDisk* disk : {&marked, &full}) {
+        for (const char* name : {"hypbak", "vendor_b"}) {
+            for (int t = PRIMARY_GPT; t <= SECONDARY_GPT; t++) {
+                std::span<uint8_t> e = disk->Find(name, (enum gpt_instance)t);
+                ASSERT_FALSE(e.empty());
+                e[AB_FLAG_OFFSET] ^= AB_PARTITION_ATTR_UNBOOTABLE;
+                e[UNIQUE_GUID_OFFSET] ^= 0xff;
+                if (disk == &marked) {
+                    ASSERT_EQ(0, gpt_disk_mark_pentry_dirty(disk->c_disk(), e.data()));
+                }
+            }
+        }
+        ASSERT_EQ(0, disk->UpdateCrc());
+    }
+    for (int t = PRIMARY_GPT; t <= SECONDARY_GPT; t++) {
+        std::span<uint8_t> hdr = marked.header((enum gpt_instance)t);
+        std::span<uint8_t> arr = marked.entries((enum gpt_instance)t);
+        EXPECT_EQ(Crc32(arr.data(), arr.size()), Le32(&hdr[PARTITION_CRC_OFFSET]));
+        EXPECT_EQ(HeaderCrc(hdr.data()), Le32(&hdr[HEADER_CRC_OFFSET]));
+        EXPECT_EQ(0, memcmp(hdr.data(), full.header((enum gpt_instance)t).data(),
+                            GPT_HEADER_MIN_SIZE));
+    }
+    ASSERT_EQ(0, marked.Commit());
+    EXPECT_TRUE(LunClean("sdc"));
+
+    // Another round on the same disk only counts the new marks
+    std::span<uint8_t> e = marked.Find("vbmeta", PRIMARY_GPT);
+    e[AB_FLAG_OFFSET] = AB_PARTITION_ATTR_BOOT_SUCCESSFUL;
+    ASSERT_EQ(0, gpt_disk_mark_pentry_dirty(marked.c_disk(), e.data()));
+    e = marked.Find("vbmeta", SECONDARY_GPT);
+    e[AB_FLAG_OFFSET] = AB_PARTITION_ATTR_BOOT_SUCCESSFUL;
+    ASSERT_EQ(0, gpt_disk_mark_pentry_dirty(marked.c_disk(), e.data()));
+    ASSERT_EQ(0, marked.UpdateCrc());
+    ASSERT_EQ(0, marked.Commit());
+    EXPECT_TRUE(LunClean("sdc"));
+    EXPECT_EQ(AB_PARTITION_ATTR_BOOT_SUCCESSFUL, Attr("sdc", "vbmeta", SECONDARY_GPT));
+
+    // Only entries of the disk can be marked
+    uint8_t other[PTN_ENTRY_SIZE] = {};
+    EXPECT_NE(0, gpt_disk_mark_pentry_dirty(marked.c_disk(), other));
+}
+
+TEST_P(GptUtilsTest, GptDisk) {
+    UseLuns(kFailsafeLuns);
+    GptDisk disk;
+    EXPECT_FALSE(disk.loaded());
+    EXPECT_TRUE(disk.header(PRIMARY_GPT).empty());
+
+    ASSERT_EQ(0, disk.Load("vbmeta"));
+    Image img = ReadImage("sdc");
+    EXPECT_EQ(Path("sdc"), disk.c_disk()->devpath);
+    EXPECT_EQ((uint32_t)TEST_ENTRIES, disk.num_entries());
+    for (int t = PRIMARY_GPT; t <= SECONDARY_GPT; t++) {
+        std::span<uint8_t> hdr = disk.header((enum gpt_instance)t);
+        std::span<uint8_t> arr = disk.entries((enum gpt_instance)t);
+        ASSERT_EQ(bs_, hdr.size());
+        ASSERT_EQ((size_t)TEST_ENTRIES * PTN_ENTRY_SIZE, arr.size());
+        EXPECT_EQ(0, memcmp(hdr.data(), Header(img, (enum gpt_instance)t), bs_));
+        EXPECT_EQ(0, memcmp(arr.data(), Entries(img, (enum gpt_instance)t), arr.size()));
+    }
+    EXPECT_EQ("vbmetabak", EntryName(disk.entry(3, SECONDARY_GPT).data()));
+    EXPECT_TRUE(disk.entry(TEST_ENTRIES, PRIMARY_GPT).empty());
+    EXPECT_EQ(disk.entry(2, PRIMARY_GPT).data(), disk.Find("vbmeta", PRIMARY_GPT).data());
+
+    // Reloading, even another disk of the same size, reuses the arena
+    ASSERT_EQ(0, disk.Load("abl"));
+    EXPECT_EQ(Path("sdb"), disk.c_disk()->devpath);
+    EXPECT_EQ(1U, disk.arena_allocs());
+    EXPECT_NE(0, disk.Load("nosuch"));
+    EXPECT_FALSE(disk.loaded());
+
+    // The C struct follows the object it lives in
+    ASSERT_EQ(0, disk.Load("tz"));
+    GptDisk moved(std::move(disk));
+    EXPECT_FALSE(disk.loaded());
+    EXPECT_TRUE(moved.loaded());
+    EXPECT_EQ(&moved, GptDisk::FromC(moved.c_disk()));
+    EXPECT_FALSE(moved.Find("tzbak", SECONDARY_GPT).empty());
+
+    // The C API hands out GptDisks too, and refuses structs it did not
+    struct gpt_disk* c = gpt_disk_alloc();
+    ASSERT_NE(nullptr, c);
+    ASSERT_EQ(0, gpt_disk_get_disk_info("xblbak", c));
+    EXPECT_EQ(Path("sde"), c->devpath);
+    EXPECT_NE(nullptr, GptDisk::FromC(c));
+    gpt_disk_free(c);
+    struct gpt_disk stack = {};
+    EXPECT_NE(0, gpt_disk_get_disk_info("xblbak", &stack));
+}
+
+TEST_P(GptUtilsTest, SetSlotAttr) {
+    UseLuns(kAbLuns);
+    const std::vector<std::pair<const char*, const char*>> ptns = {
+            {"sda", "boot"}, {"sda", "vendor"}, {"sdb", "abl"}, {"sdb", "tz"}};
+
+    ASSERT_EQ(0, gpt_utils_set_slot_attr(AB_SLOT_B_SUFFIX, GPT_SLOT_SET_ACTIVE));
+    for (const auto& [lun, ptn] : ptns) {
+        for (int t = PRIMARY_GPT; t <= SECONDARY_GPT; t++) {
+            EXPECT_EQ(AB_SLOT_ACTIVE_VAL, Attr(lun, std::string(ptn) + "_b", (enum gpt_instance)t))
+                    << ptn;
+            EXPECT_EQ(AB_SLOT_INACTIVE_VAL,
+                      Attr(lun, std::string(ptn) + "_a", (enum gpt_instance)t))
+                    << ptn;
+        }
+    }
+    EXPECT_EQ(AB_SLOT_ACTIVE_VAL, Attr("sde", "xbl_b", PRIMARY_GPT));
+    EXPECT_EQ(AB_SLOT_INACTIVE_VAL, Attr("sdd", "xbl_a", SECONDARY_GPT));
+    EXPECT_EQ(0, Attr("sda", "userdata", PRIMARY_GPT));
+    EXPECT_EQ(2, BootLun());
+    for (const Lun& lun : kAbLuns) EXPECT_TRUE(LunClean(lun.first));
+
+    ASSERT_EQ(0, gpt_utils_set_slot_attr(AB_SLOT_B_SUFFIX, GPT_SLOT_MARK_SUCCESSFUL));
+    ASSERT_EQ(0, gpt_utils_set_slot_attr(AB_SLOT_A_SUFFIX, GPT_SLOT_MARK_UNBOOTABLE));
+    for (int t = PRIMARY_GPT; t <= SECONDARY_GPT; t++) {
+        EXPECT_EQ(AB_SLOT_ACTIVE_VAL | AB_PARTITION_ATTR_BOOT_SUCCESSFUL,
+                  Attr("sdb", "tz_b", (enum gpt_instance)t));
+        EXPECT_EQ(AB_PARTITION_ATTR_UNBOOTABLE, Attr("sdb", "tz_a", (enum gpt_instance)t));
+    }
+    // Marking a slot leaves the boot LUN alone
+    EXPECT_EQ(2, BootLun());
+
+    ASSERT_EQ(0, gpt_utils_set_slot_attr(AB_SLOT_A_SUFFIX, GPT_SLOT_SET_ACTIVE));
+    EXPECT_EQ(AB_SLOT_ACTIVE_VAL, Attr("sda", "boot_a", SECONDARY_GPT));
+    EXPECT_EQ(AB_SLOT_INACTIVE_VAL, Attr("sda", "boot_b", SECONDARY_GPT));
+    EXPECT_EQ(1, BootLun());
+    for (const Lun& lun : kAbLuns) EXPECT_TRUE(LunClean(lun.first));
+
+    EXPECT_NE(0, gpt_utils_set_slot_attr("_c", GPT_SLOT_SET_ACTIVE));
+    EXPECT_NE(0, gpt_utils_set_slot_attr(NULL, GPT_SLOT_SET_ACTIVE));
+}
+
+TEST_P(GptUtilsTest, Scan) {
+    UseLuns(kFailsafeLuns);
+    struct gpt_scan_lun luns[GPT_SCAN_MAX_LUNS];
+    struct gpt_scan_lun lun;
+    uint32_t num_luns = 0;
+
+    ASSERT_EQ(0, gpt_utils_scan(luns, GPT_SCAN_MAX_LUNS, &num_luns));
+    ASSERT_EQ(kFailsafeLuns.size(), num_luns);
+    for (uint32_t i = 0; i < num_luns; i++) {
+        EXPECT_EQ(bs_, luns[i].block_size);
+        EXPECT_EQ(0U, luns[i].table_errors[PRIMARY_GPT] | luns[i].table_errors[SECONDARY_GPT]);
+        EXPECT_EQ(0U, luns[i].num_mismatches);
+    }
+
+    // Swaps of a failsafe update in progress are told apart from damage
+    ASSERT_EQ(0, prepare_boot_update(UPDATE_MAIN));
+    ASSERT_EQ(1, gpt_utils_scan_lun(Path("sdb").c_str(), &lun));
+    EXPECT_TRUE(lun.table_errors[PRIMARY_GPT] & GPT_SCAN_BAD_SIGNATURE);
+    EXPECT_EQ(0U, lun.table_errors[SECONDARY_GPT]);
+    EXPECT_EQ(4U, lun.num_mismatches);
+    EXPECT_EQ(4U, lun.num_expected);
+
+    // A backup entry changed on its own
+    WriteAttr("sda", "persist", SECONDARY_GPT, AB_PARTITION_ATTR_UNBOOTABLE);
+    ASSERT_EQ(1, gpt_utils_scan_lun(Path("sda").c_str(), &lun));
+    EXPECT_EQ(0U, lun.table_errors[PRIMARY_GPT] | lun.table_errors[SECONDARY_GPT]);
+    ASSERT_EQ(1U, lun.num_mismatches);
+    EXPECT_EQ(0U, lun.num_expected);
+    EXPECT_EQ(1U, lun.mismatches[0].index);
+    EXPECT_EQ((uint32_t)GPT_SCAN_DIFF_ATTR, lun.mismatches[0].fields);
+    EXPECT_STREQ("persist", lun.mismatches[0].name_bak);
+
+    // A backup header that does not match its CRC
+    Image img = ReadImage("sdc");
+    img[img.size() - bs_ + DISK_GUID_OFFSET] ^= 1;
+    WriteImage("sdc", img);
+    ASSERT_EQ(1, gpt_utils_scan_lun(Path("sdc").c_str(), &lun));
+    EXPECT_TRUE(lun.table_errors[SECONDARY_GPT] & GPT_SCAN_BAD_HDR_CRC);
+
+    EXPECT_EQ(-1, gpt_utils_scan_lun(Path("nosuch").c_str(), &lun));
+}
+
+TEST_P(GptUtilsTest, SlotAttrSnapshot) {
+    UseLuns(kAbLuns);
+    struct gpt_utils_stats before, after;
+    uint8_t attr = 0;
+
+    ASSERT_EQ(0, gpt_utils_get_ab_attr("boot_a", &attr));
+    EXPECT_EQ(AB_SLOT_ACTIVE_VAL, attr);
+
+    // Answered from the snapshot while the disks are left alone
+    ASSERT_EQ(0, gpt_utils_get_stats(&before, 0));
+    ASSERT_EQ(0, gpt_utils_get_ab_attr("xbl_b", &attr));
+    EXPECT_EQ(AB_SLOT_INACTIVE_VAL, attr);
+    ASSERT_EQ(0, gpt_utils_get_stats(&after, 0));
+    EXPECT_EQ(before.api[GPT_API_GET_AB_ATTR].hits + 1, after.api[GPT_API_GET_AB_ATTR].hits);
+
+    // Rebuilt after gpt-utils wrote to the disks
+    ASSERT_EQ(0, gpt_utils_set_slot_attr(AB_SLOT_B_SUFFIX, GPT_SLOT_SET_ACTIVE));
+    ASSERT_EQ(0, gpt_utils_get_stats(&before, 0));
+    ASSERT_EQ(0, gpt_utils_get_ab_attr("tz_b", &attr));
+    EXPECT_EQ(AB_SLOT_ACTIVE_VAL, attr);
+    ASSERT_EQ(0, gpt_utils_get_stats(&after, 0));
+    EXPECT_EQ(before.api[GPT_API_GET_AB_ATTR].hits, after.api[GPT_API_GET_AB_ATTR].hits);
+    ASSERT_EQ(0, gpt_utils_get_ab_attr("boot_a", &attr));
+    EXPECT_EQ(AB_SLOT_INACTIVE_VAL, attr);
+
+    // and after something else did
+    WriteAttr("sda", "boot_a", PRIMARY_GPT, AB_PARTITION_ATTR_UNBOOTABLE);
+    WriteAttr("sda", "boot_a", SECONDARY_GPT, AB_PARTITION_ATTR_UNBOOTABLE);
+    ASSERT_EQ(0, gpt_utils_get_ab_attr("boot_a", &attr));
+    EXPECT_EQ(AB_PARTITION_ATTR_UNBOOTABLE, attr);
+
+    // Only the A/B partitions are in it
+    EXPECT_NE(0, gpt_utils_get_ab_attr("userdata", &attr));
+    EXPECT_NE(0, gpt_utils_get_ab_attr("boot", &attr));
+    EXPECT_NE(0, gpt_utils_get_ab_attr(NULL, &attr));
+}
+
+// 512 byte sectors as on eMMC, 4 KiB ones as on UFS
+INSTANTIATE_TEST_SUITE_P(SectorSize, GptUtilsTest, ::testing::Values(512U, 4096U),
+                         [](const ::testing::TestParamInfo<uint32_t>& info) {
+                             return std::to_string(info.param);
+                         });
@@ -0,0 +1,334 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// Query paths of recovery-ufs-bsg against the in-memory device of
+// ufs-bsg-fake: replies parsed into attributes, flags and descriptors,
+// faults surfacing as errors, the boot LUN switch over the BSG node or the
+// legacy ioctl, and ufs_set_transport() dropping what was cached.
+
+#include <gtest/gtest.h>
+#include <errno.h>
+
+#include "ufs-bsg-fake.h"
+
+// Scsi generic node the legacy set_boot_lun() queries
+#define FAKE_SG_DEV "/dev/sg0"
+
+// Numbered as in the UFS spec, the names of recovery-ufs-bsg.h only exist
+// in BSG builds
+#define ATTR_BOOT_LU_EN 0x00
+#define DESC_GEOMETRY 0x07
+#define DESC_UNIT 0x02
+#define GEOMETRY_OPT_WRITE_BLK 0x14
+
+class UfsBsgTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        dev_ = ufs_fake_create();
+        ufs_fake_add_node(dev_, FAKE_SG_DEV);
+        ufs_fake_install(dev_);
+    }
+
+    void TearDown() override {
+        ufs_fake_uninstall();
+        ufs_fake_destroy(dev_);
+    }
+
+    struct ufs_fake_stats Stats() const {
+        struct ufs_fake_stats stats;
+        ufs_fake_get_stats(dev_, &stats);
+        return stats;
+    }
+
+    struct ufs_fake* dev_;
+};
+
+TEST_F(UfsBsgTest, SetBootLun) {
+    ASSERT_EQ(0, set_boot_lun((char*)FAKE_SG_DEV, 2));
+    EXPECT_EQ(2U, ufs_fake_get_attr(dev_, ATTR_BOOT_LU_EN, 0, 0));
+    ASSERT_EQ(0, set_boot_lun((char*)FAKE_SG_DEV, 1));
+    EXPECT_EQ(1U, ufs_fake_get_attr(dev_, ATTR_BOOT_LU_EN, 0, 0));
+
+    struct ufs_fake_stats stats = Stats();
+#ifdef _BSG_FRAMEWORK_KERNEL_HEADERS
+    // The switch goes over the BSG node, the sg node is left alone
+    EXPECT_EQ(2UL, stats.bsg_queries);
+    EXPECT_EQ(0UL, stats.legacy_queries);
+#else
+    EXPECT_EQ(0UL, stats.bsg_queries);
+    EXPECT_EQ(2UL, stats.legacy_queries);
+#endif
+}
+
+TEST_F(UfsBsgTest, SetBootLunFault) {
+    ufs_fake_inject(dev_, UFS_FAKE_ANY, ATTR_BOOT_LU_EN, UFS_FAKE_FAULT_ERRNO, EIO, 0, 1);
+    EXPECT_NE(0, set_boot_lun((char*)FAKE_SG_DEV, 2));
+    EXPECT_EQ(1U, ufs_fake_get_attr(dev_, ATTR_BOOT_LU_EN, 0, 0));
+    EXPECT_EQ(0, set_boot_lun((char*)FAKE_SG_DEV, 2));
+    EXPECT_EQ(2U, ufs_fake_get_attr(dev_, ATTR_BOOT_LU_EN, 0, 0));
+}
+
+#ifdef _BSG_FRAMEWORK_KERNEL_HEADERS
+TEST_F(UfsBsgTest, ReadWriteAttr) {
+    struct ufs_bsg_session* session = ufs_bsg_session_get();
+    __u32 value = 0;
+
+    ASSERT_NE(nullptr, session);
+    ufs_fake_set_attr(dev_, QUERY_ATTR_IDN_CURR_WB_BUFF_SIZE, 0, 0, 0x12345678);
+    ASSERT_EQ(0, ufs_bsg_read_attr(session, QUERY_ATTR_IDN_CURR_WB_BUFF_SIZE, 0, 0, &value));
+    EXPECT_EQ(0x12345678U, value);
+
+    ASSERT_EQ(0, ufs_bsg_write_attr(session, QUERY_ATTR_IDN_ACTIVE_ICC_LVL, 0, 0, 7));
+    EXPECT_EQ(7U, ufs_fake_get_attr(dev_, QUERY_ATTR_IDN_ACTIVE_ICC_LVL, 0, 0));
+}
+
+TEST_F(UfsBsgTest, Flags) {
+    struct ufs_bsg_session* session = ufs_bsg_session_get();
+    bool value = true;
+
+    ASSERT_NE(nullptr, session);
+    ufs_fake_set_flag(dev_, QUERY_FLAG_IDN_BKOPS_EN, 0, false);
+    ASSERT_EQ(0, ufs_bsg_read_flag(session, QUERY_FLAG_IDN_BKOPS_EN, 0, &value));
+    EXPECT_FALSE(value);
+    ASSERT_EQ(0, ufs_bsg_set_flag(session, QUERY_FLAG_IDN_BKOPS_EN, 0));
+    EXPECT_TRUE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_BKOPS_EN, 0));
+    ASSERT_EQ(0, ufs_bsg_clear_flag(session, QUERY_FLAG_IDN_BKOPS_EN, 0));
+    EXPECT_FALSE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_BKOPS_EN, 0));
+}
+
+TEST_F(UfsBsgTest, ReadDesc) {
+    struct ufs_bsg_session* session = ufs_bsg_session_get();
+    __u8 expected[256], buf[256] = {0};
+    __u16 len = sizeof(buf);
+    __u16 size;
+
+    ASSERT_NE(nullptr, session);
+    size = ufs_fake_get_desc(dev_, DESC_GEOMETRY, 0, expected, sizeof(expected));
+    ASSERT_NE(0, size);
+    ASSERT_EQ(0, ufs_bsg_read_desc(session, DESC_GEOMETRY, 0, 0, buf, &len));
+    ASSERT_EQ(size, len);
+    EXPECT_EQ(0, memcmp(expected, buf, len));
+
+    // Shorter buffers get a truncated descriptor
+    len = 8;
+    ASSERT_EQ(0, ufs_bsg_read_desc(session, DESC_GEOMETRY, 0, 0, buf, &len));
+    EXPECT_EQ(8, len);
+}
+
+TEST_F(UfsBsgTest, IoUnit) {
+    uint32_t write_unit = 0, erase_unit = 0;
+
+    ASSERT_EQ(0, get_ufs_io_unit(1, &write_unit, &erase_unit));
+    // bOptimalWriteBlockSize 0x40 sectors, dEraseBlockSize 1024 blocks
+    EXPECT_EQ(32U * 1024, write_unit);
+    EXPECT_EQ(4U * 1024 * 1024, erase_unit);
+}
+
+TEST_F(UfsBsgTest, BadDescriptor) {
+    __u8 desc[256];
+    __u16 size = ufs_fake_get_desc(dev_, DESC_UNIT, 3, desc, sizeof(desc));
+    struct ufs_bsg_session* session = ufs_bsg_session_get();
+    struct ufs_unit unit;
+
+    ASSERT_NE(nullptr, session);
+    ASSERT_NE(0, size);
+    // Unit descriptor of another kind, then one too short
+    desc[1] = DESC_GEOMETRY;
+    ufs_fake_set_desc(dev_, DESC_UNIT, 3, desc, size);
+    EXPECT_EQ(-EIO, ufs_read_unit(session, 3, &unit));
+    desc[1] = DESC_UNIT;
+    desc[0] = 4;
+    ufs_fake_set_desc(dev_, DESC_UNIT, 3, desc, 4);
+    EXPECT_EQ(-EIO, ufs_read_unit(session, 3, &unit));
+}
+
+TEST_F(UfsBsgTest, Faults) {
+    struct ufs_bsg_session* session = ufs_bsg_session_get();
+    __u32 value = 0;
+
+    ASSERT_NE(nullptr, session);
+    ufs_fake_inject(dev_, QUERY_REQ_OP_READ_ATTR, QUERY_ATTR_IDN_BKOPS_STATUS,
+                    UFS_FAKE_FAULT_ERRNO, EIO, 0, 1);
+    EXPECT_NE(0, ufs_bsg_read_attr(session, QUERY_ATTR_IDN_BKOPS_STATUS, 0, 0, &value));
+
+    ufs_fake_inject(dev_, QUERY_REQ_OP_READ_ATTR, QUERY_ATTR_IDN_BKOPS_STATUS,
+                    UFS_FAKE_FAULT_LLD, -EIO, 0, 1);
+    EXPECT_EQ(-EAGAIN, ufs_bsg_read_attr(session, QUERY_ATTR_IDN_BKOPS_STATUS, 0, 0, &value));
+
+    ufs_fake_inject(dev_, QUERY_REQ_OP_READ_ATTR, QUERY_ATTR_IDN_BKOPS_STATUS,
+                    UFS_FAKE_FAULT_RESPONSE, 0xFF, 0, 1);
+    EXPECT_EQ(-EIO, ufs_bsg_read_attr(session, QUERY_ATTR_IDN_BKOPS_STATUS, 0, 0, &value));
+
+    // Faults are used up, the next query goes through
+    ufs_fake_set_attr(dev_, QUERY_ATTR_IDN_BKOPS_STATUS, 0, 0, 2);
+    ASSERT_EQ(0, ufs_bsg_read_attr(session, QUERY_ATTR_IDN_BKOPS_STATUS, 0, 0, &value));
+    EXPECT_EQ(2U, value);
+    EXPECT_EQ(3UL, Stats().failed);
+}
+
+TEST_F(UfsBsgTest, BatchKeepsGoing) {
+    struct ufs_bsg_session* session = ufs_bsg_session_get();
+    struct ufs_query queries[3] = {};
+
+    ASSERT_NE(nullptr, session);
+    for (auto& q : queries) q.opcode = QUERY_REQ_OP_READ_ATTR;
+    queries[0].idn = QUERY_ATTR_IDN_BOOT_LU_EN;
+    queries[1].idn = QUERY_ATTR_IDN_BKOPS_STATUS;
+    queries[2].idn = QUERY_ATTR_IDN_AVAIL_WB_BUFF_SIZE;
+    ufs_fake_inject(dev_, QUERY_REQ_OP_READ_ATTR, QUERY_ATTR_IDN_BKOPS_STATUS,
+                    UFS_FAKE_FAULT_RESPONSE, 0xFF, 0, 1);
+
+    EXPECT_EQ(1, ufs_bsg_query_batch(session, queries, 3));
+    EXPECT_EQ(0, queries[0].result);
+    EXPECT_EQ(1U, queries[0].value);
+    EXPECT_EQ(-EIO, queries[1].result);
+    EXPECT_EQ(0, queries[2].result);
+    EXPECT_EQ(UFS_WB_AVAIL_BUF_FULL, queries[2].value);
+}
+
+TEST_F(UfsBsgTest, TransportResetsCache) {
+    uint32_t write_unit = 0, erase_unit = 0;
+    __u8 desc[256];
+    __u16 size = ufs_fake_get_desc(dev_, DESC_GEOMETRY, 0, desc, sizeof(desc));
+
+    ASSERT_EQ(0, get_ufs_io_unit(1, &write_unit, &erase_unit));
+    ASSERT_EQ(32U * 1024, write_unit);
+
+    // Descriptors are cached: a change on the device goes unnoticed
+    desc[GEOMETRY_OPT_WRITE_BLK] = 0x20;
+    ufs_fake_set_desc(dev_, DESC_GEOMETRY, 0, desc, size);
+    ASSERT_EQ(0, get_ufs_io_unit(1, &write_unit, &erase_unit));
+    EXPECT_EQ(32U * 1024, write_unit);
+
+    // until the transport is set again
+    ufs_fake_install(dev_);
+    ASSERT_EQ(0, get_ufs_io_unit(1, &write_unit, &erase_unit));
+    EXPECT_EQ(16U * 1024, write_unit);
+}
+
+TEST_F(UfsBsgTest, TransportResetsSession) {
+    struct ufs_fake* other = ufs_fake_create();
+    struct ufs_bsg_session* session;
+    __u32 value = 0;
+
+    ASSERT_NE(nullptr, ufs_bsg_session_get());
+    ufs_fake_set_attr(other, QUERY_ATTR_IDN_ACTIVE_ICC_LVL, 0, 0, 9);
+    ufs_fake_install(other);
+    session = ufs_bsg_session_get();
+    ASSERT_NE(nullptr, session);
+    ASSERT_EQ(0, ufs_bsg_read_attr(session, QUERY_ATTR_IDN_ACTIVE_ICC_LVL, 0, 0, &value));
+    EXPECT_EQ(9U, value);
+    EXPECT_EQ(1UL, Stats().opens);
+
+    ufs_fake_install(dev_);
+    ufs_fake_destroy(other);
+}
+
+TEST_F(UfsBsgTest, WbStatus) {
+    struct ufs_bsg_session* session = ufs_bsg_session_get();
+    struct ufs_wb_status status;
+
+    ASSERT_NE(nullptr, session);
+    ufs_fake_set_flag(dev_, QUERY_FLAG_IDN_WB_EN, 0, true);
+    ufs_fake_set_flag(dev_, QUERY_FLAG_IDN_WB_BUFF_FLUSH_EN, 0, false);
+    ufs_fake_set_flag(dev_, QUERY_FLAG_IDN_WB_BUFF_FLUSH_DURING_HIBERN8, 0, true);
+    ufs_fake_set_attr(dev_, QUERY_ATTR_IDN_WB_FLUSH_STATUS, 0, 0, UFS_WB_FLUSH_COMPLETED);
+    ufs_fake_set_attr(dev_, QUERY_ATTR_IDN_AVAIL_WB_BUFF_SIZE, 0, 0, 7);
+    ufs_fake_set_attr(dev_, QUERY_ATTR_IDN_WB_BUFF_LIFE_TIME_EST, 0, 0, 2);
+    ufs_fake_set_attr(dev_, QUERY_ATTR_IDN_CURR_WB_BUFF_SIZE, 0, 0, 0x400);
+    ASSERT_EQ(0, ufs_wb_read_status(session, &status));
+    EXPECT_TRUE(status.enabled);
+    EXPECT_FALSE(status.flush);
+    EXPECT_TRUE(status.flush_during_hibern8);
+    EXPECT_EQ((__u32)UFS_WB_FLUSH_COMPLETED, status.flush_status);
+    EXPECT_EQ(7U, status.avail_buf);
+    EXPECT_EQ(2U, status.lifetime);
+    EXPECT_EQ(0x400U, status.cur_buf_size);
+    // All of it in one batch, flag by flag and attribute by attribute
+    EXPECT_EQ(7UL, Stats().bsg_queries);
+
+    ASSERT_EQ(0, ufs_wb_set_enable(session, false));
+    EXPECT_FALSE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_WB_EN, 0));
+    ASSERT_EQ(0, ufs_wb_set_flush(session, true));
+    EXPECT_TRUE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_WB_BUFF_FLUSH_EN, 0));
+    ASSERT_EQ(0, ufs_wb_set_flush_during_hibern8(session, false));
+    EXPECT_FALSE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_WB_BUFF_FLUSH_DURING_HIBERN8, 0));
+}
+
+TEST_F(UfsBsgTest, WbStatusFault) {
+    struct ufs_bsg_session* session = ufs_bsg_session_get();
+    struct ufs_wb_status status;
+
+    ASSERT_NE(nullptr, session);
+    // Devices without WriteBooster reject its attributes
+    ufs_fake_inject(dev_, QUERY_REQ_OP_READ_ATTR, QUERY_ATTR_IDN_AVAIL_WB_BUFF_SIZE,
+                    UFS_FAKE_FAULT_RESPONSE, 0xF5, 0, 0);
+    EXPECT_NE(0, ufs_wb_read_status(session, &status));
+    ufs_fake_clear_faults(dev_);
+    ufs_fake_inject(dev_, QUERY_REQ_OP_SET_FLAG, QUERY_FLAG_IDN_WB_EN, UFS_FAKE_FAULT_ERRNO,
+                    EIO, 0, 1);
+    ufs_fake_set_flag(dev_, QUERY_FLAG_IDN_WB_EN, 0, false);
+    EXPECT_NE(0, ufs_wb_set_enable(session, true));
+    EXPECT_FALSE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_WB_EN, 0));
+}
+
+TEST_F(UfsBsgTest, Bkops) {
+    struct ufs_bsg_session* session = ufs_bsg_session_get();
+    __u32 status = 0;
+    bool enabled = false;
+
+    ASSERT_NE(nullptr, session);
+    ufs_fake_set_flag(dev_, QUERY_FLAG_IDN_BKOPS_EN, 0, true);
+    ufs_fake_set_attr(dev_, QUERY_ATTR_IDN_BKOPS_STATUS, 0, 0, UFS_BKOPS_STATUS_PERF_IMPACT);
+    ASSERT_EQ(0, ufs_bkops_read_status(session, &enabled, &status));
+    EXPECT_TRUE(enabled);
+    EXPECT_EQ((__u32)UFS_BKOPS_STATUS_PERF_IMPACT, status);
+
+    ASSERT_EQ(0, ufs_bkops_set_enable(session, false));
+    EXPECT_FALSE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_BKOPS_EN, 0));
+    ASSERT_EQ(0, ufs_bkops_set_enable(session, true));
+    EXPECT_TRUE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_BKOPS_EN, 0));
+
+    // Either half failing fails the read
+    ufs_fake_inject(dev_, QUERY_REQ_OP_READ_ATTR, QUERY_ATTR_IDN_BKOPS_STATUS,
+                    UFS_FAKE_FAULT_ERRNO, EIO, 0, 1);
+    EXPECT_NE(0, ufs_bkops_read_status(session, &enabled, &status));
+}
+
+TEST_F(UfsBsgTest, IccLevel) {
+    struct ufs_bsg_session* session = ufs_bsg_session_get();
+    __u32 level = 0xFF;
+
+    ASSERT_NE(nullptr, session);
+    ufs_fake_set_attr(dev_, QUERY_ATTR_IDN_ACTIVE_ICC_LVL, 0, 0, 4);
+    ASSERT_EQ(0, ufs_icc_read_level(session, &level));
+    EXPECT_EQ(4U, level);
+    ASSERT_EQ(0, ufs_icc_set_level(session, UFS_ICC_LEVEL_MAX));
+    EXPECT_EQ((__u32)UFS_ICC_LEVEL_MAX, ufs_fake_get_attr(dev_, QUERY_ATTR_IDN_ACTIVE_ICC_LVL, 0, 0));
+
+    // Out of range levels never reach the device
+    unsigned long queries = Stats().bsg_queries;
+    EXPECT_EQ(-EINVAL, ufs_icc_set_level(session, UFS_ICC_LEVEL_MAX + 1));
+    EXPECT_EQ(queries, Stats().bsg_queries);
+    EXPECT_EQ((__u32)UFS_ICC_LEVEL_MAX, ufs_fake_get_attr(dev_, QUERY_ATTR_IDN_ACTIVE_ICC_LVL, 0, 0));
+}
+
+TEST_F(UfsBsgTest, SessionRelease) {
+    ASSERT_NE(nullptr, ufs_bsg_session_get());
+    ASSERT_NE(nullptr, ufs_bsg_session_get());
+    EXPECT_EQ(1UL, Stats().opens);
+    ufs_bsg_session_release();
+    ASSERT_NE(nullptr, ufs_bsg_session_get());
+    EXPECT_EQ(2UL, Stats().opens);
+}
+#else
+TEST_F(UfsBsgTest, NoIoUnit) {
+    uint32_t write_unit, erase_unit;
+
+    // Descriptors are only read through the BSG framework
+    EXPECT_NE(0, get_ufs_io_unit(1, &write_unit, &erase_unit));
+}
+#endif
@@ -0,0 +1,225 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+// The WriteBooster and sustained I/O policies of ufs_policyd against the
+// in-memory device of ufs-bsg-fake, fed with made up I/O activity: what
+// they set on the device, and that an idle device is left alone.
+
+#include <gtest/gtest.h>
+
+#include "tools/ufs_policy.h"
+#include "ufs-bsg-fake.h"
+
+class UfsPolicyTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        dev_ = ufs_fake_create();
+        ufs_fake_install(dev_);
+        session_ = ufs_bsg_session_get();
+        ASSERT_NE(nullptr, session_);
+        ufs_fake_set_attr(dev_, QUERY_ATTR_IDN_AVAIL_WB_BUFF_SIZE, 0, 0, UFS_WB_AVAIL_BUF_FULL);
+        ufs_fake_set_attr(dev_, QUERY_ATTR_IDN_WB_BUFF_LIFE_TIME_EST, 0, 0, 1);
+    }
+
+    void TearDown() override {
+        ufs_fake_uninstall();
+        ufs_fake_destroy(dev_);
+    }
+
+    // One poll worth of activity, a second after the previous one
+    struct io_activity Poll(uint64_t bps, uint64_t write_bps) {
+        now_++;
+        io_.now_s = now_;
+        io_.bps = bps;
+        io_.write_bps = write_bps;
+        io_.busy = bps != 0;
+        io_.idle_s = io_.busy ? 0 : io_.idle_s + 1;
+        return io_;
+    }
+
+    // Have pp see sys.boot_completed, long enough ago for the boot phase
+    // to be over
+    void BootLongAgo(struct power_policy* pp) {
+        struct io_activity io = Poll(0, 0);
+        power_policy_update(pp, &io, true);
+        now_ += BOOT_BOOST_S;
+    }
+
+    unsigned long Queries() const {
+        struct ufs_fake_stats stats;
+        ufs_fake_get_stats(dev_, &stats);
+        return stats.bsg_queries;
+    }
+
+    struct ufs_fake* dev_;
+    struct ufs_bsg_session* session_;
+    uint64_t now_ = 1000;
+    struct io_activity io_ = {};
+};
+
+TEST_F(UfsPolicyTest, WbFollowsHeavyWrites) {
+    struct wb_policy wb;
+    struct io_activity io;
+
+    ufs_fake_set_flag(dev_, QUERY_FLAG_IDN_WB_EN, 0, false);
+    ASSERT_TRUE(wb_policy_init(&wb, session_, now_));
+    // The device gets to flush the buffer while hibernating
+    EXPECT_TRUE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_WB_BUFF_FLUSH_DURING_HIBERN8, 0));
+
+    for (unsigned i = 0; i < WB_HEAVY_SAMPLES; i++) {
+        io = Poll(WB_HEAVY_WRITE_BPS, WB_HEAVY_WRITE_BPS);
+        wb_policy_update(&wb, &io, false);
+    }
+    EXPECT_TRUE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_WB_EN, 0));
+
+    // Still on right after the writes, off once they are long over
+    for (unsigned i = 0; i < WB_OFF_DELAY_S - 1; i++) {
+        io = Poll(4096, 4096);
+        wb_policy_update(&wb, &io, false);
+    }
+    EXPECT_TRUE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_WB_EN, 0));
+    io = Poll(4096, 4096);
+    wb_policy_update(&wb, &io, false);
+    EXPECT_FALSE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_WB_EN, 0));
+}
+
+TEST_F(UfsPolicyTest, WbLeftToKernel) {
+    struct wb_policy wb;
+    struct io_activity io;
+
+    ufs_fake_set_flag(dev_, QUERY_FLAG_IDN_WB_EN, 0, false);
+    ASSERT_TRUE(wb_policy_init(&wb, session_, now_));
+    unsigned long queries = Queries();
+    for (unsigned i = 0; i < WB_HEAVY_SAMPLES + IDLE_DELAY_S; i++) {
+        io = Poll(i < WB_HEAVY_SAMPLES ? WB_HEAVY_WRITE_BPS : 0,
+                  i < WB_HEAVY_SAMPLES ? WB_HEAVY_WRITE_BPS : 0);
+        wb_policy_update(&wb, &io, true);
+    }
+    EXPECT_FALSE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_WB_EN, 0));
+    EXPECT_EQ(queries, Queries());
+}
+
+TEST_F(UfsPolicyTest, WbWornOut) {
+    struct wb_policy wb;
+    struct io_activity io;
+
+    ufs_fake_set_flag(dev_, QUERY_FLAG_IDN_WB_EN, 0, false);
+    ufs_fake_set_attr(dev_, QUERY_ATTR_IDN_WB_BUFF_LIFE_TIME_EST, 0, 0, UFS_WB_LIFETIME_EXCEEDED);
+    ASSERT_TRUE(wb_policy_init(&wb, session_, now_));
+    for (unsigned i = 0; i < 2 * WB_HEAVY_SAMPLES; i++) {
+        io = Poll(WB_HEAVY_WRITE_BPS, WB_HEAVY_WRITE_BPS);
+        wb_policy_update(&wb, &io, false);
+    }
+    EXPECT_FALSE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_WB_EN, 0));
+}
+
+TEST_F(UfsPolicyTest, WbFlushWhileIdle) {
+    struct wb_policy wb;
+    struct io_activity io;
+
+    ufs_fake_set_flag(dev_, QUERY_FLAG_IDN_WB_EN, 0, false);
+    ufs_fake_set_attr(dev_, QUERY_ATTR_IDN_AVAIL_WB_BUFF_SIZE, 0, 0, 3);
+    ASSERT_TRUE(wb_policy_init(&wb, session_, now_));
+    io = Poll(4096, 4096);
+    wb_policy_update(&wb, &io, false);
+    for (unsigned i = 0; i < IDLE_DELAY_S; i++) {
+        io = Poll(0, 0);
+        wb_policy_update(&wb, &io, false);
+    }
+    EXPECT_TRUE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_WB_BUFF_FLUSH_EN, 0));
+
+    // The idle device is only looked at every WB_FLUSH_CHECK_S
+    unsigned long queries = Queries();
+    for (unsigned i = 0; i < WB_FLUSH_CHECK_S - 1; i++) {
+        io = Poll(0, 0);
+        wb_policy_update(&wb, &io, false);
+    }
+    EXPECT_EQ(queries, Queries());
+
+    // Foreground I/O stops the flush
+    io = Poll(4096, 4096);
+    wb_policy_update(&wb, &io, false);
+    EXPECT_FALSE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_WB_BUFF_FLUSH_EN, 0));
+}
+
+TEST_F(UfsPolicyTest, SustainedIo) {
+    struct power_policy pp;
+    struct io_activity io;
+
+    ufs_fake_set_attr(dev_, QUERY_ATTR_IDN_ACTIVE_ICC_LVL, 0, 0, 2);
+    ufs_fake_set_flag(dev_, QUERY_FLAG_IDN_BKOPS_EN, 0, true);
+    ASSERT_TRUE(power_policy_init(&pp, session_, 9));
+    BootLongAgo(&pp);
+
+    for (unsigned i = 0; i < IO_SUSTAINED_SAMPLES - 1; i++) {
+        io = Poll(IO_SUSTAINED_BPS, 0);
+        power_policy_update(&pp, &io, true);
+    }
+    EXPECT_EQ(2U, ufs_fake_get_attr(dev_, QUERY_ATTR_IDN_ACTIVE_ICC_LVL, 0, 0));
+    io = Poll(IO_SUSTAINED_BPS, 0);
+    power_policy_update(&pp, &io, true);
+    EXPECT_EQ(9U, ufs_fake_get_attr(dev_, QUERY_ATTR_IDN_ACTIVE_ICC_LVL, 0, 0));
+    EXPECT_FALSE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_BKOPS_EN, 0));
+
+    // Nothing is queried while it goes on
+    unsigned long queries = Queries();
+    io = Poll(IO_SUSTAINED_BPS, 0);
+    power_policy_update(&pp, &io, true);
+    EXPECT_EQ(queries, Queries());
+
+    for (unsigned i = 0; i < IO_SUSTAINED_HOLD_S; i++) {
+        io = Poll(0, 0);
+        power_policy_update(&pp, &io, true);
+    }
+    EXPECT_EQ(2U, ufs_fake_get_attr(dev_, QUERY_ATTR_IDN_ACTIVE_ICC_LVL, 0, 0));
+    EXPECT_TRUE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_BKOPS_EN, 0));
+}
+
+TEST_F(UfsPolicyTest, UrgentBkopsKept) {
+    struct power_policy pp;
+    struct io_activity io;
+
+    ufs_fake_set_flag(dev_, QUERY_FLAG_IDN_BKOPS_EN, 0, true);
+    ufs_fake_set_attr(dev_, QUERY_ATTR_IDN_BKOPS_STATUS, 0, 0, UFS_BKOPS_STATUS_PERF_IMPACT);
+    ASSERT_TRUE(power_policy_init(&pp, session_, -1));
+    BootLongAgo(&pp);
+    for (unsigned i = 0; i < IO_SUSTAINED_SAMPLES; i++) {
+        io = Poll(IO_SUSTAINED_BPS, 0);
+        power_policy_update(&pp, &io, true);
+    }
+    EXPECT_TRUE(ufs_fake_get_flag(dev_, QUERY_FLAG_IDN_BKOPS_EN, 0));
+}
+
+TEST_F(UfsPolicyTest, BootLowersTheBar) {
+    struct power_policy pp;
+    struct io_activity io;
+
+    ufs_fake_set_flag(dev_, QUERY_FLAG_IDN_BKOPS_EN, 0, true);
+    ASSERT_TRUE(power_policy_init(&pp, session_, 5));
+
+    // An idle device is left alone while booting
+    unsigned long queries = Queries();
+    for (unsigned i = 0; i < 10; i++) {
+        io = Poll(0, 0);
+        power_policy_update(&pp, &io, false);
+    }
+    EXPECT_EQ(queries, Queries());
+
+    io = Poll(BOOT_IO_BPS, 0);
+    power_policy_update(&pp, &io, false);
+    EXPECT_EQ(5U, ufs_fake_get_attr(dev_, QUERY_ATTR_IDN_ACTIVE_ICC_LVL, 0, 0));
+
+    // Long after boot completed the same I/O is not sustained anymore
+    for (unsigned i = 0; i < IO_SUSTAINED_HOLD_S; i++) {
+        io = Poll(0, 0);
+        power_policy_update(&pp, &io, true);
+    }
+    EXPECT_EQ(0U, ufs_fake_get_attr(dev_, QUERY_ATTR_IDN_ACTIVE_ICC_LVL, 0, 0));
+    now_ += BOOT_BOOST_S;
+    io = Poll(BOOT_IO_BPS, 0);
+    power_policy_update(&pp, &io, true);
+    EXPECT_EQ(0U, ufs_fake_get_attr(dev_, QUERY_ATTR_IDN_ACTIVE_ICC_LVL, 0, 0));
+}
@@ -0,0 +1,516 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "gpt-disk.h"
+#include "gpt-utils.h"
+#include "gpt-verify.h"
+
+// Set by --stats
+static int print_stats;
+
+static uint64_t now_us() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Start of an operation: its start time and the library counters of every
+// thread, as the boot update and scan spread their I/O over worker threads
+struct op_start {
+    uint64_t us;
+    struct gpt_utils_stats stats;
+};
+
+static struct op_start op_begin() {
+    struct op_start start;
+
+    gpt_utils_get_stats(&start.stats, 1);
+    start.us = now_us();
+    return start;
+}
+
+// Latency and I/O counters of an operation
+static void report(const char *op, const struct op_start &start) {
+    uint64_t us = now_us() - start.us;
+    struct gpt_utils_stats end;
+
+    if (!print_stats) return;
+    gpt_utils_get_stats(&end, 1);
+    fprintf(stderr,
+            "stats: %s: %" PRIu64 " us, %" PRIu64 " syscalls, %" PRIu64 " reads, %" PRIu64
+            " writes, %" PRIu64 " fsyncs, %" PRIu64 " ioctls, %" PRIu64 " bytes read, %" PRIu64
+            " bytes written\n",
+            op, us, end.syscalls - start.stats.syscalls, end.reads - start.stats.reads,
+            end.writes - start.stats.writes, end.fsyncs - start.stats.fsyncs,
+            end.ioctls - start.stats.ioctls, end.bytes_read - start.stats.bytes_read,
+            end.bytes_written - start.stats.bytes_written);
+}
+
+// Where the time went, by library call
+static void report_api() {
+    struct gpt_utils_stats stats;
+
+    if (!print_stats) return;
+    gpt_utils_get_stats(&stats, 1);
+    for (int i = 0; i < GPT_API_COUNT; i++) {
+        if (!stats.api[i].calls) continue;
+        fprintf(stderr, "stats: %s: %" PRIu64 " calls (%" PRIu64 " cached), %" PRIu64 " us\n",
+                gpt_utils_api_name((enum gpt_api)i), stats.api[i].calls, stats.api[i].hits,
+                stats.api[i].time_ns / 1000);
+    }
+}
+
+static uint64_t get_le(const uint8_t *p, int len) {
+    uint64_t v = 0;
+
+    for (int i = len - 1; i >= 0; i--) v = (v << 8) | p[i];
+    return v;
+}
+
+// Partition name of an entry, UTF-16LE narrowed to ASCII
+static const char *entry_name(const uint8_t *pentry, char *buf) {
+    int i;
+
+    for (i = 0; i < MAX_GPT_NAME_SIZE / 2; i++) {
+        uint16_t c = get_le(pentry + PARTITION_NAME_OFFSET + 2 * i, 2);
+        if (!c) break;
+        buf[i] = c < 0x80 ? (char)c : '?';
+    }
+    buf[i] = '\0';
+    return buf;
+}
+
+static int is_unused(const uint8_t *pentry) {
+    static const uint8_t zero[16] = {};
+
+    return !memcmp(pentry + TYPE_GUID_OFFSET, zero, sizeof(zero));
+}
+
+static int cmd_dump(int argc, char **argv) {
+    static const char *const tables[] = {"primary", "backup"};
+    char name[MAX_GPT_NAME_SIZE / 2 + 1];
+    struct op_start start = op_begin();
+    GptDisk disk;
+
+    if (argc != 1) return -1;
+    if (disk.Load(argv[0])) {
+        fprintf(stderr, "Failed to load the GPT of the disk holding %s\n", argv[0]);
+        return 1;
+    }
+    report("load", start);
+    printf("%s: block size %u, %u entries of %u bytes\n", disk.c_disk()->devpath,
+           disk.c_disk()->block_size, disk.num_entries(), disk.c_disk()->pentry_size);
+    for (int i = PRIMARY_GPT; i <= SECONDARY_GPT; i++) {
+        const uint8_t *hdr = disk.header((enum gpt_instance)i).data();
+
+        printf("%s header: lba %" PRIu64 ", other %" PRIu64 ", usable %" PRIu64 "-%" PRIu64
+               ", entries at %" PRIu64 ", header crc %08x, entries crc %08x\n",
+               tables[i], get_le(hdr + PRIMARY_HEADER_OFFSET, 8),
+               get_le(hdr + BACKUP_HEADER_OFFSET, 8), get_le(hdr + FIRST_USABLE_LBA_OFFSET, 8),
+               get_le(hdr + LAST_USABLE_LBA_OFFSET, 8), get_le(hdr + PENTRIES_OFFSET, 8),
+               (uint32_t)get_le(hdr + HEADER_CRC_OFFSET, 4),
+               (uint32_t)get_le(hdr + PARTITION_CRC_OFFSET, 4));
+    }
+    for (uint32_t i = 0; i < disk.num_entries(); i++) {
+        std::span<uint8_t> e = disk.entry(i, PRIMARY_GPT);
+        std::span<uint8_t> eb = disk.entry(i, SECONDARY_GPT);
+
+        if (is_unused(e.data()) && is_unused(eb.data())) continue;
+        printf("  [%3u] %-20s %10" PRIu64 "-%-10" PRIu64 " ab %02x%s\n", i,
+               entry_name(e.data(), name), get_le(e.data() + FIRST_LBA_OFFSET, 8),
+               get_le(e.data() + LAST_LBA_OFFSET, 8), e[AB_FLAG_OFFSET],
+               memcmp(e.data(), eb.data(), e.size()) ? "  (backup differs)" : "");
+    }
+    return 0;
+}
+
+static int cmd_map(int argc, char **argv) {
+    std::vector<std::string> ptns(argv, argv + argc);
+    std::map<std::string, std::vector<std::string>> ptn_map;
+    struct op_start start = op_begin();
+
+    if (!argc) return -1;
+    if (gpt_utils_get_partition_map(ptns, ptn_map)) {
+        fprintf(stderr, "Failed to map the partitions to their disks\n");
+        return 1;
+    }
+    report("map", start);
+    for (const auto &it : ptn_map) {
+        printf("%s:", it.first.c_str());
+        for (const std::string &ptn : it.second) printf(" %s", ptn.c_str());
+        printf("\n");
+    }
+    return 0;
+}
+
+static int cmd_get_attr(int argc, char **argv) {
+    int rc = 0;
+
+    if (!argc) return -1;
+    for (int i = 0; i < argc; i++) {
+        struct op_start start = op_begin();
+        uint8_t attr;
+
+        if (gpt_utils_get_ab_attr(argv[i], &attr)) {
+            fprintf(stderr, "No A/B attributes for %s\n", argv[i]);
+            rc = 1;
+            continue;
+        }
+        report("get-attr", start);
+        printf("%s: %02x%s%s%s\n", argv[i], attr,
+               attr & AB_PARTITION_ATTR_SLOT_ACTIVE ? " active" : "",
+               attr & AB_PARTITION_ATTR_BOOT_SUCCESSFUL ? " successful" : "",
+               attr & AB_PARTITION_ATTR_UNBOOTABLE ? " unbootable" : "");
+    }
+    return rc;
+}
+
+// Slot suffix of a, b, _a or _b, NULL for anything else
+static const char *parse_slot(const char *arg) {
+    if (!strcmp(arg, "a") || !strcmp(arg, AB_SLOT_A_SUFFIX)) return AB_SLOT_A_SUFFIX;
+    if (!strcmp(arg, "b") || !strcmp(arg, AB_SLOT_B_SUFFIX)) return AB_SLOT_B_SUFFIX;
+    return NULL;
+}
+
+static int cmd_set_slot(int argc, char **argv) {
+    static const struct {
+        const char *name;
+        enum gpt_slot_op op;
+    } ops[] = {
+            {"active", GPT_SLOT_SET_ACTIVE},
+            {"successful", GPT_SLOT_MARK_SUCCESSFUL},
+            {"unbootable", GPT_SLOT_MARK_UNBOOTABLE},
+    };
+    struct op_start start;
+    const char *slot;
+    size_t i;
+
+    if (argc != 2 || !(slot = parse_slot(argv[0]))) return -1;
+    for (i = 0; i < ARRAY_SIZE(ops); i++)
+        if (!strcmp(argv[1], ops[i].name)) break;
+    if (i == ARRAY_SIZE(ops)) return -1;
+    start = op_begin();
+    if (gpt_utils_set_slot_attr(slot, ops[i].op)) {
+        fprintf(stderr, "Failed to mark slot %s %s\n", slot, ops[i].name);
+        return 1;
+    }
+    report("set-slot", start);
+    return 0;
+}
+
+static int cmd_boot_update(int argc, char **argv) {
+    static const char *const stages[] = {"main", "backup", "finalize"};
+    int first = UPDATE_MAIN, last = UPDATE_FINALIZE;
+
+    if (argc != 1) return -1;
+    if (strcmp(argv[0], "all")) {
+        for (first = UPDATE_MAIN; first <= UPDATE_FINALIZE; first++)
+            if (!strcmp(argv[0], stages[first - UPDATE_MAIN])) break;
+        if (first > UPDATE_FINALIZE) return -1;
+        last = first;
+    }
+    for (int stage = first; stage <= last; stage++) {
+        struct op_start start = op_begin();
+
+        if (prepare_boot_update((enum boot_update_stage)stage)) {
+            fprintf(stderr, "Stage %s of the boot update failed\n",
+                    stages[stage - UPDATE_MAIN]);
+            return 1;
+        }
+        report(stages[stage - UPDATE_MAIN], start);
+    }
+    return 0;
+}
+
+static const char *table_errors(uint32_t errors, char *buf, size_t len) {
+    static const struct {
+        uint32_t bit;
+        const char *name;
+    } names[] = {
+            {GPT_SCAN_IO_ERROR, "io-error"},
+            {GPT_SCAN_BAD_SIGNATURE, "bad-signature"},
+            {GPT_SCAN_BAD_HDR_CRC, "bad-header-crc"},
+            {GPT_SCAN_BAD_HDR_FIELDS, "bad-header-fields"},
+            {GPT_SCAN_BAD_PENTRIES_CRC, "bad-entries-crc"},
+    };
+    size_t pos = 0;
+
+    buf[0] = '\0';
+    for (size_t i = 0; i < ARRAY_SIZE(names); i++) {
+        if (errors & names[i].bit)
+            pos += snprintf(buf + pos, len - pos, "%s%s", pos ? "," : "", names[i].name);
+        if (pos >= len) break;
+    }
+    return errors ? buf : "ok";
+}
+
+static const char *diff_fields(uint32_t fields, char *buf, size_t len) {
+    static const struct {
+        uint32_t bit;
+        const char *name;
+    } names[] = {
+            {GPT_SCAN_DIFF_TYPE_GUID, "type-guid"}, {GPT_SCAN_DIFF_UNIQUE_GUID, "unique-guid"},
+            {GPT_SCAN_DIFF_LBA, "lba"},             {GPT_SCAN_DIFF_ATTR, "attributes"},
+            {GPT_SCAN_DIFF_NAME, "name"},           {GPT_SCAN_DIFF_RESERVED, "reserved"},
+    };
+    size_t pos = 0;
+
+    buf[0] = '\0';
+    for (size_t i = 0; i < ARRAY_SIZE(names); i++) {
+        if (fields & names[i].bit)
+            pos += snprintf(buf + pos, len - pos, "%s%s", pos ? "," : "", names[i].name);
+        if (pos >= len) break;
+    }
+    return buf;
+}
+
+// What the scan found on a LUN. Failsafe swaps are only listed with verbose.
+static void print_lun(const struct gpt_scan_lun *lun, int verbose) {
+    char buf[128];
+    uint32_t i;
+
+    printf("%s: block size %u\n", lun->devpath, lun->block_size);
+    if (print_stats)
+        fprintf(stderr, "stats: scan %s: %" PRIu64 " us\n", lun->devpath, lun->elapsed_us);
+    printf("  primary: %s\n", table_errors(lun->table_errors[PRIMARY_GPT], buf, sizeof(buf)));
+    printf("  backup: %s\n", table_errors(lun->table_errors[SECONDARY_GPT], buf, sizeof(buf)));
+    if (lun->hdr_mismatch) printf("  headers disagree on disk GUID, usable range or entries\n");
+    if (!lun->num_mismatches) return;
+    printf("  %u entries differ, %u of them failsafe swaps\n", lun->num_mismatches,
+           lun->num_expected);
+    for (i = 0; i < lun->num_mismatches && i < GPT_SCAN_MAX_MISMATCHES; i++) {
+        const struct gpt_scan_mismatch *m = &lun->mismatches[i];
+
+        if (m->expected && !verbose) continue;
+        printf("  [%u] %s / %s: %s%s\n", m->index, m->name, m->name_bak,
+               diff_fields(m->fields, buf, sizeof(buf)), m->expected ? " (swap)" : "");
+    }
+}
+
+static int cmd_scan(int argc, char **argv) {
+    int verbose = argc && !strcmp(argv[0], "-v");
+    uint32_t num_luns = argc - verbose ? argc - verbose : GPT_SCAN_MAX_LUNS;
+    std::vector<struct gpt_scan_lun> luns(num_luns);
+    struct op_start start = op_begin();
+    int problems = 0;
+
+    argv += verbose;
+    argc -= verbose;
+    if (argc) {
+        for (int i = 0; i < argc; i++)
+            if (gpt_utils_scan_lun(argv[i], &luns[i])) problems++;
+    } else {
+        problems = gpt_utils_scan(luns.data(), num_luns, &num_luns);
+        if (problems < 0) {
+            fprintf(stderr, "Failed to scan the boot device\n");
+            return 1;
+        }
+    }
+    report("scan", start);
+    for (uint32_t i = 0; i < num_luns; i++) print_lun(&luns[i], verbose);
+    printf("%u LUNs scanned, %d with problems\n", num_luns, problems);
+    return problems ? 1 : 0;
+}
+
+static void print_digest(const struct gpt_verify_entry *e, const uint8_t *digest) {
+    for (uint32_t i = 0; i < gpt_hash_size(e->algo); i++) printf("%02x", digest[i]);
+}
+
+static double mb_per_s(const struct gpt_verify_entry *e) {
+    return e->elapsed_us ? (double)e->bytes / e->elapsed_us : 0;
+}
+
+// Manifest of a slot, with the names stripped of their slot suffix so that
+// it can be checked against either slot
+static int cmd_hash_slot(int argc, char **argv) {
+    enum gpt_hash_algo algo = GPT_HASH_SHA256;
+    struct gpt_verify_entry *entries;
+    struct op_start start;
+    uint32_t num_entries;
+    const char *slot;
+    int rc;
+
+    if (argc < 1 || argc > 2 || !(slot = parse_slot(argv[0]))) return -1;
+    if (argc == 2) {
+        if (!strcmp(argv[1], gpt_hash_name(GPT_HASH_CRC32)))
+            algo = GPT_HASH_CRC32;
+        else if (strcmp(argv[1], gpt_hash_name(GPT_HASH_SHA256)))
+            return -1;
+    }
+    start = op_begin();
+    if (gpt_verify_slot_entries(slot, algo, &entries, &num_entries)) {
+        fprintf(stderr, "Failed to list the partitions of slot %s\n", slot);
+        return 1;
+    }
+    rc = gpt_verify_run(entries, num_entries);
+    report("hash-slot", start);
+    for (uint32_t i = 0; i < num_entries; i++) {
+        struct gpt_verify_entry *e = &entries[i];
+
+        if (e->status != GPT_VERIFY_OK) {
+            fprintf(stderr, "Failed to hash %s\n", e->name);
+            continue;
+        }
+        printf("%.*s %s ", (int)(strlen(e->name) - strlen(slot)), e->name,
+               gpt_hash_name(e->algo));
+        print_digest(e, e->digest);
+        printf("\n");
+        if (print_stats)
+            fprintf(stderr, "stats: %s: %" PRIu64 " bytes, %" PRIu64 " us, %.1f MB/s\n",
+                    e->name, e->bytes, e->elapsed_us, mb_per_s(e));
+    }
+    free(entries);
+    return rc ? 1 : 0;
+}
+
+static int cmd_verify_slot(int argc, char **argv) {
+    static const char *const results[] = {"ok", "MISMATCH", "not found", "I/O error"};
+    struct gpt_verify_entry *entries;
+    struct op_start start;
+    uint32_t num_entries;
+    const char *slot;
+    int rc;
+
+    if (argc != 2 || !(slot = parse_slot(argv[0]))) return -1;
+    if (gpt_verify_load_manifest(argv[1], slot, &entries, &num_entries)) {
+        fprintf(stderr, "Failed to load manifest %s\n", argv[1]);
+        return 1;
+    }
+    start = op_begin();
+    rc = gpt_verify_run(entries, num_entries);
+    report("verify-slot", start);
+    if (rc < 0) {
+        fprintf(stderr, "Failed to verify slot %s\n", slot);
+        free(entries);
+        return 1;
+    }
+    for (uint32_t i = 0; i < num_entries; i++) {
+        struct gpt_verify_entry *e = &entries[i];
+
+        printf("%s: %s", e->name, results[e->status]);
+        if (e->status == GPT_VERIFY_OK || e->status == GPT_VERIFY_MISMATCH)
+            printf(", %" PRIu64 " bytes at %.1f MB/s", e->bytes, mb_per_s(e));
+        printf("\n");
+        if (e->status == GPT_VERIFY_MISMATCH && e->bytes) {
+            printf("  expected ");
+            print_digest(e, e->expected);
+            printf("\n  got      ");
+            print_digest(e, e->digest);
+            printf("\n");
+        }
+    }
+    free(entries);
+    return rc ? 1 : 0;
+}
+
+static const struct {
+    const char *name;
+    int (*run)(int argc, char **argv);
+} commands[] = {
+        {"dump", cmd_dump},         {"map", cmd_map},
+        {"get-attr", cmd_get_attr}, {"set-slot", cmd_set_slot},
+        {"boot-update", cmd_boot_update}, {"scan", cmd_scan},
+        {"verify", cmd_scan},
+        {"hash-slot", cmd_hash_slot},     {"verify-slot", cmd_verify_slot},
+};
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [options] <command> [args]\n"
+            "Commands:\n"
+            "  dump <partition>             both GPT tables of the disk holding partition\n"
+            "  map <partition>...           disk each partition sits on\n"
+            "  get-attr <partition>...      A/B attributes, eg: boot_a\n"
+            "  set-slot <a|b> <active|successful|unbootable>\n"
+            "  boot-update <main|backup|finalize|all>\n"
+            "                               run prepare_boot_update stages\n"
+            "  scan [-v] [<block dev>...]   check both tables of every LUN, -v also\n"
+            "                               lists the entries a failsafe update swapped\n"
+            "  verify [<block dev>...]      same as scan\n"
+            "  hash-slot <a|b> [sha256|crc32]\n"
+            "                               print a manifest of the partitions of a slot\n"
+            "  verify-slot <a|b> <manifest> check the partitions of a slot against a\n"
+            "                               manifest written by hash-slot\n"
+            "Options:\n"
+            "  --stats          print latency and I/O counters of each operation, and the\n"
+            "                   time spent in each library call\n"
+            "  -i <image root>  work on the disk images under <image root>\n"
+            "  -s <sector size> sector size of the images (default 4096)\n"
+            "  -e               the images are of an eMMC device\n"
+            "  -d               bypass the page cache, see gpt_utils_set_direct_io()\n"
+            "  -u               batch multi-LUN I/O through io_uring\n",
+            prog);
+}
+
+int main(int argc, char **argv) {
+    static const struct option options[] = {
+            {"stats", no_argument, &print_stats, 1},
+            {"help", no_argument, NULL, 'h'},
+            {NULL, 0, NULL, 0},
+    };
+    const char *image_root = NULL;
+    uint32_t sector_size = 4096;
+    int is_ufs = 1;
+    int opt, rc;
+
+    while ((opt = getopt_long(argc, argv, "+i:s:eduh", options, NULL)) != -1) {
+        switch (opt) {
+            case 0:
+                break;
+            case 'i':
+                image_root = optarg;
+                break;
+            case 's':
+                sector_size = strtoul(optarg, NULL, 0);
+                break;
+            case 'e':
+                is_ufs = 0;
+                break;
+            case 'd':
+                gpt_utils_set_direct_io(1);
+                break;
+            case 'u':
+                gpt_utils_set_io_uring(1);
+                break;
+            default:
+                usage(argv[0]);
+                return 2;
+        }
+    }
+    if (optind == argc) {
+        usage(argv[0]);
+        return 2;
+    }
+    if (image_root && gpt_utils_set_image_backend(image_root, sector_size, is_ufs)) {
+        fprintf(stderr, "Failed to use the disk images under %s\n", image_root);
+        return 2;
+    }
+    for (size_t i = 0; i < ARRAY_SIZE(commands); i++) {
+        if (strcmp(argv[optind], commands[i].name)) continue;
+        rc = commands[i].run(argc - optind - 1, argv + optind + 1);
+        report_api();
+        if (rc < 0) {
+            usage(argv[0]);
+            return 2;
+        }
+        return rc;
+    }
+    fprintf(stderr, "Unknown command %s\n", argv[optind]);
+    usage(argv[0]);
+    return 2;
+}
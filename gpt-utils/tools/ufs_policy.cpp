@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * WriteBooster, background operations and ICC level policy for the UFS
+ * device, applied through the UFS BSG node.
+ *
+ * The msm-4.19 ufshcd manages some of the same flags itself:
+ * - it turns WriteBooster on and off as it scales the clocks up and down,
+ *   enables it again whenever it resets the device, and flushes the buffer
+ *   around runtime suspend;
+ * - on runtime suspend it turns background operations off unless the
+ *   device reports they are urgent, and on resume back on, or to whatever
+ *   the urgency calls for;
+ * - it sets bActiveICCLevel from the power descriptor at probe and reset.
+ * So nothing the daemon sets is assumed to stick. A flag is read back
+ * from the device right before it is changed, and the daemon only steps
+ * in where the kernel has no policy of its own: WriteBooster while clock
+ * scaling is off (init.qcom.power.rc turns it off), and background
+ * operations and the ICC level during sustained I/O, when the device does
+ * not suspend. Idle time belongs to the kernel.
+ */
+
+#define LOG_TAG "ufs_policyd"
+
+/******************************************************************************
+ * INCLUDE SECTION
+ ******************************************************************************/
+#include <string.h>
+#include <cutils/log.h>
+#include "ufs_policy.h"
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+bool wb_policy_init(struct wb_policy *wb, struct ufs_bsg_session *session,
+        uint64_t now_s)
+{
+    struct ufs_wb_status status;
+
+    memset(wb, 0, sizeof(*wb));
+    wb->session = session;
+    wb->last_heavy_s = now_s;
+    if (ufs_wb_read_status(session, &status)) {
+        ALOGI("No WriteBooster support, nothing to do");
+        return false;
+    }
+    ALOGI("WriteBooster %s, %u/%u of the buffer free, lifetime estimate %#x",
+            status.enabled ? "on" : "off", status.avail_buf,
+            UFS_WB_AVAIL_BUF_FULL, status.lifetime);
+    wb->enabled = status.enabled;
+    wb->flushing = status.flush;
+    if (status.lifetime >= UFS_WB_LIFETIME_EXCEEDED) {
+        ALOGW("WriteBooster buffer is worn out, turning WriteBooster off for good");
+        wb->worn_out = true;
+    }
+    //Let the device drain the buffer whenever the link hibernates, the
+    //explicit flush only covers longer idle periods. ufshcd sets it up the
+    //same way when it supports WriteBooster.
+    if (!status.flush_during_hibern8)
+        ufs_wb_set_flush_during_hibern8(session, true);
+    return true;
+}
+
+//Set fWriteBoosterEn, unless the device already has it that way
+static void wb_set_enable(struct wb_policy *wb, bool enable)
+{
+    struct ufs_wb_status status;
+
+    if (ufs_wb_read_status(wb->session, &status))
+        return;
+    if (status.enabled != enable && ufs_wb_set_enable(wb->session, enable)) {
+        wb->enabled = status.enabled;
+        return;
+    }
+    wb->enabled = enable;
+    if (status.enabled != enable)
+        ALOGI("WriteBooster %s", enable ? "on" : "off");
+}
+
+static void wb_set_flush(struct wb_policy *wb, bool flush, uint64_t now)
+{
+    if (ufs_wb_set_flush(wb->session, flush))
+        return;
+    wb->flushing = flush;
+    wb->last_flush_check_s = now;
+    ALOGI("%s WriteBooster buffer flush", flush ? "Started" : "Stopped");
+}
+
+//Catch up with the device, which the kernel may have reset or flushed
+//since the last look, and tell whether an idle device should flush the
+//buffer: it holds data that has not been written to the main storage yet
+static bool wb_sync(struct wb_policy *wb)
+{
+    struct ufs_wb_status status;
+
+    if (ufs_wb_read_status(wb->session, &status))
+        return false;
+    wb->enabled = status.enabled;
+    wb->flushing = status.flush;
+    if (status.lifetime >= UFS_WB_LIFETIME_EXCEEDED && !wb->worn_out) {
+        ALOGW("WriteBooster buffer is worn out, turning WriteBooster off for good");
+        wb->worn_out = true;
+    }
+    return status.avail_buf < UFS_WB_AVAIL_BUF_FULL &&
+        status.flush_status != UFS_WB_FLUSH_FAILED;
+}
+
+void wb_policy_update(struct wb_policy *wb, const struct io_activity *io,
+        bool kernel_owned)
+{
+    uint64_t now = io->now_s;
+    bool needs_flush;
+
+    if (io->busy)
+        wb->idle_checked = false;
+    if (io->write_bps >= WB_HEAVY_WRITE_BPS)
+        wb->heavy_samples++;
+    else
+        wb->heavy_samples = 0;
+    if (wb->heavy_samples >= WB_HEAVY_SAMPLES)
+        wb->last_heavy_s = now;
+
+    //With clock scaling on, ufshcd turns WriteBooster on and off and
+    //flushes the buffer itself
+    if (kernel_owned)
+        return;
+
+    //An explicit flush competes with foreground I/O
+    if (wb->flushing && io->busy)
+        wb_set_flush(wb, false, now);
+
+    if (wb->heavy_samples >= WB_HEAVY_SAMPLES) {
+        if (!wb->enabled && !wb->worn_out)
+            wb_set_enable(wb, true);
+    } else if (wb->enabled && (wb->worn_out ||
+                now - wb->last_heavy_s >= WB_OFF_DELAY_S)) {
+        wb_set_enable(wb, false);
+    }
+
+    //Queries wake the link up, so an idle device is only looked at when
+    //it becomes idle and then every WB_FLUSH_CHECK_S while flushing
+    if (io->idle_s < IDLE_DELAY_S)
+        return;
+    if (!wb->flushing) {
+        if (wb->idle_checked)
+            return;
+        wb->idle_checked = true;
+        needs_flush = wb_sync(wb);
+        if (wb->enabled && (wb->worn_out ||
+                    now - wb->last_heavy_s >= WB_OFF_DELAY_S))
+            wb_set_enable(wb, false);
+        if (needs_flush && !wb->flushing)
+            wb_set_flush(wb, true, now);
+    } else if (now - wb->last_flush_check_s >= WB_FLUSH_CHECK_S) {
+        wb->last_flush_check_s = now;
+        if (!wb_sync(wb) && wb->flushing)
+            wb_set_flush(wb, false, now);
+    }
+}
+
+bool power_policy_init(struct power_policy *pp,
+        struct ufs_bsg_session *session, int32_t icc_boost)
+{
+    __u32 bkops_status;
+    bool bkops;
+
+    memset(pp, 0, sizeof(*pp));
+    if (ufs_icc_read_level(session, &pp->icc_base) ||
+            ufs_bkops_read_status(session, &bkops, &bkops_status)) {
+        ALOGE("Failed to read the ICC level and background operations state");
+        return false;
+    }
+    pp->icc_boost = icc_boost < 0 ? pp->icc_base :
+        icc_boost > UFS_ICC_LEVEL_MAX ? UFS_ICC_LEVEL_MAX : icc_boost;
+    //Only a policy that could read the device state gets to change it
+    pp->session = session;
+    ALOGI("ICC level %u (%u during sustained I/O), background operations %s, status %u",
+            pp->icc_base, pp->icc_boost, bkops ? "on" : "off", bkops_status);
+    return true;
+}
+
+//Turn background operations off as sustained I/O starts, or hand them
+//back once it is over
+static void power_hold_bkops(struct power_policy *pp, bool sustained)
+{
+    __u32 status;
+    bool enabled;
+
+    if (!sustained && !pp->bkops_held)
+        return;
+    if (ufs_bkops_read_status(pp->session, &enabled, &status))
+        return;
+    if (sustained) {
+        //Garbage collection in the middle of sustained I/O stalls it,
+        //unless the device is already running out of free blocks. The
+        //kernel turns them back on by itself when they become urgent.
+        if (enabled && status < UFS_BKOPS_STATUS_PERF_IMPACT &&
+                !ufs_bkops_set_enable(pp->session, false)) {
+            pp->bkops_held = true;
+            ALOGI("Background operations off");
+        }
+        return;
+    }
+    pp->bkops_held = false;
+    if (!enabled && !ufs_bkops_set_enable(pp->session, true))
+        ALOGI("Background operations on");
+}
+
+void power_policy_update(struct power_policy *pp,
+        const struct io_activity *io, bool boot_completed)
+{
+    uint64_t now = io->now_s;
+    bool sustained;
+
+    if (!pp->boot_completed_s && boot_completed)
+        pp->boot_completed_s = now;
+    if (io->bps >= IO_SUSTAINED_BPS)
+        pp->sustained_samples++;
+    else
+        pp->sustained_samples = 0;
+    //Booting only lowers the bar, an idle device is left alone
+    if (pp->sustained_samples >= IO_SUSTAINED_SAMPLES ||
+            (io->bps >= BOOT_IO_BPS && (!pp->boot_completed_s ||
+                now - pp->boot_completed_s < BOOT_BOOST_S)))
+        pp->last_sustained_s = now;
+    sustained = pp->last_sustained_s &&
+        now - pp->last_sustained_s < IO_SUSTAINED_HOLD_S;
+
+    //The device is only queried as sustained I/O starts and stops
+    if (sustained == pp->sustained)
+        return;
+    pp->sustained = sustained;
+    if (pp->icc_boost != pp->icc_base && sustained != pp->boosted &&
+            !ufs_icc_set_level(pp->session,
+                sustained ? pp->icc_boost : pp->icc_base)) {
+        pp->boosted = sustained;
+        ALOGI("ICC level %u", sustained ? pp->icc_boost : pp->icc_base);
+    }
+    power_hold_bkops(pp, sustained);
+}
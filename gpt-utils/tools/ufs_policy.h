@@ -0,0 +1,114 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef __UFS_POLICY_H__
+#define __UFS_POLICY_H__
+
+/*
+ * The policies ufs_policyd applies, fed with what the block device did at
+ * every poll. They only reach the device through the session they were
+ * initialized with, so tests can run them against ufs-bsg-fake.
+ */
+
+#include <stdint.h>
+#include "recovery-ufs-bsg.h"
+
+//Writing this fast for WB_HEAVY_SAMPLES polls in a row starts a
+//write-heavy phase
+#define WB_HEAVY_WRITE_BPS (16ULL << 20)
+#define WB_HEAVY_SAMPLES 2
+//WriteBooster is turned back off this long after the last heavy write
+#define WB_OFF_DELAY_S 30
+//The device counts as idle after this long without any I/O
+#define IDLE_DELAY_S 5
+//While flushing, how often to check whether the buffer is empty yet
+#define WB_FLUSH_CHECK_S 10
+
+//Reading and writing this fast for IO_SUSTAINED_SAMPLES polls in a row
+//is sustained I/O: an app install, an OTA, dexopt
+#define IO_SUSTAINED_BPS (32ULL << 20)
+#define IO_SUSTAINED_SAMPLES 3
+//Sustained I/O settings are kept this long after it stops
+#define IO_SUSTAINED_HOLD_S 10
+//Storage stays busy for a while after boot completes, with the
+//boot_completed tuning of init.qcom.power.rc, dexopt and app updates.
+//Until then any I/O at BOOT_IO_BPS counts as sustained.
+#define BOOT_BOOST_S 120
+#define BOOT_IO_BPS (4ULL << 20)
+
+//What the block device did since the previous poll
+struct io_activity {
+    //When the poll happened, in seconds on CLOCK_MONOTONIC
+    uint64_t now_s;
+    uint64_t bps;
+    uint64_t write_bps;
+    bool busy;
+    //Seconds since the device was last busy
+    uint64_t idle_s;
+};
+
+struct wb_policy {
+    struct ufs_bsg_session *session;
+    //The buffer is worn out, WriteBooster stays off
+    bool worn_out;
+    //fWriteBoosterEn and fWriteBoosterBufferFlushEn as last set or read
+    bool enabled;
+    bool flushing;
+    //The buffer was looked at since the device became idle
+    bool idle_checked;
+    unsigned heavy_samples;
+    uint64_t last_heavy_s;
+    uint64_t last_flush_check_s;
+};
+
+//Active ICC level and background operations during sustained I/O: the
+//boost ICC level, and no background operations unless the device reports
+//that postponing them costs performance
+struct power_policy {
+    //NULL unless the ICC level and background operations could be read
+    struct ufs_bsg_session *session;
+    __u32 icc_base;
+    __u32 icc_boost;
+    //Sustained I/O settings are applied
+    bool sustained;
+    bool boosted;
+    //Background operations were on and got turned off for sustained I/O
+    bool bkops_held;
+    unsigned sustained_samples;
+    uint64_t last_sustained_s;
+    //When sys.boot_completed was seen, 0 before
+    uint64_t boot_completed_s;
+};
+
+/*
+ * Look at the WriteBooster state of the device. false if it has none, the
+ * policy is then of no use.
+ */
+bool wb_policy_init(struct wb_policy *wb, struct ufs_bsg_session *session,
+        uint64_t now_s);
+/*
+ * Turn WriteBooster on for write-heavy phases and off after them, and
+ * flush the buffer while the device is idle. Nothing is done while
+ * kernel_owned: ufshcd drives WriteBooster along with clock scaling.
+ */
+void wb_policy_update(struct wb_policy *wb, const struct io_activity *io,
+        bool kernel_owned);
+
+/*
+ * Read the ICC level and background operations state. icc_boost is the
+ * ICC level for sustained I/O, negative to keep the current one. false if
+ * the state could not be read, the policy then leaves the device alone.
+ */
+bool power_policy_init(struct power_policy *pp,
+        struct ufs_bsg_session *session, int32_t icc_boost);
+/*
+ * Apply or drop the sustained I/O settings. boot_completed tells whether
+ * sys.boot_completed is set.
+ */
+void power_policy_update(struct power_policy *pp,
+        const struct io_activity *io, bool boot_completed);
+
+#endif /* __UFS_POLICY_H__ */
@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+/*
+ * Daemon applying the UFS policies of ufs_policy.h, driven by the I/O
+ * statistics of the disk holding /data.
+ */
+
+#define LOG_TAG "ufs_policyd"
+
+/******************************************************************************
+ * INCLUDE SECTION
+ ******************************************************************************/
+#include <dirent.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <unistd.h>
+#include <cutils/log.h>
+#include <cutils/properties.h>
+#include "ufs_policy.h"
+
+/******************************************************************************
+ * DEFINE SECTION
+ ******************************************************************************/
+//The traffic of the disk holding this file system drives the policy
+#define IO_MOUNT_POINT "/data"
+//Below the disk's host controller, 1 while ufshcd scales the clocks, and
+//WriteBooster with them
+#define CLKSCALE_NAME "clkscale_enable"
+//The poll interval doubles up to POLL_MAX_S while the disk stays idle and
+//drops back to POLL_MIN_S as soon as there is I/O
+#define POLL_MIN_S 1
+#define POLL_MAX_S 16
+//The node is created at coldboot, before the daemon starts. Give up on it
+//after NODE_RETRIES lookups NODE_RETRY_S apart.
+#define NODE_RETRY_S 5
+#define NODE_RETRIES 6
+
+//ICC level applied during sustained I/O. It must stay within what the UFS
+//supplies can deliver, so without it the level ufshcd derived from the
+//power descriptor and the regulator limits is kept.
+#define ICC_BOOST_PROP "ro.vendor.ufs_policyd.icc_boost"
+
+/******************************************************************************
+ * TYPES
+ ******************************************************************************/
+struct io_sample {
+    uint64_t ios;
+    uint64_t read_sectors;
+    uint64_t write_sectors;
+    uint64_t in_flight;
+};
+
+/******************************************************************************
+ * GLOBALS
+ ******************************************************************************/
+//stat file of the disk holding IO_MOUNT_POINT
+static char io_stat_path[PATH_MAX];
+//clock scaling switch of its host controller, empty if it has none
+static char clkscale_path[PATH_MAX];
+
+/******************************************************************************
+ * FUNCTIONS
+ ******************************************************************************/
+static uint64_t now_s(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec;
+}
+
+//Find the disk under a mount point, through device mapper targets (/data
+//sits on dm-default-key) and down from a partition, then its SCSI host
+//controller
+static bool resolve_paths(const char *mount)
+{
+    char path[PATH_MAX], next[PATH_MAX];
+    struct dirent *de;
+    struct stat st;
+    char *p;
+    DIR *dir;
+    int depth;
+
+    if (stat(mount, &st)) {
+        ALOGE("Failed to stat %s: %s", mount, strerror(errno));
+        return false;
+    }
+    snprintf(next, sizeof(next), "/sys/dev/block/%u:%u",
+            major(st.st_dev), minor(st.st_dev));
+    for (depth = 0; depth < 8; depth++) {
+        if (!realpath(next, path)) {
+            ALOGE("Failed to resolve %s: %s", next, strerror(errno));
+            return false;
+        }
+        //A mapped device lists what it maps in slaves/, a disk has it
+        //empty and a partition has none
+        snprintf(next, sizeof(next), "%s/slaves", path);
+        if (!(dir = opendir(next)))
+            break;
+        while ((de = readdir(dir)) && de->d_name[0] == '.')
+            ;
+        if (de)
+            snprintf(next, sizeof(next), "%s/slaves/%s", path, de->d_name);
+        closedir(dir);
+        if (!de)
+            break;
+    }
+    //A partition sits in its disk's directory, a disk in block/
+    p = strrchr(path, '/');
+    if (p && p - path >= 6 && strncmp(p - 6, "/block", 6))
+        *p = '\0';
+    snprintf(io_stat_path, sizeof(io_stat_path), "%s/stat", path);
+    //.../<controller>/hostN/targetN:N:N/...
+    clkscale_path[0] = '\0';
+    for (p = strstr(path, "/host"); p; p = strstr(p + 1, "/host")) {
+        if (p[5] >= '0' && p[5] <= '9') {
+            snprintf(clkscale_path, sizeof(clkscale_path), "%.*s/"
+                    CLKSCALE_NAME, (int)(p - path), path);
+            break;
+        }
+    }
+    ALOGI("Following %s%s%s", io_stat_path,
+            clkscale_path[0] ? ", " : "", clkscale_path);
+    return true;
+}
+
+static bool read_io_sample(struct io_sample *sample)
+{
+    uint64_t v[9] = {0};
+    FILE *f = fopen(io_stat_path, "re");
+    int n;
+
+    if (!f)
+        return false;
+    //reads, merges, sectors, ticks, then the same for writes, in flight
+    n = fscanf(f, "%" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64
+            " %" SCNu64 " %" SCNu64 " %" SCNu64 " %" SCNu64,
+            &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7], &v[8]);
+    fclose(f);
+    if (n != 9)
+        return false;
+    sample->ios = v[0] + v[4];
+    sample->read_sectors = v[2];
+    sample->write_sectors = v[6];
+    sample->in_flight = v[8];
+    return true;
+}
+
+//Whether ufshcd drives WriteBooster, ie: it scales the clocks
+static bool wb_kernel_owned(void)
+{
+    char buf[16] = {0};
+    FILE *f;
+    bool on;
+
+    if (!clkscale_path[0] || !(f = fopen(clkscale_path, "re")))
+        return false;
+    on = fgets(buf, sizeof(buf), f) && atoi(buf);
+    fclose(f);
+    return on;
+}
+
+//init restarts the service whenever it exits, so with nothing to do the
+//daemon stays around asleep
+static void __attribute__((noreturn)) idle_forever(void)
+{
+    for (;;)
+        pause();
+}
+
+int main(void)
+{
+    struct ufs_bsg_session *session;
+    struct io_sample prev, cur;
+    struct io_activity io = {};
+    struct power_policy pp;
+    struct wb_policy wb;
+    uint64_t last, now;
+    unsigned interval;
+    bool has_wb, booted = false;
+    int i;
+
+    for (i = 0; !(session = ufs_bsg_session_get()); i++) {
+        if (i + 1 >= NODE_RETRIES) {
+            ALOGI("No UFS BSG node, nothing to do");
+            idle_forever();
+        }
+        sleep(NODE_RETRY_S);
+    }
+    if (!resolve_paths(IO_MOUNT_POINT) || !read_io_sample(&prev)) {
+        ALOGE("Failed to read the I/O statistics of " IO_MOUNT_POINT);
+        idle_forever();
+    }
+    last = now_s();
+    has_wb = wb_policy_init(&wb, session, last);
+    if (has_wb && wb_kernel_owned())
+        ALOGI("WriteBooster driven by ufshcd clock scaling");
+    if (!power_policy_init(&pp, session,
+                property_get_int32(ICC_BOOST_PROP, -1)) && !has_wb)
+        idle_forever();
+    interval = POLL_MIN_S;
+    for (;;) {
+        sleep(interval);
+        if (!read_io_sample(&cur))
+            continue;
+        now = now_s();
+        if (now <= last)
+            now = last + 1;
+        io.write_bps = (cur.write_sectors - prev.write_sectors) * 512 /
+            (now - last);
+        io.bps = io.write_bps + (cur.read_sectors - prev.read_sectors) *
+            512 / (now - last);
+        io.busy = cur.ios != prev.ios || cur.in_flight;
+        io.idle_s = io.busy ? 0 : io.idle_s + now - last;
+        interval = io.busy ? POLL_MIN_S :
+            interval * 2 > POLL_MAX_S ? POLL_MAX_S : interval * 2;
+        io.now_s = now;
+        prev = cur;
+        last = now;
+        if (!booted)
+            booted = property_get_bool("sys.boot_completed", false);
+        if (has_wb)
+            wb_policy_update(&wb, &io, wb_kernel_owned());
+        if (pp.session)
+            power_policy_update(&pp, &io, booted);
+    }
+    return 0;
+}
@@ -0,0 +1,625 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#define LOG_TAG "ufs_bsg_fake"
+
+#include "ufs-bsg-fake.h"
+
+#include <time.h>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#ifndef _BSG_FRAMEWORK_KERNEL_HEADERS
+#ifndef _GENERIC_KERNEL_HEADERS
+#include <scsi/ufs/ioctl.h>
+#include <scsi/ufs/ufs.h>
+#endif
+#endif
+
+using namespace std;
+
+/*
+ * Query opcodes, attributes and flags as numbered by the UFS spec: the
+ * names of recovery-ufs-bsg.h only exist in BSG builds and the legacy
+ * kernel headers have their own.
+ */
+enum {
+    FAKE_OP_READ_DESC       = 0x1,
+    FAKE_OP_WRITE_DESC      = 0x2,
+    FAKE_OP_READ_ATTR       = 0x3,
+    FAKE_OP_WRITE_ATTR      = 0x4,
+    FAKE_OP_READ_FLAG       = 0x5,
+    FAKE_OP_SET_FLAG        = 0x6,
+    FAKE_OP_CLEAR_FLAG      = 0x7,
+    FAKE_OP_TOGGLE_FLAG     = 0x8,
+};
+
+enum {
+    FAKE_DESC_DEVICE        = 0x0,
+    FAKE_DESC_CONFIG        = 0x1,
+    FAKE_DESC_UNIT          = 0x2,
+    FAKE_DESC_GEOMETRY      = 0x7,
+};
+
+enum {
+    FAKE_ATTR_BOOT_LU_EN    = 0x00,
+    FAKE_ATTR_POWER_MODE    = 0x02,
+    FAKE_ATTR_ACTIVE_ICC_LVL = 0x03,
+    FAKE_ATTR_BKOPS_STATUS  = 0x05,
+    FAKE_ATTR_WB_FLUSH_STATUS = 0x1C,
+    FAKE_ATTR_AVAIL_WB_BUFF_SIZE = 0x1D,
+    FAKE_ATTR_WB_BUFF_LIFE_TIME_EST = 0x1E,
+    FAKE_ATTR_CURR_WB_BUFF_SIZE = 0x1F,
+};
+
+enum {
+    FAKE_FLAG_FDEVICEINIT   = 0x01,
+    FAKE_FLAG_PERMANENT_WPE = 0x02,
+    FAKE_FLAG_PWR_ON_WPE    = 0x03,
+    FAKE_FLAG_BKOPS_EN      = 0x04,
+    FAKE_FLAG_WB_EN         = 0x0E,
+    FAKE_FLAG_WB_BUFF_FLUSH_EN = 0x0F,
+    FAKE_FLAG_WB_BUFF_FLUSH_DURING_HIBERN8 = 0x10,
+};
+
+/* Query response codes */
+enum {
+    FAKE_RESP_SUCCESS           = 0x00,
+    FAKE_RESP_NOT_WRITEABLE     = 0xF7,
+    FAKE_RESP_INVALID_LENGTH    = 0xF9,
+    FAKE_RESP_INVALID_VALUE     = 0xFA,
+    FAKE_RESP_INVALID_INDEX     = 0xFC,
+    FAKE_RESP_INVALID_IDN       = 0xFD,
+    FAKE_RESP_INVALID_OPCODE    = 0xFE,
+    FAKE_RESP_GENERAL_FAILURE   = 0xFF,
+};
+
+#define FAKE_UPIU_QUERY_RSP     0x36
+#define FAKE_NUM_LUNS           8
+/* Descriptors that may be written, the others only exist to be read */
+#define FAKE_DESC_WRITABLE(idn) ((idn) == FAKE_DESC_CONFIG)
+/* State is keyed by idn, index (the LUN for units) and selector */
+#define FAKE_KEY(idn, index, sel) \
+    (((__u32)(idn) << 16) | ((__u32)(index) << 8) | (sel))
+/* First descriptor handed out, away from any real one */
+#define FAKE_FD_BASE            0x40000
+
+struct ufs_fake_fault {
+    __u8 opcode;
+    __u8 idn;
+    enum ufs_fake_fault_type type;
+    int code;
+    unsigned skip;
+    /* Queries still to fail, 0 for every one */
+    unsigned count;
+};
+
+struct ufs_fake {
+    mutex lock;
+    set<string> nodes;
+    set<int> fds;
+    int next_fd;
+    map<__u32, __u32> attrs;
+    map<__u32, bool> flags;
+    map<__u32, vector<__u8>> descs;
+    vector<ufs_fake_fault> faults;
+    unsigned latency_us;
+    struct ufs_fake_stats stats;
+};
+
+static void put_be(vector<__u8> &desc, unsigned offset, __u64 value,
+        unsigned len)
+{
+    unsigned i;
+
+    for (i = 0; i < len; i++)
+        desc[offset + len - 1 - i] = (__u8)(value >> (8 * i));
+}
+
+/* Descriptors and state of a 128 GiB part booted off LUN 1 */
+static void ufs_fake_reset(struct ufs_fake *dev)
+{
+    vector<__u8> device(0x40), geometry(0x48);
+    unsigned lun;
+
+    device[0x00] = device.size();
+    device[0x01] = FAKE_DESC_DEVICE;
+    device[0x06] = FAKE_NUM_LUNS;           /* bNumberLU */
+    device[0x07] = 4;                       /* bNumberWLU */
+    device[0x08] = 1;                       /* bBootEnable */
+    put_be(device, 0x10, 0x0310, 2);        /* wSpecVersion */
+    dev->descs[FAKE_KEY(FAKE_DESC_DEVICE, 0, 0)] = device;
+
+    geometry[0x00] = geometry.size();
+    geometry[0x01] = FAKE_DESC_GEOMETRY;
+    put_be(geometry, 0x04, (128ULL << 30) / 512, 8);
+    geometry[0x0C] = 0;                     /* bMaxNumberLU: 8 */
+    put_be(geometry, 0x0D, 0x2000, 4);      /* dSegmentSize: 4 MiB */
+    geometry[0x11] = 1;                     /* bAllocationUnitSize */
+    geometry[0x12] = 0x08;                  /* bMinAddrBlockSize: 4 KiB */
+    geometry[0x13] = 0x40;                  /* bOptimalReadBlockSize */
+    geometry[0x14] = 0x40;                  /* bOptimalWriteBlockSize */
+    geometry[0x15] = 0x08;                  /* bMaxInBufferSize */
+    geometry[0x16] = 0x08;                  /* bMaxOutBufferSize */
+    dev->descs[FAKE_KEY(FAKE_DESC_GEOMETRY, 0, 0)] = geometry;
+
+    for (lun = 0; lun < FAKE_NUM_LUNS; lun++) {
+        vector<__u8> unit(0x23);
+        unit[0x00] = unit.size();
+        unit[0x01] = FAKE_DESC_UNIT;
+        unit[0x02] = lun;
+        unit[0x03] = lun < 6;               /* bLUEnable */
+        unit[0x04] = lun == 1 ? 1 : lun == 2 ? 2 : 0;   /* bBootLunID */
+        unit[0x06] = 32;                    /* bLUQueueDepth */
+        unit[0x0A] = 12;                    /* bLogicalBlockSize: 4 KiB */
+        put_be(unit, 0x0B, lun ? 2048 : (120ULL << 30) / 4096, 8);
+        put_be(unit, 0x13, 1024, 4);        /* dEraseBlockSize, in blocks */
+        unit[0x17] = 2;                     /* bProvisioningType */
+        dev->descs[FAKE_KEY(FAKE_DESC_UNIT, lun, 0)] = unit;
+    }
+
+    dev->attrs[FAKE_KEY(FAKE_ATTR_BOOT_LU_EN, 0, 0)] = 1;
+    dev->attrs[FAKE_KEY(FAKE_ATTR_POWER_MODE, 0, 0)] = 0x11;
+    dev->attrs[FAKE_KEY(FAKE_ATTR_ACTIVE_ICC_LVL, 0, 0)] = 0;
+    dev->attrs[FAKE_KEY(FAKE_ATTR_BKOPS_STATUS, 0, 0)] = 0;
+    dev->attrs[FAKE_KEY(FAKE_ATTR_WB_FLUSH_STATUS, 0, 0)] = 0;
+    dev->attrs[FAKE_KEY(FAKE_ATTR_AVAIL_WB_BUFF_SIZE, 0, 0)] = 0x0A;
+    dev->attrs[FAKE_KEY(FAKE_ATTR_WB_BUFF_LIFE_TIME_EST, 0, 0)] = 0x01;
+    dev->attrs[FAKE_KEY(FAKE_ATTR_CURR_WB_BUFF_SIZE, 0, 0)] = 0x800;
+
+    for (__u8 idn : { FAKE_FLAG_FDEVICEINIT, FAKE_FLAG_PERMANENT_WPE,
+            FAKE_FLAG_PWR_ON_WPE, FAKE_FLAG_BKOPS_EN, FAKE_FLAG_WB_EN,
+            FAKE_FLAG_WB_BUFF_FLUSH_EN,
+            FAKE_FLAG_WB_BUFF_FLUSH_DURING_HIBERN8 })
+        dev->flags[FAKE_KEY(idn, 0, 0)] = false;
+    dev->flags[FAKE_KEY(FAKE_FLAG_BKOPS_EN, 0, 0)] = true;
+}
+
+/* Response for an attribute, flag or descriptor that is not there */
+template <typename T>
+static __u8 ufs_fake_missing(const map<__u32, T> &state, __u8 idn)
+{
+    auto it = state.lower_bound(FAKE_KEY(idn, 0, 0));
+    if (it != state.end() && (it->first >> 16) == idn)
+        return FAKE_RESP_INVALID_INDEX;
+    return FAKE_RESP_INVALID_IDN;
+}
+
+/* Writes the device refuses, the rest of the attributes take any value */
+static __u8 ufs_fake_check_attr(__u8 idn, __u32 value)
+{
+    switch (idn) {
+    case FAKE_ATTR_BOOT_LU_EN:
+        return value <= 2 ? FAKE_RESP_SUCCESS : FAKE_RESP_INVALID_VALUE;
+    case FAKE_ATTR_ACTIVE_ICC_LVL:
+        return value <= 0x0F ? FAKE_RESP_SUCCESS : FAKE_RESP_INVALID_VALUE;
+    case FAKE_ATTR_POWER_MODE:
+    case FAKE_ATTR_BKOPS_STATUS:
+    case FAKE_ATTR_WB_FLUSH_STATUS:
+    case FAKE_ATTR_AVAIL_WB_BUFF_SIZE:
+    case FAKE_ATTR_WB_BUFF_LIFE_TIME_EST:
+    case FAKE_ATTR_CURR_WB_BUFF_SIZE:
+        return FAKE_RESP_NOT_WRITEABLE;
+    }
+    return FAKE_RESP_SUCCESS;
+}
+
+/*
+ * Run one query against the device state, called with the lock held.
+ * value carries the attribute or flag in and out, buf and *len the
+ * descriptor. Returns the query response code.
+ */
+static __u8 ufs_fake_query(struct ufs_fake *dev, __u8 opcode, __u8 idn,
+        __u8 index, __u8 sel, __u32 *value, __u8 *buf, __u16 *len)
+{
+    __u32 key = FAKE_KEY(idn, index, sel);
+    __u8 resp;
+
+    switch (opcode) {
+    case FAKE_OP_READ_DESC: {
+        auto it = dev->descs.find(key);
+        if (it == dev->descs.end())
+            return ufs_fake_missing(dev->descs, idn);
+        if (*len > it->second.size())
+            *len = it->second.size();
+        memcpy(buf, it->second.data(), *len);
+        return FAKE_RESP_SUCCESS;
+    }
+    case FAKE_OP_WRITE_DESC:
+        if (!FAKE_DESC_WRITABLE(idn))
+            return dev->descs.count(key) ? FAKE_RESP_NOT_WRITEABLE :
+                    ufs_fake_missing(dev->descs, idn);
+        if (*len < 2 || buf[0] != *len || buf[1] != idn)
+            return FAKE_RESP_INVALID_LENGTH;
+        dev->descs[key].assign(buf, buf + *len);
+        return FAKE_RESP_SUCCESS;
+    case FAKE_OP_READ_ATTR:
+    case FAKE_OP_WRITE_ATTR: {
+        auto it = dev->attrs.find(key);
+        if (it == dev->attrs.end())
+            return ufs_fake_missing(dev->attrs, idn);
+        if (opcode == FAKE_OP_READ_ATTR) {
+            *value = it->second;
+            return FAKE_RESP_SUCCESS;
+        }
+        resp = ufs_fake_check_attr(idn, *value);
+        if (resp == FAKE_RESP_SUCCESS)
+            it->second = *value;
+        return resp;
+    }
+    case FAKE_OP_READ_FLAG:
+    case FAKE_OP_SET_FLAG:
+    case FAKE_OP_CLEAR_FLAG:
+    case FAKE_OP_TOGGLE_FLAG: {
+        auto it = dev->flags.find(key);
+        if (it == dev->flags.end())
+            return ufs_fake_missing(dev->flags, idn);
+        if (opcode == FAKE_OP_SET_FLAG)
+            it->second = true;
+        else if (opcode == FAKE_OP_CLEAR_FLAG)
+            it->second = false;
+        else if (opcode == FAKE_OP_TOGGLE_FLAG)
+            it->second = !it->second;
+        /* Initialization completes as soon as it is asked for */
+        if (idn == FAKE_FLAG_FDEVICEINIT)
+            it->second = false;
+        *value = it->second;
+        return FAKE_RESP_SUCCESS;
+    }
+    }
+    return FAKE_RESP_INVALID_OPCODE;
+}
+
+/* The injected fault a query runs into, if any. Called with the lock held. */
+static bool ufs_fake_take_fault(struct ufs_fake *dev, __u8 opcode, __u8 idn,
+        struct ufs_fake_fault *fault)
+{
+    auto it = dev->faults.begin();
+
+    for (; it != dev->faults.end(); ++it) {
+        if ((it->opcode != UFS_FAKE_ANY && it->opcode != opcode) ||
+                (it->idn != UFS_FAKE_ANY && it->idn != idn))
+            continue;
+        if (it->skip) {
+            it->skip--;
+            return false;
+        }
+        *fault = *it;
+        if (it->count && !--it->count)
+            dev->faults.erase(it);
+        return true;
+    }
+    return false;
+}
+
+static void ufs_fake_delay(struct ufs_fake *dev)
+{
+    struct timespec ts;
+    unsigned us;
+
+    {
+        lock_guard<mutex> lock(dev->lock);
+        us = dev->latency_us;
+    }
+    if (!us)
+        return;
+    ts.tv_sec = us / 1000000;
+    ts.tv_nsec = (us % 1000000) * 1000L;
+    nanosleep(&ts, NULL);
+}
+
+#ifdef _BSG_FRAMEWORK_KERNEL_HEADERS
+/* SG_IO on the BSG node, see ufs_bsg_ioctl() */
+static int ufs_fake_sg_io(struct ufs_fake *dev, struct sg_io_v4 *io)
+{
+    struct ufs_bsg_request *req;
+    struct ufs_bsg_reply *rsp;
+    struct ufs_fake_fault fault;
+    __u8 func, opcode, resp;
+    bool read, faulted;
+    __u32 value;
+    __u16 len;
+    __u8 *buf;
+
+    if (io->guard != 'Q' || io->protocol != BSG_PROTOCOL_SCSI ||
+            io->subprotocol != BSG_SUB_PROTOCOL_SCSI_TRANSPORT ||
+            io->request_len < sizeof(*req) || !io->request ||
+            io->max_response_len < sizeof(*rsp) || !io->response) {
+        errno = EINVAL;
+        return -1;
+    }
+    req = (struct ufs_bsg_request *)(uintptr_t)io->request;
+    rsp = (struct ufs_bsg_reply *)(uintptr_t)io->response;
+    memset(rsp, 0, sizeof(*rsp));
+    io->info = 0;
+    ufs_fake_delay(dev);
+
+    lock_guard<mutex> lock(dev->lock);
+    dev->stats.bsg_queries++;
+    if (req->msgcode != UTP_UPIU_QUERY_REQ) {
+        dev->stats.failed++;
+        rsp->result = -EINVAL;
+        return 0;
+    }
+    opcode = req->upiu_req.qr.opcode;
+    func = (be32toh(req->upiu_req.header.dword_1) >> 16) & 0xff;
+    read = opcode == FAKE_OP_READ_DESC || opcode == FAKE_OP_READ_ATTR ||
+            opcode == FAKE_OP_READ_FLAG;
+    value = be32toh(req->upiu_req.qr.value);
+    len = be16toh(req->upiu_req.qr.length);
+    buf = (__u8 *)(uintptr_t)(read ? io->din_xferp : io->dout_xferp);
+    if (len > (read ? io->din_xfer_len : io->dout_xfer_len))
+        len = read ? io->din_xfer_len : io->dout_xfer_len;
+
+    faulted = ufs_fake_take_fault(dev, opcode, req->upiu_req.qr.idn, &fault);
+    if (faulted && fault.type == UFS_FAKE_FAULT_ERRNO) {
+        dev->stats.failed++;
+        errno = fault.code;
+        return -1;
+    }
+    if (faulted && fault.type == UFS_FAKE_FAULT_LLD) {
+        dev->stats.failed++;
+        rsp->result = fault.code;
+        return 0;
+    }
+    if (faulted)
+        resp = fault.code;
+    else if (func != (read ? QUERY_REQ_FUNC_STD_READ : QUERY_REQ_FUNC_STD_WRITE))
+        resp = FAKE_RESP_GENERAL_FAILURE;
+    else if ((opcode == FAKE_OP_READ_DESC || opcode == FAKE_OP_WRITE_DESC) &&
+            (!buf || !len))
+        resp = FAKE_RESP_INVALID_LENGTH;
+    else
+        resp = ufs_fake_query(dev, opcode, req->upiu_req.qr.idn,
+                req->upiu_req.qr.index, req->upiu_req.qr.selector, &value,
+                buf, &len);
+    if (resp != FAKE_RESP_SUCCESS)
+        dev->stats.failed++;
+
+    rsp->upiu_rsp.header.dword_0 = DWORD(FAKE_UPIU_QUERY_RSP, 0, 0, 0);
+    rsp->upiu_rsp.header.dword_1 = DWORD(0, func, resp, 0);
+    rsp->upiu_rsp.qr = req->upiu_req.qr;
+    if (resp == FAKE_RESP_SUCCESS && opcode != FAKE_OP_WRITE_DESC) {
+        rsp->upiu_rsp.qr.value = htobe32(value);
+        if (opcode == FAKE_OP_READ_DESC) {
+            rsp->upiu_rsp.qr.length = htobe16(len);
+            rsp->reply_payload_rcv_len = len;
+        }
+    }
+    return 0;
+}
+#endif
+
+#if !defined(_BSG_FRAMEWORK_KERNEL_HEADERS) && \
+        !defined(_GENERIC_KERNEL_HEADERS)
+/*
+ * UFS_IOCTL_QUERY on a scsi generic node, see the legacy set_boot_lun().
+ * Attributes are a native endian __u32 at the start of the buffer, flags
+ * a single byte. Every query goes to index and selector 0.
+ */
+static int ufs_fake_legacy_query(struct ufs_fake *dev,
+        struct ufs_ioctl_query_data *data)
+{
+    struct ufs_fake_fault fault;
+    __u16 len = data->buf_size;
+    __u32 value = 0;
+    __u8 resp;
+
+    ufs_fake_delay(dev);
+
+    lock_guard<mutex> lock(dev->lock);
+    dev->stats.legacy_queries++;
+    if (ufs_fake_take_fault(dev, data->opcode, data->idn, &fault)) {
+        dev->stats.failed++;
+        errno = fault.type == UFS_FAKE_FAULT_ERRNO ? fault.code : EIO;
+        return -1;
+    }
+    if ((data->opcode == FAKE_OP_READ_ATTR || data->opcode == FAKE_OP_WRITE_ATTR) &&
+            data->buf_size < sizeof(value)) {
+        dev->stats.failed++;
+        errno = EINVAL;
+        return -1;
+    }
+    if (data->opcode == FAKE_OP_WRITE_ATTR)
+        memcpy(&value, data->buffer, sizeof(value));
+    resp = ufs_fake_query(dev, data->opcode, data->idn, 0, 0, &value,
+            data->buffer, &len);
+    if (resp != FAKE_RESP_SUCCESS) {
+        dev->stats.failed++;
+        errno = EINVAL;
+        return -1;
+    }
+    switch (data->opcode) {
+    case FAKE_OP_READ_DESC:
+        data->buf_size = len;
+        break;
+    case FAKE_OP_READ_ATTR:
+        memcpy(data->buffer, &value, sizeof(value));
+        data->buf_size = sizeof(value);
+        break;
+    case FAKE_OP_READ_FLAG:
+    case FAKE_OP_SET_FLAG:
+    case FAKE_OP_CLEAR_FLAG:
+    case FAKE_OP_TOGGLE_FLAG:
+        if (data->buf_size)
+            data->buffer[0] = value;
+        break;
+    }
+    return 0;
+}
+#endif
+
+static int ufs_fake_open(void *ctx, const char *path, int flags)
+{
+    struct ufs_fake *dev = (struct ufs_fake *)ctx;
+    lock_guard<mutex> lock(dev->lock);
+
+    if (!dev->nodes.count(path)) {
+        errno = ENOENT;
+        return -1;
+    }
+    dev->stats.opens++;
+    dev->fds.insert(dev->next_fd);
+    return dev->next_fd++;
+}
+
+static int ufs_fake_close(void *ctx, int fd)
+{
+    struct ufs_fake *dev = (struct ufs_fake *)ctx;
+    lock_guard<mutex> lock(dev->lock);
+
+    if (!dev->fds.erase(fd)) {
+        errno = EBADF;
+        return -1;
+    }
+    return 0;
+}
+
+static int ufs_fake_ioctl(void *ctx, int fd, unsigned long request, void *arg)
+{
+    struct ufs_fake *dev = (struct ufs_fake *)ctx;
+
+    {
+        lock_guard<mutex> lock(dev->lock);
+        if (!dev->fds.count(fd)) {
+            errno = EBADF;
+            return -1;
+        }
+    }
+#ifdef _BSG_FRAMEWORK_KERNEL_HEADERS
+    if (request == SG_IO)
+        return ufs_fake_sg_io(dev, (struct sg_io_v4 *)arg);
+#elif !defined(_GENERIC_KERNEL_HEADERS)
+    if (request == UFS_IOCTL_QUERY)
+        return ufs_fake_legacy_query(dev, (struct ufs_ioctl_query_data *)arg);
+#endif
+    errno = ENOTTY;
+    return -1;
+}
+
+static bool ufs_fake_is_chr(void *ctx, const char *path)
+{
+    struct ufs_fake *dev = (struct ufs_fake *)ctx;
+    lock_guard<mutex> lock(dev->lock);
+
+    return dev->nodes.count(path);
+}
+
+struct ufs_fake *ufs_fake_create(void)
+{
+    struct ufs_fake *dev = new ufs_fake();
+
+    dev->next_fd = FAKE_FD_BASE;
+    dev->nodes.insert(UFS_BSG_DEV0);
+    ufs_fake_reset(dev);
+    return dev;
+}
+
+void ufs_fake_destroy(struct ufs_fake *dev)
+{
+    delete dev;
+}
+
+void ufs_fake_install(struct ufs_fake *dev)
+{
+    struct ufs_transport transport = {
+        ufs_fake_open, ufs_fake_close, ufs_fake_ioctl, ufs_fake_is_chr, dev,
+    };
+
+    ufs_set_transport(&transport);
+}
+
+void ufs_fake_uninstall(void)
+{
+    ufs_set_transport(NULL);
+}
+
+void ufs_fake_add_node(struct ufs_fake *dev, const char *path)
+{
+    lock_guard<mutex> lock(dev->lock);
+    dev->nodes.insert(path);
+}
+
+void ufs_fake_set_attr(struct ufs_fake *dev, __u8 idn, __u8 index,
+        __u8 sel, __u32 value)
+{
+    lock_guard<mutex> lock(dev->lock);
+    dev->attrs[FAKE_KEY(idn, index, sel)] = value;
+}
+
+__u32 ufs_fake_get_attr(struct ufs_fake *dev, __u8 idn, __u8 index,
+        __u8 sel)
+{
+    lock_guard<mutex> lock(dev->lock);
+    auto it = dev->attrs.find(FAKE_KEY(idn, index, sel));
+    return it == dev->attrs.end() ? 0 : it->second;
+}
+
+void ufs_fake_set_flag(struct ufs_fake *dev, __u8 idn, __u8 index,
+        bool value)
+{
+    lock_guard<mutex> lock(dev->lock);
+    dev->flags[FAKE_KEY(idn, index, 0)] = value;
+}
+
+bool ufs_fake_get_flag(struct ufs_fake *dev, __u8 idn, __u8 index)
+{
+    lock_guard<mutex> lock(dev->lock);
+    auto it = dev->flags.find(FAKE_KEY(idn, index, 0));
+    return it != dev->flags.end() && it->second;
+}
+
+void ufs_fake_set_desc(struct ufs_fake *dev, __u8 idn, __u8 index,
+        const __u8 *buf, __u16 len)
+{
+    lock_guard<mutex> lock(dev->lock);
+    dev->descs[FAKE_KEY(idn, index, 0)].assign(buf, buf + len);
+}
+
+__u16 ufs_fake_get_desc(struct ufs_fake *dev, __u8 idn, __u8 index,
+        __u8 *buf, __u16 size)
+{
+    lock_guard<mutex> lock(dev->lock);
+    auto it = dev->descs.find(FAKE_KEY(idn, index, 0));
+    __u16 len;
+
+    if (it == dev->descs.end())
+        return 0;
+    len = it->second.size() < size ? it->second.size() : size;
+    memcpy(buf, it->second.data(), len);
+    return len;
+}
+
+void ufs_fake_inject(struct ufs_fake *dev, __u8 opcode, __u8 idn,
+        enum ufs_fake_fault_type type, int code, unsigned skip,
+        unsigned count)
+{
+    struct ufs_fake_fault fault = { opcode, idn, type, code, skip, count };
+    lock_guard<mutex> lock(dev->lock);
+
+    dev->faults.push_back(fault);
+}
+
+void ufs_fake_clear_faults(struct ufs_fake *dev)
+{
+    lock_guard<mutex> lock(dev->lock);
+    dev->faults.clear();
+}
+
+void ufs_fake_set_latency(struct ufs_fake *dev, unsigned latency_us)
+{
+    lock_guard<mutex> lock(dev->lock);
+    dev->latency_us = latency_us;
+}
+
+void ufs_fake_get_stats(struct ufs_fake *dev, struct ufs_fake_stats *stats)
+{
+    lock_guard<mutex> lock(dev->lock);
+    *stats = dev->stats;
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2026 StatiXOS
+ *
+ * SPDX-License-Identifier: Apache-2.0
+ */
+
+#ifndef __UFS_BSG_FAKE_H__
+#define __UFS_BSG_FAKE_H__
+
+/*
+ * In-memory UFS device for host tests and benchmarks of the query paths of
+ * recovery-ufs-bsg. Once installed, it stands in for the kernel behind the
+ * BSG node (SG_IO with ufs_bsg_request UPIUs) and behind the scsi generic
+ * nodes of the legacy UFS_IOCTL_QUERY ioctl. It keeps the attribute, flag
+ * and descriptor state queries read and modify, and can fail or delay them
+ * on request.
+ */
+
+#include "recovery-ufs-bsg.h"
+
+struct ufs_fake;
+
+/*
+ * A fresh 128 GiB device: 8 LUNs of 4 KiB blocks, booting off LUN 1, with
+ * its device, geometry and unit descriptors, the WriteBooster, BKOPS and
+ * power attributes and flags, and UFS_BSG_DEV0 as its only node
+ */
+struct ufs_fake *ufs_fake_create(void);
+void ufs_fake_destroy(struct ufs_fake *dev);
+
+/*
+ * Route every UFS query of the process to dev, see ufs_set_transport().
+ * Paths that are not nodes of dev fail to open with ENOENT.
+ */
+void ufs_fake_install(struct ufs_fake *dev);
+void ufs_fake_uninstall(void);
+
+/* Have path open on dev too, eg: a /dev/sgN node for the legacy ioctl */
+void ufs_fake_add_node(struct ufs_fake *dev, const char *path);
+
+void ufs_fake_set_attr(struct ufs_fake *dev, __u8 idn, __u8 index,
+        __u8 sel, __u32 value);
+__u32 ufs_fake_get_attr(struct ufs_fake *dev, __u8 idn, __u8 index,
+        __u8 sel);
+void ufs_fake_set_flag(struct ufs_fake *dev, __u8 idn, __u8 index,
+        bool value);
+bool ufs_fake_get_flag(struct ufs_fake *dev, __u8 idn, __u8 index);
+/* Replace descriptor idn, len bytes long */
+void ufs_fake_set_desc(struct ufs_fake *dev, __u8 idn, __u8 index,
+        const __u8 *buf, __u16 len);
+/* Copy descriptor idn to buf, return its length or 0 if there is none */
+__u16 ufs_fake_get_desc(struct ufs_fake *dev, __u8 idn, __u8 index,
+        __u8 *buf, __u16 size);
+
+/* How an injected fault fails a query */
+enum ufs_fake_fault_type {
+    /* The ioctl fails with errno code */
+    UFS_FAKE_FAULT_ERRNO,
+    /* The ioctl succeeds, the reply carries LLD result code */
+    UFS_FAKE_FAULT_LLD,
+    /* The device answers with query response code, eg: 0xFF */
+    UFS_FAKE_FAULT_RESPONSE,
+};
+
+/* Opcode or idn a fault matches regardless of the query */
+#define UFS_FAKE_ANY            0xFF
+
+/*
+ * Fail the queries matching opcode (enum query_req_opcode) and idn: skip
+ * of them pass first, the next count fail (0: all of them)
+ */
+void ufs_fake_inject(struct ufs_fake *dev, __u8 opcode, __u8 idn,
+        enum ufs_fake_fault_type type, int code, unsigned skip,
+        unsigned count);
+void ufs_fake_clear_faults(struct ufs_fake *dev);
+
+/* Time every query takes, on top of the time to model it */
+void ufs_fake_set_latency(struct ufs_fake *dev, unsigned latency_us);
+
+struct ufs_fake_stats {
+    /* Queries received over SG_IO and over the legacy ioctl */
+    unsigned long bsg_queries;
+    unsigned long legacy_queries;
+    /* Queries that failed, injected or not */
+    unsigned long failed;
+    /* Nodes opened */
+    unsigned long opens;
+};
+
+void ufs_fake_get_stats(struct ufs_fake *dev, struct ufs_fake_stats *stats);
+
+#endif /* __UFS_BSG_FAKE_H__ */
@@ -450,6 +450,12 @@ PRODUCT_PACKAGES += \
 PRODUCT_PACKAGES += \
     vendor.lineage.touch@1.0-service.xiaomi
 
+# UFS
+ifeq ($(TARGET_HAS_UFS_BSG),true)
+PRODUCT_PACKAGES += \
+    ufs_policyd.xiaomi_kona
+endif
+
 # USB
 $(call inherit-product, vendor/qcom/opensource/usb/vendor_product.mk)
 